@@ -0,0 +1,38 @@
+/*
+ * XDP program for the AF_XDP capture of obs-h8819-proc
+ *
+ * REAC frames (EtherType 0x8819) are redirected to the AF_XDP socket bound on the receiving queue.
+ * Other frames, and REAC frames on a queue without a socket, go to the normal network stack.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <bpf/bpf_helpers.h>
+#include <bpf/bpf_endian.h>
+
+#define ETH_P_REAC 0x8819
+
+struct {
+	__uint(type, BPF_MAP_TYPE_XSKMAP);
+	__uint(max_entries, 64);
+	__type(key, __u32);
+	__type(value, __u32);
+} xsks_map SEC(".maps");
+
+SEC("xdp")
+int xdp_h8819(struct xdp_md *ctx)
+{
+	const void *data = (void *)(long)ctx->data;
+	const void *data_end = (void *)(long)ctx->data_end;
+	const struct ethhdr *eth = data;
+
+	if ((const void *)(eth + 1) > data_end)
+		return XDP_PASS;
+
+	if (eth->h_proto != bpf_htons(ETH_P_REAC))
+		return XDP_PASS;
+
+	return bpf_redirect_map(&xsks_map, ctx->rx_queue_index, XDP_PASS);
+}
+
+char _license[] SEC("license") = "GPL";
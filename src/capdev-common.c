@@ -1,3 +1,4 @@
+#include <math.h>
 #include <obs-module.h>
 #include <util/platform.h>
 #include <util/threading.h>
@@ -6,9 +7,40 @@
 #include "source.h"
 #include "capdev.h"
 #include "capdev-internal.h"
+#include "capdev-proc.h"
+#include "devlist.h"
+#include "probes.h"
+
+// The first one is the default.
+static const struct capdev_backend_s *backends[] = {
+#ifndef OS_WINDOWS
+	&capdev_backend_proc,
+#endif
+#ifdef HAVE_CAPDEV_PCAP
+	&capdev_backend_pcap,
+#endif
+	NULL,
+};
 
 static pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
 static capdev_t *devices = NULL;
+static struct capdev_tsgroup_s *tsgroups = NULL;
+
+// Estimation of the timestamp left by a destroyed device so that the next device of the name locks quickly.
+struct tsseed_s
+{
+	char *name;
+	struct h8819_tsest_s tsest;
+	struct tsseed_s *next;
+};
+static struct tsseed_s *tsseeds = NULL;
+
+// Released devices are kept in `devices` until the keep-alive period expires
+// and then destroyed by this thread so that the caller never waits for the capture thread.
+static bool reaper_started = false;
+static bool reaper_exiting = false;
+static pthread_t reaper_thread;
+static os_event_t *reaper_event = NULL;
 
 capdev_t *capdev_get_ref(capdev_t *dev)
 {
@@ -34,11 +66,43 @@ capdev_t *capdev_get_ref(capdev_t *dev)
 	return NULL;
 }
 
-static capdev_t *capdev_find_unlocked(const char *device_name)
+static const struct capdev_backend_s *backend_find(const char *id)
+{
+	for (size_t i = 0; id && backends[i]; i++) {
+		if (strcmp(backends[i]->id, id) == 0)
+			return backends[i];
+	}
+	return backends[0];
+}
+
+const char *capdev_default_backend()
+{
+	return backends[0]->id;
+}
+
+void capdev_enum_backends(void (*cb)(const char *id, void *param), void *param)
+{
+	for (size_t i = 0; backends[i]; i++)
+		cb(backends[i]->id, param);
+}
+
+static capdev_t *capdev_find_unlocked(const char *device_name, const struct capdev_backend_s *backend)
 {
 	for (capdev_t *dev = devices; dev; dev = dev->next) {
-		if (strcmp(dev->name, device_name) == 0)
-			return capdev_get_ref(dev);
+		if (strcmp(dev->name, device_name) != 0 || dev->backend != backend)
+			continue;
+
+		if (os_atomic_load_long(&dev->refcnt) == -1) {
+			// The device was released but is still in its keep-alive period.
+			if (os_atomic_load_bool(&dev->stopped))
+				continue;
+			blog(LOG_INFO, "h8819[%s]: reusing the device", dev->name);
+			os_atomic_set_long(&dev->refcnt, 0);
+			dev->release_ts = 0;
+			return dev;
+		}
+
+		return capdev_get_ref(dev);
 	}
 	return NULL;
 }
@@ -54,86 +118,440 @@ static void capdev_remove_from_devices_unlocked(capdev_t *dev)
 	}
 }
 
-static capdev_t *capdev_create_unlocked(const char *device_name);
+static capdev_t *capdev_create_unlocked(const char *device_name, const struct capdev_backend_s *backend);
 static void capdev_destroy(capdev_t *dev);
 
-capdev_t *capdev_find_or_create(const char *device_name)
+capdev_t *capdev_find_or_create(const char *device_name, const char *backend_id)
 {
+	const struct capdev_backend_s *backend = backend_find(backend_id);
+
 	pthread_mutex_lock(&mutex);
-	capdev_t *dev = capdev_find_unlocked(device_name);
+	capdev_t *dev = capdev_find_unlocked(device_name, backend);
 	if (dev) {
 		pthread_mutex_unlock(&mutex);
 		return dev;
 	}
 
-	dev = capdev_create_unlocked(device_name);
+	dev = capdev_create_unlocked(device_name, backend);
 
 	pthread_mutex_unlock(&mutex);
 
 	return dev;
 }
 
+static void *reaper_thread_main(void *data)
+{
+	UNUSED_PARAMETER(data);
+	os_set_thread_name("h8819-reaper");
+
+	pthread_mutex_lock(&mutex);
+	while (!reaper_exiting) {
+		uint64_t now = os_gettime_ns();
+		uint64_t next = now + 1000000000ULL;
+		capdev_t *expired = NULL;
+
+		capdev_t *next_dev;
+		for (capdev_t *dev = devices; dev; dev = next_dev) {
+			next_dev = dev->next;
+			if (os_atomic_load_long(&dev->refcnt) != -1 || !dev->release_ts)
+				continue;
+
+			uint64_t expire = dev->release_ts + dev->keepalive_ms * 1000000ULL;
+			if (expire > now) {
+				if (expire < next)
+					next = expire;
+				continue;
+			}
+
+			capdev_remove_from_devices_unlocked(dev);
+			dev->next = expired;
+			expired = dev;
+		}
+		pthread_mutex_unlock(&mutex);
+
+		while (expired) {
+			capdev_t *dev = expired;
+			expired = dev->next;
+			dev->next = NULL;
+			capdev_destroy(dev);
+		}
+
+		os_event_timedwait(reaper_event, (unsigned long)((next - now) / 1000000 + 1));
+		pthread_mutex_lock(&mutex);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	return NULL;
+}
+
+static void reaper_start_unlocked()
+{
+	if (reaper_started)
+		return;
+
+	if (os_event_init(&reaper_event, OS_EVENT_TYPE_AUTO) != 0) {
+		blog(LOG_ERROR, "failed to create an event for the reaper thread");
+		return;
+	}
+
+	reaper_exiting = false;
+	if (pthread_create(&reaper_thread, NULL, reaper_thread_main, NULL) != 0) {
+		blog(LOG_ERROR, "failed to create the reaper thread");
+		os_event_destroy(reaper_event);
+		reaper_event = NULL;
+		return;
+	}
+	reaper_started = true;
+}
+
 void capdev_release(capdev_t *dev)
 {
-	if (os_atomic_dec_long(&dev->refcnt) == -1)
+	if (os_atomic_dec_long(&dev->refcnt) > -1)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	// Another thread might have picked up the device in the meantime.
+	if (os_atomic_load_long(&dev->refcnt) == -1) {
+		dev->release_ts = os_gettime_ns();
+		reaper_start_unlocked();
+		if (reaper_started) {
+			os_event_signal(reaper_event);
+		}
+		else {
+			capdev_remove_from_devices_unlocked(dev);
+			pthread_mutex_unlock(&mutex);
+			capdev_destroy(dev);
+			return;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+static struct tsseed_s *tsseed_find_unlocked(const char *name)
+{
+	for (struct tsseed_s *seed = tsseeds; seed; seed = seed->next) {
+		if (strcmp(seed->name, name) == 0)
+			return seed;
+	}
+	return NULL;
+}
+
+static void tsseed_save(const capdev_t *dev)
+{
+	// Any stream will do since the packet timestamp is the capture time on the host.
+	const struct h8819_tsest_s *tsest = NULL;
+	for (int i = 0; i < dev->demux.n_streams && !tsest; i++) {
+		if (dev->streams[i].tsest.converged)
+			tsest = &dev->streams[i].tsest;
+	}
+	if (!tsest)
+		return;
+
+	pthread_mutex_lock(&mutex);
+	struct tsseed_s *seed = tsseed_find_unlocked(dev->name);
+	if (!seed) {
+		seed = bzalloc(sizeof(struct tsseed_s));
+		seed->name = bstrdup(dev->name);
+		seed->next = tsseeds;
+		tsseeds = seed;
+	}
+	seed->tsest = *tsest;
+	pthread_mutex_unlock(&mutex);
+}
+
+static struct capdev_tsgroup_s *tsgroup_get_unlocked(const char *name)
+{
+	for (struct capdev_tsgroup_s *group = tsgroups; group; group = group->next) {
+		if (strcmp(group->name, name) == 0)
+			return group;
+	}
+
+	struct capdev_tsgroup_s *group = bzalloc(sizeof(struct capdev_tsgroup_s));
+	group->name = bstrdup(name);
+	pthread_mutex_init(&group->mutex, NULL);
+	group->next = tsgroups;
+	tsgroups = group;
+	return group;
+}
+
+// Applies the settings that the sources on the device share.
+// The device is kept open for the longest keepalive of the sources and joins the group of the first source that
+// names one. The device keeps the settings when its last source is unlinked.
+static void update_device_settings(capdev_t *dev, bool warn)
+{
+	pthread_mutex_lock(&dev->mutex);
+	bool has_sources = dev->sources != NULL;
+	uint32_t keepalive_ms = 0;
+	char *group_name = NULL;
+	bool mismatch = false;
+	for (const struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->keepalive_ms > keepalive_ms)
+			keepalive_ms = item->keepalive_ms;
+		if (!item->tsgroup_name)
+			continue;
+		if (!group_name)
+			group_name = bstrdup(item->tsgroup_name);
+		else if (strcmp(group_name, item->tsgroup_name) != 0)
+			mismatch = true;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	if (!has_sources)
+		return;
+
+	if (warn && mismatch)
+		blog(LOG_WARNING, "h8819[%s]: sources on the device specify different timebase groups, using '%s'",
+		     dev->name, group_name);
+
+	pthread_mutex_lock(&mutex);
+	dev->keepalive_ms = keepalive_ms;
+	struct capdev_tsgroup_s *group = group_name ? tsgroup_get_unlocked(group_name) : NULL;
+	if (group != dev->tsgroup) {
+		if (group)
+			blog(LOG_INFO, "h8819[%s]: joining the timebase group '%s'", dev->name, group->name);
+		else
+			blog(LOG_INFO, "h8819[%s]: leaving the timebase group '%s'", dev->name, dev->tsgroup->name);
+		dev->tsgroup = group;
+	}
+	pthread_mutex_unlock(&mutex);
+
+	bfree(group_name);
+}
+
+void capdev_set_source_keepalive(capdev_t *dev, source_t *src, int keepalive_ms)
+{
+	uint32_t ms = keepalive_ms > 0 ? (uint32_t)keepalive_ms : 0;
+	bool changed = false;
+
+	pthread_mutex_lock(&dev->mutex);
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		changed = item->keepalive_ms != ms;
+		item->keepalive_ms = ms;
+		break;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	if (changed)
+		update_device_settings(dev, false);
+}
+
+void capdev_set_source_timebase_group(capdev_t *dev, source_t *src, const char *name)
+{
+	if (name && !*name)
+		name = NULL;
+	bool changed = false;
+
+	pthread_mutex_lock(&dev->mutex);
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		if (name && item->tsgroup_name)
+			changed = strcmp(name, item->tsgroup_name) != 0;
+		else
+			changed = name || item->tsgroup_name;
+		if (changed) {
+			bfree(item->tsgroup_name);
+			item->tsgroup_name = name ? bstrdup(name) : NULL;
+		}
+		break;
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	if (changed)
+		update_device_settings(dev, true);
+}
+
+void capdev_init()
+{
+	capdev_platform_init();
+}
+
+void capdev_shutdown()
+{
+	pthread_mutex_lock(&mutex);
+	bool started = reaper_started;
+	reaper_exiting = true;
+	pthread_mutex_unlock(&mutex);
+
+	if (started) {
+		os_event_signal(reaper_event);
+		pthread_join(reaper_thread, NULL);
+		os_event_destroy(reaper_event);
+		reaper_event = NULL;
+		reaper_started = false;
+	}
+
+	pthread_mutex_lock(&mutex);
+	bool remaining = false;
+	while (devices) {
+		capdev_t *dev = devices;
+		capdev_remove_from_devices_unlocked(dev);
+		if (os_atomic_load_long(&dev->refcnt) != -1) {
+			blog(LOG_ERROR, "capdev_shutdown: device '%s' is still referenced", dev->name);
+			remaining = true;
+			continue;
+		}
+		pthread_mutex_unlock(&mutex);
 		capdev_destroy(dev);
+		pthread_mutex_lock(&mutex);
+	}
+	// A remaining device might still use its group.
+	if (!remaining) {
+		while (tsgroups) {
+			struct capdev_tsgroup_s *group = tsgroups;
+			tsgroups = group->next;
+			pthread_mutex_destroy(&group->mutex);
+			bfree(group->name);
+			bfree(group);
+		}
+	}
+	while (tsseeds) {
+		struct tsseed_s *seed = tsseeds;
+		tsseeds = seed->next;
+		bfree(seed->name);
+		bfree(seed);
+	}
+	pthread_mutex_unlock(&mutex);
+
+	capdev_platform_shutdown();
 }
 
-static capdev_t *capdev_create_unlocked(const char *device_name)
+static void *capdev_thread_wrapper(void *data)
+{
+	struct capdev_s *dev = data;
+	void *ret = dev->backend->thread_main(dev);
+	os_atomic_set_bool(&dev->stopped, true);
+	return ret;
+}
+
+static capdev_t *capdev_create_unlocked(const char *device_name, const struct capdev_backend_s *backend)
 {
 	capdev_t *dev = bzalloc(sizeof(struct capdev_s));
 	if (!dev)
 		return NULL;
 	dev->name = bstrdup(device_name);
+	dev->backend = backend;
+	blog(LOG_INFO, "h8819[%s]: opening the device with the %s backend", dev->name, backend->id);
+	dev->keepalive_ms = CAPDEV_KEEPALIVE_S_DEFAULT * 1000;
 	dev->next = devices;
 	dev->prev_next = &devices;
 	if (dev->next)
 		dev->next->prev_next = &dev->next;
 	devices = dev;
 
+	struct tsseed_s *seed = tsseed_find_unlocked(device_name);
+	if (seed)
+		dev->tsseed = seed->tsest;
+
 	pthread_mutex_init(&dev->mutex, NULL);
-	pthread_create(&dev->thread, NULL, capdev_thread_main, dev);
+#ifndef OS_WINDOWS
+	pthread_mutex_init(&dev->transmit_mutex, NULL);
+#endif
+	pthread_create(&dev->thread, NULL, capdev_thread_wrapper, dev);
 
 	return dev;
 }
 
-static void capdev_destroy(capdev_t *dev)
+static void resample_destroy(struct capdev_resample_s *rs)
 {
-	pthread_mutex_lock(&mutex);
-	capdev_remove_from_devices_unlocked(dev);
-	pthread_mutex_unlock(&mutex);
+	if (!rs)
+		return;
+	h8819_resampler_free(&rs->rs);
+	bfree(rs);
+}
+
+static void preroll_resample_destroy(struct capdev_preroll_resample_s *pr)
+{
+	if (!pr)
+		return;
+	h8819_resampler_free(&pr->rs);
+	bfree(pr);
+}
+
+static struct capdev_resample_s *resample_create(const capdev_t *dev, uint32_t sample_rate)
+{
+	struct capdev_resample_s *rs = bzalloc(sizeof(struct capdev_resample_s));
+	if (!h8819_resampler_init(&rs->rs, sample_rate)) {
+		blog(LOG_WARNING, "h8819[%s]: cannot resample to %u Hz on the device", dev->name, sample_rate);
+		rs->unsupported = true;
+		rs->rs.rate_out = sample_rate;
+	}
+	for (int ch = 0; ch < N_CHANNELS; ch++)
+		rs->fltp[ch] = rs->out[ch];
+	return rs;
+}
+
+static struct capdev_preroll_resample_s *preroll_resample_create(uint32_t sample_rate)
+{
+	struct capdev_preroll_resample_s *pr = bzalloc(sizeof(struct capdev_preroll_resample_s));
+	if (!h8819_resampler_init(&pr->rs, sample_rate)) {
+		bfree(pr);
+		return NULL;
+	}
+	for (int ch = 0; ch < N_CHANNELS; ch++)
+		pr->fltp[ch] = pr->out[ch];
+	return pr;
+}
 
+static void capdev_destroy(capdev_t *dev)
+{
+	os_atomic_set_bool(&dev->exiting, true);
 	pthread_join(dev->thread, NULL);
 	if (dev->sources)
 		blog(LOG_ERROR, "capdev_destroy: sources are remaining");
+	tsseed_save(dev);
+	for (int i = 0; i < H8819_MAX_STREAMS; i++)
+		resample_destroy(dev->streams[i].resample);
 	pthread_mutex_destroy(&dev->mutex);
+#ifndef OS_WINDOWS
+	pthread_mutex_destroy(&dev->transmit_mutex);
+	da_free(dev->transmit_pending);
+#endif
 
 	bfree(dev->name);
 	bfree(dev);
 }
 
-static uint64_t channels_to_mask(const int *channels)
+static void item_update_channel_mask(struct source_list_s *item)
 {
-	uint64_t channel_mask = 0;
-	for (size_t ix = 0; channels[ix] >= 0; ix++)
-		channel_mask |= 1ULL << channels[ix];
-	return channel_mask;
+	struct h8819_chmask_s channel_mask = {0};
+	if (item->mix) {
+		for (int i = 0; i < item->mix->n_inputs; i++)
+			h8819_chmask_set(&channel_mask, item->mix->channels[i]);
+	}
+	else {
+		for (uint32_t i = 0; i < item->n_channels; i++)
+			h8819_chmask_set(&channel_mask, item->channels[i]);
+	}
+
+	struct h8819_chmask_s added = channel_mask;
+	h8819_chmask_andnot(&added, &item->channel_mask);
+	if (!h8819_chmask_is_empty(&added)) {
+		item->switching = true;
+		item->n_held = 0;
+	}
+	item->channel_mask = channel_mask;
 }
 
 static void item_set_channels_unlocked(struct source_list_s *item, const int *channels)
 {
-	item->channel_mask = channels_to_mask(channels);
 	for (item->n_channels = 0; item->n_channels < N_CHANNELS; item->n_channels++) {
 		if (channels[item->n_channels] < 0)
 			break;
 		item->channels[item->n_channels] = channels[item->n_channels];
 	}
+	item_update_channel_mask(item);
 }
 
 void capdev_link_source(capdev_t *dev, source_t *src, const int *channels)
 {
 	struct source_list_s *item = bzalloc(sizeof(struct source_list_s));
 	item->src = src;
+	item->keepalive_ms = CAPDEV_KEEPALIVE_S_DEFAULT * 1000;
 	item_set_channels_unlocked(item, channels);
 
 	pthread_mutex_lock(&dev->mutex);
@@ -142,18 +560,144 @@ void capdev_link_source(capdev_t *dev, source_t *src, const int *channels)
 	dev->sources = item;
 	if (item->next)
 		item->next->prev_next = &item->next;
-	dev->channel_mask |= item->channel_mask;
 
 	pthread_mutex_unlock(&dev->mutex);
 }
 
-static void recalculate_channel_mask_unlocked(capdev_t *dev)
+static bool item_on_stream_unlocked(const capdev_t *dev, const struct source_list_s *item, int stream)
+{
+	if (item->stream_key)
+		return item->stream_key == dev->demux.keys[stream];
+	return stream == 0;
+}
+
+// The delay lines are in samples at 48 kHz, so that a source with delays is left to the resampler of libobs.
+static bool item_resampled(const struct source_list_s *item)
 {
-	uint64_t channel_mask = 0;
+	return (item->resample || item->drift_correct) && !item->delay;
+}
+
+// Rate that the source resamples to on the device, 0 if it does not
+static uint32_t item_resample_rate(const struct source_list_s *item)
+{
+	if (!item_resampled(item) || (item->sample_rate == H8819_SAMPLE_RATE && !item->drift_correct))
+		return 0;
+	return item->sample_rate;
+}
+
+// Rate of the resampler of each stream, 0 if no source resamples on it
+static void stream_resample_rates_unlocked(const capdev_t *dev, uint32_t rates[H8819_MAX_STREAMS])
+{
+	for (int i = 0; i < H8819_MAX_STREAMS; i++) {
+		rates[i] = 0;
+		if (i >= dev->demux.n_streams)
+			continue;
+		for (const struct source_list_s *item = dev->sources; item; item = item->next) {
+			uint32_t rate = item_resample_rate(item);
+			if (rate && item_on_stream_unlocked(dev, item, i))
+				rates[i] = rate;
+		}
+	}
+}
+
+// Resampler for the pre-roll of a source, swapped with the one of the source
+struct preroll_swap_s
+{
+	source_t *src;
+	uint32_t sample_rate; // 0 to free the one of the source
+	struct capdev_preroll_resample_s *pr;
+};
+
+// Allocate the resamplers of the streams and of the pre-roll of the sources that resample on the device,
+// and free those no longer used, so that the capture thread finds them ready.
+// Called after the sources or the streams change.
+// Allocated before locking because the capture thread waits for the lock.
+static void resample_prepare(capdev_t *dev)
+{
+	uint32_t rates[H8819_MAX_STREAMS];
+	bool create[H8819_MAX_STREAMS];
+	DARRAY(struct preroll_swap_s) swaps;
+	da_init(swaps);
+
+	pthread_mutex_lock(&dev->mutex);
+	stream_resample_rates_unlocked(dev, rates);
+	for (int i = 0; i < H8819_MAX_STREAMS; i++) {
+		const struct capdev_resample_s *rs = dev->streams[i].resample;
+		create[i] = rates[i] && (!rs || rs->rs.rate_out != rates[i]);
+	}
 	for (struct source_list_s *item = dev->sources; item; item = item->next) {
-		channel_mask |= item->channel_mask;
+		uint32_t rate = item_resample_rate(item);
+		if (rate != (item->preroll_rs ? item->preroll_rs->rs.rate_out : 0)) {
+			struct preroll_swap_s swap = {.src = item->src, .sample_rate = rate};
+			da_push_back(swaps, &swap);
+		}
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	struct capdev_resample_s *created[H8819_MAX_STREAMS];
+	for (int i = 0; i < H8819_MAX_STREAMS; i++)
+		created[i] = create[i] ? resample_create(dev, rates[i]) : NULL;
+	for (size_t k = 0; k < swaps.num; k++) {
+		struct preroll_swap_s *swap = swaps.array + k;
+		swap->pr = swap->sample_rate ? preroll_resample_create(swap->sample_rate) : NULL;
+	}
+
+	// What no longer fits after a change in the meantime is freed, and the call after the change fixes it.
+	pthread_mutex_lock(&dev->mutex);
+	stream_resample_rates_unlocked(dev, rates);
+	for (int i = 0; i < H8819_MAX_STREAMS; i++) {
+		struct capdev_resample_s **cur = &dev->streams[i].resample;
+		bool fits = created[i] && created[i]->rs.rate_out == rates[i];
+		if (!rates[i] || (fits && (!*cur || (*cur)->rs.rate_out != rates[i]))) {
+			struct capdev_resample_s *old = *cur;
+			*cur = rates[i] ? created[i] : NULL;
+			created[i] = old;
+		}
+	}
+	for (size_t k = 0; k < swaps.num; k++) {
+		struct preroll_swap_s *swap = swaps.array + k;
+		for (struct source_list_s *item = dev->sources; item; item = item->next) {
+			if (item->src != swap->src || item_resample_rate(item) != swap->sample_rate)
+				continue;
+			struct capdev_preroll_resample_s *old = item->preroll_rs;
+			item->preroll_rs = swap->pr;
+			swap->pr = old;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	for (int i = 0; i < H8819_MAX_STREAMS; i++)
+		resample_destroy(created[i]);
+	for (size_t k = 0; k < swaps.num; k++)
+		preroll_resample_destroy(swaps.array[k].pr);
+	da_free(swaps);
+}
+
+static void recalculate_channel_mask_unlocked(capdev_t *dev)
+{
+	for (int i = 0; i < dev->demux.n_streams; i++) {
+		struct h8819_chmask_s channel_mask = {0};
+		bool metering = false;
+		for (struct source_list_s *item = dev->sources; item; item = item->next) {
+			if (!item_on_stream_unlocked(dev, item, i))
+				continue;
+			if (item->active)
+				h8819_chmask_or(&channel_mask, &item->channel_mask);
+			if (item->metering)
+				metering = true;
+		}
+		if (metering) {
+			for (int ch = 0; ch < N_CHANNELS; ch++)
+				h8819_chmask_set(&channel_mask, ch);
+		}
+		if (metering && !dev->streams[i].metering) {
+			memset(dev->streams[i].meter_clips, 0, sizeof(dev->streams[i].meter_clips));
+			dev->streams[i].levels = (struct capdev_levels_s){0};
+		}
+		dev->streams[i].channel_mask = channel_mask;
+		os_atomic_set_bool(&dev->streams[i].metering, metering);
 	}
-	dev->channel_mask = channel_mask;
 }
 
 void capdev_update_source(capdev_t *dev, source_t *src, const int *channels)
@@ -173,7 +717,7 @@ void capdev_update_source(capdev_t *dev, source_t *src, const int *channels)
 	pthread_mutex_unlock(&dev->mutex);
 }
 
-void capdev_unlink_source(capdev_t *dev, source_t *src)
+void capdev_set_source_active(capdev_t *dev, source_t *src, bool active)
 {
 	pthread_mutex_lock(&dev->mutex);
 
@@ -181,10 +725,7 @@ void capdev_unlink_source(capdev_t *dev, source_t *src)
 		if (item->src != src)
 			continue;
 
-		*item->prev_next = item->next;
-		if (item->next)
-			item->next->prev_next = item->prev_next;
-		bfree(item);
+		item->active = active;
 		break;
 	}
 
@@ -193,28 +734,842 @@ void capdev_unlink_source(capdev_t *dev, source_t *src)
 	pthread_mutex_unlock(&dev->mutex);
 }
 
-void capdev_send_blank_audio_to_all_unlocked(struct capdev_s *dev, int n, uint64_t timestamp)
+void capdev_set_source_mix(capdev_t *dev, source_t *src, const struct capdev_mix_s *mix)
 {
-	if (n <= 0)
-		return;
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		bfree(item->mix);
+		item->mix = NULL;
+		if (mix) {
+			item->mix = bmalloc(sizeof(struct capdev_mix_s));
+			*item->mix = *mix;
+		}
+		item_update_channel_mask(item);
+		break;
+	}
+
+	recalculate_channel_mask_unlocked(dev);
 
-	// If 2 seconds or more (n >= 96000), libobs starts to add offset, which we should avoid.
-	// TS_SMOOTHING_THRESHOLD (>= 70 ms, n >= 3360) is another threshold to smooth.
-	// If the blank is larger than TS_SMOOTHING_THRESHOLD, let libobs to flush the buffer.
-	// Added ~10% to the threshold to ensure exceeding the threshold.
-	if (n > 3700)
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+static struct capdev_delay_s *delay_create(const uint32_t delays[N_CHANNELS])
+{
+	int n_lines = 0;
+	for (int ch = 0; delays && ch < N_CHANNELS; ch++) {
+		if (delays[ch])
+			n_lines++;
+	}
+	if (!n_lines)
+		return NULL;
+
+	struct capdev_delay_s *delay = bzalloc(sizeof(struct capdev_delay_s));
+	delay->rings = bzalloc(sizeof(float) * H8819_DELAY_RING_SAMPLES * n_lines);
+	for (int ch = 0; ch < N_CHANNELS; ch++) {
+		if (!delays[ch])
+			continue;
+		int i = delay->n_lines++;
+		delay->channels[i] = ch;
+		delay->lines[i].buf = delay->rings + (size_t)H8819_DELAY_RING_SAMPLES * i;
+		delay->lines[i].delay = delays[ch] < H8819_DELAY_MAX_SAMPLES ? delays[ch] : H8819_DELAY_MAX_SAMPLES;
+	}
+	return delay;
+}
+
+static void delay_destroy(struct capdev_delay_s *delay)
+{
+	if (!delay)
 		return;
+	bfree(delay->rings);
+	bfree(delay);
+}
 
-	float *buf = bmalloc(sizeof(float) * n);
-	for (int i = 0; i < n; i++)
-		buf[i] = 0.0f;
+void capdev_set_source_delays(capdev_t *dev, source_t *src, const uint32_t delays[N_CHANNELS])
+{
+	// Allocated before locking because the capture thread waits for the lock.
+	struct capdev_delay_s *delay = delay_create(delays);
 
-	float *fltp[N_CHANNELS];
-	for (int i = 0; i < N_CHANNELS; i++)
-		fltp[i] = buf;
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
 
-	for (struct source_list_s *item = dev->sources; item; item = item->next)
-		source_add_audio(item->src, fltp, n, timestamp - sample_time(n));
+		struct capdev_delay_s *old = item->delay;
+		item->delay = delay;
+		delay = old;
+		break;
+	}
 
-	bfree(buf);
+	pthread_mutex_unlock(&dev->mutex);
+
+	delay_destroy(delay);
+	// A source with delays is not resampled on the device.
+	resample_prepare(dev);
+}
+
+void capdev_set_source_stream(capdev_t *dev, source_t *src, uint64_t stream_key)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		item->stream_key = stream_key;
+		break;
+	}
+
+	recalculate_channel_mask_unlocked(dev);
+
+	pthread_mutex_unlock(&dev->mutex);
+	resample_prepare(dev);
+}
+
+void capdev_set_source_record(capdev_t *dev, source_t *src, const struct capdev_record_s *rec)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		bfree((char *)item->record.directory);
+		item->recording = rec != NULL;
+		if (rec) {
+			item->record = *rec;
+			item->record.directory = bstrdup(rec->directory);
+		}
+		else {
+			item->record = (struct capdev_record_s){0};
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+const struct source_list_s *capdev_find_recording_unlocked(struct capdev_s *dev)
+{
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->recording)
+			return item;
+	}
+	return NULL;
+}
+
+void capdev_set_source_flightrec(capdev_t *dev, source_t *src, const struct capdev_flightrec_s *fr)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		bfree((char *)item->flightrec.directory);
+		item->flightrec_enabled = fr != NULL;
+		if (fr) {
+			item->flightrec = *fr;
+			item->flightrec.directory = bstrdup(fr->directory);
+		}
+		else {
+			item->flightrec = (struct capdev_flightrec_s){0};
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+const struct source_list_s *capdev_find_flightrec_unlocked(struct capdev_s *dev)
+{
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->flightrec_enabled)
+			return item;
+	}
+	return NULL;
+}
+
+void capdev_set_source_rtp(capdev_t *dev, source_t *src, const struct capdev_rtp_s *rtp)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		bfree((char *)item->rtp.destination);
+		bfree((char *)item->rtp.interface_address);
+		item->rtp_enabled = rtp != NULL;
+		if (rtp) {
+			item->rtp = *rtp;
+			item->rtp.destination = bstrdup(rtp->destination);
+			item->rtp.interface_address = bstrdup(rtp->interface_address);
+		}
+		else {
+			item->rtp = (struct capdev_rtp_s){0};
+		}
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+const struct source_list_s *capdev_find_rtp_unlocked(struct capdev_s *dev)
+{
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->rtp_enabled)
+			return item;
+	}
+	return NULL;
+}
+
+void capdev_set_source_meter(capdev_t *dev, source_t *src, bool meter)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		item->metering = meter;
+		break;
+	}
+
+	recalculate_channel_mask_unlocked(dev);
+
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+void capdev_set_source_resample(capdev_t *dev, source_t *src, bool resample, uint32_t sample_rate)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		item->resample = resample;
+		item->sample_rate = sample_rate;
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+
+	resample_prepare(dev);
+}
+
+void capdev_set_source_drift_correct(capdev_t *dev, source_t *src, bool drift_correct)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		item->drift_correct = drift_correct;
+		break;
+	}
+
+	pthread_mutex_unlock(&dev->mutex);
+
+	resample_prepare(dev);
+}
+
+bool capdev_get_levels(capdev_t *dev, uint64_t stream_key, struct capdev_levels_s *levels)
+{
+	pthread_mutex_lock(&dev->mutex);
+	int ix = stream_key ? h8819_demux_find(&dev->demux, stream_key) : dev->demux.n_streams > 0 ? 0 : -1;
+	bool ret = ix >= 0 && dev->streams[ix].metering;
+	if (ret)
+		*levels = dev->streams[ix].levels;
+	pthread_mutex_unlock(&dev->mutex);
+	return ret;
+}
+
+void capdev_request_dump(capdev_t *dev)
+{
+	os_atomic_inc_long(&dev->dump_requests);
+}
+
+void capdev_enum_streams(capdev_t *dev, void (*cb)(uint64_t stream_key, void *param), void *param)
+{
+	pthread_mutex_lock(&dev->mutex);
+	for (int i = 0; i < dev->demux.n_streams; i++)
+		cb(dev->demux.keys[i], param);
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+int capdev_get_stream(struct capdev_s *dev, uint64_t key)
+{
+	int ix = h8819_demux_find(&dev->demux, key);
+	if (ix >= 0)
+		return ix;
+
+	pthread_mutex_lock(&dev->mutex);
+	bool created;
+	ix = h8819_demux_get(&dev->demux, key, &created);
+	if (created) {
+		h8819_tsest_seed(&dev->streams[ix].tsest, &dev->tsseed);
+		char mac[H8819_MAC_STRLEN];
+		h8819_stream_key_to_string(mac, key);
+		blog(LOG_INFO, "h8819[%s]: new stream %s", dev->name, mac);
+		recalculate_channel_mask_unlocked(dev);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+
+	// Once for each stream, before its first frame is delivered
+	if (created)
+		resample_prepare(dev);
+
+	return ix;
+}
+
+void capdev_unlink_source(capdev_t *dev, source_t *src)
+{
+	pthread_mutex_lock(&dev->mutex);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->src != src)
+			continue;
+
+		*item->prev_next = item->next;
+		if (item->next)
+			item->next->prev_next = item->prev_next;
+		bfree((char *)item->record.directory);
+		bfree((char *)item->flightrec.directory);
+		bfree((char *)item->rtp.destination);
+		bfree((char *)item->rtp.interface_address);
+		bfree(item->tsgroup_name);
+		bfree(item->mix);
+		delay_destroy(item->delay);
+		preroll_resample_destroy(item->preroll_rs);
+		bfree(item);
+		break;
+	}
+
+	recalculate_channel_mask_unlocked(dev);
+
+	pthread_mutex_unlock(&dev->mutex);
+	// Frees the resamplers of the streams that no source resamples on any more
+	resample_prepare(dev);
+	update_device_settings(dev, false);
+}
+
+// If 2 seconds or more (n >= 96000), libobs starts to add offset, which we should avoid.
+// TS_SMOOTHING_THRESHOLD (>= 70 ms, n >= 3360) is another threshold to smooth.
+// If the blank is larger than TS_SMOOTHING_THRESHOLD, let libobs to flush the buffer.
+// Added ~10% to the threshold to ensure exceeding the threshold.
+#define BLANK_MAX_SAMPLES 3700
+
+void capdev_send_blank_audio_to_all_unlocked(struct capdev_s *dev, int stream, int n, uint64_t timestamp,
+					     const struct capdev_resample_s *rs)
+{
+	if (n <= 0)
+		return;
+
+	if (n > BLANK_MAX_SAMPLES)
+		return;
+
+	H8819_PROBE2(send_blank_audio, n, timestamp);
+
+	float *buf = bmalloc(sizeof(float) * n);
+	for (int i = 0; i < n; i++)
+		buf[i] = 0.0f;
+
+	float *fltp[N_CHANNELS];
+	for (int i = 0; i < N_CHANNELS; i++)
+		fltp[i] = buf;
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (!item->active || item->delay || (rs && item_resampled(item)) ||
+		    !item_on_stream_unlocked(dev, item, stream))
+			continue;
+		source_add_audio(item->src, fltp, n, H8819_SAMPLE_RATE, timestamp - h8819_sample_time(n));
+	}
+
+	bfree(buf);
+}
+
+// Accumulate the levels of the channels in the frame. Returns true if a period has completed.
+static bool meter_frame(struct capdev_stream_s *st, float *fltp_all[N_CHANNELS], const float *silence,
+			int n_samples)
+{
+	static const char *meter_name = "meter";
+
+	profile_start(meter_name);
+	for (int ch = 0; ch < N_CHANNELS; ch++) {
+		if (fltp_all[ch] && fltp_all[ch] != silence)
+			h8819_meter_update(st->meter + ch, fltp_all[ch], n_samples);
+	}
+	st->meter_samples += (uint32_t)n_samples;
+	profile_end(meter_name);
+
+	return st->meter_samples >= CAPDEV_METER_PERIOD_SAMPLES;
+}
+
+static void meter_publish_unlocked(struct capdev_stream_s *st)
+{
+	struct capdev_levels_s *levels = &st->levels;
+	levels->n_channels = 0;
+	for (int ch = 0; ch < N_CHANNELS; ch++) {
+		struct h8819_meter_s *m = st->meter + ch;
+		st->meter_clips[ch] += m->n_clips;
+		levels->peak[ch] = m->peak;
+		levels->rms[ch] = m->n_samples ? sqrtf(m->sum_squares / (float)m->n_samples) : 0.0f;
+		levels->clips[ch] = st->meter_clips[ch];
+		if (m->n_samples)
+			levels->n_channels = ch + 1;
+		*m = (struct h8819_meter_s){0};
+	}
+	st->meter_samples = 0;
+}
+
+// `n_samples` does not exceed `H8819_RESAMPLE_MAX_OUTPUT`, which both backends and the resampler have checked.
+static void deliver_mix_unlocked(struct source_list_s *item, float *fltp_all[N_CHANNELS], float *silence,
+				 int n_samples, uint32_t sample_rate, int64_t timestamp)
+{
+	const struct capdev_mix_s *mix = item->mix;
+	const float *in[N_CHANNELS];
+	for (int i = 0; i < mix->n_inputs; i++) {
+		float *p = fltp_all[mix->channels[i]];
+		in[i] = p ? p : silence;
+	}
+
+	float bus[2][H8819_RESAMPLE_MAX_OUTPUT];
+	float *fltp[2] = {bus[0], bus[1]};
+	for (int i = 0; i < 2; i++)
+		h8819_mix(fltp[i], in, mix->gains[i], mix->n_inputs, n_samples);
+
+	source_add_audio(item->src, fltp, n_samples, sample_rate, timestamp);
+}
+
+// Returns the channels with the delayed channels replaced.
+static float **delay_frame(struct capdev_delay_s *delay, float *fltp_delayed[N_CHANNELS],
+			   float *fltp_all[N_CHANNELS], float *silence, int n_samples)
+{
+	memcpy(fltp_delayed, fltp_all, sizeof(float *) * N_CHANNELS);
+	for (int i = 0; i < delay->n_lines; i++) {
+		int ch = delay->channels[i];
+		const float *in = fltp_all[ch] ? fltp_all[ch] : silence;
+		h8819_delay_process(delay->lines + i, delay->out[i], in, n_samples);
+		fltp_delayed[ch] = delay->out[i];
+	}
+	return fltp_delayed;
+}
+
+static void deliver_channels_unlocked(struct source_list_s *item, float *fltp_in[N_CHANNELS], float *silence,
+				      int n_samples, uint32_t sample_rate, int64_t timestamp)
+{
+	if (item->mix) {
+		deliver_mix_unlocked(item, fltp_in, silence, n_samples, sample_rate, timestamp);
+		return;
+	}
+
+	float *fltp[N_CHANNELS];
+	for (uint32_t i = 0; i < item->n_channels; i++) {
+		float *p = fltp_in[item->channels[i]];
+		fltp[i] = p ? p : silence;
+	}
+
+	source_add_audio(item->src, fltp, n_samples, sample_rate, timestamp);
+}
+
+// Instead of the blank, run the delay lines over silence for the missing packets
+// so that the samples delayed from before the gap are played at the time of the gap.
+static void deliver_delayed_gap_unlocked(struct source_list_s *item, float *silence, int n_samples,
+					 int64_t timestamp, int n_skipped_packets)
+{
+	struct capdev_delay_s *delay = item->delay;
+	int n_gap = n_skipped_packets * n_samples;
+	if (n_gap > BLANK_MAX_SAMPLES) {
+		// libobs flushes the buffer of the source; only the alignment of the delay is kept.
+		for (int i = 0; i < delay->n_lines; i++)
+			h8819_delay_skip(delay->lines + i, n_gap);
+		return;
+	}
+
+	float *fltp_none[N_CHANNELS] = {0};
+	float *fltp_delayed[N_CHANNELS];
+	int64_t ts = timestamp - h8819_sample_time(n_gap);
+	for (int i = 0; i < n_skipped_packets; i++) {
+		float **fltp_in = delay_frame(delay, fltp_delayed, fltp_none, silence, n_samples);
+		deliver_channels_unlocked(item, fltp_in, silence, n_samples, H8819_SAMPLE_RATE,
+					  ts + h8819_sample_time(i * n_samples));
+	}
+}
+
+static void deliver_item_unlocked(struct source_list_s *item, float *fltp_all[N_CHANNELS], float *silence,
+				  int n_samples, uint32_t sample_rate, int64_t timestamp, int n_skipped_packets)
+{
+	float *fltp_delayed[N_CHANNELS];
+	float **fltp_in = fltp_all;
+	if (item->delay) {
+		if (n_skipped_packets)
+			deliver_delayed_gap_unlocked(item, silence, n_samples, timestamp, n_skipped_packets);
+		fltp_in = delay_frame(item->delay, fltp_delayed, fltp_all, silence, n_samples);
+	}
+
+	deliver_channels_unlocked(item, fltp_in, silence, n_samples, sample_rate, timestamp);
+}
+
+// Timestamp error beyond this restarts the output from the timestamp of the frame.
+#define DRIFT_CORRECT_RELOCK_NS 20000000LL
+// Critically damped with the time constant of 20 s
+#define DRIFT_CORRECT_KP 0.1    // [1/s]
+#define DRIFT_CORRECT_KI 0.0025 // [1/s^2]
+#define DRIFT_CORRECT_MAX_PPM 1000.0
+#define DRIFT_CORRECT_REPORT_SAMPLES (H8819_SAMPLE_RATE * 300ULL)
+
+// Deliver the output samples back to back and adjust the ratio so that they stay on the timestamp of the frames.
+static void drift_correct_frame(struct capdev_s *dev, int stream, struct capdev_resample_s *rs, int64_t ts,
+				int n_samples, int n_skipped_packets)
+{
+	const uint32_t rate = rs->rs.rate_out;
+	int64_t next_ts = rs->ts_base + (int64_t)rs->n_out_total * 1000000000 / rate;
+	int64_t error = next_ts - ts;
+
+	if (!rs->locked || n_skipped_packets || error > DRIFT_CORRECT_RELOCK_NS || error < -DRIFT_CORRECT_RELOCK_NS) {
+		// The correction is kept since the clocks have not changed.
+		if (rs->locked)
+			rs->n_relocks++;
+		rs->locked = true;
+		rs->ts_base = next_ts = ts;
+		rs->n_out_total = 0;
+		error = 0;
+	}
+	else {
+		double e = (double)error * 1e-9;
+		double dt = (double)n_samples / H8819_SAMPLE_RATE;
+		double c = (DRIFT_CORRECT_KP * e + DRIFT_CORRECT_KI * (rs->integral + e * dt)) * 1e6;
+		// The integral stops while the correction saturates.
+		if (fabs(c) < DRIFT_CORRECT_MAX_PPM)
+			rs->integral += e * dt;
+		else
+			c = c > 0 ? DRIFT_CORRECT_MAX_PPM : -DRIFT_CORRECT_MAX_PPM;
+		rs->correction = c;
+		h8819_resampler_set_correction(&rs->rs, c);
+	}
+
+	rs->timestamp = next_ts;
+	rs->n_out_total += rs->n_samples;
+	if (rs->n_out_total >= rate) {
+		rs->n_out_total -= rate;
+		rs->ts_base += 1000000000;
+	}
+	H8819_PROBE2(drift_correct, (int64_t)(rs->correction * 1e3), error);
+
+	rs->n_corrected += n_samples;
+	if (rs->n_corrected >= DRIFT_CORRECT_REPORT_SAMPLES) {
+		char mac[H8819_MAC_STRLEN];
+		h8819_stream_key_to_string(mac, dev->demux.keys[stream]);
+		blog(LOG_INFO, "h8819[%s] stream %s: clock correction %+.2f ppm, timestamp error %+.3f ms, %u relocks",
+		     dev->name, mac, rs->correction, (double)error * 1e-6, rs->n_relocks);
+		rs->n_corrected = 0;
+	}
+}
+
+// Returns the resampler for the union of the channels of the sources that resample once for all of them.
+// Returns NULL if no source resamples, or OBS runs at 48 kHz and no source corrects the drift.
+// The resampler is allocated by `resample_prepare` at the rate of OBS cached by the sources.
+static struct capdev_resample_s *resample_get_unlocked(struct capdev_s *dev, int stream)
+{
+	struct capdev_stream_s *st = dev->streams + stream;
+	struct capdev_resample_s *rs = st->resample;
+	if (!rs)
+		return NULL;
+
+	struct h8819_chmask_s channel_mask = {0};
+	bool correcting = false;
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (item->active && item_resampled(item) && item_on_stream_unlocked(dev, item, stream)) {
+			h8819_chmask_or(&channel_mask, &item->channel_mask);
+			correcting |= item->drift_correct;
+		}
+	}
+
+	if (h8819_chmask_is_empty(&channel_mask) || (rs->rs.rate_out == H8819_SAMPLE_RATE && !correcting)) {
+		rs->locked = false;
+		return NULL;
+	}
+	if (rs->unsupported)
+		return NULL;
+
+	if (correcting != rs->correcting) {
+		rs->correcting = correcting;
+		rs->locked = false;
+		rs->integral = 0.0;
+		rs->correction = 0.0;
+		h8819_resampler_set_correction(&rs->rs, 0.0);
+	}
+	rs->channel_mask = channel_mask;
+
+	return rs;
+}
+
+// Resample a frame into `rs->fltp`, `rs->n_samples`, and `rs->timestamp`.
+static void resample_frame_unlocked(struct capdev_s *dev, int stream, struct capdev_resample_s *rs,
+				    float *fltp_all[N_CHANNELS], float *silence, int n_samples, int64_t timestamp,
+				    int n_skipped_packets)
+{
+	static const char *resample_name = "resample";
+	profile_start(resample_name);
+	const float *in[N_CHANNELS];
+	for (int ch = 0; ch < N_CHANNELS; ch++)
+		in[ch] = fltp_all[ch] ? fltp_all[ch] : silence;
+	int64_t offset_ns;
+	rs->n_samples = h8819_resampler_process(&rs->rs, rs->fltp, in, &rs->channel_mask, n_samples, &offset_ns);
+	if (rs->correcting)
+		drift_correct_frame(dev, stream, rs, timestamp + offset_ns, n_samples, n_skipped_packets);
+	else
+		rs->timestamp = timestamp + offset_ns;
+	profile_end(resample_name);
+}
+
+// Instead of the blank, resample silence for the missing packets so that the output at the rate of OBS
+// continues up to the frame. Returns false if the gap is too long, which libobs flushes.
+static bool resample_gap_unlocked(struct capdev_s *dev, int stream, struct capdev_resample_s *rs, float *silence,
+				  int n_samples, int64_t timestamp, int n_skipped_packets)
+{
+	int n_gap = n_skipped_packets * n_samples;
+	if (n_gap > BLANK_MAX_SAMPLES)
+		return false;
+
+	float *fltp_none[N_CHANNELS] = {0};
+	int64_t ts = timestamp - h8819_sample_time(n_gap);
+	for (int i = 0; i < n_skipped_packets; i++) {
+		// Drift correction restarts from the beginning of the gap.
+		resample_frame_unlocked(dev, stream, rs, fltp_none, silence, n_samples,
+					ts + h8819_sample_time(i * n_samples), i == 0);
+		if (!rs->n_samples)
+			continue;
+		for (struct source_list_s *item = dev->sources; item; item = item->next) {
+			if (item->active && item_resampled(item) && item_on_stream_unlocked(dev, item, stream))
+				deliver_item_unlocked(item, rs->fltp, rs->silence, rs->n_samples, rs->rs.rate_out,
+						      rs->timestamp, 0);
+		}
+	}
+	return true;
+}
+
+static bool item_has_channels(const struct source_list_s *item, float *fltp_all[N_CHANNELS], const float *silence)
+{
+	for (int ch = 0; ch < N_CHANNELS; ch++) {
+		if (h8819_chmask_test(&item->channel_mask, ch) && (!fltp_all[ch] || fltp_all[ch] == silence))
+			return false;
+	}
+	return true;
+}
+
+// Take the state of the resampler of the stream for the pre-roll.
+static void preroll_resample_start(struct source_list_s *item, const struct capdev_resample_s *rs)
+{
+	struct capdev_preroll_resample_s *pr = item->preroll_rs;
+	if (!pr || pr->rs.rate_out != rs->rs.rate_out)
+		return;
+
+	h8819_resampler_copy_state(&pr->rs, &rs->rs);
+	pr->started = true;
+}
+
+// Returns true if the frame should be held back until the pre-roll with the new channels arrives.
+// Called before `rs` takes the frame.
+static bool item_hold_unlocked(struct source_list_s *item, const struct capdev_resample_s *rs,
+			       float *fltp_all[N_CHANNELS], const float *silence, int64_t timestamp,
+			       int n_skipped_packets)
+{
+	if (!item->switching)
+		return false;
+
+	// The pre-roll does not continue over a gap, nor cover more than this.
+	if (!n_skipped_packets && item->n_held < CAPDEV_PROC_PREROLL_FRAMES &&
+	    !item_has_channels(item, fltp_all, silence)) {
+		if (item->n_held++ == 0) {
+			item->held_ts = timestamp;
+			if (item->preroll_rs)
+				item->preroll_rs->started = false;
+			if (rs && item_resampled(item))
+				preroll_resample_start(item, rs);
+		}
+		return true;
+	}
+
+	item->switching = false;
+	item->n_held = 0;
+	return false;
+}
+
+void capdev_deliver_audio(struct capdev_s *dev, int stream, float *fltp_all[N_CHANNELS], float *silence,
+			  int n_samples, int64_t timestamp, int n_skipped_packets)
+{
+	static const char *source_add_audio_name = "source_add_audio";
+	struct capdev_stream_s *st = dev->streams + stream;
+
+	// A stale value of `metering` only affects one frame.
+	bool period_done = os_atomic_load_bool(&st->metering) && meter_frame(st, fltp_all, silence, n_samples);
+
+	profile_start(source_add_audio_name);
+	pthread_mutex_lock(&dev->mutex);
+	if (period_done)
+		meter_publish_unlocked(st);
+
+	struct capdev_resample_s *rs = resample_get_unlocked(dev, stream);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		item->holding = item->active && item_on_stream_unlocked(dev, item, stream) &&
+				item_hold_unlocked(item, rs, fltp_all, silence, timestamp, n_skipped_packets);
+	}
+
+	if (n_skipped_packets) {
+		capdev_send_blank_audio_to_all_unlocked(dev, stream, n_skipped_packets * n_samples, timestamp, rs);
+		if (rs && resample_gap_unlocked(dev, stream, rs, silence, n_samples, timestamp, n_skipped_packets))
+			n_skipped_packets = 0;
+	}
+
+	if (rs)
+		resample_frame_unlocked(dev, stream, rs, fltp_all, silence, n_samples, timestamp, n_skipped_packets);
+
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (!item->active || item->holding || !item_on_stream_unlocked(dev, item, stream))
+			continue;
+
+		if (rs && item_resampled(item)) {
+			if (rs->n_samples)
+				deliver_item_unlocked(item, rs->fltp, rs->silence, rs->n_samples, rs->rs.rate_out,
+						      rs->timestamp, 0);
+			continue;
+		}
+
+		deliver_item_unlocked(item, fltp_all, silence, n_samples, H8819_SAMPLE_RATE, timestamp,
+				      n_skipped_packets);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+	profile_end(source_add_audio_name);
+}
+
+void capdev_deliver_preroll(struct capdev_s *dev, int stream, float *fltp_all[N_CHANNELS], float *silence,
+			    int n_samples, int64_t timestamp)
+{
+	// The timestamp may differ from the held frame by a small correction of the estimation.
+	const int64_t tolerance = h8819_sample_time(n_samples) / 2;
+
+	pthread_mutex_lock(&dev->mutex);
+	for (struct source_list_s *item = dev->sources; item; item = item->next) {
+		if (!item->active || !item->switching || !item->n_held || !item_on_stream_unlocked(dev, item, stream))
+			continue;
+		// The frames before the first held frame were delivered with the previous channels.
+		if (timestamp < item->held_ts - tolerance || !item_has_channels(item, fltp_all, silence))
+			continue;
+		item->held_ts = timestamp + h8819_sample_time(n_samples);
+
+		struct capdev_preroll_resample_s *pr = item->preroll_rs;
+		if (!item_resampled(item) || !pr || !pr->started) {
+			deliver_item_unlocked(item, fltp_all, silence, n_samples, H8819_SAMPLE_RATE, timestamp, 0);
+			continue;
+		}
+
+		const float *in[N_CHANNELS];
+		for (int ch = 0; ch < N_CHANNELS; ch++)
+			in[ch] = fltp_all[ch] ? fltp_all[ch] : silence;
+		int64_t offset_ns;
+		int n_out = h8819_resampler_process(&pr->rs, pr->fltp, in, &item->channel_mask, n_samples, &offset_ns);
+		if (n_out)
+			deliver_item_unlocked(item, pr->fltp, pr->silence, n_out, pr->rs.rate_out,
+					      timestamp + offset_ns, 0);
+	}
+	pthread_mutex_unlock(&dev->mutex);
+}
+
+// The device was stopped if no packet arrived for this period.
+#define DRIFT_RESTART_NS 1000000000LL
+#define DRIFT_REPORT_SAMPLES (H8819_SAMPLE_RATE * 300ULL)
+
+static void report_timebase(struct capdev_s *dev, int stream, const struct capdev_tsgroup_s *group,
+			    int64_t group_offset)
+{
+	struct capdev_stream_s *st = dev->streams + stream;
+	char mac[H8819_MAC_STRLEN];
+	h8819_stream_key_to_string(mac, dev->demux.keys[stream]);
+
+	// Positive when the sample clock of the stream is faster than the host clock.
+	double elapsed = (double)(st->drift_ts_last - st->drift_ts_start);
+	double ppm = ((double)st->drift_samples * 1e9 / H8819_SAMPLE_RATE / elapsed - 1.0) * 1e6;
+
+	blog(LOG_INFO, "h8819[%s] timebase group '%s': stream %s is %+.3f ms from the group, clock %+.1f ppm",
+	     dev->name, group->name, mac, (double)(st->tsest.ts_offset - group_offset) * 1e-6, ppm);
+}
+
+static void drift_update(struct capdev_stream_s *st, int64_t ts_packet, int n_samples)
+{
+	if (!st->drift_ts_last || ts_packet <= st->drift_ts_last || ts_packet - st->drift_ts_last > DRIFT_RESTART_NS) {
+		st->drift_ts_start = ts_packet;
+		st->drift_samples = 0;
+		st->drift_reported = 0;
+	}
+	else {
+		st->drift_samples += n_samples;
+	}
+	st->drift_ts_last = ts_packet;
+}
+
+int64_t capdev_replay_timestamp(struct capdev_s *dev, int stream, int64_t ts_packet)
+{
+	struct capdev_tsgroup_s *group = dev->tsgroup;
+	if (!group)
+		return ts_packet + dev->streams[stream].tsest.ts_offset;
+
+	pthread_mutex_lock(&group->mutex);
+	int64_t ts = ts_packet + group->tsest.ts_offset;
+	pthread_mutex_unlock(&group->mutex);
+	return ts;
+}
+
+int64_t capdev_estimate_timestamp(struct capdev_s *dev, int stream, int64_t ts_packet, int n_samples, int n_packets)
+{
+	struct capdev_stream_s *st = dev->streams + stream;
+	int64_t ts_obs = (int64_t)os_gettime_ns() - h8819_sample_time(n_samples);
+	bool converged = st->tsest.converged;
+	int64_t ts = h8819_tsest_update(&st->tsest, ts_packet, ts_obs);
+	if (!converged && st->tsest.converged) {
+		blog(LOG_INFO, "h8819[%s]: timestamp converged after %u updates%s, error %.3f ms", dev->name,
+		     st->tsest.n_updates, st->tsest.seeded ? " from the previous session" : "",
+		     sqrt((double)st->tsest.err_var) * 1e-6);
+	}
+
+	struct capdev_tsgroup_s *group = dev->tsgroup;
+	if (!group)
+		return ts;
+
+	// The estimation of the stream itself is kept to report the offset from the group.
+	pthread_mutex_lock(&group->mutex);
+	ts = h8819_tsest_update(&group->tsest, ts_packet, ts_obs);
+	int64_t group_offset = group->tsest.ts_offset;
+	pthread_mutex_unlock(&group->mutex);
+
+	drift_update(st, ts_packet, n_samples * n_packets);
+	if (st->drift_samples / DRIFT_REPORT_SAMPLES != st->drift_reported) {
+		st->drift_reported = st->drift_samples / DRIFT_REPORT_SAMPLES;
+		report_timebase(dev, stream, group, group_offset);
+	}
+
+	return ts;
+}
+
+void capdev_count_packets(struct capdev_s *dev, int n_packets, int n_skipped_packets)
+{
+	int packets_received_prev = dev->packets_received;
+	dev->packets_received += n_packets;
+	dev->packets_missed += n_skipped_packets;
+	if (packets_received_prev / 4096 != dev->packets_received / 4096)
+		devlist_mark_reac_seen(dev->name);
+	if (packets_received_prev / 65536 != dev->packets_received / 65536 &&
+	    dev->packets_missed != dev->packets_missed_llog) {
+		blog(LOG_INFO, "h8819[%s] current status: %d packets received, %d packets dropped", dev->name,
+		     dev->packets_received, dev->packets_missed);
+		dev->packets_missed_llog = dev->packets_missed;
+	}
 }
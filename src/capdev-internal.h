@@ -1,49 +1,215 @@
 #pragma once
 
-#define N_CHANNELS 40
-#define N_IGNORE_FIRST_PACKET 1024
+#include "h8819.h"
+
+#define N_CHANNELS H8819_MAX_CHANNELS
+
+// Delay lines of the channels with a delay, owned by a source
+struct capdev_delay_s
+{
+	int n_lines;
+	int channels[N_CHANNELS];
+	struct h8819_delay_s lines[N_CHANNELS];
+	float out[N_CHANNELS][H8819_N_SAMPLES];
+	float *rings; // `H8819_DELAY_RING_SAMPLES` for each line
+};
+
+// Resampler of a source playing the pre-roll at the rate of OBS,
+// continuing from the state of the resampler of the stream before the first held frame
+struct capdev_preroll_resample_s
+{
+	struct h8819_resampler_s rs;
+	bool started; // false if the stream was not resampled at the first held frame
+	float *fltp[N_CHANNELS];
+	float out[N_CHANNELS][H8819_RESAMPLE_MAX_OUTPUT];
+	float silence[H8819_RESAMPLE_MAX_OUTPUT];
+};
 
 struct source_list_s
 {
 	source_t *src;
-	uint64_t channel_mask;
+	bool active;
+	uint64_t stream_key; // 0 to follow the first stream on the device
+	struct h8819_chmask_s channel_mask;
 	uint32_t n_channels;
 	int channels[N_CHANNELS];
+	struct capdev_mix_s *mix; // owned, NULL to take `channels` one to one
+	struct capdev_delay_s *delay; // NULL if no channel is delayed
+	bool recording;
+	struct capdev_record_s record; // `directory` is owned
+	bool flightrec_enabled;
+	struct capdev_flightrec_s flightrec; // `directory` is owned
+	bool rtp_enabled;
+	struct capdev_rtp_s rtp; // `destination` and `interface_address` are owned
+	bool metering;
+	bool resample;
+	bool drift_correct;
+	uint32_t sample_rate; // of OBS when the source was created or updated
+	uint32_t keepalive_ms;
+	char *tsgroup_name; // owned, NULL if the source names no timebase group
+
+	// Set when channels are added and cleared at the first frame that has all the channels.
+	// Meanwhile the frames are held back and played from the pre-roll sent by the helper.
+	bool switching;
+	bool holding; // the current frame is held back
+	int n_held;
+	int64_t held_ts; // timestamp of the next frame to take from the pre-roll
+	struct capdev_preroll_resample_s *preroll_rs; // owned, allocated while the source resamples on the device
 
 	struct source_list_s *next;
 	struct source_list_s **prev_next;
 };
 
+struct capdev_backend_s
+{
+	const char *id;
+	void *(*thread_main)(void *);
+};
+
+// Channels of a stream resampled to the rate of OBS, used by the capture thread with `mutex` locked.
+// Allocated while a source resamples on the stream, outside the capture thread except when the stream is found.
+struct capdev_resample_s
+{
+	struct h8819_resampler_s rs;
+	bool unsupported;
+	int n_samples;
+	int64_t timestamp;
+
+	// Correction of the ratio to follow the host clock, if any source on the stream corrects the drift
+	bool correcting;
+	bool locked;
+	int64_t ts_base;      // timestamp of the output after `n_out_total` samples are delivered
+	uint32_t n_out_total; // less than `rs.rate_out` since whole seconds are moved to `ts_base`
+	double integral;      // of the timestamp error [s^2]
+	double correction;    // [ppm]
+	uint64_t n_corrected; // input samples since the last report
+	uint32_t n_relocks;
+	struct h8819_chmask_s channel_mask; // union of the channels of the sources resampled in the current frame
+	float *fltp[N_CHANNELS];
+	float out[N_CHANNELS][H8819_RESAMPLE_MAX_OUTPUT];
+	float silence[H8819_RESAMPLE_MAX_OUTPUT];
+};
+
+// Logical stream demultiplexed by the source MAC address
+struct capdev_stream_s
+{
+	// Written with `mutex` locked. The capture thread may read it without the lock;
+	// a torn read only affects the channels of one frame.
+	struct h8819_chmask_s channel_mask;
+	struct h8819_stream_s stream;
+	struct h8819_tsest_s tsest;
+	int packets_received;
+
+	// Used only by the capture thread while the device is in a timebase group.
+	int64_t drift_ts_start;
+	int64_t drift_ts_last;
+	uint64_t drift_samples;
+	uint64_t drift_reported;
+
+	// Written with `mutex` locked, read by the capture thread without the lock.
+	volatile bool metering;
+	// Accumulated only by the capture thread and copied to `levels` with `mutex` locked every period.
+	struct h8819_meter_s meter[N_CHANNELS];
+	uint32_t meter_clips[N_CHANNELS];
+	uint32_t meter_samples;
+	struct capdev_levels_s levels;
+
+	struct capdev_resample_s *resample;
+};
+
+// Devices in the same group share one offset from the packet timestamps to the OBS clock.
+// Groups are kept until `capdev_shutdown` so that the capture threads can use them without the global mutex.
+struct capdev_tsgroup_s
+{
+	char *name;
+	pthread_mutex_t mutex;
+	struct h8819_tsest_s tsest;
+	struct capdev_tsgroup_s *next;
+};
+
 struct capdev_s
 {
 	char *name;
+	const struct capdev_backend_s *backend;
 	capdev_t *next;
 	capdev_t **prev_next;
 	volatile long refcnt;
+	volatile bool exiting;
+	volatile bool stopped;
+	uint64_t release_ts;
+	uint32_t keepalive_ms;
 
 	pthread_mutex_t mutex;
 	pthread_t thread;
-	volatile uint64_t channel_mask;
 	struct source_list_s *sources;
 
-	int64_t ts_offset;
+	// `demux` is written only by the capture thread with `mutex` locked.
+	struct h8819_demux_s demux;
+	struct capdev_stream_s streams[H8819_MAX_STREAMS];
 
 	int packets_received;
 	int packets_missed;
 	int packets_missed_llog;
 
+	// Incremented by `capdev_request_dump` and consumed by the capture thread.
+	volatile long dump_requests;
+
+	// Written with the global mutex locked. The capture thread reads it without the lock.
+	struct capdev_tsgroup_s *volatile tsgroup;
+
+	// Estimation left by the previous session of the same device, set before the thread starts.
+	struct h8819_tsest_s tsseed;
+
 #ifndef OS_WINDOWS
 	pid_t pid;
-#else // OS_WINDOWS
-	uint16_t counter_last;
-	bool got_packet;
+
+	// Transmit requests appended by `capdev_transmit` and written to the helper by the capture thread.
+	pthread_mutex_t transmit_mutex;
+	DARRAY(uint8_t) transmit_pending;
+	uint64_t transmit_dropped; // bytes of requests dropped while the helper was not reading
+	volatile bool transmitting;
 #endif
 };
 
-static inline int64_t sample_time(int n_samples)
-{
-	return n_samples * 62500 / 3; // * 1000000000 / 48000
-}
+#ifndef OS_WINDOWS
+extern const struct capdev_backend_s capdev_backend_proc;
+#endif
+#ifdef HAVE_CAPDEV_PCAP
+extern const struct capdev_backend_s capdev_backend_pcap;
+#endif
+
+void capdev_platform_init(void);
+void capdev_platform_shutdown(void);
+// Sources that take the output of `rs` and sources with delays fill the gap by themselves.
+void capdev_send_blank_audio_to_all_unlocked(struct capdev_s *dev, int stream, int n, uint64_t timestamp,
+					     const struct capdev_resample_s *rs);
+
+// Returns the recording settings of the first source that records on the device, or NULL.
+const struct source_list_s *capdev_find_recording_unlocked(struct capdev_s *dev);
+
+// Returns the flight recorder settings of the first source that enables it on the device, or NULL.
+const struct source_list_s *capdev_find_flightrec_unlocked(struct capdev_s *dev);
+
+// Returns the RTP settings of the first source that re-streams on the device, or NULL.
+const struct source_list_s *capdev_find_rtp_unlocked(struct capdev_s *dev);
+
+// Called from the capture thread to find the stream of the packet. Returns -1 if too many streams.
+int capdev_get_stream(struct capdev_s *dev, uint64_t key);
+
+// Called from the capture thread to convert the timestamp of the packet to the OBS clock.
+// `n_packets` is the number of packets since the previous call including the skipped packets.
+int64_t capdev_estimate_timestamp(struct capdev_s *dev, int stream, int64_t ts_packet, int n_samples, int n_packets);
+
+// Called from the capture thread for each packet to send the samples to the active sources on the stream.
+// Channels whose pointer is NULL in `fltp_all` are filled with `silence`.
+void capdev_deliver_audio(struct capdev_s *dev, int stream, float *fltp_all[N_CHANNELS], float *silence,
+			  int n_samples, int64_t timestamp, int n_skipped_packets);
+
+// Called from the capture thread for a frame sent again by the helper after channels were added.
+// Delivers it only to the sources holding back their frames until their new channels arrive.
+void capdev_deliver_preroll(struct capdev_s *dev, int stream, float *fltp_all[N_CHANNELS], float *silence,
+			    int n_samples, int64_t timestamp);
 
-void *capdev_thread_main(void *);
-void capdev_send_blank_audio_to_all_unlocked(struct capdev_s *dev, int n, uint64_t timestamp);
+// Same as `capdev_estimate_timestamp` for a frame that was already counted.
+int64_t capdev_replay_timestamp(struct capdev_s *dev, int stream, int64_t ts_packet);
+void capdev_count_packets(struct capdev_s *dev, int n_packets, int n_skipped_packets);
@@ -4,8 +4,10 @@
 #define _GNU_SOURCE // close_range, pipe2
 #endif
 #include <unistd.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <fcntl.h>
+#include <limits.h>
 #include <inttypes.h>
 #include <obs-module.h>
 #include <util/platform.h>
@@ -16,14 +18,20 @@
 #include "capdev.h"
 #include "capdev-internal.h"
 #include "capdev-proc.h"
+#include "probes.h"
 
 #define PROC_4219 "obs-h8819-proc"
 
+// No helper is started in advance unless asked for.
+// The helper needs the capture capability, and most OBS sessions have no h8819 source.
+#define POOL_SIZE_DEFAULT 0
+#define POOL_SIZE_MAX 8
+
 #define LIST_DELIM '\n'
 
-#define K_OFFSET_DECAY (256 * 16)
+extern char **environ;
 
-#if defined(__APPLE__)
+#if defined(__APPLE__) && !defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
 static void closefrom(int lower)
 {
 	struct proc_fdinfo fds[128];
@@ -37,7 +45,9 @@ static void closefrom(int lower)
 		}
 	} while (ret >= sizeof(fds) / sizeof(*fds));
 }
+#endif
 
+#if defined(__APPLE__)
 static int pipe2(int pipefd[2], int flags)
 {
 	int ret = pipe(pipefd);
@@ -53,50 +63,64 @@ static int pipe2(int pipefd[2], int flags)
 }
 #endif
 
-static pid_t thread_start_proc(const char *name, int *fd_req, int *fd_data)
-{
-	int pipe_req[2] = {-1, -1};
-	int pipe_data[2];
+#if defined(HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP) || defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+#define USE_POSIX_SPAWN
+#endif
 
-	if (fd_req && pipe2(pipe_req, O_CLOEXEC) < 0) {
-		blog(LOG_ERROR, "failed to create pipe");
-		goto fail0;
-	}
+#ifdef USE_POSIX_SPAWN
+static pid_t spawn_proc(const char *proc_path, const char *arg, int fd_stdin, int fd_stdout)
+{
+	posix_spawn_file_actions_t fa;
+	posix_spawnattr_t attr;
+	posix_spawn_file_actions_init(&fa);
+	posix_spawnattr_init(&attr);
+
+	if (fd_stdin >= 0)
+		posix_spawn_file_actions_adddup2(&fa, fd_stdin, 0);
+	posix_spawn_file_actions_adddup2(&fa, fd_stdout, 1);
+#if defined(POSIX_SPAWN_CLOEXEC_DEFAULT)
+	// Only the descriptors in the file actions are inherited.
+	if (fd_stdin < 0)
+		posix_spawn_file_actions_addinherit_np(&fa, 0);
+	posix_spawn_file_actions_addinherit_np(&fa, 2);
+	posix_spawnattr_setflags(&attr, POSIX_SPAWN_CLOEXEC_DEFAULT);
+#else
+	posix_spawn_file_actions_addclosefrom_np(&fa, 3);
+#endif
 
-	if (pipe2(pipe_data, O_CLOEXEC) < 0) {
-		blog(LOG_ERROR, "failed to create pipe");
-		goto fail1;
+	char *argv[] = {PROC_4219, (char *)arg, NULL};
+	pid_t pid = -1;
+	int ret = posix_spawn(&pid, proc_path, &fa, &attr, argv, environ);
+	if (ret) {
+		blog(LOG_ERROR, "failed to spawn '%s' ret code: %d", proc_path, ret);
+		pid = -1;
 	}
 
-	char *proc_path = obs_module_file(PROC_4219);
-	if (!proc_path) {
-		blog(LOG_ERROR, "failed to find '%s'", PROC_4219);
-		goto fail2;
-	}
+	posix_spawnattr_destroy(&attr);
+	posix_spawn_file_actions_destroy(&fa);
 
-	// TODO: consider using vfork
+	return pid;
+}
+#else  // USE_POSIX_SPAWN
+static pid_t spawn_proc(const char *proc_path, const char *arg, int fd_stdin, int fd_stdout)
+{
 	pid_t pid = fork();
 	if (pid < 0) {
 		blog(LOG_ERROR, "failed to fork");
-		goto fail3;
+		return -1;
 	}
 
 	if (pid == 0) {
 		// I'm a child
-		if (pipe_req[0] >= 0) {
-			dup2(pipe_req[0], 0);
-			close(pipe_req[0]);
-			close(pipe_req[1]);
-		}
-		dup2(pipe_data[1], 1);
-		close(pipe_data[0]);
-		close(pipe_data[1]);
+		if (fd_stdin >= 0)
+			dup2(fd_stdin, 0);
+		dup2(fd_stdout, 1);
 #if defined(__APPLE__) || defined(__FreeBSD__) || defined(__DragonFly__)
 		closefrom(3);
 #else // Linux
 		close_range(3, 65535, 0);
 #endif
-		int ret = execlp(proc_path, PROC_4219, name, NULL);
+		int ret = execlp(proc_path, PROC_4219, arg, NULL);
 
 		fprintf(stderr, "Error: failed to exec '%s' ret code: %d\n", proc_path, ret);
 		close(0);
@@ -104,6 +128,35 @@ static pid_t thread_start_proc(const char *name, int *fd_req, int *fd_data)
 		exit(1);
 	}
 
+	return pid;
+}
+#endif // USE_POSIX_SPAWN
+
+static pid_t thread_start_proc(const char *arg, int *fd_req, int *fd_data)
+{
+	int pipe_req[2] = {-1, -1};
+	int pipe_data[2];
+
+	if (fd_req && pipe2(pipe_req, O_CLOEXEC) < 0) {
+		blog(LOG_ERROR, "failed to create pipe");
+		goto fail0;
+	}
+
+	if (pipe2(pipe_data, O_CLOEXEC) < 0) {
+		blog(LOG_ERROR, "failed to create pipe");
+		goto fail1;
+	}
+
+	char *proc_path = obs_module_file(PROC_4219);
+	if (!proc_path) {
+		blog(LOG_ERROR, "failed to find '%s'", PROC_4219);
+		goto fail2;
+	}
+
+	pid_t pid = spawn_proc(proc_path, arg, pipe_req[0], pipe_data[1]);
+	if (pid < 0)
+		goto fail3;
+
 	if (fd_req) {
 		*fd_req = pipe_req[1];
 		close(pipe_req[0]);
@@ -129,162 +182,542 @@ fail0:
 	return -1;
 }
 
-static inline void s24lep_to_fltp(float *ptr_dst, const uint8_t *ptr_src, size_t n_samples)
+struct helper_s
+{
+	pid_t pid;
+	int fd_req;
+	int fd_data;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct helper_s pool[POOL_SIZE_MAX];
+static int pool_num = 0;
+static int pool_size = 0;
+
+static void pool_fill()
+{
+	pthread_mutex_lock(&pool_mutex);
+	while (pool_num < pool_size) {
+		struct helper_s *h = pool + pool_num;
+		h->pid = thread_start_proc("-w", &h->fd_req, &h->fd_data);
+		if (h->pid < 0)
+			break;
+		pool_num++;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+static bool pool_take(struct helper_s *h)
+{
+	pthread_mutex_lock(&pool_mutex);
+	bool ret = pool_num > 0;
+	if (ret)
+		*h = pool[--pool_num];
+	pthread_mutex_unlock(&pool_mutex);
+	return ret;
+}
+
+static void helper_wait(pid_t pid)
+{
+	int retval;
+	waitpid(pid, &retval, 0);
+	blog(retval ? LOG_ERROR : LOG_INFO, "exit h8819 proc %d", retval);
+}
+
+static bool open_pooled_helper(struct capdev_s *dev, int *fd_req, int *fd_data)
 {
-	for (size_t n = n_samples; n > 0; n--) {
-		uint32_t u = ptr_src[0] | ptr_src[1] << 8 | ptr_src[2] << 16;
-		int s = u & 0x800000 ? u - 0x1000000 : u;
-		*ptr_dst = (float)s / 8388608.0f;
-		ptr_src += 3;
-		ptr_dst += 1;
+	struct helper_s h;
+	if (!pool_take(&h))
+		return false;
+
+	size_t len = strlen(dev->name);
+	struct capdev_proc_request_s req = {
+		.flags = CAPDEV_REQ_FLAG_OPEN,
+		.n_extra_bytes = (uint32_t)len,
+	};
+	if (write(h.fd_req, &req, sizeof(req)) != sizeof(req) || write(h.fd_req, dev->name, len) != (ssize_t)len) {
+		blog(LOG_ERROR, "failed to send the device name to the pooled helper %d", (int)h.pid);
+		close(h.fd_req);
+		close(h.fd_data);
+		helper_wait(h.pid);
+		return false;
 	}
+
+	dev->pid = h.pid;
+	*fd_req = h.fd_req;
+	*fd_data = h.fd_data;
+	return true;
+}
+
+void capdev_platform_init()
+{
+	const char *env = getenv("OBS_H8819_POOL_SIZE");
+	int size = env ? atoi(env) : POOL_SIZE_DEFAULT;
+	if (size < 0)
+		size = 0;
+	if (size > POOL_SIZE_MAX)
+		size = POOL_SIZE_MAX;
+
+	pthread_mutex_lock(&pool_mutex);
+	pool_size = size;
+	pthread_mutex_unlock(&pool_mutex);
+
+	pool_fill();
 }
 
-static int64_t estimate_timestamp(struct capdev_s *dev, const struct capdev_proc_header_s *pkt, int n_samples)
+void capdev_platform_shutdown()
 {
-	int64_t ts_obs = (int64_t)os_gettime_ns() - sample_time(n_samples);
-	if (dev->packets_received == 0 || pkt->timestamp + dev->ts_offset >= ts_obs ||
-	    pkt->timestamp + dev->ts_offset + 70000000 < ts_obs) {
-		dev->ts_offset = ts_obs - (int64_t)pkt->timestamp;
+	pthread_mutex_lock(&pool_mutex);
+	pool_size = 0;
+	pthread_mutex_unlock(&pool_mutex);
+
+	struct helper_s h;
+	while (pool_take(&h)) {
+		// The helper exits when it reads EOF.
+		close(h.fd_req);
+		close(h.fd_data);
+		helper_wait(h.pid);
+	}
+}
+
+// Same limit as the helper
+#define RECORD_DIR_MAX 4095
+#define RECORD_REQUEST_MAX \
+	(sizeof(struct capdev_proc_request_s) + sizeof(struct capdev_proc_record_s) + RECORD_DIR_MAX)
+#define FLIGHTREC_REQUEST_MAX \
+	(sizeof(struct capdev_proc_request_s) + sizeof(struct capdev_proc_flightrec_s) + RECORD_DIR_MAX)
+#define RTP_REQUEST_MAX \
+	(sizeof(struct capdev_proc_request_s) + sizeof(struct capdev_proc_rtp_s) + CAPDEV_PROC_RTP_ADDRESS_MAX * 2)
+
+struct requested_s
+{
+	struct h8819_chmask_s channel_mask[H8819_MAX_STREAMS];
+	uint8_t record[RECORD_REQUEST_MAX]; // whole record request
+	size_t record_size;                 // 0 if not recording
+	uint8_t flightrec[FLIGHTREC_REQUEST_MAX];
+	size_t flightrec_size; // 0 if the flight recorder is not running
+	uint8_t rtp[RTP_REQUEST_MAX];
+	size_t rtp_size; // 0 if not re-streaming
+};
+
+static size_t build_record_request_unlocked(uint8_t *msg, struct capdev_s *dev)
+{
+	const struct source_list_s *item = capdev_find_recording_unlocked(dev);
+	if (!item)
+		return 0;
+
+	const struct capdev_record_s *rec = &item->record;
+	size_t dir_len = strlen(rec->directory);
+	if (!dir_len || dir_len > RECORD_DIR_MAX)
+		return 0;
+
+	struct capdev_proc_request_s req = {
+		.channel_mask = rec->channel_mask,
+		.stream_key = item->stream_key,
+		.flags = CAPDEV_REQ_FLAG_RECORD,
+		.n_extra_bytes = (uint32_t)(sizeof(struct capdev_proc_record_s) + dir_len),
+	};
+	struct capdev_proc_record_s rr = {
+		.format = (uint32_t)rec->format,
+		.flags = rec->direct_io ? CAPDEV_RECORD_FLAG_DIRECT_IO : 0,
+		.rollover_bytes = rec->rollover_bytes,
+		.rollover_seconds = rec->rollover_seconds,
+	};
+	memcpy(msg, &req, sizeof(req));
+	memcpy(msg + sizeof(req), &rr, sizeof(rr));
+	memcpy(msg + sizeof(req) + sizeof(rr), rec->directory, dir_len);
+	return sizeof(req) + sizeof(rr) + dir_len;
+}
+
+static size_t build_flightrec_request_unlocked(uint8_t *msg, struct capdev_s *dev)
+{
+	const struct source_list_s *item = capdev_find_flightrec_unlocked(dev);
+	if (!item)
+		return 0;
+
+	const struct capdev_flightrec_s *fr = &item->flightrec;
+	size_t dir_len = strlen(fr->directory);
+	if (!dir_len || dir_len > RECORD_DIR_MAX)
+		return 0;
+
+	struct capdev_proc_request_s req = {
+		.flags = CAPDEV_REQ_FLAG_FLIGHTREC,
+		.n_extra_bytes = (uint32_t)(sizeof(struct capdev_proc_flightrec_s) + dir_len),
+	};
+	struct capdev_proc_flightrec_s rf = {
+		.seconds_before = fr->seconds_before,
+		.seconds_after = fr->seconds_after,
+	};
+	memcpy(msg, &req, sizeof(req));
+	memcpy(msg + sizeof(req), &rf, sizeof(rf));
+	memcpy(msg + sizeof(req) + sizeof(rf), fr->directory, dir_len);
+	return sizeof(req) + sizeof(rf) + dir_len;
+}
+
+static size_t build_rtp_request_unlocked(uint8_t *msg, struct capdev_s *dev)
+{
+	const struct source_list_s *item = capdev_find_rtp_unlocked(dev);
+	if (!item)
+		return 0;
+
+	const struct capdev_rtp_s *rtp = &item->rtp;
+	size_t dst_len = strlen(rtp->destination);
+	size_t if_len = strlen(rtp->interface_address);
+	if (!dst_len || dst_len > CAPDEV_PROC_RTP_ADDRESS_MAX || if_len > CAPDEV_PROC_RTP_ADDRESS_MAX)
+		return 0;
+
+	struct capdev_proc_request_s req = {
+		.channel_mask = rtp->channel_mask,
+		.stream_key = item->stream_key,
+		.flags = CAPDEV_REQ_FLAG_RTP,
+		.n_extra_bytes = (uint32_t)(sizeof(struct capdev_proc_rtp_s) + dst_len + if_len),
+	};
+	struct capdev_proc_rtp_s rr = {
+		.ptime_samples = rtp->ptime_samples,
+		.destination_len = (uint16_t)dst_len,
+		.interface_len = (uint16_t)if_len,
+	};
+	uint8_t *ptr = msg;
+	memcpy(ptr, &req, sizeof(req));
+	ptr += sizeof(req);
+	memcpy(ptr, &rr, sizeof(rr));
+	ptr += sizeof(rr);
+	memcpy(ptr, rtp->destination, dst_len);
+	ptr += dst_len;
+	memcpy(ptr, rtp->interface_address, if_len);
+	ptr += if_len;
+	return ptr - msg;
+}
+
+/* Requests waiting to be written to the helper. The capture thread never blocks on the pipe
+ * since the helper may be blocked writing frames that only this thread reads. */
+struct request_queue_s
+{
+	DARRAY(uint8_t) buf; // whole requests, taken from `transmit_pending` or built by this thread
+	size_t written;
+	uint64_t dropped_logged;
+};
+
+// Queue `msg` and remember it as `last`. An empty `msg` is queued as a request with `flag` and no extra bytes.
+static void queue_setting_request(uint8_t *last, size_t *last_size, const uint8_t *msg, size_t size, uint32_t flag,
+				  struct request_queue_s *queue)
+{
+	memcpy(last, msg, size);
+	*last_size = size;
+
+	struct capdev_proc_request_s stop = {.flags = flag};
+	if (!size) {
+		msg = (const uint8_t *)&stop;
+		size = sizeof(stop);
+	}
+
+	da_push_back_array(queue->buf, msg, size);
+}
+
+// Start, change, or stop recording if the settings have changed since the last request.
+static void update_record_unlocked(struct requested_s *requested, struct capdev_s *dev, struct request_queue_s *queue)
+{
+	uint8_t msg[RECORD_REQUEST_MAX];
+	size_t size = build_record_request_unlocked(msg, dev);
+	if (size == requested->record_size && memcmp(msg, requested->record, size) == 0)
+		return;
+
+	if (size) {
+		blog(LOG_INFO, "h8819[%s]: recording to '%s'", dev->name,
+		     capdev_find_recording_unlocked(dev)->record.directory);
 	}
 	else {
-		int64_t e = ts_obs - (int64_t)pkt->timestamp - dev->ts_offset;
-		dev->ts_offset += e / K_OFFSET_DECAY;
+		blog(LOG_INFO, "h8819[%s]: stop recording", dev->name);
 	}
 
-	int64_t ts = pkt->timestamp + dev->ts_offset;
+	queue_setting_request(requested->record, &requested->record_size, msg, size, CAPDEV_REQ_FLAG_RECORD, queue);
+}
 
-#if 0
-	blog(LOG_INFO, "timestamp: obs: %0.6f pcap: %0.6f ts_offset: %0.6f timestamp: %0.6f", ts_obs * 1e-9,
-			pkt->timestamp * 1e-9, dev->ts_offset * 1e-9, ts * 1e-9);
-#endif
+// Same as `update_record_unlocked` for re-streaming.
+static void update_rtp_unlocked(struct requested_s *requested, struct capdev_s *dev, struct request_queue_s *queue)
+{
+	uint8_t msg[RTP_REQUEST_MAX];
+	size_t size = build_rtp_request_unlocked(msg, dev);
+	if (size == requested->rtp_size && memcmp(msg, requested->rtp, size) == 0)
+		return;
+
+	if (size)
+		blog(LOG_INFO, "h8819[%s]: RTP to '%s'", dev->name, capdev_find_rtp_unlocked(dev)->rtp.destination);
+	else
+		blog(LOG_INFO, "h8819[%s]: stop RTP", dev->name);
+
+	queue_setting_request(requested->rtp, &requested->rtp_size, msg, size, CAPDEV_REQ_FLAG_RTP, queue);
+}
+
+// Same as `update_record_unlocked` for the flight recorder. Also queues the dump requests.
+static void update_flightrec_unlocked(struct requested_s *requested, struct capdev_s *dev,
+				      struct request_queue_s *queue)
+{
+	uint8_t msg[FLIGHTREC_REQUEST_MAX];
+	size_t size = build_flightrec_request_unlocked(msg, dev);
+	if (size != requested->flightrec_size || memcmp(msg, requested->flightrec, size) != 0) {
+		if (size) {
+			blog(LOG_INFO, "h8819[%s]: flight recorder to '%s'", dev->name,
+			     capdev_find_flightrec_unlocked(dev)->flightrec.directory);
+		}
+		else {
+			blog(LOG_INFO, "h8819[%s]: stop flight recorder", dev->name);
+		}
+
+		queue_setting_request(requested->flightrec, &requested->flightrec_size, msg, size,
+				      CAPDEV_REQ_FLAG_FLIGHTREC, queue);
+	}
+
+	if (os_atomic_set_long(&dev->dump_requests, 0) <= 0)
+		return;
+	if (!requested->flightrec_size) {
+		blog(LOG_WARNING, "h8819[%s]: flight recorder is not running", dev->name);
+		return;
+	}
 
-	return ts;
+	struct capdev_proc_request_s req = {.flags = CAPDEV_REQ_FLAG_DUMP};
+	da_push_back_array(queue->buf, (const uint8_t *)&req, sizeof(req));
 }
 
-static bool update_channel_mask(struct capdev_proc_request_s *req, struct capdev_s *dev)
+// Queue the recorder settings and the channel mask of each stream that have changed since the last request.
+static void update_channel_mask(struct requested_s *requested, struct capdev_s *dev, struct request_queue_s *queue)
 {
 	if (pthread_mutex_trylock(&dev->mutex) != 0)
-		return false;
-	bool ret = false;
-	if (dev->channel_mask != req->channel_mask) {
-		ret = true;
-		req->channel_mask = dev->channel_mask;
+		return;
+	update_record_unlocked(requested, dev, queue);
+	update_flightrec_unlocked(requested, dev, queue);
+	update_rtp_unlocked(requested, dev, queue);
+	for (int i = 0; i < dev->demux.n_streams; i++) {
+		if (h8819_chmask_equal(&dev->streams[i].channel_mask, &requested->channel_mask[i]))
+			continue;
+
+		struct capdev_proc_request_s req = {
+			.channel_mask = dev->streams[i].channel_mask,
+			.stream_key = dev->demux.keys[i],
+		};
+		blog(LOG_INFO, "requesting %d channels stream=%" PRIx64, h8819_chmask_count(&req.channel_mask),
+		     req.stream_key);
+		da_push_back_array(queue->buf, (const uint8_t *)&req, sizeof(req));
+		requested->channel_mask[i] = req.channel_mask;
 	}
 	pthread_mutex_unlock(&dev->mutex);
-	return ret;
 }
 
-void *capdev_thread_main(void *data)
+// Called when the queue is empty.
+static void take_transmit_requests(struct capdev_s *dev, struct request_queue_s *queue)
+{
+	queue->buf.num = 0;
+	queue->written = 0;
+
+	pthread_mutex_lock(&dev->transmit_mutex);
+	struct darray tmp = queue->buf.da;
+	queue->buf.da = dev->transmit_pending.da;
+	dev->transmit_pending.da = tmp;
+	uint64_t dropped = dev->transmit_dropped;
+	pthread_mutex_unlock(&dev->transmit_mutex);
+
+	if (dropped != queue->dropped_logged) {
+		blog(LOG_WARNING, "h8819[%s]: %" PRIu64 " bytes of transmit requests dropped", dev->name,
+		     dropped - queue->dropped_logged);
+		queue->dropped_logged = dropped;
+	}
+}
+
+// Write the queued requests as much as the pipe takes without blocking so that the data keeps being read.
+static bool write_requests(struct request_queue_s *queue, int fd_req)
+{
+	while (queue->written < queue->buf.num) {
+		fd_set writefds;
+		FD_ZERO(&writefds);
+		FD_SET(fd_req, &writefds);
+		struct timeval timeout = {0};
+		if (select(fd_req + 1, NULL, &writefds, NULL, &timeout) <= 0)
+			return true;
+
+		// A writable pipe has room for at least PIPE_BUF bytes.
+		size_t size = queue->buf.num - queue->written;
+		if (size > PIPE_BUF)
+			size = PIPE_BUF;
+		ssize_t written = write(fd_req, queue->buf.array + queue->written, size);
+		if (written <= 0) {
+			blog(LOG_ERROR, "write returns %d.", (int)written);
+			return false;
+		}
+		queue->written += written;
+	}
+	return true;
+}
+
+// A record can be larger than PIPE_BUF so that it may arrive in pieces.
+static ssize_t read_full(int fd, void *data, size_t size)
+{
+	size_t done = 0;
+	while (done < size) {
+		ssize_t ret = read(fd, (uint8_t *)data + done, size - done);
+		if (ret <= 0)
+			return done ? (ssize_t)done : ret;
+		done += ret;
+	}
+	return (ssize_t)done;
+}
+
+static void *capdev_proc_thread_main(void *data)
 {
 	os_set_thread_name("h8819");
 	struct capdev_s *dev = data;
 
+	const char *profile_name =
+		profile_store_name(obs_get_profiler_name_store(), "h8819-capdev_thread_main(%s)", dev->name);
+	static const char *read_name = "read";
+	static const char *convert_name = "s24lep_to_fltp";
+	static const char *estimate_timestamp_name = "estimate_timestamp";
+
 	int fd_req = -1, fd_data = -1;
-	dev->pid = thread_start_proc(dev->name, &fd_req, &fd_data);
+	uint64_t start_ns = os_gettime_ns();
+	bool pooled = open_pooled_helper(dev, &fd_req, &fd_data);
+	if (pooled)
+		pool_fill();
+	else
+		dev->pid = thread_start_proc(dev->name, &fd_req, &fd_data);
 	if (dev->pid < 0) {
 		return NULL;
 	}
 
-	struct capdev_proc_request_s req = {0};
+	struct requested_s requested = {0};
+	struct request_queue_s queue = {0};
 
-	while (dev->refcnt > -1) {
-		if (update_channel_mask(&req, dev)) {
-			blog(LOG_INFO, "requesting channel_mask=%" PRIx64, req.channel_mask);
-			ssize_t ret = write(fd_req, &req, sizeof(req));
-			if (ret != sizeof(req)) {
-				blog(LOG_ERROR, "write returns %d.", (int)ret);
-				break;
-			}
-		}
+	while (!os_atomic_load_bool(&dev->exiting)) {
+		if (queue.written == queue.buf.num)
+			take_transmit_requests(dev, &queue);
+		update_channel_mask(&requested, dev, &queue);
+		if (!write_requests(&queue, fd_req))
+			break;
 
-		fd_set readfds;
+		fd_set readfds, writefds;
 		FD_ZERO(&readfds);
 		FD_SET(fd_data, &readfds);
-		struct timeval timeout = {.tv_sec = 0, .tv_usec = 50 * 1000};
-		int ret_select = select(fd_data + 1, &readfds, NULL, NULL, &timeout);
+		FD_ZERO(&writefds);
+		bool queue_left = queue.written < queue.buf.num;
+		if (queue_left)
+			FD_SET(fd_req, &writefds);
+		// Transmit requests are taken at each iteration so that the helper does not run out of samples.
+		int timeout_ms = os_atomic_load_bool(&dev->transmitting) ? 2 : 50;
+		struct timeval timeout = {.tv_sec = 0, .tv_usec = timeout_ms * 1000};
+		int nfds = (fd_data > fd_req ? fd_data : fd_req) + 1;
+		int ret_select = select(nfds, &readfds, queue_left ? &writefds : NULL, NULL, &timeout);
 
 		if (ret_select < 0) {
 			blog(LOG_ERROR, "select returns %d", ret_select);
 			break;
 		}
-		if (ret_select <= 0)
+		if (ret_select <= 0 || !FD_ISSET(fd_data, &readfds))
 			continue;
 
+		profile_start(profile_name);
+
+		profile_start(read_name);
 		struct capdev_proc_header_s header_data;
-		ssize_t ret = read(fd_data, &header_data, sizeof(header_data));
+		ssize_t ret = read_full(fd_data, &header_data, sizeof(header_data));
 		if (ret != sizeof(header_data)) {
+			profile_end(read_name);
+			profile_end(profile_name);
 			blog(LOG_ERROR, "capdev capdev_thread_main: read returns %d.", (int)ret);
 			break;
 		}
 
-		uint8_t buf[1500];
-		float fltp_buf[500];
-		if (header_data.n_data_bytes > (uint32_t)sizeof(buf)) {
+		uint8_t buf[H8819_MAX_PAYLOAD_LEN];
+		float fltp_buf[H8819_N_SAMPLES * (H8819_MAX_CHANNELS + 1)];
+		if (header_data.n_data_bytes > (uint32_t)sizeof(buf) || header_data.n_samples > H8819_N_SAMPLES ||
+		    header_data.n_channels > H8819_MAX_CHANNELS) {
+			profile_end(read_name);
+			profile_end(profile_name);
 			blog(LOG_ERROR, "header_data.n_data_bytes = %u is too large.", header_data.n_data_bytes);
 			break;
 		}
-		ret = read(fd_data, buf, header_data.n_data_bytes);
+		ret = read_full(fd_data, buf, header_data.n_data_bytes);
+		profile_end(read_name);
+		H8819_PROBE3(pipe_read, header_data.n_data_bytes, header_data.channel_mask.w[0],
+			     header_data.n_skipped_packets);
 		if (ret != header_data.n_data_bytes) {
+			profile_end(profile_name);
 			blog(LOG_ERROR, "capdev capdev_thread_main: read returns %d expected %u.", (int)ret,
 			     header_data.n_data_bytes);
 			break;
 		}
 
-		s24lep_to_fltp(fltp_buf, buf, header_data.n_data_bytes / 3);
+		const int stream = capdev_get_stream(dev, header_data.stream_key);
+		if (stream < 0) {
+			profile_end(profile_name);
+			continue;
+		}
+		struct capdev_stream_s *st = dev->streams + stream;
+
+		const int n_channels = h8819_chmask_count_below(&header_data.channel_mask, header_data.n_channels);
+		const int n_samples = header_data.n_samples;
+		const int n_packets = (int)(header_data.n_packets + header_data.n_skipped_packets);
+		// The packets lost while no channel was requested are counted but not played as a gap.
+		const int n_gap_packets = (int)(header_data.n_skipped_packets - header_data.n_muted_skipped_packets);
+		const bool preroll = header_data.flags & CAPDEV_HEADER_FLAG_PREROLL;
+
+		profile_start(estimate_timestamp_name);
+		int64_t timestamp =
+			preroll ? capdev_replay_timestamp(dev, stream, header_data.timestamp)
+				: capdev_estimate_timestamp(dev, stream, header_data.timestamp, n_samples, n_packets);
+		profile_end(estimate_timestamp_name);
+
+		if (n_channels && n_channels * n_samples * 3 == (int)header_data.n_data_bytes && st->tsest.converged) {
+			profile_start(convert_name);
+			H8819_PROBE3(convert_start, header_data.channel_mask.w[0], n_channels,
+				     header_data.n_data_bytes);
+			h8819_s24lep_to_fltp(fltp_buf, buf, header_data.n_data_bytes / 3);
+			H8819_PROBE3(convert_done, header_data.channel_mask.w[0], n_channels,
+				     header_data.n_data_bytes);
+			profile_end(convert_name);
+
+			float *fltp_all[H8819_MAX_CHANNELS];
+			float *ptr = fltp_buf;
+			for (int i = 0; i < H8819_MAX_CHANNELS; i++) {
+				if (i < header_data.n_channels && h8819_chmask_test(&header_data.channel_mask, i)) {
+					fltp_all[i] = ptr;
+					ptr += n_samples;
+				}
+				else
+					fltp_all[i] = NULL;
+			}
 
-		const int n_channels = countones_uint64(header_data.channel_mask);
-		// TODO: 12 is the expected number of samples.
-		const int n_samples = n_channels ? header_data.n_data_bytes / 3 / n_channels : 12;
+			// send muted audio if the data is unavailable
+			for (int i = 0; i < n_samples; i++)
+				ptr[i] = 0.0f;
 
-		float *fltp_all[N_CHANNELS];
-		float *ptr = fltp_buf;
-		for (int i = 0; i < N_CHANNELS; i++) {
-			if (header_data.channel_mask & (1LL << i)) {
-				fltp_all[i] = ptr;
-				ptr += n_samples;
-			}
+			if (preroll)
+				capdev_deliver_preroll(dev, stream, fltp_all, ptr, n_samples, timestamp);
 			else
-				fltp_all[i] = NULL;
+				capdev_deliver_audio(dev, stream, fltp_all, ptr, n_samples, timestamp, n_gap_packets);
 		}
 
-		// send muted audio if the data is unavailable
-		for (int i = 0; i < n_samples; i++)
-			ptr[i] = 0.0f;
-
-		int64_t timestamp = estimate_timestamp(dev, &header_data, n_samples);
-
-		if (dev->packets_received >= N_IGNORE_FIRST_PACKET) {
-			pthread_mutex_lock(&dev->mutex);
-			if (header_data.n_skipped_packets)
-				capdev_send_blank_audio_to_all_unlocked(dev, header_data.n_skipped_packets * n_samples,
-									timestamp);
-
-			for (struct source_list_s *item = dev->sources; item; item = item->next) {
-				float *fltp[N_CHANNELS];
-				for (uint32_t i = 0; i < item->n_channels; i++) {
-					float *p = fltp_all[item->channels[i]];
-					fltp[i] = p ? p : ptr;
-				}
-
-				source_add_audio(item->src, fltp, n_samples, timestamp);
-			}
-			pthread_mutex_unlock(&dev->mutex);
+		if (preroll) {
+			profile_end(profile_name);
+			continue;
 		}
 
-		dev->packets_received++;
-		dev->packets_missed += header_data.n_skipped_packets;
-		if (dev->packets_received % 65536 == 0 && dev->packets_missed != dev->packets_missed_llog) {
-			blog(LOG_INFO, "h8819[%s] current status: %d packets received, %d packets dropped", dev->name,
-			     dev->packets_received, dev->packets_missed);
-			dev->packets_missed_llog = dev->packets_missed;
+		if (dev->packets_received == 0) {
+			uint64_t first_ns = os_gettime_ns() - start_ns;
+			H8819_PROBE2(first_packet, first_ns, pooled);
+			blog(LOG_INFO, "h8819[%s]: first packet arrived %.1f ms after starting %s helper", dev->name,
+			     first_ns * 1e-6, pooled ? "a pooled" : "a new");
 		}
+
+		st->packets_received += (int)header_data.n_packets;
+		capdev_count_packets(dev, (int)header_data.n_packets, (int)header_data.n_skipped_packets);
+
+		profile_end(profile_name);
 	}
 
 	blog(LOG_INFO, "exiting h8819 thread");
 
-	if (fd_req >= 0) {
-		req.flags |= CAPDEV_REQ_FLAG_EXIT;
+	// Closing the pipe in the middle of a request also makes the helper exit.
+	if (fd_req >= 0 && queue.written == queue.buf.num) {
+		struct capdev_proc_request_s req = {.flags = CAPDEV_REQ_FLAG_EXIT};
 		ssize_t ret = write(fd_req, &req, sizeof(req));
 		if (ret != sizeof(req)) {
 			blog(LOG_ERROR, "write returns %zd.", ret);
@@ -293,16 +726,79 @@ void *capdev_thread_main(void *data)
 
 	close(fd_req);
 	close(fd_data);
+	da_free(queue.buf);
 
-	int retval;
-	waitpid(dev->pid, &retval, 0);
-	blog(retval ? LOG_ERROR : LOG_INFO, "exit h8819 proc %d", retval);
+	helper_wait(dev->pid);
 	blog(dev->packets_missed ? LOG_ERROR : LOG_INFO, "h8819[%s]: %d packets received, %d packets dropped",
 	     dev->name, dev->packets_received, dev->packets_missed);
 
 	return NULL;
 }
 
+const struct capdev_backend_s capdev_backend_proc = {
+	.id = "proc",
+	.thread_main = capdev_proc_thread_main,
+};
+
+// Limit of the requests waiting for the capture thread, about 1 second of 64 channels
+#define TRANSMIT_PENDING_MAX (1024 * 1024)
+
+bool capdev_transmit(capdev_t *dev, int n_frame_channels, int first_channel, const float *const *data, int n_channels,
+		     uint32_t n_samples)
+{
+	if (dev->backend != &capdev_backend_proc)
+		return false;
+	if (n_frame_channels <= 0 || n_frame_channels > H8819_MAX_CHANNELS || first_channel < 0 || n_channels <= 0 ||
+	    first_channel + n_channels > n_frame_channels)
+		return false;
+
+	pthread_mutex_lock(&dev->transmit_mutex);
+	for (uint32_t offset = 0; offset < n_samples; offset += CAPDEV_PROC_TRANSMIT_MAX_SAMPLES) {
+		uint32_t n = n_samples - offset;
+		if (n > CAPDEV_PROC_TRANSMIT_MAX_SAMPLES)
+			n = CAPDEV_PROC_TRANSMIT_MAX_SAMPLES;
+
+		struct capdev_proc_transmit_s rt = {
+			.n_frame_channels = (uint16_t)n_frame_channels,
+			.first_channel = (uint16_t)first_channel,
+			.n_channels = (uint16_t)n_channels,
+			.n_samples = (uint16_t)n,
+		};
+		struct capdev_proc_request_s req = {
+			.flags = CAPDEV_REQ_FLAG_TRANSMIT,
+			.n_extra_bytes = (uint32_t)(sizeof(rt) + sizeof(float) * n_channels * n),
+		};
+		if (dev->transmit_pending.num + sizeof(req) + req.n_extra_bytes > TRANSMIT_PENDING_MAX) {
+			dev->transmit_dropped += sizeof(req) + req.n_extra_bytes;
+			continue;
+		}
+
+		da_push_back_array(dev->transmit_pending, (const uint8_t *)&req, sizeof(req));
+		da_push_back_array(dev->transmit_pending, (const uint8_t *)&rt, sizeof(rt));
+		for (int i = 0; i < n_channels; i++) {
+			const uint8_t *samples = (const uint8_t *)(data[i] + offset);
+			da_push_back_array(dev->transmit_pending, samples, sizeof(float) * n);
+		}
+	}
+	pthread_mutex_unlock(&dev->transmit_mutex);
+
+	os_atomic_set_bool(&dev->transmitting, true);
+	return true;
+}
+
+void capdev_transmit_stop(capdev_t *dev)
+{
+	if (dev->backend != &capdev_backend_proc)
+		return;
+
+	struct capdev_proc_request_s req = {.flags = CAPDEV_REQ_FLAG_TRANSMIT};
+	pthread_mutex_lock(&dev->transmit_mutex);
+	da_push_back_array(dev->transmit_pending, (const uint8_t *)&req, sizeof(req));
+	pthread_mutex_unlock(&dev->transmit_mutex);
+
+	os_atomic_set_bool(&dev->transmitting, false);
+}
+
 void capdev_enum_devices(void (*cb)(const char *name, const char *description, void *param), void *param)
 {
 	int fd_data;
@@ -330,7 +826,6 @@ void capdev_enum_devices(void (*cb)(const char *name, const char *description, v
 
 	close(fd_data);
 
-	blog(LOG_INFO, "Available devices:");
 	for (size_t offset = 0; offset < da.num;) {
 		const char delim[] = {LIST_DELIM};
 		size_t d1 = da_find(da, delim, offset);
@@ -361,7 +856,7 @@ void capdev_enum_devices(void (*cb)(const char *name, const char *description, v
 			unlist = true;
 #endif
 
-		blog(LOG_INFO, " '%s' '%s'%s", name, description, unlist ? " unlisted" : "");
+		blog(LOG_DEBUG, " '%s' '%s'%s", name, description, unlist ? " unlisted" : "");
 		if (!unlist)
 			cb(name, description, param);
 
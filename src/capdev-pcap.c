@@ -0,0 +1,188 @@
+#include <inttypes.h>
+#include <pcap.h>
+#ifndef OS_WINDOWS
+#include <poll.h>
+#endif
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include "plugin-macros.generated.h"
+#include "source.h"
+#include "capdev.h"
+#include "capdev-internal.h"
+#include "probes.h"
+
+/*
+ * In-process capture backend
+ *
+ * Packets are captured by libpcap on the capture thread of the device and converted directly to float.
+ * This is the only backend on Windows.
+ * On Linux, OBS itself needs CAP_NET_RAW to use this backend.
+ */
+
+static pcap_t *initialize_pcap(struct capdev_s *dev)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	pcap_t *p = pcap_create(dev->name, errbuf);
+	if (!p) {
+		blog(LOG_ERROR, "pcap_create: %s", errbuf);
+		return NULL;
+	}
+
+	pcap_set_timeout(p, 44 /*[ms]*/);
+	pcap_set_buffer_size(p, 4 * 256 * 1024);
+
+	int ret = pcap_activate(p);
+	if (ret) {
+		blog(LOG_WARNING, "pcap_activate: %s", pcap_geterr(p));
+#ifndef OS_WINDOWS
+		if (ret < 0) {
+			pcap_close(p);
+			return NULL;
+		}
+#endif
+	}
+
+	struct bpf_program fp = {0};
+	ret = pcap_compile(p, &fp, "ether proto 0x8819", 1, PCAP_NETMASK_UNKNOWN);
+	if (ret) {
+		blog(LOG_WARNING, "pcap_compile: %s", pcap_geterr(p));
+	}
+	else {
+		ret = pcap_setfilter(p, &fp);
+		if (ret)
+			blog(LOG_ERROR, "pcap_setfilter: %s", pcap_geterr(p));
+		pcap_freecode(&fp);
+	}
+
+	return p;
+}
+
+static int64_t ts_pcap_to_obs(const struct pcap_pkthdr *pktheader)
+{
+	return pktheader->ts.tv_sec * 1000000000LL + pktheader->ts.tv_usec * 1000LL;
+}
+
+static void got_msg(const uint8_t *data_packet, const struct pcap_pkthdr *pktheader, struct capdev_s *dev)
+{
+	static const char *profile_name = "got_msg";
+	static const char *convert_name = "convert_to_fltp";
+	static const char *estimate_timestamp_name = "estimate_timestamp";
+
+	uint64_t key = h8819_stream_key(data_packet, pktheader->caplen);
+	int stream = key ? capdev_get_stream(dev, key) : -1;
+	if (stream < 0)
+		return;
+	struct capdev_stream_s *st = dev->streams + stream;
+
+	struct h8819_frame_s frame;
+	int ret = h8819_stream_feed(&st->stream, &frame, data_packet, pktheader->caplen, ts_pcap_to_obs(pktheader));
+	if (ret == H8819_ERROR_TRAILER) {
+		blog(LOG_ERROR, "Ending word failed: %02X %02X\n", (int)data_packet[pktheader->caplen - 2],
+		     (int)data_packet[pktheader->caplen - 1]);
+		return;
+	}
+	if (ret < 0)
+		return;
+
+	struct h8819_chmask_s channel_mask = st->channel_mask;
+	int n_channels = h8819_chmask_count_below(&channel_mask, (int)frame.n_channels);
+
+	profile_start(profile_name);
+
+	if (ret & H8819_EVENT_GAP) {
+		blog(LOG_ERROR, "missing packets: counter is %d expected %d\n", (int)frame.header->l2_counter,
+		     (int)frame.counter_expected);
+	}
+
+	const int n_samples = (int)frame.n_samples;
+
+	profile_start(estimate_timestamp_name);
+	int64_t timestamp =
+		capdev_estimate_timestamp(dev, stream, frame.timestamp, n_samples, 1 + (int)frame.n_skipped_packets);
+	profile_end(estimate_timestamp_name);
+
+	if (n_channels && st->tsest.converged) {
+		float fltp_buf[H8819_N_SAMPLES * (N_CHANNELS + 1)];
+		float *fltp_all[N_CHANNELS];
+		profile_start(convert_name);
+		H8819_PROBE3(convert_start, channel_mask.w[0], n_channels, n_channels * n_samples * 3);
+		h8819_convert_to_fltp(fltp_all, fltp_buf, &frame, &channel_mask);
+		H8819_PROBE3(convert_done, channel_mask.w[0], n_channels, n_channels * n_samples * 3);
+		profile_end(convert_name);
+
+		capdev_deliver_audio(dev, stream, fltp_all, fltp_buf, n_samples, timestamp,
+				     (int)frame.n_skipped_packets);
+	}
+
+	st->packets_received++;
+	capdev_count_packets(dev, 1, (int)frame.n_skipped_packets);
+
+	profile_end(profile_name);
+}
+
+static void *capdev_pcap_thread_main(void *data)
+{
+	os_set_thread_name("h8819");
+	struct capdev_s *dev = data;
+
+	const char *profile_name =
+		profile_store_name(obs_get_profiler_name_store(), "h8819-capdev_thread_main(%s)", dev->name);
+	static const char *pcap_next_ex_name = "pcap_next_ex";
+
+	pcap_t *p = initialize_pcap(dev);
+	if (!p) {
+		blog(LOG_ERROR, "capdev_thread_main: Failed to initialize pcap device '%s'", dev->name);
+		return NULL;
+	}
+
+#ifdef OS_WINDOWS
+	HANDLE hPCap = pcap_getevent(p);
+#else
+	struct pollfd fds = {.fd = pcap_get_selectable_fd(p), .events = POLLIN};
+	if (fds.fd < 0) {
+		blog(LOG_ERROR, "capdev_thread_main: No selectable descriptor for '%s'", dev->name);
+		pcap_close(p);
+		return NULL;
+	}
+#endif
+
+	while (!os_atomic_load_bool(&dev->exiting)) {
+
+#ifdef OS_WINDOWS
+		DWORD retWait = WaitForSingleObject(hPCap, 70 /* ms */);
+		bool readable = retWait == WAIT_OBJECT_0;
+#else
+		bool readable = poll(&fds, 1, 70 /* ms */) > 0 && fds.revents & POLLIN;
+#endif
+
+		if (readable) {
+			struct pcap_pkthdr *header;
+			const uint8_t *payload;
+			profile_start(profile_name);
+
+			profile_start(pcap_next_ex_name);
+			int retNext = pcap_next_ex(p, &header, &payload);
+			profile_end(pcap_next_ex_name);
+
+			if (retNext == 1)
+				got_msg(payload, header, dev);
+			profile_end(profile_name);
+		}
+	}
+
+	blog(LOG_INFO, "exiting h8819 thread");
+
+	pcap_close(p);
+
+	blog(dev->packets_missed ? LOG_ERROR : LOG_INFO, "h8819[%s]: %d packets received, %d packets dropped",
+	     dev->name, dev->packets_received, dev->packets_missed);
+
+	return NULL;
+}
+
+const struct capdev_backend_s capdev_backend_pcap = {
+	.id = "pcap",
+	.thread_main = capdev_pcap_thread_main,
+};
@@ -0,0 +1,106 @@
+#include "capdev-proc-filter.h"
+
+#define ETHERTYPE_REAC 0x8819
+// Length of a pair of channels in a frame
+#define CHANNEL_PAIR_LEN (H8819_N_SAMPLES * 3 * 2)
+#define MIN_FRAME_LEN (H8819_L2_HEADER_LEN + CHANNEL_PAIR_LEN + H8819_TRAILER_LEN)
+
+// Jump target resolved to the final `ret #0` once the length of the program is known
+#define REJECT 0xFF
+
+struct builder_s
+{
+	struct bpf_insn *insns;
+	int n;
+};
+
+static void emit(struct builder_s *b, uint16_t code, uint8_t jt, uint8_t jf, uint32_t k)
+{
+	b->insns[b->n++] = (struct bpf_insn){.code = code, .jt = jt, .jf = jf, .k = k};
+}
+
+static void emit_header(struct builder_s *b)
+{
+	emit(b, BPF_LD | BPF_H | BPF_ABS, 0, 0, 12);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, ETHERTYPE_REAC);
+	emit(b, BPF_LD | BPF_W | BPF_ABS, 0, 0, 0);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, 0xFFFFFFFF);
+	emit(b, BPF_LD | BPF_H | BPF_ABS, 0, 0, 4);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, 0xFFFF);
+}
+
+// Any number of channel pairs up to `H8819_MAX_CHANNELS` with the trailer at the end of the frame
+static void emit_geometry(struct builder_s *b)
+{
+	emit(b, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+	emit(b, BPF_JMP | BPF_JGT | BPF_K, REJECT, 0, H8819_MAX_FRAME_LEN);
+	emit(b, BPF_JMP | BPF_JGE | BPF_K, 0, REJECT, MIN_FRAME_LEN);
+	emit(b, BPF_ALU | BPF_SUB | BPF_K, 0, 0, H8819_L2_HEADER_LEN + H8819_TRAILER_LEN);
+	emit(b, BPF_MISC | BPF_TAX, 0, 0, 0);
+	// Division and multiplication instead of BPF_MOD, which not every kernel has.
+	emit(b, BPF_ALU | BPF_DIV | BPF_K, 0, 0, CHANNEL_PAIR_LEN);
+	emit(b, BPF_ALU | BPF_MUL | BPF_K, 0, 0, CHANNEL_PAIR_LEN);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_X, 0, REJECT, 0);
+
+	emit(b, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+	emit(b, BPF_ALU | BPF_SUB | BPF_K, 0, 0, H8819_TRAILER_LEN);
+	emit(b, BPF_MISC | BPF_TAX, 0, 0, 0);
+	emit(b, BPF_LD | BPF_B | BPF_IND, 0, 0, 0);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, 0xC2);
+	emit(b, BPF_LD | BPF_B | BPF_IND, 0, 0, 1);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, 0xEA);
+	emit(b, BPF_RET | BPF_K, 0, 0, H8819_MAX_FRAME_LEN);
+}
+
+// The offsets are constant since the length is known. A mismatch goes to the next stream, and then to the geometry.
+static void emit_stream(struct builder_s *b, const struct proc_filter_stream_s *s)
+{
+	emit(b, BPF_LD | BPF_W | BPF_ABS, 0, 0, 6);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 9, (uint32_t)(s->key >> 16));
+	emit(b, BPF_LD | BPF_H | BPF_ABS, 0, 0, 10);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 7, (uint32_t)(s->key & 0xFFFF));
+	emit(b, BPF_LD | BPF_W | BPF_LEN, 0, 0, 0);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 5, s->frame_len);
+	emit(b, BPF_LD | BPF_B | BPF_ABS, 0, 0, s->frame_len - 2);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 3, 0xC2);
+	emit(b, BPF_LD | BPF_B | BPF_ABS, 0, 0, s->frame_len - 1);
+	emit(b, BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0xEA);
+	emit(b, BPF_RET | BPF_K, 0, 0, s->frame_len);
+}
+
+static int finish(struct builder_s *b)
+{
+	emit(b, BPF_RET | BPF_K, 0, 0, 0);
+
+	for (int i = 0; i < b->n; i++) {
+		struct bpf_insn *p = b->insns + i;
+		if (BPF_CLASS(p->code) != BPF_JMP)
+			continue;
+		if (p->jt == REJECT)
+			p->jt = (uint8_t)(b->n - 1 - (i + 1));
+		if (p->jf == REJECT)
+			p->jf = (uint8_t)(b->n - 1 - (i + 1));
+	}
+	return b->n;
+}
+
+int proc_filter_build(struct bpf_insn *insns, const struct proc_filter_stream_s *streams, int n_streams)
+{
+	struct builder_s b = {.insns = insns};
+
+	emit_header(&b);
+	for (int i = 0; i < n_streams && i < H8819_MAX_STREAMS; i++)
+		emit_stream(&b, streams + i);
+	emit_geometry(&b);
+	return finish(&b);
+}
+
+int proc_filter_build_any(struct bpf_insn *insns)
+{
+	struct builder_s b = {.insns = insns};
+
+	emit(&b, BPF_LD | BPF_H | BPF_ABS, 0, 0, 12);
+	emit(&b, BPF_JMP | BPF_JEQ | BPF_K, 0, REJECT, ETHERTYPE_REAC);
+	emit(&b, BPF_RET | BPF_K, 0, 0, H8819_MAX_FRAME_LEN);
+	return finish(&b);
+}
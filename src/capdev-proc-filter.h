@@ -0,0 +1,32 @@
+#pragma once
+
+#include <stdint.h>
+#include <pcap/bpf.h>
+#include "h8819.h"
+
+/*
+ * Classic BPF programs for the libpcap capture of obs-h8819-proc
+ *
+ * The program runs in the kernel and checks the EtherType, the broadcast destination, the trailer,
+ * and a frame length that fits the geometry of REAC, so that other frames never wake up the helper.
+ * Frames of the pinned streams are checked first against their exact length with constant offsets,
+ * and the filter returns that length as the snapshot length.
+ * Frames from any other source, and of a pinned stream whose length has changed, take the check of the geometry
+ * so that new streams are still found.
+ */
+
+// Header checks, the check of each stream, the check of the geometry, and the final reject
+#define PROC_FILTER_MAX_INSNS (6 + 11 * H8819_MAX_STREAMS + 16 + 1)
+
+struct proc_filter_stream_s
+{
+	uint64_t key; // given by `h8819_stream_key`
+	uint32_t frame_len;
+};
+
+/* Writes a program into `insns`, which has `PROC_FILTER_MAX_INSNS` entries, and returns the number of instructions.
+ * `streams` may be NULL if `n_streams` is 0. */
+int proc_filter_build(struct bpf_insn *insns, const struct proc_filter_stream_s *streams, int n_streams);
+
+/* Same as `proc_filter_build` but checks only the EtherType, for the flight recorder to keep malformed frames. */
+int proc_filter_build_any(struct bpf_insn *insns);
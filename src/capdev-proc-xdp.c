@@ -0,0 +1,336 @@
+#define _GNU_SOURCE // readlink
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/ethtool.h>
+#include <linux/if_link.h>
+#include <linux/sockios.h>
+#include <linux/if_xdp.h>
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+#include <xdp/libxdp.h>
+#include <xdp/xsk.h>
+#include "h8819.h"
+#include "capdev-proc-xdp.h"
+
+// Frames of all the queues. Each queue has at least `MIN_QUEUE_FRAMES`.
+#define NUM_FRAMES 4096
+#define MIN_QUEUE_FRAMES 1024
+#define FRAME_SIZE XSK_UMEM__DEFAULT_FRAME_SIZE
+#define RX_BATCH_SIZE 64
+// Same as `max_entries` of `xsks_map`
+#define MAX_QUEUES 64
+
+// One socket with its own UMEM for each receive queue of the interface
+struct xdp_queue_s
+{
+	uint32_t queue_id;
+	uint32_t n_frames;
+	void *buffer;
+	struct xsk_umem *umem;
+	struct xsk_ring_prod fq;
+	struct xsk_ring_cons cq;
+
+	struct xsk_socket *xsk;
+	struct xsk_ring_cons rx;
+};
+
+struct xdp_capture_s
+{
+	struct xdp_queue_s *queues;
+	uint32_t n_queues;
+	int epoll_fd; // readable when any of the sockets is
+
+	struct xdp_program *prog;
+	enum xdp_attach_mode mode;
+	int ifindex;
+};
+
+static char *find_xdp_obj()
+{
+	const char *env = getenv("OBS_H8819_XDP_OBJ");
+	if (env && *env)
+		return strdup(env);
+
+	// The object is installed next to the executable.
+	char path[4096];
+	ssize_t len = readlink("/proc/self/exe", path, sizeof(path) - sizeof(XDP_OBJ_NAME) - 1);
+	if (len <= 0)
+		return NULL;
+	path[len] = '\0';
+	char *slash = strrchr(path, '/');
+	if (!slash)
+		return NULL;
+	strcpy(slash + 1, XDP_OBJ_NAME);
+	return strdup(path);
+}
+
+static bool attach_program(struct xdp_capture_s *xc, bool generic)
+{
+	char *path = find_xdp_obj();
+	if (!path) {
+		fprintf(stderr, "Error: cannot locate %s\n", XDP_OBJ_NAME);
+		return false;
+	}
+
+	xc->prog = xdp_program__open_file(path, "xdp", NULL);
+	long err = libxdp_get_error(xc->prog);
+	if (err) {
+		fprintf(stderr, "Error: failed to open '%s': %s\n", path, strerror((int)-err));
+		xc->prog = NULL;
+		free(path);
+		return false;
+	}
+	free(path);
+
+	xc->mode = generic ? XDP_MODE_SKB : XDP_MODE_NATIVE;
+	int ret = xdp_program__attach(xc->prog, xc->ifindex, xc->mode, 0);
+	if (ret && !generic) {
+		// The driver does not support XDP. The generic mode still skips libpcap.
+		xc->mode = XDP_MODE_SKB;
+		ret = xdp_program__attach(xc->prog, xc->ifindex, xc->mode, 0);
+	}
+	if (ret) {
+		fprintf(stderr, "Error: failed to attach the XDP program: %s\n", strerror(-ret));
+		xdp_program__close(xc->prog);
+		xc->prog = NULL;
+		return false;
+	}
+
+	return true;
+}
+
+// Number of the receive queues. The NIC spreads frames over them, REAC frames included.
+static uint32_t count_rx_queues(const char *if_name)
+{
+	struct ethtool_channels ch = {.cmd = ETHTOOL_GCHANNELS};
+	struct ifreq ifr = {.ifr_data = (void *)&ch};
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", if_name);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	int ret = fd >= 0 ? ioctl(fd, SIOCETHTOOL, &ifr) : -1;
+	if (fd >= 0)
+		close(fd);
+	if (ret < 0) {
+		// The driver does not report its channels, which is usual for a single queue.
+		return 1;
+	}
+
+	uint32_t n = ch.combined_count + ch.rx_count;
+	if (n > MAX_QUEUES) {
+		fprintf(stderr, "Warning: '%s' has %u receive queues, frames on the queues from %d are not captured\n",
+			if_name, n, MAX_QUEUES);
+		n = MAX_QUEUES;
+	}
+	return n ? n : 1;
+}
+
+static bool create_umem(struct xdp_queue_s *q)
+{
+	size_t size = (size_t)q->n_frames * FRAME_SIZE;
+	q->buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (q->buffer == MAP_FAILED) {
+		q->buffer = NULL;
+		fprintf(stderr, "Error: failed to allocate UMEM\n");
+		return false;
+	}
+
+	struct xsk_umem_config cfg = {
+		.fill_size = q->n_frames,
+		.comp_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+		.frame_size = FRAME_SIZE,
+		.frame_headroom = XSK_UMEM__DEFAULT_FRAME_HEADROOM,
+	};
+	int ret = xsk_umem__create(&q->umem, q->buffer, size, &q->fq, &q->cq, &cfg);
+	if (ret) {
+		fprintf(stderr, "Error: xsk_umem__create: %s\n", strerror(-ret));
+		q->umem = NULL;
+		return false;
+	}
+
+	uint32_t idx;
+	if (xsk_ring_prod__reserve(&q->fq, q->n_frames, &idx) != q->n_frames) {
+		fprintf(stderr, "Error: failed to populate the fill ring\n");
+		return false;
+	}
+	for (uint32_t i = 0; i < q->n_frames; i++)
+		*xsk_ring_prod__fill_addr(&q->fq, idx++) = (uint64_t)i * FRAME_SIZE;
+	xsk_ring_prod__submit(&q->fq, q->n_frames);
+
+	return true;
+}
+
+static bool create_socket(struct xdp_capture_s *xc, struct xdp_queue_s *q, const char *if_name)
+{
+	struct xsk_socket_config cfg = {
+		.rx_size = XSK_RING_CONS__DEFAULT_NUM_DESCS,
+		.tx_size = 0,
+		.libxdp_flags = XSK_LIBXDP_FLAGS__INHIBIT_PROG_LOAD,
+		.bind_flags = XDP_USE_NEED_WAKEUP,
+	};
+
+	int ret = -EINVAL;
+	if (xc->mode == XDP_MODE_NATIVE) {
+		cfg.bind_flags |= XDP_ZEROCOPY;
+		ret = xsk_socket__create(&q->xsk, if_name, q->queue_id, q->umem, &q->rx, NULL, &cfg);
+		cfg.bind_flags &= ~XDP_ZEROCOPY;
+	}
+	if (ret) {
+		cfg.bind_flags |= XDP_COPY;
+		ret = xsk_socket__create(&q->xsk, if_name, q->queue_id, q->umem, &q->rx, NULL, &cfg);
+	}
+	if (ret) {
+		fprintf(stderr, "Error: xsk_socket__create on queue %u: %s\n", q->queue_id, strerror(-ret));
+		q->xsk = NULL;
+		return false;
+	}
+
+	int map_fd = bpf_object__find_map_fd_by_name(xdp_program__bpf_obj(xc->prog), "xsks_map");
+	if (map_fd < 0 || xsk_socket__update_xskmap(q->xsk, map_fd)) {
+		fprintf(stderr, "Error: failed to register the socket to xsks_map\n");
+		return false;
+	}
+
+	struct epoll_event ev = {.events = EPOLLIN, .data.ptr = q};
+	if (epoll_ctl(xc->epoll_fd, EPOLL_CTL_ADD, xsk_socket__fd(q->xsk), &ev) < 0) {
+		fprintf(stderr, "Error: epoll_ctl: %s\n", strerror(errno));
+		return false;
+	}
+
+	fprintf(stderr, "Info: AF_XDP on '%s' queue %u in %s mode, %s\n", if_name, q->queue_id,
+		xc->mode == XDP_MODE_NATIVE ? "native" : "generic", cfg.bind_flags & XDP_COPY ? "copy" : "zero-copy");
+	return true;
+}
+
+struct xdp_capture_s *xdp_capture_open(const char *if_name, bool generic)
+{
+	struct xdp_capture_s *xc = calloc(1, sizeof(struct xdp_capture_s));
+	if (!xc)
+		return NULL;
+	xc->epoll_fd = -1;
+
+	xc->ifindex = (int)if_nametoindex(if_name);
+	if (!xc->ifindex) {
+		fprintf(stderr, "Error: unknown interface '%s'\n", if_name);
+		goto fail;
+	}
+
+	xc->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (xc->epoll_fd < 0) {
+		fprintf(stderr, "Error: epoll_create1: %s\n", strerror(errno));
+		goto fail;
+	}
+
+	uint32_t n_queues = count_rx_queues(if_name);
+	uint32_t n_frames = NUM_FRAMES / n_queues;
+	if (n_frames < MIN_QUEUE_FRAMES)
+		n_frames = MIN_QUEUE_FRAMES;
+	xc->queues = calloc(n_queues, sizeof(struct xdp_queue_s));
+	if (!xc->queues)
+		goto fail;
+
+	if (!attach_program(xc, generic))
+		goto fail;
+	for (uint32_t i = 0; i < n_queues; i++) {
+		struct xdp_queue_s *q = xc->queues + xc->n_queues++;
+		q->queue_id = i;
+		q->n_frames = n_frames;
+		if (!create_umem(q) || !create_socket(xc, q, if_name))
+			goto fail;
+	}
+
+	return xc;
+
+fail:
+	xdp_capture_close(xc);
+	return NULL;
+}
+
+void xdp_capture_close(struct xdp_capture_s *xc)
+{
+	if (!xc)
+		return;
+
+	for (uint32_t i = 0; i < xc->n_queues; i++) {
+		struct xdp_queue_s *q = xc->queues + i;
+		if (q->xsk)
+			xsk_socket__delete(q->xsk);
+		if (q->umem)
+			xsk_umem__delete(q->umem);
+		if (q->buffer)
+			munmap(q->buffer, (size_t)q->n_frames * FRAME_SIZE);
+	}
+	free(xc->queues);
+	if (xc->epoll_fd >= 0)
+		close(xc->epoll_fd);
+	if (xc->prog) {
+		xdp_program__detach(xc->prog, xc->ifindex, xc->mode, 0);
+		xdp_program__close(xc->prog);
+	}
+
+	free(xc);
+}
+
+int xdp_capture_get_fd(const struct xdp_capture_s *xc)
+{
+	return xc->epoll_fd;
+}
+
+static int64_t gettime_realtime_ns()
+{
+	// Same clock as the timestamp given by libpcap.
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static int receive_queue(struct xdp_queue_s *q, xdp_capture_cb cb, void *param)
+{
+	uint32_t idx_rx = 0;
+	uint32_t n = xsk_ring_cons__peek(&q->rx, RX_BATCH_SIZE, &idx_rx);
+	if (!n) {
+		if (xsk_ring_prod__needs_wakeup(&q->fq))
+			recvfrom(xsk_socket__fd(q->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+		return 0;
+	}
+
+	// AF_XDP does not provide the receive time.
+	// Frames in a batch have queued at the packet rate, so date them back from the latest one.
+	const int64_t interval = h8819_sample_time(H8819_N_SAMPLES);
+	int64_t timestamp = gettime_realtime_ns() - interval * (n - 1);
+
+	uint32_t idx_fq = 0;
+	while (xsk_ring_prod__reserve(&q->fq, n, &idx_fq) != n) {
+		if (xsk_ring_prod__needs_wakeup(&q->fq))
+			recvfrom(xsk_socket__fd(q->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+	}
+
+	for (uint32_t i = 0; i < n; i++) {
+		const struct xdp_desc *desc = xsk_ring_cons__rx_desc(&q->rx, idx_rx++);
+		uint64_t addr = xsk_umem__add_offset_to_addr(desc->addr);
+		cb(xsk_umem__get_data(q->buffer, addr), desc->len, timestamp, param);
+		timestamp += interval;
+		*xsk_ring_prod__fill_addr(&q->fq, idx_fq++) = xsk_umem__extract_addr(desc->addr);
+	}
+
+	xsk_ring_prod__submit(&q->fq, n);
+	xsk_ring_cons__release(&q->rx, n);
+
+	return (int)n;
+}
+
+int xdp_capture_receive(struct xdp_capture_s *xc, xdp_capture_cb cb, void *param)
+{
+	int n = 0;
+	for (uint32_t i = 0; i < xc->n_queues; i++)
+		n += receive_queue(xc->queues + i, cb, param);
+	return n;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * AF_XDP capture for obs-h8819-proc
+ *
+ * An XDP program redirects REAC frames on the interface to a UMEM ring
+ * so that the frames skip the socket layer of the kernel and libpcap.
+ */
+
+#define XDP_OBJ_NAME "xdp-h8819.bpf.o"
+
+struct xdp_capture_s;
+
+typedef void (*xdp_capture_cb)(const uint8_t *data, uint32_t len, int64_t timestamp, void *param);
+
+// Returns NULL if AF_XDP is not available on the interface. The caller should fall back to libpcap.
+// A socket is bound to each receive queue of the interface since the NIC can put REAC frames on any of them.
+// If `generic` is true, the XDP program runs in the generic (SKB) mode, which works on veth.
+struct xdp_capture_s *xdp_capture_open(const char *if_name, bool generic);
+void xdp_capture_close(struct xdp_capture_s *xc);
+
+// Descriptor to wait for frames on any queue by select or poll.
+int xdp_capture_get_fd(const struct xdp_capture_s *xc);
+
+// Calls `cb` for each received frame and returns the number of frames.
+int xdp_capture_receive(struct xdp_capture_s *xc, xdp_capture_cb cb, void *param);
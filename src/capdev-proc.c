@@ -1,112 +1,347 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <inttypes.h>
 #include <stdbool.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #include <pcap.h>
+#include "h8819.h"
 #include "capdev-proc.h"
-#include "common.h"
+#include "capdev-proc-filter.h"
+#include "recorder.h"
+#include "flightrec.h"
+#include "redundant.h"
+#include "rtp.h"
+#ifdef HAVE_TRANSMIT
+#include "transmit.h"
+#endif
+#ifdef HAVE_AF_XDP
+#include "capdev-proc-xdp.h"
+#endif
+#include "probes.h"
 
-#define ETHER_HEADER_LEN (6 * 2 + 2)
-#define L2_HEADER_LEN (ETHER_HEADER_LEN + 2 + 2 + 32)
+// Recent frames of all channels as they are on the wire, converted only when channels are added.
+struct preroll_s
+{
+	uint8_t *payloads; // `CAPDEV_PROC_PREROLL_FRAMES` of `payload_len` bytes
+	int64_t timestamps[CAPDEV_PROC_PREROLL_FRAMES];
+	uint32_t n_channels;
+	uint32_t n_samples;
+	size_t payload_len;
+	int next;
+	int count;
+};
+
+struct stream_s
+{
+	struct h8819_stream_s stream;
+	struct h8819_chmask_s channel_mask;
+	uint32_t n_idle_packets;
+	uint32_t n_idle_skipped_packets;
+	uint32_t n_muted_skipped_packets; // of `n_idle_skipped_packets`, lost while no channel was requested
+	struct preroll_s preroll;
+	uint32_t frame_len; // 0 until the first valid frame
+};
 
-struct packet_header_s
+// Kernel filter installed on the libpcap captures
+struct filter_s
 {
-	uint8_t dhost[6];
-	uint8_t shost[6];
-	uint8_t type[2];
+	bool dirty; // set when the pinned streams may have changed
+	int n_pinned;
+};
 
-	uint16_t l2_counter; // assume LE
-	uint16_t l2_type;
-	uint8_t l2_unkown[32];
+/* Frames waiting to be written to the plugin. Standard output does not block
+ * so that the requests keep being read while the plugin is busy. */
+struct output_s
+{
+	uint8_t *buf;
+	size_t size;    // queued bytes including the written ones
+	size_t written; // bytes at the beginning of `buf`
+	size_t capacity;
+	uint64_t n_dropped; // frames dropped because the plugin did not read
 };
 
+// About 2 seconds of 64 channels, well above the pre-roll
+#define OUTPUT_MAX (4 * 1024 * 1024)
+
 struct context_s
 {
 	struct capdev_proc_request_s req;
-	uint16_t counter_last;
-	bool got_packet;
+	struct h8819_demux_s demux;
+	struct stream_s streams[H8819_MAX_STREAMS];
+	struct recorder_s *recorder;
+	uint64_t record_key;
+	struct flightrec_s *flightrec;
+	struct rtp_s *rtp;
+	uint64_t rtp_key;
+	struct redundant_s *redundant;
+#ifdef HAVE_TRANSMIT
+	struct transmit_s *transmit;
+	int transmit_channels;
+	uint64_t transmit_key;
+	float *transmit_buf;
+#endif
+	struct filter_s filter;
+	struct output_s output;
 	bool cont;
 };
 
-static inline void convert_to_pcm24lep(uint8_t *dptr, const uint8_t *sptr, uint64_t channel_mask)
+// Parameter of the capture callbacks to tell which interface the frame came from
+struct leg_s
 {
-	for (int ch = 0; ch < 40; ch++) {
-		if (!(channel_mask & (1LL << ch)))
-			continue;
+	struct context_s *ctx;
+	int leg;
+};
 
-		const uint8_t *sptr1 = sptr + (ch & ~1) * 3;
-		for (int is = 0; is < 12; is++) {
-			if ((ch & 1) == 0) {
-				*dptr++ = sptr1[3];
-				*dptr++ = sptr1[0];
-				*dptr++ = sptr1[1];
-			}
-			else {
-				*dptr++ = sptr1[4];
-				*dptr++ = sptr1[5];
-				*dptr++ = sptr1[2];
-			}
-			sptr1 += 40 * 3;
+static int64_t ts_pcap_to_obs(const struct pcap_pkthdr *pktheader)
+{
+	return pktheader->ts.tv_sec * 1000000000LL + pktheader->ts.tv_usec * 1000LL;
+}
+
+static int64_t monotonic_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void preroll_push(struct preroll_s *pr, const struct h8819_frame_s *frame)
+{
+	size_t payload_len = (size_t)frame->n_channels * frame->n_samples * 3;
+	if (!pr->payloads || frame->n_channels != pr->n_channels || frame->n_samples != pr->n_samples) {
+		free(pr->payloads);
+		pr->payloads = malloc(payload_len * CAPDEV_PROC_PREROLL_FRAMES);
+		pr->n_channels = frame->n_channels;
+		pr->n_samples = frame->n_samples;
+		pr->payload_len = payload_len;
+		pr->count = 0;
+		if (!pr->payloads)
+			return;
+	}
+
+	// The frames before a gap cannot be played continuously with the frames after it.
+	if (frame->n_skipped_packets)
+		pr->count = 0;
+
+	memcpy(pr->payloads + pr->next * payload_len, frame->payload, payload_len);
+	pr->timestamps[pr->next] = frame->timestamp;
+	pr->next = (pr->next + 1) % CAPDEV_PROC_PREROLL_FRAMES;
+	if (pr->count < CAPDEV_PROC_PREROLL_FRAMES)
+		pr->count++;
+}
+
+// Writes the queued frames as much as the pipe takes.
+static void output_flush(struct context_s *ctx)
+{
+	struct output_s *out = &ctx->output;
+	while (out->written < out->size) {
+		ssize_t written = write(1, out->buf + out->written, out->size - out->written);
+		H8819_PROBE2(pipe_write, out->size - out->written, written);
+		if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+			return;
+		if (written <= 0) {
+			fprintf(stderr, "Failed to write\n");
+			ctx->cont = false;
+			return;
 		}
+		out->written += written;
 	}
+	out->size = out->written = 0;
 }
 
-static int64_t ts_pcap_to_obs(const struct pcap_pkthdr *pktheader)
+// Returns false if the frame is dropped since the plugin has not read the queued frames.
+static bool output_push(struct output_s *out, const void *data, size_t size)
 {
-	return pktheader->ts.tv_sec * 1000000000LL + pktheader->ts.tv_usec * 1000LL;
+	if (out->size - out->written + size > OUTPUT_MAX) {
+		if (out->n_dropped++ % 1000 == 0)
+			fprintf(stderr, "Error: the plugin is not reading, %" PRIu64 " frames dropped\n",
+				out->n_dropped);
+		return false;
+	}
+
+	if (out->written && out->size + size > out->capacity) {
+		memmove(out->buf, out->buf + out->written, out->size - out->written);
+		out->size -= out->written;
+		out->written = 0;
+	}
+	if (out->size + size > out->capacity) {
+		size_t capacity = out->capacity ? out->capacity : 65536;
+		while (capacity < out->size + size)
+			capacity *= 2;
+		uint8_t *buf = realloc(out->buf, capacity);
+		if (!buf)
+			return false;
+		out->buf = buf;
+		out->capacity = capacity;
+	}
+
+	memcpy(out->buf + out->size, data, size);
+	out->size += size;
+	return true;
 }
 
-static void got_msg(const uint8_t *data_packet, const struct pcap_pkthdr *pktheader, struct context_s *ctx)
+static bool output_pending(const struct context_s *ctx)
 {
-	if (pktheader->caplen < sizeof(struct packet_header_s) + 2)
-		return;
-	const struct packet_header_s *packet_header = (const void *)data_packet;
+	return ctx->output.written < ctx->output.size;
+}
+
+static bool write_frame(struct context_s *ctx, struct capdev_proc_header_s *header, const struct h8819_frame_s *frame)
+{
+	uint8_t *pcm24lep = (uint8_t *)header + sizeof(struct capdev_proc_header_s);
 
-	if (packet_header->type[0] != 0x88 || packet_header->type[1] != 0x19) {
+	H8819_PROBE3(convert_start, header->channel_mask.w[0], header->n_data_bytes / 3 / frame->n_samples,
+		     header->n_data_bytes);
+	h8819_convert_to_s24lep(pcm24lep, frame, &header->channel_mask);
+	H8819_PROBE3(convert_done, header->channel_mask.w[0], header->n_data_bytes / 3 / frame->n_samples,
+		     header->n_data_bytes);
+
+	if (!output_push(&ctx->output, header, sizeof(struct capdev_proc_header_s) + header->n_data_bytes))
+		return false;
+	output_flush(ctx);
+	return true;
+}
+
+// Queue the recent frames again with the channels in `channel_mask` before the next frame.
+static void preroll_write(struct context_s *ctx, struct stream_s *st, uint64_t key)
+{
+	struct preroll_s *pr = &st->preroll;
+	int n_channel = h8819_chmask_count_below(&st->channel_mask, (int)pr->n_channels);
+	if (!pr->count || !n_channel)
 		return;
+
+	uint8_t buf[H8819_MAX_PAYLOAD_LEN + sizeof(struct capdev_proc_header_s)];
+	struct capdev_proc_header_s *header = (void *)buf;
+	for (int i = 0; i < pr->count && ctx->cont; i++) {
+		int slot = (pr->next - pr->count + i + CAPDEV_PROC_PREROLL_FRAMES) % CAPDEV_PROC_PREROLL_FRAMES;
+		struct h8819_frame_s frame = {
+			.payload = pr->payloads + slot * pr->payload_len,
+			.timestamp = pr->timestamps[slot],
+			.n_samples = pr->n_samples,
+			.n_channels = pr->n_channels,
+		};
+		*header = (struct capdev_proc_header_s){
+			.channel_mask = st->channel_mask,
+			.stream_key = key,
+			.timestamp = frame.timestamp,
+			.n_data_bytes = frame.n_samples * 3 * n_channel,
+			.n_channels = (uint16_t)frame.n_channels,
+			.n_samples = (uint16_t)frame.n_samples,
+			.flags = CAPDEV_HEADER_FLAG_PREROLL,
+		};
+		write_frame(ctx, header, &frame);
 	}
+}
 
-	// TODO: Check destination is broadcast address.
+static void got_frame(const uint8_t *data_packet, uint32_t caplen, int64_t timestamp, void *param)
+{
+	struct context_s *ctx = param;
+	uint64_t key = h8819_stream_key(data_packet, caplen);
+
+#ifdef HAVE_TRANSMIT
+	// The frames sent by this helper are seen as outgoing frames.
+	if (key && key == ctx->transmit_key)
+		return;
+#endif
+
+	if (ctx->flightrec)
+		flightrec_push(ctx->flightrec, data_packet, caplen, timestamp);
 
-	if (data_packet[pktheader->caplen - 2] != 0xC2 || data_packet[pktheader->caplen - 1] != 0xEA) {
-		fprintf(stderr, "Error: ending word failed: %02X %02X\n", (int)data_packet[pktheader->caplen - 2],
-			(int)data_packet[pktheader->caplen - 1]);
+	bool created;
+	int ix = key ? h8819_demux_get(&ctx->demux, key, &created) : -1;
+	if (ix < 0)
 		return;
+	struct stream_s *st = ctx->streams + ix;
+	if (created) {
+		char mac[H8819_MAC_STRLEN];
+		h8819_stream_key_to_string(mac, key);
+		fprintf(stderr, "Info: new stream %s\n", mac);
 	}
 
-	uint8_t buf[12 * 40 * 3 + sizeof(struct capdev_proc_header_s)];
-	struct capdev_proc_header_s *header = (void *)buf;
-	int n_channel = countones_uint64(ctx->req.channel_mask);
-	if (n_channel < 0 || 40 < n_channel)
+	struct h8819_frame_s frame;
+	int ret = h8819_stream_feed(&st->stream, &frame, data_packet, caplen, timestamp);
+	if (ret == H8819_ERROR_TRAILER) {
+		fprintf(stderr, "Error: ending word failed: %02X %02X\n", (int)data_packet[caplen - 2],
+			(int)data_packet[caplen - 1]);
+		if (ctx->flightrec)
+			flightrec_trigger(ctx->flightrec, "trailer", timestamp);
+		return;
+	}
+	if (ret < 0)
 		return;
-	header->channel_mask = ctx->req.channel_mask;
-	header->timestamp = ts_pcap_to_obs(pktheader);
-	header->n_data_bytes = 12 * 3 * n_channel;
-	header->n_skipped_packets = 0;
-	uint8_t *pcm24lep = buf + sizeof(struct capdev_proc_header_s);
 
-	if (ctx->got_packet) {
-		uint16_t counter_exp = ctx->counter_last + 1;
-		if (counter_exp != packet_header->l2_counter) {
-			uint16_t skipped = packet_header->l2_counter - counter_exp;
-			header->n_skipped_packets = (int)skipped;
-			fprintf(stderr, "Error: missing packets: counter is %d expected %d\n",
-				(int)packet_header->l2_counter, (int)counter_exp);
-		}
+	if (ret & H8819_EVENT_FIRST)
+		fprintf(stderr, "Info: %u channels, %u samples per frame\n", frame.n_channels, frame.n_samples);
+	if (st->frame_len != caplen) {
+		st->frame_len = caplen;
+		ctx->filter.dirty = true;
+	}
+
+	if (ret & H8819_EVENT_GAP) {
+		fprintf(stderr, "Error: missing packets: counter is %d expected %d\n", (int)frame.header->l2_counter,
+			(int)frame.counter_expected);
+		if (ctx->flightrec)
+			flightrec_trigger(ctx->flightrec, "gap", timestamp);
 	}
 
-	convert_to_pcm24lep(pcm24lep, data_packet + L2_HEADER_LEN, header->channel_mask);
+	if (ctx->recorder && (ctx->record_key ? key == ctx->record_key : ix == 0))
+		recorder_write_frame(ctx->recorder, &frame);
+
+	if (ctx->rtp && (ctx->rtp_key ? key == ctx->rtp_key : ix == 0))
+		rtp_write_frame(ctx->rtp, &frame);
+
+	preroll_push(&st->preroll, &frame);
+
+	uint8_t buf[H8819_MAX_PAYLOAD_LEN + sizeof(struct capdev_proc_header_s)];
+	struct capdev_proc_header_s *header = (void *)buf;
+	int n_channel = h8819_chmask_count_below(&st->channel_mask, (int)frame.n_channels);
 
-	ssize_t written = write(1, buf, sizeof(struct capdev_proc_header_s) + header->n_data_bytes);
-	if (written != sizeof(struct capdev_proc_header_s) + header->n_data_bytes) {
-		fprintf(stderr, "Failed to write\n");
-		ctx->cont = false;
+	// Nobody needs the samples if no channel is requested.
+	// Then only the timestamp is sent at intervals to keep the timestamp estimation warm.
+	st->n_idle_packets++;
+	st->n_idle_skipped_packets += frame.n_skipped_packets;
+	if (n_channel == 0)
+		st->n_muted_skipped_packets += frame.n_skipped_packets;
+	if (n_channel == 0 && st->n_idle_packets < CAPDEV_PROC_IDLE_INTERVAL && !created)
 		return;
+
+	*header = (struct capdev_proc_header_s){
+		.channel_mask = st->channel_mask,
+		.stream_key = key,
+		.timestamp = frame.timestamp,
+		.n_data_bytes = frame.n_samples * 3 * n_channel,
+		.n_skipped_packets = st->n_idle_skipped_packets,
+		.n_packets = st->n_idle_packets,
+		.n_channels = (uint16_t)frame.n_channels,
+		.n_samples = (uint16_t)frame.n_samples,
+		.n_muted_skipped_packets = st->n_muted_skipped_packets,
+	};
+	st->n_idle_packets = 0;
+	st->n_idle_skipped_packets = 0;
+	st->n_muted_skipped_packets = 0;
+
+	// The plugin fills the dropped frame with the blank of the next frame.
+	if (!write_frame(ctx, header, &frame)) {
+		st->n_idle_skipped_packets = header->n_skipped_packets + header->n_packets;
+		st->n_muted_skipped_packets = header->n_muted_skipped_packets + (n_channel ? 0 : header->n_packets);
 	}
-	ctx->counter_last = packet_header->l2_counter;
+}
+
+static void got_leg_frame(const uint8_t *data_packet, uint32_t caplen, int64_t timestamp, void *param)
+{
+	struct leg_s *leg = param;
+	if (leg->ctx->redundant)
+		redundant_feed(leg->ctx->redundant, leg->leg, data_packet, caplen, timestamp);
+	else
+		got_frame(data_packet, caplen, timestamp, leg->ctx);
+}
 
-	ctx->got_packet = true;
+static void got_msg(const uint8_t *data_packet, const struct pcap_pkthdr *pktheader, struct leg_s *leg)
+{
+	got_leg_frame(data_packet, pktheader->caplen, ts_pcap_to_obs(pktheader), leg);
 }
 
 static int list_devices()
@@ -140,25 +375,32 @@ static int list_devices()
 	return 0;
 }
 
-int main(int argc, char **argv)
+// No stream is known yet. The filter returns the exact length once streams are pinned.
+static void set_initial_filter(pcap_t *p)
 {
-	char errbuf[PCAP_ERRBUF_SIZE];
-	const char *if_name = argc > 1 ? argv[1] : NULL;
-
-	if (!if_name)
-		return list_devices();
+	struct bpf_insn insns[PROC_FILTER_MAX_INSNS];
+	struct bpf_program fp = {.bf_len = (unsigned int)proc_filter_build(insns, NULL, 0), .bf_insns = insns};
+	if (pcap_setfilter(p, &fp))
+		fprintf(stderr, "Error: pcap_setfilter: %s\n", pcap_geterr(p));
+}
 
+static pcap_t *open_device(const char *if_name)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
 	pcap_t *p = pcap_create(if_name, errbuf);
 
 	if (!p) {
 		fprintf(stderr, "%s\n", errbuf);
-		return 1;
+		return NULL;
 	}
 
 	// Immediate mode caused packet losses.
 	// Trying timeout less than the smoothing threshold in libobs (70 ms).
 	pcap_set_timeout(p, 44 /*[ms]*/);
 
+	// Nothing longer than a REAC frame passes the filter.
+	pcap_set_snaplen(p, H8819_MAX_FRAME_LEN);
+
 	// 44 ms x 48 kHz x 40 ch x 3 byte/ch = 254 kbytes
 	// Allocate twice for the slave device, another twice for more safety.
 	pcap_set_buffer_size(p, 4 * 256 * 1024);
@@ -166,57 +408,614 @@ int main(int argc, char **argv)
 	int ret = pcap_activate(p);
 	if (ret) {
 		fprintf(stderr, "Error: pcap_activate failed %s\n", pcap_geterr(p));
-		return 1;
+		pcap_close(p);
+		return NULL;
 	}
 
-	struct bpf_program fp = {0};
-	ret = pcap_compile(p, &fp, "ether proto 0x8819", 1, PCAP_NETMASK_UNKNOWN);
-	if (ret) {
-		fprintf(stderr, "Warning: pcap_compile: %s\n", pcap_geterr(p));
+	set_initial_filter(p);
+
+	return p;
+}
+
+// The record and transmit requests can be larger than PIPE_BUF so that they may arrive in pieces.
+static bool read_full(int fd, void *data, size_t size)
+{
+	while (size) {
+		ssize_t ret = read(fd, data, size);
+		if (ret <= 0)
+			return false;
+		data = (uint8_t *)data + ret;
+		size -= ret;
+	}
+	return true;
+}
+
+static bool read_record_request(struct context_s *ctx)
+{
+	recorder_destroy(ctx->recorder);
+	ctx->recorder = NULL;
+
+	uint32_t n = ctx->req.n_extra_bytes;
+	if (n == 0)
+		return true;
+
+	struct capdev_proc_record_s rr;
+	char directory[4096];
+	if (n <= sizeof(rr) || n - sizeof(rr) >= sizeof(directory)) {
+		fprintf(stderr, "Error: unexpected record request n_extra_bytes=%u\n", n);
+		return false;
+	}
+	if (!read_full(0, &rr, sizeof(rr)) || !read_full(0, directory, n - sizeof(rr))) {
+		fprintf(stderr, "Error: failed to read the record request\n");
+		return false;
+	}
+	directory[n - sizeof(rr)] = '\0';
+	if (rr.format > RECORDER_FORMAT_CAF) {
+		fprintf(stderr, "Error: unknown record format %u\n", rr.format);
+		return true;
+	}
+
+	struct recorder_config_s cfg = {
+		.directory = directory,
+		.channel_mask = ctx->req.channel_mask,
+		.format = rr.format,
+		.rollover_seconds = rr.rollover_seconds,
+		.rollover_bytes = rr.rollover_bytes,
+		.direct_io = rr.flags & CAPDEV_RECORD_FLAG_DIRECT_IO,
+	};
+	ctx->recorder = recorder_create(&cfg);
+	ctx->record_key = ctx->req.stream_key;
+	return true;
+}
+
+static bool read_flightrec_request(struct context_s *ctx)
+{
+	flightrec_destroy(ctx->flightrec);
+	ctx->flightrec = NULL;
+
+	uint32_t n = ctx->req.n_extra_bytes;
+	if (n == 0)
+		return true;
+
+	struct capdev_proc_flightrec_s fr;
+	char directory[4096];
+	if (n <= sizeof(fr) || n - sizeof(fr) >= sizeof(directory)) {
+		fprintf(stderr, "Error: unexpected flight recorder request n_extra_bytes=%u\n", n);
+		return false;
+	}
+	if (!read_full(0, &fr, sizeof(fr)) || !read_full(0, directory, n - sizeof(fr))) {
+		fprintf(stderr, "Error: failed to read the flight recorder request\n");
+		return false;
+	}
+	directory[n - sizeof(fr)] = '\0';
+	// The ring holds the traffic of the whole window.
+	if (fr.seconds_before > 60 || fr.seconds_after > 60) {
+		fprintf(stderr, "Error: flight recorder window is too long %u + %u s\n", fr.seconds_before,
+			fr.seconds_after);
+		return true;
+	}
+
+	struct flightrec_config_s cfg = {
+		.directory = directory,
+		.seconds_before = fr.seconds_before,
+		.seconds_after = fr.seconds_after,
+	};
+	ctx->flightrec = flightrec_create(&cfg);
+	return true;
+}
+
+static bool read_rtp_request(struct context_s *ctx)
+{
+	rtp_destroy(ctx->rtp);
+	ctx->rtp = NULL;
+
+	uint32_t n = ctx->req.n_extra_bytes;
+	if (n == 0)
+		return true;
+
+	struct capdev_proc_rtp_s rr;
+	char destination[CAPDEV_PROC_RTP_ADDRESS_MAX + 1];
+	char interface_address[CAPDEV_PROC_RTP_ADDRESS_MAX + 1];
+	if (n < sizeof(rr) || !read_full(0, &rr, sizeof(rr))) {
+		fprintf(stderr, "Error: failed to read the RTP request\n");
+		return false;
+	}
+	if (n != sizeof(rr) + rr.destination_len + rr.interface_len || !rr.destination_len ||
+	    rr.destination_len > CAPDEV_PROC_RTP_ADDRESS_MAX || rr.interface_len > CAPDEV_PROC_RTP_ADDRESS_MAX) {
+		fprintf(stderr, "Error: unexpected RTP request n_extra_bytes=%u\n", n);
+		return false;
+	}
+	if (!read_full(0, destination, rr.destination_len) ||
+	    (rr.interface_len && !read_full(0, interface_address, rr.interface_len))) {
+		fprintf(stderr, "Error: failed to read the RTP request\n");
+		return false;
+	}
+	destination[rr.destination_len] = '\0';
+	interface_address[rr.interface_len] = '\0';
+
+	struct rtp_config_s cfg = {
+		.destination = destination,
+		.interface_address = interface_address,
+		.channel_mask = ctx->req.channel_mask,
+		.ptime_samples = rr.ptime_samples,
+	};
+	ctx->rtp = rtp_create(&cfg);
+	ctx->rtp_key = ctx->req.stream_key;
+	return true;
+}
+
+#ifdef HAVE_TRANSMIT
+static void stop_transmit(struct context_s *ctx)
+{
+	transmit_destroy(ctx->transmit);
+	ctx->transmit = NULL;
+	ctx->transmit_channels = 0;
+	ctx->transmit_key = 0;
+}
+#else
+static bool skip_extra_bytes(uint32_t n)
+{
+	uint8_t buf[4096];
+	while (n) {
+		uint32_t len = n < sizeof(buf) ? n : (uint32_t)sizeof(buf);
+		if (!read_full(0, buf, len))
+			return false;
+		n -= len;
+	}
+	return true;
+}
+#endif
+
+static bool read_transmit_request(struct context_s *ctx, const char *if_name)
+{
+	uint32_t n = ctx->req.n_extra_bytes;
+	struct capdev_proc_transmit_s rt = {0};
+	if (n && (n < sizeof(rt) || !read_full(0, &rt, sizeof(rt)))) {
+		fprintf(stderr, "Error: failed to read the transmit request\n");
+		return false;
+	}
+	if (n)
+		n -= sizeof(rt);
+	if (n != (uint32_t)rt.n_channels * rt.n_samples * sizeof(float) || rt.n_channels > H8819_MAX_CHANNELS ||
+	    rt.n_samples > CAPDEV_PROC_TRANSMIT_MAX_SAMPLES) {
+		fprintf(stderr, "Error: unexpected transmit request n_extra_bytes=%u\n", ctx->req.n_extra_bytes);
+		return false;
+	}
+
+#ifdef HAVE_TRANSMIT
+	if (!ctx->req.n_extra_bytes) {
+		stop_transmit(ctx);
+		return true;
+	}
+
+	if (!ctx->transmit_buf)
+		ctx->transmit_buf = malloc(sizeof(float) * H8819_MAX_CHANNELS * CAPDEV_PROC_TRANSMIT_MAX_SAMPLES);
+	if (!ctx->transmit_buf || !read_full(0, ctx->transmit_buf, n)) {
+		fprintf(stderr, "Error: failed to read the transmit request\n");
+		return false;
+	}
+
+	if (ctx->transmit_channels != rt.n_frame_channels) {
+		stop_transmit(ctx);
+
+		// Only the first interface of the redundant pair transmits.
+		char name[256];
+		snprintf(name, sizeof(name), "%.*s", (int)strcspn(if_name, (char[]){CAPDEV_PROC_LEG_DELIM, 0}),
+			 if_name);
+		struct transmit_config_s cfg = {
+			.if_name = name,
+			.n_channels = rt.n_frame_channels,
+		};
+		ctx->transmit = name[0] ? transmit_create(&cfg) : NULL;
+		// Not retried for each request if it failed.
+		ctx->transmit_channels = rt.n_frame_channels;
+		if (ctx->transmit)
+			ctx->transmit_key = transmit_stream_key(ctx->transmit);
+	}
+
+	if (ctx->transmit)
+		transmit_push(ctx->transmit, rt.first_channel, rt.n_channels, ctx->transmit_buf, rt.n_samples);
+	return true;
+#else
+	(void)if_name;
+	static bool warned = false;
+	if (!warned)
+		fputs("Error: transmit is not supported on this platform\n", stderr);
+	warned = true;
+	return skip_extra_bytes(n);
+#endif
+}
+
+static bool read_request(struct context_s *ctx, char *if_name, size_t if_name_size)
+{
+	ssize_t bytes = read(0, &ctx->req, sizeof(ctx->req));
+	// The transmit requests are written in pieces of PIPE_BUF so that a request can be split anywhere.
+	if (bytes > 0 && bytes < (ssize_t)sizeof(ctx->req) &&
+	    read_full(0, (uint8_t *)&ctx->req + bytes, sizeof(ctx->req) - bytes))
+		bytes = sizeof(ctx->req);
+	if (bytes == 0 || (bytes == sizeof(ctx->req) && ctx->req.flags & CAPDEV_REQ_FLAG_EXIT)) {
+		fprintf(stderr, "Info normal exit '%s'\n", if_name[0] ? if_name : "(null)");
+		return false;
+	}
+	else if (bytes != sizeof(ctx->req)) {
+		fprintf(stderr, "Error: read %d bytes, expected %d bytes.\n", (int)bytes, (int)sizeof(ctx->req));
+		return false;
+	}
+
+	if (ctx->req.flags & CAPDEV_REQ_FLAG_RECORD)
+		return read_record_request(ctx);
+
+	if (ctx->req.flags & CAPDEV_REQ_FLAG_FLIGHTREC)
+		return read_flightrec_request(ctx);
+
+	if (ctx->req.flags & CAPDEV_REQ_FLAG_RTP)
+		return read_rtp_request(ctx);
+
+	if (ctx->req.flags & CAPDEV_REQ_FLAG_TRANSMIT)
+		return read_transmit_request(ctx, if_name);
+
+	if (ctx->req.flags & CAPDEV_REQ_FLAG_DUMP) {
+		if (ctx->flightrec)
+			flightrec_trigger_now(ctx->flightrec, "request");
+		return true;
+	}
+
+	if (ctx->req.n_extra_bytes) {
+		if (!(ctx->req.flags & CAPDEV_REQ_FLAG_OPEN) || ctx->req.n_extra_bytes >= if_name_size || if_name[0]) {
+			fprintf(stderr, "Error: unexpected request flags=%x n_extra_bytes=%u\n", ctx->req.flags,
+				ctx->req.n_extra_bytes);
+			return false;
+		}
+		bytes = read(0, if_name, ctx->req.n_extra_bytes);
+		if (bytes != ctx->req.n_extra_bytes) {
+			fprintf(stderr, "Error: read %d bytes, expected %u bytes.\n", (int)bytes,
+				ctx->req.n_extra_bytes);
+			return false;
+		}
+		if_name[bytes] = '\0';
+	}
+
+	if (ctx->req.stream_key) {
+		bool created;
+		int ix = h8819_demux_get(&ctx->demux, ctx->req.stream_key, &created);
+		if (ix >= 0) {
+			struct stream_s *st = ctx->streams + ix;
+			struct h8819_chmask_s added = ctx->req.channel_mask;
+			h8819_chmask_andnot(&added, &st->channel_mask);
+			// Nobody was listening to the packets lost until now.
+			if (h8819_chmask_is_empty(&st->channel_mask))
+				st->n_muted_skipped_packets = st->n_idle_skipped_packets;
+			st->channel_mask = ctx->req.channel_mask;
+			if (!h8819_chmask_is_empty(&added))
+				preroll_write(ctx, st, ctx->req.stream_key);
+		}
+	}
+
+	return true;
+}
+
+// Capture file replayed in place of an interface
+struct replay_s
+{
+	bool pace; // at the timestamps in the file, or as fast as the plugin reads
+	bool started;
+	bool eof;
+	int64_t ts_offset;          // from the timestamps in the file to the monotonic clock
+	struct pcap_pkthdr *header; // packet read from the file but not due yet
+	const uint8_t *data;
+};
+
+// Packets replayed at once before the requests are checked again
+#define REPLAY_BATCH 64
+
+struct capture_s
+{
+	pcap_t *p;
+#ifdef HAVE_AF_XDP
+	struct xdp_capture_s *xdp;
+#endif
+	bool replaying;
+	struct replay_s replay;
+	int fd;
+};
+
+static bool replay_open(struct capture_s *cap, const char *path)
+{
+	char errbuf[PCAP_ERRBUF_SIZE];
+	cap->p = pcap_open_offline(path, errbuf);
+	if (!cap->p) {
+		fprintf(stderr, "Error: %s\n", errbuf);
+		return false;
+	}
+
+	// The same filter as an interface so that the file is checked the same way.
+	set_initial_filter(cap->p);
+
+	const char *env = getenv("OBS_H8819_REPLAY_PACE");
+	cap->replaying = true;
+	cap->replay = (struct replay_s){.pace = !env || !*env || strcmp(env, "0") != 0};
+	cap->fd = -1;
+	fprintf(stderr, "Info: replaying '%s'%s\n", path, cap->replay.pace ? "" : " without pacing");
+	return true;
+}
+
+// A file is not read further until the plugin takes the queued frames, so no frame is dropped.
+static void replay_read(struct capture_s *cap, struct leg_s *leg)
+{
+	struct replay_s *r = &cap->replay;
+	for (int i = 0; i < REPLAY_BATCH && !r->eof && !output_pending(leg->ctx); i++) {
+		if (!r->header && pcap_next_ex(cap->p, &r->header, &r->data) != 1) {
+			r->header = NULL;
+			r->eof = true;
+			fputs("Info: end of the capture file\n", stderr);
+			break;
+		}
+
+		const int64_t ts = ts_pcap_to_obs(r->header);
+		if (r->pace) {
+			const int64_t now = monotonic_ns();
+			if (!r->started)
+				r->ts_offset = now - ts;
+			r->started = true;
+			if (ts + r->ts_offset > now)
+				break;
+		}
+
+		got_msg(r->data, r->header, leg);
+		r->header = NULL;
+	}
+}
+
+#ifdef HAVE_AF_XDP
+static struct xdp_capture_s *open_xdp(const char *if_name)
+{
+	// The XDP program takes over the interface, so it is used only when requested.
+	const char *env = getenv("OBS_H8819_AF_XDP");
+	if (!env || !*env || strcmp(env, "0") == 0)
+		return NULL;
+
+	struct xdp_capture_s *xdp = xdp_capture_open(if_name, strcmp(env, "generic") == 0);
+	if (!xdp)
+		fputs("Warning: AF_XDP is not available, falling back to libpcap\n", stderr);
+	return xdp;
+}
+#endif
+
+static bool capture_open(struct capture_s *cap, const char *if_name)
+{
+	const size_t replay_len = strlen(CAPDEV_PROC_REPLAY_PREFIX);
+	if (strncmp(if_name, CAPDEV_PROC_REPLAY_PREFIX, replay_len) == 0)
+		return replay_open(cap, if_name + replay_len);
+
+#ifdef HAVE_AF_XDP
+	cap->xdp = open_xdp(if_name);
+	if (cap->xdp) {
+		cap->fd = xdp_capture_get_fd(cap->xdp);
+		return true;
+	}
+#endif
+
+	cap->p = open_device(if_name);
+	if (!cap->p)
+		return false;
+	cap->fd = pcap_get_selectable_fd(cap->p);
+	return true;
+}
+
+static void capture_read(struct capture_s *cap, struct leg_s *leg)
+{
+	if (cap->replaying) {
+		replay_read(cap, leg);
+		return;
+	}
+
+#ifdef HAVE_AF_XDP
+	if (cap->xdp) {
+		xdp_capture_receive(cap->xdp, got_leg_frame, leg);
+		return;
+	}
+#endif
+
+	struct pcap_pkthdr *header;
+	const uint8_t *payload;
+	if (pcap_next_ex(cap->p, &header, &payload) == 1)
+		got_msg(payload, header, leg);
+}
+
+static void capture_close(struct capture_s *cap)
+{
+#ifdef HAVE_AF_XDP
+	if (cap->xdp)
+		xdp_capture_close(cap->xdp);
+	cap->xdp = NULL;
+#endif
+	if (cap->p)
+		pcap_close(cap->p);
+	cap->p = NULL;
+	cap->replaying = false;
+}
+
+// Interval to poll a capture that has no descriptor to wait for, -1 to wait for the plugin to read
+static long capture_poll_us(const struct capture_s *cap, bool output_left)
+{
+	if (!cap->replaying)
+		return 500;
+	if (cap->replay.eof)
+		return 50000;
+	if (output_left)
+		return -1;
+	return cap->replay.pace ? 500 : 0;
+}
+
+// Streams are pinned while their channels are sent, recorded, or re-streamed.
+static bool stream_pinned(const struct context_s *ctx, int ix)
+{
+	const struct stream_s *st = ctx->streams + ix;
+	const uint64_t key = ctx->demux.keys[ix];
+	if (!st->frame_len)
+		return false;
+	if (!h8819_chmask_is_empty(&st->channel_mask))
+		return true;
+	if (ctx->recorder && (ctx->record_key ? key == ctx->record_key : ix == 0))
+		return true;
+	if (ctx->rtp && (ctx->rtp_key ? key == ctx->rtp_key : ix == 0))
+		return true;
+	return false;
+}
+
+/* Installs a filter that checks the pinned streams exactly and the other streams by the geometry.
+ * Called when a request has arrived or the length of the frames of a stream has changed. */
+static void update_filter(struct context_s *ctx, struct capture_s caps[], int n_legs)
+{
+	struct filter_s *f = &ctx->filter;
+	f->dirty = false;
+
+	struct bpf_insn insns[PROC_FILTER_MAX_INSNS];
+	struct bpf_program fp = {.bf_insns = insns};
+	int n_pinned = 0;
+	if (ctx->flightrec) {
+		fp.bf_len = (unsigned int)proc_filter_build_any(insns);
 	}
 	else {
-		ret = pcap_setfilter(p, &fp);
-		if (ret)
-			fprintf(stderr, "Error: pcap_setfilter: %s\n", pcap_geterr(p));
+		struct proc_filter_stream_s streams[H8819_MAX_STREAMS];
+		for (int ix = 0; ix < ctx->demux.n_streams; ix++) {
+			if (stream_pinned(ctx, ix))
+				streams[n_pinned++] = (struct proc_filter_stream_s){
+					.key = ctx->demux.keys[ix],
+					.frame_len = ctx->streams[ix].frame_len,
+				};
+		}
+		fp.bf_len = (unsigned int)proc_filter_build(insns, streams, n_pinned);
 	}
 
-	int fd_pcap = pcap_get_selectable_fd(p);
+	for (int i = 0; i < n_legs; i++) {
+		if (caps[i].p && pcap_setfilter(caps[i].p, &fp))
+			fprintf(stderr, "Error: pcap_setfilter: %s\n", pcap_geterr(caps[i].p));
+	}
+	if (n_pinned != f->n_pinned)
+		fprintf(stderr, "Info: kernel filter checks %d pinned streams exactly\n", n_pinned);
+	f->n_pinned = n_pinned;
+}
+
+/* Opens each interface of `if_name`, separated by `CAPDEV_PROC_LEG_DELIM`.
+ * Returns the number of the opened interfaces, 0 on failure. */
+static int captures_open(struct capture_s caps[], struct context_s *ctx, const char *if_name)
+{
+	char names[REDUNDANT_MAX_LEGS][256];
+	int n_legs = 0;
+	for (const char *s = if_name; n_legs < REDUNDANT_MAX_LEGS; n_legs++) {
+		const char *e = strchr(s, CAPDEV_PROC_LEG_DELIM);
+		size_t len = e ? (size_t)(e - s) : strlen(s);
+		snprintf(names[n_legs], sizeof(names[n_legs]), "%.*s", (int)len, s);
+		if (!e) {
+			n_legs++;
+			break;
+		}
+		s = e + 1;
+	}
+
+	for (int i = 0; i < n_legs; i++) {
+		if (!capture_open(caps + i, names[i])) {
+			while (--i >= 0)
+				capture_close(caps + i);
+			return 0;
+		}
+	}
+
+	if (n_legs > 1) {
+		const char *legs[REDUNDANT_MAX_LEGS];
+		for (int i = 0; i < n_legs; i++)
+			legs[i] = names[i];
+		ctx->redundant = redundant_create(n_legs, legs, got_frame, ctx);
+		fprintf(stderr, "Info: merging '%s' and '%s'\n", names[0], names[1]);
+	}
+
+	return n_legs;
+}
+
+int main(int argc, char **argv)
+{
+	char if_name[256] = {0};
+	bool wait_open = false;
+
+	if (argc <= 1)
+		return list_devices();
+
+	if (strcmp(argv[1], "-w") == 0)
+		wait_open = true;
+	else
+		snprintf(if_name, sizeof(if_name), "%s", argv[1]);
+
+	// The frames are queued in `ctx.output` if the plugin is not reading.
+	fcntl(1, F_SETFL, fcntl(1, F_GETFL) | O_NONBLOCK);
 
 	struct context_s ctx = {0};
+	struct capture_s caps[REDUNDANT_MAX_LEGS];
+	struct leg_s legs[REDUNDANT_MAX_LEGS];
+	for (int i = 0; i < REDUNDANT_MAX_LEGS; i++) {
+		caps[i] = (struct capture_s){.fd = -1};
+		legs[i] = (struct leg_s){.ctx = &ctx, .leg = i};
+	}
+	int n_legs = 0;
+
+	if (!wait_open) {
+		n_legs = captures_open(caps, &ctx, if_name);
+		if (!n_legs)
+			return 1;
+	}
 
 	for (ctx.cont = true; ctx.cont;) {
+		if (n_legs && ctx.filter.dirty)
+			update_filter(&ctx, caps, n_legs);
+
 		int nfds = 1;
-		if (fd_pcap + 1 > nfds)
-			nfds = fd_pcap + 1;
+		// Nothing to do until the open request arrives.
+		long timeout_us = n_legs ? 50000 : 1000000;
 		fd_set readfds;
+		fd_set writefds;
 		fd_set exceptfds;
 		FD_ZERO(&readfds);
+		FD_ZERO(&writefds);
 		FD_ZERO(&exceptfds);
 		FD_SET(0, &readfds);
 		FD_SET(0, &exceptfds);
-		if (fd_pcap >= 0)
-			FD_SET(fd_pcap, &readfds);
+		bool output_left = output_pending(&ctx);
+		if (output_left) {
+			FD_SET(1, &writefds);
+			if (nfds < 2)
+				nfds = 2;
+		}
+		for (int i = 0; i < n_legs; i++) {
+			if (caps[i].fd < 0) {
+				long poll_us = capture_poll_us(caps + i, output_left);
+				if (poll_us >= 0 && poll_us < timeout_us)
+					timeout_us = poll_us;
+				continue;
+			}
+			FD_SET(caps[i].fd, &readfds);
+			if (caps[i].fd + 1 > nfds)
+				nfds = caps[i].fd + 1;
+		}
 
-		struct timeval timeout = {.tv_sec = 0, .tv_usec = fd_pcap >= 0 ? 50000 : 500};
-		int ret = select(nfds, &readfds, NULL, &exceptfds, &timeout);
+		struct timeval timeout = {.tv_sec = timeout_us / 1000000, .tv_usec = timeout_us % 1000000};
+		int ret = select(nfds, &readfds, output_left ? &writefds : NULL, &exceptfds, &timeout);
 		if (ret < 0) {
 			perror("select");
 			ctx.cont = false;
 		}
+		if (ret > 0 && output_left && FD_ISSET(1, &writefds))
+			output_flush(&ctx);
+		// Packets held for a batch are not kept while no frame arrives.
+		if (ret == 0 && ctx.rtp)
+			rtp_flush(ctx.rtp);
 
 		if (FD_ISSET(0, &readfds)) {
-			size_t bytes = read(0, &ctx.req, sizeof(ctx.req));
-			if (bytes == 0 || ctx.req.flags & CAPDEV_REQ_FLAG_EXIT) {
-				fprintf(stderr, "Info normal exit '%s'\n", if_name ? if_name : "(null)");
-				ctx.cont = false;
-				break;
-			}
-			else if (bytes != sizeof(ctx.req)) {
-				fprintf(stderr, "Error: read %d bytes, expected %d bytes.\n", (int)bytes,
-					(int)sizeof(ctx.req));
+			if (!read_request(&ctx, if_name, sizeof(if_name))) {
 				ctx.cont = false;
 				break;
 			}
+			// Channels, the recorder, or the flight recorder may have changed.
+			ctx.filter.dirty = true;
 		}
 
 		if (FD_ISSET(0, &exceptfds)) {
@@ -224,15 +1023,32 @@ int main(int argc, char **argv)
 			ctx.cont = false;
 		}
 
-		if (fd_pcap < 0 || FD_ISSET(fd_pcap, &readfds)) {
-			struct pcap_pkthdr *header;
-			const uint8_t *payload;
-			if (pcap_next_ex(p, &header, &payload) == 1)
-				got_msg(payload, header, &ctx);
+		if (!n_legs && if_name[0]) {
+			n_legs = captures_open(caps, &ctx, if_name);
+			if (!n_legs)
+				return 1;
+			continue;
+		}
+
+		for (int i = 0; i < n_legs; i++) {
+			if (caps[i].fd < 0 || FD_ISSET(caps[i].fd, &readfds))
+				capture_read(caps + i, legs + i);
 		}
 	}
 
-	pcap_close(p);
+	for (int i = 0; i < n_legs; i++)
+		capture_close(caps + i);
+	redundant_destroy(ctx.redundant);
+#ifdef HAVE_TRANSMIT
+	stop_transmit(&ctx);
+	free(ctx.transmit_buf);
+#endif
+	recorder_destroy(ctx.recorder);
+	rtp_destroy(ctx.rtp);
+	flightrec_destroy(ctx.flightrec);
+	for (int i = 0; i < H8819_MAX_STREAMS; i++)
+		free(ctx.streams[i].preroll.payloads);
+	free(ctx.output.buf);
 
 	return 0;
 }
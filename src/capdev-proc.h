@@ -1,18 +1,111 @@
 #pragma once
 
+#include "h8819.h"
+
+/* A device name `a+b` captures the same streams on the interfaces `a` and `b` and merges them. */
+#define CAPDEV_PROC_LEG_DELIM '+'
+
+/* A device name `replay:file.pcap` replays the capture file instead of capturing on an interface,
+ * at the pace of the timestamps in the file, or as fast as the plugin reads if `OBS_H8819_REPLAY_PACE=0`.
+ * The helper keeps running without packets at the end of the file. */
+#define CAPDEV_PROC_REPLAY_PREFIX "replay:"
+
 #define CAPDEV_REQ_FLAG_EXIT 1
+/* Open the interface whose name follows the request in `n_extra_bytes` bytes.
+ * Used to start capturing on a helper started with `-w`. */
+#define CAPDEV_REQ_FLAG_OPEN 2
+/* Record channels in `channel_mask` of the stream `stream_key` to files, 0 for the first stream.
+ * `struct capdev_proc_record_s` and the directory follow the request in `n_extra_bytes` bytes.
+ * An empty channel mask stops recording. */
+#define CAPDEV_REQ_FLAG_RECORD 4
+/* Keep recent frames in memory and dump them to pcap files on glitches.
+ * `struct capdev_proc_flightrec_s` and the directory follow the request in `n_extra_bytes` bytes.
+ * No extra bytes stops the flight recorder. */
+#define CAPDEV_REQ_FLAG_FLIGHTREC 8
+/* Dump the frames around now if the flight recorder is running. */
+#define CAPDEV_REQ_FLAG_DUMP 16
+/* Transmit samples from the interface, Linux only.
+ * `struct capdev_proc_transmit_s` and the planar float samples follow the request in `n_extra_bytes` bytes.
+ * No extra bytes stops transmitting. */
+#define CAPDEV_REQ_FLAG_TRANSMIT 32
+/* Re-stream channels in `channel_mask` of the stream `stream_key` as RTP L24, 0 for the first stream.
+ * `struct capdev_proc_rtp_s`, the destination, and the interface address follow the request in `n_extra_bytes` bytes.
+ * No extra bytes stops re-streaming. */
+#define CAPDEV_REQ_FLAG_RTP 64
 
+/* While no channel is requested on a stream, the helper sends only a header for this number of packets
+ * to keep the timestamp estimation warm and to tell that the stream exists. */
+#define CAPDEV_PROC_IDLE_INTERVAL 64
+
+/* When channels are added to a stream, the helper sends this number of recent frames again before the next frame
+ * so that the added channels can be played from the time they were requested.
+ * It covers the time from a change of the channels on the plugin to the request read by the helper. */
+#define CAPDEV_PROC_PREROLL_FRAMES 128
+
+/* `channel_mask` applies to the stream `stream_key`, which is the source MAC address given by `h8819_stream_key`. */
 struct capdev_proc_request_s
 {
-	uint64_t channel_mask;
+	struct h8819_chmask_s channel_mask;
+	uint64_t stream_key;
+	uint32_t flags;
+	uint32_t n_extra_bytes;
+};
+
+#define CAPDEV_RECORD_FLAG_DIRECT_IO 1
+
+struct capdev_proc_record_s
+{
+	uint32_t format; // enum recorder_format_e
 	uint32_t flags;
+	uint64_t rollover_bytes;
+	uint32_t rollover_seconds;
 	uint32_t unused;
 };
 
+struct capdev_proc_flightrec_s
+{
+	uint32_t seconds_before;
+	uint32_t seconds_after;
+};
+
+/* `n_samples` samples of each of `n_channels` channels from `first_channel` in frames of `n_frame_channels`. */
+struct capdev_proc_transmit_s
+{
+	uint16_t n_frame_channels;
+	uint16_t first_channel;
+	uint16_t n_channels;
+	uint16_t n_samples;
+};
+
+#define CAPDEV_PROC_TRANSMIT_MAX_SAMPLES 4096
+
+/* Followed by `destination_len` bytes of `group[:port]` and `interface_len` bytes of the local address. */
+struct capdev_proc_rtp_s
+{
+	uint32_t ptime_samples;
+	uint16_t destination_len;
+	uint16_t interface_len;
+};
+
+#define CAPDEV_PROC_RTP_ADDRESS_MAX 255
+
+/* The frame was sent before and is sent again with the added channels. `n_packets` is 0. */
+#define CAPDEV_HEADER_FLAG_PREROLL 1
+
+/* `n_channels` and `n_samples` are the geometry of the frame.
+ * The data contains channels in `channel_mask` below `n_channels`.
+ * `n_muted_skipped_packets` of `n_skipped_packets` were lost while no channel was requested,
+ * so they are counted but not played as a gap. */
 struct capdev_proc_header_s
 {
-	uint64_t channel_mask;
+	struct h8819_chmask_s channel_mask;
+	uint64_t stream_key;
 	int64_t timestamp;
 	uint32_t n_data_bytes;
 	uint32_t n_skipped_packets;
+	uint32_t n_packets;
+	uint16_t n_channels;
+	uint16_t n_samples;
+	uint32_t flags;
+	uint32_t n_muted_skipped_packets;
 };
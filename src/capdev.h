@@ -1,14 +1,129 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdbool.h>
 #include "common.h"
+#include "h8819.h"
 
-capdev_t *capdev_find_or_create(const char *device_name);
+#define CAPDEV_KEEPALIVE_S_DEFAULT 10
+
+// `backend` is one of the IDs given by `capdev_enum_backends`. NULL or an unknown ID selects the default.
+capdev_t *capdev_find_or_create(const char *device_name, const char *backend);
 capdev_t *capdev_get_ref(capdev_t *dev);
 void capdev_release(capdev_t *dev);
+void capdev_init(void);
+void capdev_shutdown(void);
 
 void capdev_link_source(capdev_t *dev, source_t *src, const int *channels);
 void capdev_update_source(capdev_t *dev, source_t *src, const int *channels);
+void capdev_set_source_active(capdev_t *dev, source_t *src, bool active);
 void capdev_unlink_source(capdev_t *dev, source_t *src);
 
+// Channels summed into the stereo output of the source instead of taking the channels one to one.
+struct capdev_mix_s
+{
+	int n_inputs;
+	int channels[H8819_MAX_CHANNELS];   // 0-based
+	float gains[2][H8819_MAX_CHANNELS]; // linear gain of each input to the left and the right
+};
+
+// `mix` is copied. NULL goes back to the channels given by `capdev_link_source` or `capdev_update_source`.
+void capdev_set_source_mix(capdev_t *dev, source_t *src, const struct capdev_mix_s *mix);
+
+// Delay of each channel in samples, up to `H8819_DELAY_MAX_SAMPLES`, before the channels are taken or mixed.
+// NULL or all zero removes the delay lines.
+void capdev_set_source_delays(capdev_t *dev, source_t *src, const uint32_t delays[H8819_MAX_CHANNELS]);
+
+// `stream_key` selects the stream by the source MAC address. 0 follows the first stream on the device.
+void capdev_set_source_stream(capdev_t *dev, source_t *src, uint64_t stream_key);
+void capdev_enum_streams(capdev_t *dev, void (*cb)(uint64_t stream_key, void *param), void *param);
+
+// Recording done by the capture helper, independent of the audio mixer.
+struct capdev_record_s
+{
+	const char *directory;
+	struct h8819_chmask_s channel_mask;
+	int format;                // enum recorder_format_e
+	uint32_t rollover_seconds; // 0 not to roll over by time
+	uint64_t rollover_bytes;   // 0 not to roll over by size
+	bool direct_io;
+};
+
+// `rec` is copied. NULL stops recording by the source.
+// The first source that records on the device is used. Only the helper process backend can record.
+void capdev_set_source_record(capdev_t *dev, source_t *src, const struct capdev_record_s *rec);
+
+// Flight recorder in the capture helper, which dumps the frames around glitches to pcap files.
+struct capdev_flightrec_s
+{
+	const char *directory;
+	uint32_t seconds_before;
+	uint32_t seconds_after;
+};
+
+// `fr` is copied. NULL stops the flight recorder by the source.
+// The first source that enables it on the device is used. Only the helper process backend has it.
+void capdev_set_source_flightrec(capdev_t *dev, source_t *src, const struct capdev_flightrec_s *fr);
+
+// Dump the frames around now to a pcap file if the flight recorder is running.
+void capdev_request_dump(capdev_t *dev);
+
+// Re-streaming by the capture helper as RTP L24 multicast.
+struct capdev_rtp_s
+{
+	const char *destination;       // IPv4 group with an optional port such as `239.69.0.1:5004`
+	const char *interface_address; // local address to send from, empty for the default route
+	struct h8819_chmask_s channel_mask;
+	uint32_t ptime_samples;
+};
+
+// `rtp` is copied. NULL stops re-streaming by the source.
+// The first source that re-streams on the device is used. Only the helper process backend can re-stream.
+void capdev_set_source_rtp(capdev_t *dev, source_t *src, const struct capdev_rtp_s *rtp);
+
+// Levels of each channel over the last period, published by the capture thread.
+#define CAPDEV_METER_PERIOD_SAMPLES 2400
+struct capdev_levels_s
+{
+	int n_channels; // highest metered channel + 1, 0 until the first period
+	float peak[H8819_MAX_CHANNELS]; // maximum absolute value in the period
+	float rms[H8819_MAX_CHANNELS];
+	uint32_t clips[H8819_MAX_CHANNELS]; // clipped samples since the metering started
+};
+
+// While a source meters, all channels of its stream are captured and metered regardless of the active state.
+void capdev_set_source_meter(capdev_t *dev, source_t *src, bool meter);
+
+// Sources that resample on the device get the channels resampled to the rate of OBS once for all of them.
+// Channels of a source with delays are not resampled on the device.
+// `sample_rate` is the rate of OBS, taken when the source is created or updated.
+void capdev_set_source_resample(capdev_t *dev, source_t *src, bool resample, uint32_t sample_rate);
+
+// Sources that correct the drift get the channels resampled on the device with a ratio adjusted by a few ppm
+// so that the samples follow the clock of the host. The other sources that resample on the device share the ratio.
+void capdev_set_source_drift_correct(capdev_t *dev, source_t *src, bool drift_correct);
+
+// The device keeps capturing after its last source is removed for the longest keepalive of its sources.
+void capdev_set_source_keepalive(capdev_t *dev, source_t *src, int keepalive_ms);
+
+// Devices with the same group name share the timestamp estimation so that their sources are coherent.
+// NULL or an empty name asks for no group. The device joins the group of the first source that names one,
+// and a different group named by another source on the device is ignored with a warning.
+void capdev_set_source_timebase_group(capdev_t *dev, source_t *src, const char *name);
+
+// Copy the latest levels of the stream. `stream_key` 0 is the first stream.
+// Returns false if the stream is not metered.
+// The copy is taken with the mutex of the device, which the capture thread also takes for each frame,
+// so polling the levels much faster than they are updated only adds contention.
+bool capdev_get_levels(capdev_t *dev, uint64_t stream_key, struct capdev_levels_s *levels);
+
+// Transmit `n_samples` planar samples of each of `n_channels` channels from `first_channel`, 0-based,
+// in frames of `n_frame_channels` channels sent from the device by the helper process.
+// Returns false if the device cannot transmit. Only the helper process backend on Linux can transmit.
+bool capdev_transmit(capdev_t *dev, int n_frame_channels, int first_channel, const float *const *data, int n_channels,
+		     uint32_t n_samples);
+void capdev_transmit_stop(capdev_t *dev);
+
+const char *capdev_default_backend(void);
+void capdev_enum_backends(void (*cb)(const char *id, void *param), void *param);
 void capdev_enum_devices(void (*cb)(const char *name, const char *description, void *param), void *param);
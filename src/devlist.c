@@ -0,0 +1,405 @@
+#ifdef __linux__
+#define _GNU_SOURCE // pipe2
+#endif
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include "plugin-macros.generated.h"
+#include "capdev.h"
+#include "devlist.h"
+#include "capdev-proc.h"
+
+#ifdef OS_LINUX
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#endif
+
+// Without netlink notifications, refresh when the properties are opened and the list is older than this.
+#define REFRESH_INTERVAL_NS (60 * 1000000000ULL)
+#define REAC_SEEN_TIMEOUT_NS (60 * 1000000000ULL)
+#define INITIAL_WAIT_MS 1000
+
+struct devlist_item
+{
+	char *name;
+	char *description;
+	uint64_t reac_seen_ns;
+};
+
+struct devlist_s
+{
+	pthread_mutex_t mutex;
+	pthread_t thread;
+	bool thread_started;
+
+	DARRAY(struct devlist_item) items;
+	uint64_t refreshed_ns;
+	bool populated;
+
+	volatile bool exiting;
+	volatile bool refresh_requested;
+
+#ifdef OS_LINUX
+	int fd_netlink;
+	int pipe_wakeup[2];
+#else
+	os_event_t *event;
+#endif
+};
+
+static struct devlist_s dl = {
+	.mutex = PTHREAD_MUTEX_INITIALIZER,
+#ifdef OS_LINUX
+	.fd_netlink = -1,
+	.pipe_wakeup = {-1, -1},
+#endif
+};
+
+static void items_free(struct devlist_item *array, size_t num)
+{
+	for (size_t i = 0; i < num; i++) {
+		bfree(array[i].name);
+		bfree(array[i].description);
+	}
+}
+
+static void enum_cb(const char *name, const char *description, void *param)
+{
+	DARRAY(struct devlist_item) *items = param;
+	struct devlist_item item = {
+		.name = bstrdup(name),
+		.description = bstrdup(description),
+	};
+	da_push_back(*items, &item);
+}
+
+static bool items_equal(const struct devlist_item *a, size_t na, const struct devlist_item *b, size_t nb)
+{
+	if (na != nb)
+		return false;
+	for (size_t i = 0; i < na; i++) {
+		if (strcmp(a[i].name, b[i].name) != 0 || strcmp(a[i].description, b[i].description) != 0)
+			return false;
+	}
+	return true;
+}
+
+static void refresh()
+{
+	DARRAY(struct devlist_item) items;
+	da_init(items);
+
+	uint64_t t0 = os_gettime_ns();
+	capdev_enum_devices(enum_cb, &items);
+	uint64_t t1 = os_gettime_ns();
+
+	pthread_mutex_lock(&dl.mutex);
+
+	for (size_t i = 0; i < items.num; i++) {
+		for (size_t j = 0; j < dl.items.num; j++) {
+			if (strcmp(items.array[i].name, dl.items.array[j].name) == 0) {
+				items.array[i].reac_seen_ns = dl.items.array[j].reac_seen_ns;
+				break;
+			}
+		}
+	}
+
+	bool changed = !items_equal(items.array, items.num, dl.items.array, dl.items.num);
+
+	items_free(dl.items.array, dl.items.num);
+	da_free(dl.items);
+	dl.items.da = items.da;
+	dl.refreshed_ns = t1;
+	dl.populated = true;
+
+	if (changed) {
+		blog(LOG_INFO, "Available devices (%.1f ms):", (t1 - t0) * 1e-6);
+		for (size_t i = 0; i < dl.items.num; i++)
+			blog(LOG_INFO, " '%s' '%s'", dl.items.array[i].name, dl.items.array[i].description);
+	}
+
+	pthread_mutex_unlock(&dl.mutex);
+}
+
+#ifdef OS_LINUX
+static int open_netlink()
+{
+	int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_ROUTE);
+	if (fd < 0) {
+		blog(LOG_WARNING, "devlist: failed to open netlink socket");
+		return -1;
+	}
+
+	struct sockaddr_nl sa = {
+		.nl_family = AF_NETLINK,
+		.nl_groups = RTMGRP_LINK,
+	};
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		blog(LOG_WARNING, "devlist: failed to bind netlink socket");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+static bool drain_netlink(int fd)
+{
+	bool changed = false;
+	char buf[8192] __attribute__((aligned(NLMSG_ALIGNTO)));
+	ssize_t len;
+	while ((len = recv(fd, buf, sizeof(buf), 0)) > 0) {
+		struct nlmsghdr *nh = (struct nlmsghdr *)buf;
+		for (; NLMSG_OK(nh, (size_t)len); nh = NLMSG_NEXT(nh, len)) {
+			if (nh->nlmsg_type == RTM_NEWLINK || nh->nlmsg_type == RTM_DELLINK)
+				changed = true;
+		}
+	}
+	return changed;
+}
+
+static void wakeup()
+{
+	if (dl.pipe_wakeup[1] >= 0) {
+		char c = 0;
+		if (write(dl.pipe_wakeup[1], &c, 1) < 0)
+			blog(LOG_ERROR, "devlist: failed to wake up the thread");
+	}
+}
+
+// Returns true if the device list should be refreshed.
+static bool wait_for_change()
+{
+	struct pollfd fds[2] = {
+		{.fd = dl.pipe_wakeup[0], .events = POLLIN},
+		{.fd = dl.fd_netlink, .events = POLLIN},
+	};
+	int ret = poll(fds, dl.fd_netlink >= 0 ? 2 : 1, -1);
+	if (ret <= 0)
+		return false;
+
+	if (fds[0].revents & POLLIN) {
+		char buf[16];
+		if (read(dl.pipe_wakeup[0], buf, sizeof(buf)) < 0)
+			blog(LOG_ERROR, "devlist: failed to read from the pipe");
+	}
+
+	bool changed = false;
+	if (dl.fd_netlink >= 0 && fds[1].revents & POLLIN) {
+		changed = drain_netlink(dl.fd_netlink);
+		if (changed) {
+			// Interfaces tend to change in bursts. Wait a little to coalesce them.
+			os_sleep_ms(200);
+			drain_netlink(dl.fd_netlink);
+		}
+	}
+
+	return changed;
+}
+#else  // !OS_LINUX
+static void wakeup()
+{
+	if (dl.event)
+		os_event_signal(dl.event);
+}
+
+static bool wait_for_change()
+{
+	os_event_wait(dl.event);
+	return false;
+}
+#endif // OS_LINUX
+
+static void *thread_main(void *data)
+{
+	UNUSED_PARAMETER(data);
+	os_set_thread_name("h8819-devlist");
+
+	refresh();
+
+	while (!os_atomic_load_bool(&dl.exiting)) {
+		bool changed = wait_for_change();
+		if (os_atomic_load_bool(&dl.exiting))
+			break;
+
+		if (os_atomic_load_bool(&dl.refresh_requested))
+			changed = true;
+
+		if (changed) {
+			os_atomic_set_bool(&dl.refresh_requested, false);
+			refresh();
+		}
+	}
+
+	return NULL;
+}
+
+void devlist_init()
+{
+	dl.exiting = false;
+	dl.refresh_requested = false;
+
+#ifdef OS_LINUX
+	if (pipe2(dl.pipe_wakeup, O_CLOEXEC | O_NONBLOCK) < 0) {
+		blog(LOG_ERROR, "devlist: failed to create pipe");
+		return;
+	}
+	dl.fd_netlink = open_netlink();
+#else
+	if (os_event_init(&dl.event, OS_EVENT_TYPE_AUTO) != 0) {
+		blog(LOG_ERROR, "devlist: failed to create event");
+		return;
+	}
+#endif
+
+	if (pthread_create(&dl.thread, NULL, thread_main, NULL) != 0) {
+		blog(LOG_ERROR, "devlist: failed to create thread");
+		return;
+	}
+	dl.thread_started = true;
+}
+
+void devlist_shutdown()
+{
+	if (dl.thread_started) {
+		os_atomic_set_bool(&dl.exiting, true);
+		wakeup();
+		pthread_join(dl.thread, NULL);
+		dl.thread_started = false;
+	}
+
+#ifdef OS_LINUX
+	if (dl.fd_netlink >= 0)
+		close(dl.fd_netlink);
+	for (int i = 0; i < 2; i++) {
+		if (dl.pipe_wakeup[i] >= 0)
+			close(dl.pipe_wakeup[i]);
+	}
+	dl.fd_netlink = -1;
+	dl.pipe_wakeup[0] = dl.pipe_wakeup[1] = -1;
+#else
+	os_event_destroy(dl.event);
+	dl.event = NULL;
+#endif
+
+	pthread_mutex_lock(&dl.mutex);
+	items_free(dl.items.array, dl.items.num);
+	da_free(dl.items);
+	dl.populated = false;
+	pthread_mutex_unlock(&dl.mutex);
+}
+
+void devlist_request_refresh()
+{
+	pthread_mutex_lock(&dl.mutex);
+	bool stale = dl.populated && os_gettime_ns() - dl.refreshed_ns > REFRESH_INTERVAL_NS;
+	pthread_mutex_unlock(&dl.mutex);
+
+#ifdef OS_LINUX
+	// Netlink tells us the change. Just refresh in case the socket is not available.
+	if (dl.fd_netlink >= 0)
+		stale = false;
+#endif
+
+	if (stale) {
+		os_atomic_set_bool(&dl.refresh_requested, true);
+		wakeup();
+	}
+}
+
+static void wait_populated_locked()
+{
+	// The first enumeration is running just after loading the module. Wait a moment for it.
+	for (int i = 0; !dl.populated && dl.thread_started && i < INITIAL_WAIT_MS / 10; i++) {
+		pthread_mutex_unlock(&dl.mutex);
+		os_sleep_ms(10);
+		pthread_mutex_lock(&dl.mutex);
+	}
+}
+
+void devlist_enum(void (*cb)(const char *name, const char *description, bool reac_seen, void *param), void *param)
+{
+	pthread_mutex_lock(&dl.mutex);
+	wait_populated_locked();
+
+	uint64_t now = os_gettime_ns();
+	for (int pass = 0; pass < 2; pass++) {
+		for (size_t i = 0; i < dl.items.num; i++) {
+			const struct devlist_item *item = dl.items.array + i;
+			bool reac_seen = item->reac_seen_ns && now - item->reac_seen_ns < REAC_SEEN_TIMEOUT_NS;
+			if (reac_seen == (pass == 0))
+				cb(item->name, item->description, reac_seen, param);
+		}
+	}
+
+	pthread_mutex_unlock(&dl.mutex);
+}
+
+struct fill_property_s
+{
+	obs_property_t *prop;
+	const char *current;
+	bool found_current;
+};
+
+static void fill_property_cb(const char *name, const char *description, bool reac_seen, void *param)
+{
+	struct fill_property_s *ctx = param;
+
+	if (ctx->current && strcmp(name, ctx->current) == 0)
+		ctx->found_current = true;
+
+	if (reac_seen) {
+		struct dstr desc = {0};
+		dstr_printf(&desc, "%s (%s)", description, obs_module_text("REAC detected"));
+		obs_property_list_add_string(ctx->prop, desc.array, name);
+		dstr_free(&desc);
+	}
+	else {
+		obs_property_list_add_string(ctx->prop, description, name);
+	}
+}
+
+void devlist_fill_property(obs_property_t *prop, const char *current)
+{
+	struct fill_property_s ctx = {
+		.prop = prop,
+		.current = current,
+	};
+	devlist_enum(fill_property_cb, &ctx);
+	if (current && *current && !ctx.found_current)
+		obs_property_list_add_string(prop, current, current);
+}
+
+static void mark_reac_seen_locked(const char *name, size_t len, uint64_t now)
+{
+	for (size_t i = 0; i < dl.items.num; i++) {
+		const char *item_name = dl.items.array[i].name;
+		if (strncmp(item_name, name, len) == 0 && item_name[len] == '\0') {
+			dl.items.array[i].reac_seen_ns = now;
+			break;
+		}
+	}
+}
+
+void devlist_mark_reac_seen(const char *name)
+{
+	uint64_t now = os_gettime_ns();
+	pthread_mutex_lock(&dl.mutex);
+	// Each interface of a redundant device has received the frames.
+	for (const char *s = name;;) {
+		const char *e = strchr(s, CAPDEV_PROC_LEG_DELIM);
+		size_t len = e ? (size_t)(e - s) : strlen(s);
+		mark_reac_seen_locked(s, len, now);
+		if (!e)
+			break;
+		s = e + 1;
+	}
+	pthread_mutex_unlock(&dl.mutex);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <obs.h>
+
+void devlist_init(void);
+void devlist_shutdown(void);
+
+// Request a refresh in the background if the list was not refreshed recently.
+void devlist_request_refresh(void);
+
+// List the cached devices. Devices on which REAC packets were seen recently come first.
+void devlist_enum(void (*cb)(const char *name, const char *description, bool reac_seen, void *param), void *param);
+
+// Add the cached devices to the list property. `current` is added by its name if it is not in the list.
+void devlist_fill_property(obs_property_t *prop, const char *current);
+
+// Called from the capture thread to tell that REAC packets are arriving on the device.
+// Each interface of a redundant device `a+b` is marked.
+void devlist_mark_reac_seen(const char *name);
@@ -0,0 +1,404 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include "h8819.h"
+#include "flightrec.h"
+#include "probes.h"
+
+#define PCAP_RECORD_HEADER_LEN 16
+// Frames longer than this are truncated in the ring, which pcap allows.
+#define MAX_CAPLEN (H8819_L2_HEADER_LEN + H8819_MAX_PAYLOAD_LEN + H8819_TRAILER_LEN)
+#define MAX_RECORD_LEN (PCAP_RECORD_HEADER_LEN + MAX_CAPLEN)
+// The traffic is measured for this long before the ring is sized for it.
+#define MEASURE_NS 250000000LL
+// At least one stream of the common geometry
+#define MIN_FRAMES_PER_SECOND (H8819_SAMPLE_RATE / H8819_N_SAMPLES)
+#define MIN_BYTES_PER_SECOND \
+	(MIN_FRAMES_PER_SECOND * (PCAP_RECORD_HEADER_LEN + H8819_L2_HEADER_LEN + H8819_PAYLOAD_LEN + H8819_TRAILER_LEN))
+#define MAX_EVENTS 8
+
+enum ring_state_e
+{
+	RING_MEASURING,
+	RING_MEASURED, // waiting for the background thread to allocate the ring
+	RING_READY,
+	RING_FAILED,
+};
+
+struct entry_s
+{
+	uint64_t pos;
+	int64_t timestamp;
+};
+
+struct event_s
+{
+	int64_t start;
+	int64_t end;
+	int64_t timestamp;
+	int64_t deadline; // realtime clock, in case frames stop arriving
+	char reason[16];
+};
+
+struct flightrec_s
+{
+	char *directory;
+	int64_t before_ns;
+	int64_t after_ns;
+	int64_t window_max_ns;
+	uint32_t n_seconds;
+
+	// Written only by the capture thread until the state becomes `RING_MEASURED`
+	int64_t measure_start;
+	int64_t measure_ns;
+	uint64_t measure_bytes;
+	uint64_t measure_frames;
+	_Atomic int state;
+
+	// Allocated by the background thread, then written only by the capture thread
+	uint8_t *ring;
+	size_t ring_size;
+	struct entry_s *entries; // indexed by the sequence number
+	uint64_t n_entries;
+	_Atomic uint64_t write_pos;
+	_Atomic uint64_t seq;
+	_Atomic int64_t last_timestamp;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct event_s events[MAX_EVENTS];
+	int n_events;
+	bool exiting;
+};
+
+static int64_t gettime_realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void ring_write(struct flightrec_s *fr, uint64_t pos, const void *data, size_t size)
+{
+	size_t offset = pos % fr->ring_size;
+	size_t n = fr->ring_size - offset;
+	if (n > size)
+		n = size;
+	memcpy(fr->ring + offset, data, n);
+	memcpy(fr->ring, (const uint8_t *)data + n, size - n);
+}
+
+static void ring_read(const struct flightrec_s *fr, void *data, uint64_t pos, size_t size)
+{
+	size_t offset = pos % fr->ring_size;
+	size_t n = fr->ring_size - offset;
+	if (n > size)
+		n = size;
+	memcpy(data, fr->ring + offset, n);
+	memcpy((uint8_t *)data + n, fr->ring, size - n);
+}
+
+// Accumulates the traffic of the first frames so that the ring does not need to assume the largest frames.
+static void measure(struct flightrec_s *fr, uint32_t record_len, int64_t timestamp)
+{
+	if (!fr->measure_frames)
+		fr->measure_start = timestamp;
+	fr->measure_bytes += record_len;
+	fr->measure_frames++;
+	if (timestamp - fr->measure_start < MEASURE_NS)
+		return;
+	fr->measure_ns = timestamp - fr->measure_start;
+
+	pthread_mutex_lock(&fr->mutex);
+	atomic_store_explicit(&fr->state, RING_MEASURED, memory_order_relaxed);
+	pthread_cond_broadcast(&fr->cond);
+	pthread_mutex_unlock(&fr->mutex);
+}
+
+void flightrec_push(struct flightrec_s *fr, const uint8_t *data, uint32_t caplen, int64_t timestamp)
+{
+	int state = atomic_load_explicit(&fr->state, memory_order_acquire);
+	if (state != RING_READY) {
+		if (state == RING_MEASURING)
+			measure(fr, PCAP_RECORD_HEADER_LEN + (caplen < MAX_CAPLEN ? caplen : MAX_CAPLEN), timestamp);
+		atomic_store_explicit(&fr->last_timestamp, timestamp, memory_order_release);
+		return;
+	}
+
+	uint32_t hdr[4] = {
+		(uint32_t)(timestamp / 1000000000),
+		(uint32_t)(timestamp % 1000000000),
+		caplen < MAX_CAPLEN ? caplen : MAX_CAPLEN,
+		caplen,
+	};
+
+	uint64_t pos = atomic_load_explicit(&fr->write_pos, memory_order_relaxed);
+	uint64_t s = atomic_load_explicit(&fr->seq, memory_order_relaxed);
+
+	// Pairs with the acquire fence in `still_valid`. A reader that sees any byte or entry stored below
+	// also sees `seq` and `write_pos` of the previous push, so it rejects what this push overwrites.
+	atomic_thread_fence(memory_order_release);
+
+	ring_write(fr, pos, hdr, sizeof(hdr));
+	ring_write(fr, pos + sizeof(hdr), data, hdr[2]);
+	fr->entries[s % fr->n_entries] = (struct entry_s){.pos = pos, .timestamp = timestamp};
+
+	atomic_store_explicit(&fr->write_pos, pos + sizeof(hdr) + hdr[2], memory_order_release);
+	atomic_store_explicit(&fr->seq, s + 1, memory_order_release);
+	atomic_store_explicit(&fr->last_timestamp, timestamp, memory_order_release);
+}
+
+// Whether the entry `s` and its bytes at `pos` were intact while being read.
+static bool still_valid(const struct flightrec_s *fr, uint64_t s, uint64_t pos)
+{
+	atomic_thread_fence(memory_order_acquire);
+	uint64_t seq = atomic_load_explicit(&fr->seq, memory_order_acquire);
+	uint64_t write_pos = atomic_load_explicit(&fr->write_pos, memory_order_acquire);
+	// The capture thread might be writing the next record.
+	return seq - s < fr->n_entries && write_pos + MAX_RECORD_LEN <= pos + fr->ring_size;
+}
+
+static FILE *open_dump_file(const struct flightrec_s *fr, const struct event_s *ev, char **path)
+{
+	time_t t = (time_t)(ev->timestamp / 1000000000);
+	struct tm tm;
+	localtime_r(&t, &tm);
+	char base[32];
+	strftime(base, sizeof(base), "h8819-%Y%m%d-%H%M%S", &tm);
+
+	size_t len = strlen(fr->directory) + sizeof(base) + sizeof(ev->reason) + 16;
+	*path = malloc(len);
+	for (int i = 0; i < 100; i++) {
+		if (i == 0)
+			snprintf(*path, len, "%s/%s-%s.pcap", fr->directory, base, ev->reason);
+		else
+			snprintf(*path, len, "%s/%s-%s-%d.pcap", fr->directory, base, ev->reason, i);
+		int fd = open(*path, O_WRONLY | O_CREAT | O_EXCL, 0644);
+		if (fd >= 0)
+			return fdopen(fd, "wb");
+		if (errno != EEXIST)
+			break;
+	}
+	fprintf(stderr, "Error: flight recorder: cannot create '%s': %s\n", *path, strerror(errno));
+	return NULL;
+}
+
+static void dump(struct flightrec_s *fr, const struct event_s *ev)
+{
+	char *path = NULL;
+	FILE *fp = open_dump_file(fr, ev, &path);
+	if (!fp) {
+		free(path);
+		return;
+	}
+
+	// pcap with nanosecond timestamps, Ethernet
+	const uint32_t magic = 0xA1B23C4D;
+	const uint16_t version[2] = {2, 4};
+	const uint32_t rest[4] = {0, 0, MAX_CAPLEN, 1};
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(version, sizeof(version), 1, fp);
+	fwrite(rest, sizeof(rest), 1, fp);
+
+	uint8_t *rec = malloc(MAX_RECORD_LEN);
+	int n_written = 0;
+	int64_t first_timestamp = 0;
+	uint64_t seq = atomic_load_explicit(&fr->seq, memory_order_acquire);
+	uint64_t s = seq >= fr->n_entries ? seq - fr->n_entries + 1 : 0;
+	for (; s < seq; s++) {
+		struct entry_s e = fr->entries[s % fr->n_entries];
+		if (!still_valid(fr, s, e.pos))
+			continue;
+		if (e.timestamp < ev->start)
+			continue;
+		if (e.timestamp > ev->end)
+			break;
+
+		uint32_t hdr[4];
+		ring_read(fr, hdr, e.pos, sizeof(hdr));
+		if (hdr[2] > MAX_CAPLEN)
+			hdr[2] = MAX_CAPLEN;
+		memcpy(rec, hdr, sizeof(hdr));
+		ring_read(fr, rec + sizeof(hdr), e.pos + sizeof(hdr), hdr[2]);
+		if (!still_valid(fr, s, e.pos))
+			continue;
+
+		fwrite(rec, sizeof(hdr) + hdr[2], 1, fp);
+		if (!n_written++)
+			first_timestamp = e.timestamp;
+	}
+	free(rec);
+
+	// Frames are 250 us apart. A later first frame means the ring did not cover the window.
+	bool truncated = !n_written || first_timestamp - ev->start > 1000000;
+	if (fclose(fp) != 0)
+		fprintf(stderr, "Error: flight recorder: failed to write '%s'\n", path);
+	else
+		fprintf(stderr, "Info: flight recorder: wrote %d frames around '%s' to '%s'%s\n", n_written, ev->reason,
+			path, truncated ? ", the beginning was not available" : "");
+	H8819_PROBE2(flightrec_dump, n_written, truncated);
+	free(path);
+}
+
+// Sizes the ring for the measured traffic during the whole window, with a quarter of margin.
+static void allocate_ring(struct flightrec_s *fr)
+{
+	uint64_t bytes_per_second = fr->measure_bytes * 1000000000ULL / (uint64_t)fr->measure_ns;
+	uint64_t frames_per_second = fr->measure_frames * 1000000000ULL / (uint64_t)fr->measure_ns;
+	if (bytes_per_second < MIN_BYTES_PER_SECOND)
+		bytes_per_second = MIN_BYTES_PER_SECOND;
+	if (frames_per_second < MIN_FRAMES_PER_SECOND)
+		frames_per_second = MIN_FRAMES_PER_SECOND;
+
+	size_t ring_size = (size_t)(bytes_per_second * fr->n_seconds * 5 / 4) + MAX_RECORD_LEN;
+	uint64_t n_entries = frames_per_second * fr->n_seconds * 5 / 4;
+	uint8_t *ring = malloc(ring_size);
+	struct entry_s *entries = calloc(n_entries, sizeof(struct entry_s));
+	if (!ring || !entries) {
+		fprintf(stderr, "Error: flight recorder: failed to allocate %zu MiB\n", ring_size / (1024 * 1024));
+		free(entries);
+		free(ring);
+		atomic_store_explicit(&fr->state, RING_FAILED, memory_order_relaxed);
+		return;
+	}
+
+	fr->ring = ring;
+	fr->ring_size = ring_size;
+	fr->entries = entries;
+	fr->n_entries = n_entries;
+	fprintf(stderr, "Info: flight recorder: %" PRIu64 " frames per second, %zu MiB\n", frames_per_second,
+		ring_size / (1024 * 1024));
+	atomic_store_explicit(&fr->state, RING_READY, memory_order_release);
+}
+
+static void *dump_thread(void *data)
+{
+	struct flightrec_s *fr = data;
+
+	pthread_mutex_lock(&fr->mutex);
+	while (true) {
+		if (!fr->exiting && atomic_load_explicit(&fr->state, memory_order_relaxed) == RING_MEASURED) {
+			pthread_mutex_unlock(&fr->mutex);
+			allocate_ring(fr);
+			pthread_mutex_lock(&fr->mutex);
+			continue;
+		}
+
+		if (!fr->n_events) {
+			if (fr->exiting)
+				break;
+			pthread_cond_wait(&fr->cond, &fr->mutex);
+			continue;
+		}
+
+		struct event_s ev = fr->events[0];
+		int64_t now = gettime_realtime_ns();
+		if (!fr->exiting && atomic_load(&fr->last_timestamp) < ev.end && now < ev.deadline) {
+			int64_t until = now + 100000000;
+			struct timespec ts = {.tv_sec = until / 1000000000, .tv_nsec = until % 1000000000};
+			pthread_cond_timedwait(&fr->cond, &fr->mutex, &ts);
+			continue;
+		}
+
+		fr->n_events--;
+		memmove(fr->events, fr->events + 1, sizeof(struct event_s) * fr->n_events);
+		pthread_mutex_unlock(&fr->mutex);
+
+		dump(fr, &ev);
+
+		pthread_mutex_lock(&fr->mutex);
+	}
+	pthread_mutex_unlock(&fr->mutex);
+
+	return NULL;
+}
+
+struct flightrec_s *flightrec_create(const struct flightrec_config_s *cfg)
+{
+	struct flightrec_s *fr = calloc(1, sizeof(struct flightrec_s));
+	if (!fr)
+		return NULL;
+
+	fr->directory = strdup(cfg->directory);
+	fr->before_ns = cfg->seconds_before * 1000000000LL;
+	fr->after_ns = cfg->seconds_after * 1000000000LL;
+	fr->window_max_ns = fr->before_ns + fr->after_ns + 1000000000LL;
+	// One more second for the delay to write the file
+	fr->n_seconds = cfg->seconds_before + cfg->seconds_after + 2;
+
+	// The ring is allocated once the traffic is known.
+	pthread_mutex_init(&fr->mutex, NULL);
+	pthread_cond_init(&fr->cond, NULL);
+	if (pthread_create(&fr->thread, NULL, dump_thread, fr) != 0) {
+		fputs("Error: flight recorder: failed to start\n", stderr);
+		pthread_mutex_destroy(&fr->mutex);
+		pthread_cond_destroy(&fr->cond);
+		free(fr->directory);
+		free(fr);
+		return NULL;
+	}
+
+	fprintf(stderr, "Info: flight recorder: keeping %u s before and %u s after events\n", cfg->seconds_before,
+		cfg->seconds_after);
+	return fr;
+}
+
+void flightrec_destroy(struct flightrec_s *fr)
+{
+	if (!fr)
+		return;
+
+	pthread_mutex_lock(&fr->mutex);
+	fr->exiting = true;
+	pthread_cond_broadcast(&fr->cond);
+	pthread_mutex_unlock(&fr->mutex);
+	pthread_join(fr->thread, NULL);
+
+	pthread_mutex_destroy(&fr->mutex);
+	pthread_cond_destroy(&fr->cond);
+	free(fr->entries);
+	free(fr->ring);
+	free(fr->directory);
+	free(fr);
+}
+
+void flightrec_trigger(struct flightrec_s *fr, const char *reason, int64_t timestamp)
+{
+	H8819_PROBE1(flightrec_trigger, timestamp);
+	pthread_mutex_lock(&fr->mutex);
+
+	struct event_s *last = fr->n_events ? fr->events + fr->n_events - 1 : NULL;
+	if (last && timestamp <= last->end && timestamp + fr->after_ns - last->start <= fr->window_max_ns) {
+		// Merge a burst of events into one file.
+		last->end = timestamp + fr->after_ns;
+		last->deadline = gettime_realtime_ns() + fr->after_ns + 1000000000LL;
+	}
+	else if (fr->n_events < MAX_EVENTS) {
+		struct event_s *ev = fr->events + fr->n_events++;
+		ev->start = timestamp - fr->before_ns;
+		ev->end = timestamp + fr->after_ns;
+		ev->timestamp = timestamp;
+		ev->deadline = gettime_realtime_ns() + fr->after_ns + 1000000000LL;
+		snprintf(ev->reason, sizeof(ev->reason), "%s", reason);
+		fprintf(stderr, "Info: flight recorder: event '%s'\n", reason);
+	}
+
+	pthread_cond_broadcast(&fr->cond);
+	pthread_mutex_unlock(&fr->mutex);
+}
+
+void flightrec_trigger_now(struct flightrec_s *fr, const char *reason)
+{
+	int64_t timestamp = atomic_load(&fr->last_timestamp);
+	if (!timestamp)
+		timestamp = gettime_realtime_ns();
+	flightrec_trigger(fr, reason, timestamp);
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+/*
+ * Packet flight recorder used by the capture helper and h8819-cat.
+ *
+ * The last few seconds of raw frames are kept in a preallocated ring as pcap records.
+ * The capture thread appends to the ring without a lock.
+ * When an event is triggered, a background thread waits for the seconds after the event
+ * and writes the window around the event to a pcap file.
+ */
+
+#include <stdint.h>
+
+struct flightrec_config_s
+{
+	const char *directory;
+	uint32_t seconds_before;
+	uint32_t seconds_after;
+};
+
+struct flightrec_s;
+
+struct flightrec_s *flightrec_create(const struct flightrec_config_s *cfg);
+
+/* Writes the pending events and stops the background thread. */
+void flightrec_destroy(struct flightrec_s *fr);
+
+/* Called from the capture thread for every frame including invalid ones. */
+void flightrec_push(struct flightrec_s *fr, const uint8_t *data, uint32_t caplen, int64_t timestamp);
+
+/* Request to write the window around `timestamp`.
+ * Events within the window of a pending event extend it instead of creating another file.
+ * `reason` is a short word used in the file name. */
+void flightrec_trigger(struct flightrec_s *fr, const char *reason, int64_t timestamp);
+
+/* Same as `flightrec_trigger` at the timestamp of the latest frame. */
+void flightrec_trigger_now(struct flightrec_s *fr, const char *reason);
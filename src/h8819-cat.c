@@ -0,0 +1,628 @@
+/*
+ * h8819-cat - dump REAC channels or statistics without OBS
+ *
+ * Usage:
+ *   h8819-cat [-i interface | -r file.pcap] [-c channels] [-f s24|f32] [-o output] [-n packets] [-s] [-v]
+ *             [-m mac] [-x native|generic] [-w directory] [-W w64|rf64|caf] [-F directory]
+ *             [-T interface] [-B frames] [-R group[:port]] [-P microseconds]
+ *
+ * Only one stream is dumped, selected by the source MAC address, or the first stream seen by default.
+ * Channels are 1-based and accept a list and ranges such as `1,2,7-8`.
+ * Samples are written interleaved so that the output can be read by sox, e.g.
+ *   h8819-cat -i enp2s0 -c 1-2 | sox -t raw -r 48000 -e signed -b 24 -c 2 -L - out.wav
+ * With `-w`, the channels are recorded to a multichannel file in the directory instead.
+ * With `-F`, the packets around missing packets are saved to pcap files in the directory.
+ * With `-R`, the channels are re-streamed as RTP L24 to the multicast group and the SDP is printed.
+ * With `-T`, a test tone is transmitted from the interface. Together with `-i` on the peer of a veth pair,
+ * the statistics show the latency from queuing each frame to capturing it and the error of the intervals.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <signal.h>
+#include <time.h>
+#include <pcap.h>
+#include "h8819.h"
+#include "recorder.h"
+#include "flightrec.h"
+#include "rtp.h"
+#ifdef HAVE_TRANSMIT
+#include <math.h>
+#include <stdatomic.h>
+#include "transmit.h"
+#endif
+#ifdef HAVE_AF_XDP
+#include <poll.h>
+#include "capdev-proc-xdp.h"
+#endif
+
+enum output_format {
+	FORMAT_NONE,
+	FORMAT_S24,
+	FORMAT_F32,
+};
+
+struct context_s
+{
+	struct h8819_demux_s demux;
+	uint64_t stream_key;
+	uint64_t packets_other;
+	struct h8819_stream_s stream;
+	struct h8819_chmask_s channel_mask;
+	int n_channels;
+	enum output_format format;
+	FILE *fp;
+	struct recorder_s *recorder;
+	struct flightrec_s *flightrec;
+	struct rtp_s *rtp;
+	bool verbose;
+	bool stats;
+	long n_packets_left;
+
+	int64_t ts_first;
+	int64_t ts_last;
+	uint64_t ns_processing;
+	uint64_t stats_last_packets;
+	int64_t stats_last_ts;
+
+#ifdef HAVE_TRANSMIT
+	struct transmit_s *transmit;
+	double tone_phase;
+	_Atomic int64_t *sent_ns; // realtime clock when the frame of each counter was queued
+	uint64_t n_latency;
+	int64_t latency_sum;
+	int64_t latency_max;
+	uint64_t n_intervals;
+	int64_t interval_error_sum;
+	int64_t interval_error_max;
+#endif
+};
+
+static volatile sig_atomic_t cont = 1;
+
+static void sighandler(int sig)
+{
+	(void)sig;
+	cont = 0;
+}
+
+static uint64_t gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int64_t ts_pcap_to_ns(const struct pcap_pkthdr *pktheader)
+{
+	return pktheader->ts.tv_sec * 1000000000LL + pktheader->ts.tv_usec * 1000LL;
+}
+
+static void write_samples(struct context_s *ctx, const struct h8819_frame_s *frame)
+{
+	float fltp_buf[H8819_N_SAMPLES * (H8819_MAX_CHANNELS + 1)];
+	float *fltp_all[H8819_MAX_CHANNELS];
+	h8819_convert_to_fltp(fltp_all, fltp_buf, frame, &ctx->channel_mask);
+
+	// Channels that the frame does not have are not written.
+	uint8_t buf[H8819_N_SAMPLES * H8819_MAX_CHANNELS * 4];
+	uint8_t *ptr = buf;
+	for (uint32_t is = 0; is < frame->n_samples; is++) {
+		for (int ch = 0; ch < (int)frame->n_channels; ch++) {
+			if (!h8819_chmask_test(&ctx->channel_mask, ch))
+				continue;
+			float v = fltp_all[ch][is];
+			if (ctx->format == FORMAT_F32) {
+				memcpy(ptr, &v, sizeof(v));
+				ptr += sizeof(v);
+			}
+			else {
+				int32_t s = (int32_t)(v * 8388608.0f);
+				*ptr++ = s & 0xFF;
+				*ptr++ = (s >> 8) & 0xFF;
+				*ptr++ = (s >> 16) & 0xFF;
+			}
+		}
+	}
+
+	if (fwrite(buf, 1, ptr - buf, ctx->fp) != (size_t)(ptr - buf)) {
+		perror("fwrite");
+		cont = 0;
+	}
+}
+
+static void print_stats(struct context_s *ctx, const char *prefix)
+{
+	const struct h8819_stream_s *st = &ctx->stream;
+	double duration = (ctx->ts_last - ctx->ts_first) * 1e-9;
+	fprintf(stderr, "%s%llu packets received, %llu packets dropped, %llu invalid packets", prefix,
+		(unsigned long long)st->packets_received, (unsigned long long)st->packets_missed,
+		(unsigned long long)st->packets_invalid);
+	if (ctx->packets_other)
+		fprintf(stderr, ", %llu packets on other streams", (unsigned long long)ctx->packets_other);
+	if (duration > 0.0)
+		fprintf(stderr, ", %.1f packets/s", (double)(st->packets_received - 1) / duration);
+	if (st->packets_received)
+		fprintf(stderr, ", %.1f ns/packet", (double)ctx->ns_processing / (double)st->packets_received);
+#ifdef HAVE_TRANSMIT
+	if (ctx->n_latency)
+		fprintf(stderr, ", latency %.1f us average %.1f us max",
+			(double)ctx->latency_sum / (double)ctx->n_latency * 1e-3, (double)ctx->latency_max * 1e-3);
+	if (ctx->n_intervals)
+		fprintf(stderr, ", interval error %.1f us average %.1f us max",
+			(double)ctx->interval_error_sum / (double)ctx->n_intervals * 1e-3,
+			(double)ctx->interval_error_max * 1e-3);
+#endif
+	fputc('\n', stderr);
+}
+
+#ifdef HAVE_TRANSMIT
+#define TONE_HZ 1000.0
+#define TONE_LEVEL 0.1 // -20 dBFS
+
+static int64_t gettime_realtime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void fill_tone(uint16_t counter, float *const *fltp, int n_channels, int n_samples, void *param)
+{
+	struct context_s *ctx = param;
+	for (int is = 0; is < n_samples; is++) {
+		float v = (float)(TONE_LEVEL * sin(ctx->tone_phase));
+		for (int ch = 0; ch < n_channels; ch++)
+			fltp[ch][is] = v;
+		ctx->tone_phase += 2.0 * M_PI * TONE_HZ / H8819_SAMPLE_RATE;
+	}
+	ctx->tone_phase = fmod(ctx->tone_phase, 2.0 * M_PI);
+	atomic_store_explicit(&ctx->sent_ns[counter], gettime_realtime_ns(), memory_order_relaxed);
+}
+
+// Compare the frames that came back with the time they were queued.
+static void measure_transmit(struct context_s *ctx, const struct h8819_frame_s *frame, int ret, int64_t ts)
+{
+	uint16_t counter = frame->header->l2_counter;
+	int64_t sent = atomic_load_explicit(&ctx->sent_ns[counter], memory_order_relaxed);
+	if (sent && ts >= sent && ts - sent < 1000000000LL) {
+		int64_t latency = ts - sent;
+		ctx->n_latency++;
+		ctx->latency_sum += latency;
+		if (latency > ctx->latency_max)
+			ctx->latency_max = latency;
+	}
+
+	if (!(ret & (H8819_EVENT_FIRST | H8819_EVENT_GAP))) {
+		int64_t error = ts - ctx->ts_last - h8819_sample_time(H8819_N_SAMPLES);
+		if (error < 0)
+			error = -error;
+		ctx->n_intervals++;
+		ctx->interval_error_sum += error;
+		if (error > ctx->interval_error_max)
+			ctx->interval_error_max = error;
+	}
+}
+#endif
+
+static void got_frame(const uint8_t *data_packet, uint32_t caplen, int64_t ts, void *param)
+{
+	struct context_s *ctx = param;
+	if (!cont)
+		return;
+
+	uint64_t t0 = gettime_ns();
+
+	if (ctx->flightrec)
+		flightrec_push(ctx->flightrec, data_packet, caplen, ts);
+
+	uint64_t key = h8819_stream_key(data_packet, caplen);
+	bool created;
+	if (key && h8819_demux_get(&ctx->demux, key, &created) >= 0 && created) {
+		if (!ctx->stream_key)
+			ctx->stream_key = key;
+		if (ctx->verbose) {
+			char mac[H8819_MAC_STRLEN];
+			h8819_stream_key_to_string(mac, key);
+			fprintf(stderr, "%.6f: new stream %s%s\n", ts * 1e-9, mac,
+				key == ctx->stream_key ? " selected" : "");
+		}
+	}
+	if (key != ctx->stream_key) {
+		ctx->packets_other++;
+		return;
+	}
+
+	if (ctx->n_packets_left > 0 && --ctx->n_packets_left == 0)
+		cont = 0;
+
+	struct h8819_frame_s frame;
+	int ret = h8819_stream_feed(&ctx->stream, &frame, data_packet, caplen, ts);
+	if (ret < 0) {
+		if (ctx->verbose)
+			fprintf(stderr, "%.6f: invalid packet (%d)\n", ts * 1e-9, ret);
+		if (ctx->flightrec && ret == H8819_ERROR_TRAILER)
+			flightrec_trigger(ctx->flightrec, "trailer", ts);
+		return;
+	}
+
+#ifdef HAVE_TRANSMIT
+	if (ctx->transmit)
+		measure_transmit(ctx, &frame, ret, ts);
+#endif
+
+	if (ret & H8819_EVENT_FIRST)
+		ctx->ts_first = ts;
+	ctx->ts_last = ts;
+
+	if (ret & H8819_EVENT_GAP && ctx->verbose) {
+		fprintf(stderr, "%.6f: missing packets: counter is %d expected %d\n", ts * 1e-9,
+			(int)frame.header->l2_counter, (int)frame.counter_expected);
+	}
+	if (ret & H8819_EVENT_GAP && ctx->flightrec)
+		flightrec_trigger(ctx->flightrec, "gap", ts);
+
+	if (ctx->format != FORMAT_NONE)
+		write_samples(ctx, &frame);
+	if (ctx->recorder)
+		recorder_write_frame(ctx->recorder, &frame);
+	if (ctx->rtp)
+		rtp_write_frame(ctx->rtp, &frame);
+
+	ctx->ns_processing += gettime_ns() - t0;
+
+	if (ctx->stats && ts - ctx->stats_last_ts >= 1000000000LL) {
+		if (ctx->stats_last_ts)
+			print_stats(ctx, "");
+		ctx->stats_last_ts = ts;
+	}
+}
+
+static void got_msg(const uint8_t *data_packet, const struct pcap_pkthdr *pktheader, struct context_s *ctx)
+{
+	got_frame(data_packet, pktheader->caplen, ts_pcap_to_ns(pktheader), ctx);
+}
+
+#ifdef HAVE_AF_XDP
+static int run_xdp(const char *if_name, bool generic, struct context_s *ctx)
+{
+	struct xdp_capture_s *xc = xdp_capture_open(if_name, generic);
+	if (!xc)
+		return 1;
+
+	struct pollfd fds = {.fd = xdp_capture_get_fd(xc), .events = POLLIN};
+	while (cont) {
+		if (poll(&fds, 1, 100) > 0)
+			xdp_capture_receive(xc, got_frame, ctx);
+	}
+
+	xdp_capture_close(xc);
+	return 0;
+}
+#endif
+
+// SDP for the receivers, such as `ffplay -protocol_whitelist file,udp,rtp stream.sdp`
+static void print_sdp(const struct rtp_config_s *rtp, int n_channels)
+{
+	const char *colon = strchr(rtp->destination, ':');
+	int group_len = colon ? (int)(colon - rtp->destination) : (int)strlen(rtp->destination);
+	int port = colon ? atoi(colon + 1) : RTP_PORT_DEFAULT;
+	const char *origin = rtp->interface_address && *rtp->interface_address ? rtp->interface_address : "0.0.0.0";
+
+	fprintf(stderr,
+		"v=0\n"
+		"o=- %ld 0 IN IP4 %s\n"
+		"s=h8819-cat\n"
+		"c=IN IP4 %.*s/16\n"
+		"t=0 0\n"
+		"m=audio %d RTP/AVP %d\n"
+		"a=rtpmap:%d L24/%d/%d\n"
+		"a=ptime:%g\n"
+		"a=recvonly\n",
+		(long)time(NULL), origin, group_len, rtp->destination, port, RTP_PAYLOAD_TYPE, RTP_PAYLOAD_TYPE,
+		H8819_SAMPLE_RATE, n_channels, rtp->ptime_samples * 1000.0 / H8819_SAMPLE_RATE);
+}
+
+static void finish(struct context_s *ctx)
+{
+	if (ctx->fp && ctx->fp != stdout)
+		fclose(ctx->fp);
+	else if (ctx->fp)
+		fflush(ctx->fp);
+	recorder_destroy(ctx->recorder);
+	flightrec_destroy(ctx->flightrec);
+	rtp_destroy(ctx->rtp);
+#ifdef HAVE_TRANSMIT
+	transmit_destroy(ctx->transmit);
+	free(ctx->sent_ns);
+#endif
+
+	print_stats(ctx, "Total: ");
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr,
+		"Usage: %s [-i interface | -r file.pcap] [-c channels] [-f s24|f32] [-o output] [-n packets] [-s] [-v]\n"
+		"  -i interface  capture from the interface\n"
+		"  -r file       read packets from the pcap file\n"
+		"  -c channels   channels to dump, e.g. 1,2,7-8 (default: all)\n"
+		"  -f format     s24 or f32, interleaved little-endian (default: s24)\n"
+		"  -o output     output file (default: standard output, '-' for none)\n"
+		"  -n packets    exit after the number of packets\n"
+		"  -s            print statistics every second\n"
+		"  -v            print events\n"
+		"  -m mac        source MAC address of the stream to dump (default: the first stream)\n"
+		"  -w directory  record to a file in the directory (default output becomes none)\n"
+		"  -W format     w64, rf64, or caf for -w (default: w64)\n"
+		"  -F directory  save packets around missing packets to pcap files in the directory\n"
+		"  -R group      re-stream the channels as RTP L24 to group[:port] (default output becomes none)\n"
+		"  -P us         packet time for -R in microseconds (default: 1000)\n"
+#ifdef HAVE_TRANSMIT
+		"  -T interface  transmit a 1 kHz tone on 40 channels from the interface\n"
+		"  -B frames     frames sent at once by -T (default: 4)\n"
+#endif
+#ifdef HAVE_AF_XDP
+		"  -x mode       capture from the interface by AF_XDP, mode is native or generic\n"
+#endif
+		,
+		argv0);
+}
+
+int main(int argc, char **argv)
+{
+	const char *if_name = NULL;
+	const char *file_name = NULL;
+	const char *output_name = NULL;
+	const char *xdp_mode = NULL;
+	struct recorder_config_s record = {.format = RECORDER_FORMAT_W64};
+	struct flightrec_config_s flightrec = {.seconds_before = 5, .seconds_after = 2};
+	struct rtp_config_s rtp = {.ptime_samples = 48};
+	const char *transmit_name = NULL;
+	int transmit_batch = 0;
+	struct context_s ctx = {
+		.format = FORMAT_S24,
+		.n_packets_left = -1,
+	};
+
+	int c;
+	while ((c = getopt(argc, argv, "i:r:c:f:o:n:svm:x:w:W:F:R:P:T:B:h")) != -1) {
+		switch (c) {
+		case 'i':
+			if_name = optarg;
+			break;
+		case 'r':
+			file_name = optarg;
+			break;
+		case 'c':
+			if (!h8819_chmask_from_string(&ctx.channel_mask, optarg)) {
+				fprintf(stderr, "Error: invalid channels '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'f':
+			if (strcmp(optarg, "s24") == 0)
+				ctx.format = FORMAT_S24;
+			else if (strcmp(optarg, "f32") == 0)
+				ctx.format = FORMAT_F32;
+			else {
+				fprintf(stderr, "Error: invalid format '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'o':
+			output_name = optarg;
+			break;
+		case 'n':
+			ctx.n_packets_left = strtol(optarg, NULL, 0);
+			break;
+		case 's':
+			ctx.stats = true;
+			break;
+		case 'v':
+			ctx.verbose = true;
+			break;
+		case 'm':
+			ctx.stream_key = h8819_stream_key_from_string(optarg);
+			if (!ctx.stream_key) {
+				fprintf(stderr, "Error: invalid MAC address '%s'\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			xdp_mode = optarg;
+			break;
+		case 'w':
+			record.directory = optarg;
+			break;
+		case 'W': {
+			int format = recorder_format_from_name(optarg);
+			if (format < 0) {
+				fprintf(stderr, "Error: invalid recording format '%s'\n", optarg);
+				return 1;
+			}
+			record.format = format;
+			break;
+		}
+		case 'F':
+			flightrec.directory = optarg;
+			break;
+		case 'R':
+			rtp.destination = optarg;
+			break;
+		case 'P':
+			// 333 us is rounded to 16 samples.
+			rtp.ptime_samples = (uint32_t)((atol(optarg) * H8819_SAMPLE_RATE + 500000) / 1000000);
+			break;
+		case 'T':
+			transmit_name = optarg;
+			break;
+		case 'B':
+			transmit_batch = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+			return c == 'h' ? 0 : 1;
+		}
+	}
+
+	if ((if_name && file_name) || (!if_name && !file_name && !transmit_name) || (xdp_mode && !if_name) ||
+	    (transmit_name && file_name)) {
+		usage(argv[0]);
+		return 1;
+	}
+
+
+	if (h8819_chmask_is_empty(&ctx.channel_mask)) {
+		for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++)
+			h8819_chmask_set(&ctx.channel_mask, ch);
+	}
+	ctx.n_channels = h8819_chmask_count(&ctx.channel_mask);
+	if (ctx.n_packets_left == 0)
+		cont = 0;
+
+	if (record.directory) {
+		record.channel_mask = ctx.channel_mask;
+		ctx.recorder = recorder_create(&record);
+		if (!ctx.recorder)
+			return 1;
+		if (!output_name)
+			output_name = "-";
+	}
+
+	if (flightrec.directory) {
+		ctx.flightrec = flightrec_create(&flightrec);
+		if (!ctx.flightrec)
+			return 1;
+	}
+
+	if (rtp.destination) {
+		rtp.channel_mask = ctx.channel_mask;
+		ctx.rtp = rtp_create(&rtp);
+		if (!ctx.rtp)
+			return 1;
+		print_sdp(&rtp, ctx.n_channels);
+		if (!output_name)
+			output_name = "-";
+	}
+
+	if (!if_name && !file_name)
+		output_name = "-";
+
+	if (output_name && strcmp(output_name, "-") == 0) {
+		ctx.format = FORMAT_NONE;
+	}
+	else if (output_name) {
+		ctx.fp = fopen(output_name, "wb");
+		if (!ctx.fp) {
+			perror(output_name);
+			return 1;
+		}
+	}
+	else {
+		if (isatty(1)) {
+			fputs("Error: refusing to write samples to a terminal. Use '-o -' for no output.\n", stderr);
+			return 1;
+		}
+		ctx.fp = stdout;
+	}
+
+	if (transmit_name) {
+#ifdef HAVE_TRANSMIT
+		ctx.sent_ns = calloc(UINT16_MAX + 1, sizeof(*ctx.sent_ns));
+		struct transmit_config_s cfg = {
+			.if_name = transmit_name,
+			.n_channels = H8819_N_CHANNELS,
+			.batch = transmit_batch,
+			.fill = fill_tone,
+			.param = &ctx,
+		};
+		ctx.transmit = ctx.sent_ns ? transmit_create(&cfg) : NULL;
+		if (!ctx.transmit)
+			return 1;
+#else
+		(void)transmit_batch;
+		fputs("Error: built without transmit\n", stderr);
+		return 1;
+#endif
+	}
+
+	signal(SIGINT, sighandler);
+	signal(SIGTERM, sighandler);
+
+	if (!if_name && !file_name) {
+		while (cont)
+			usleep(100000);
+		finish(&ctx);
+		return 0;
+	}
+
+	if (xdp_mode) {
+#ifdef HAVE_AF_XDP
+		int ret = run_xdp(if_name, strcmp(xdp_mode, "generic") == 0, &ctx);
+		finish(&ctx);
+		return ret;
+#else
+		fputs("Error: built without AF_XDP\n", stderr);
+		return 1;
+#endif
+	}
+
+	char errbuf[PCAP_ERRBUF_SIZE];
+	pcap_t *p;
+	if (file_name) {
+		p = pcap_open_offline(file_name, errbuf);
+		if (!p) {
+			fprintf(stderr, "Error: %s\n", errbuf);
+			return 1;
+		}
+	}
+	else {
+		p = pcap_create(if_name, errbuf);
+		if (!p) {
+			fprintf(stderr, "Error: %s\n", errbuf);
+			return 1;
+		}
+		pcap_set_timeout(p, 44 /*[ms]*/);
+		pcap_set_buffer_size(p, 4 * 256 * 1024);
+		if (pcap_activate(p)) {
+			fprintf(stderr, "Error: pcap_activate failed %s\n", pcap_geterr(p));
+			pcap_close(p);
+			return 1;
+		}
+	}
+
+	struct bpf_program fp = {0};
+	if (pcap_compile(p, &fp, "ether proto 0x8819", 1, PCAP_NETMASK_UNKNOWN)) {
+		fprintf(stderr, "Warning: pcap_compile: %s\n", pcap_geterr(p));
+	}
+	else {
+		if (pcap_setfilter(p, &fp))
+			fprintf(stderr, "Error: pcap_setfilter: %s\n", pcap_geterr(p));
+		pcap_freecode(&fp);
+	}
+
+	while (cont) {
+		struct pcap_pkthdr *header;
+		const uint8_t *payload;
+		int ret = pcap_next_ex(p, &header, &payload);
+		if (ret == 1) {
+			got_msg(payload, header, &ctx);
+		}
+		else if (ret < 0) {
+			if (ret != PCAP_ERROR_BREAK)
+				fprintf(stderr, "Error: pcap_next_ex: %s\n", pcap_geterr(p));
+			break;
+		}
+	}
+
+	pcap_close(p);
+
+	finish(&ctx);
+
+	return 0;
+}
@@ -0,0 +1,40 @@
+#include <stdlib.h>
+#include "h8819.h"
+
+static const char *skip_space(const char *str)
+{
+	while (*str == ' ')
+		str++;
+	return str;
+}
+
+bool h8819_chmask_from_string(struct h8819_chmask_s *mask, const char *str)
+{
+	*mask = (struct h8819_chmask_s){0};
+	str = skip_space(str);
+	while (*str) {
+		char *end;
+		long first = strtol(str, &end, 10);
+		long last = first;
+		if (end == str)
+			return false;
+		end = (char *)skip_space(end);
+		if (*end == '-') {
+			str = end + 1;
+			last = strtol(str, &end, 10);
+			if (end == str)
+				return false;
+			end = (char *)skip_space(end);
+		}
+		if (first < 1 || last > H8819_MAX_CHANNELS || first > last)
+			return false;
+		for (long ch = first; ch <= last; ch++)
+			h8819_chmask_set(mask, (int)ch - 1);
+		if (*end == ',')
+			end++;
+		else if (*end)
+			return false;
+		str = skip_space(end);
+	}
+	return !h8819_chmask_is_empty(mask);
+}
@@ -0,0 +1,26 @@
+#include "h8819.h"
+
+void h8819_delay_process(struct h8819_delay_s *d, float *out, const float *in, int n_samples)
+{
+	const uint32_t mask = H8819_DELAY_RING_SAMPLES - 1;
+
+	// Write first so that a delay shorter than the frame reads the samples of this frame.
+	for (int is = 0; is < n_samples; is++)
+		d->buf[(d->pos + is) & mask] = in[is];
+	uint32_t rpos = d->pos - d->delay;
+	for (int is = 0; is < n_samples; is++)
+		out[is] = d->buf[(rpos + is) & mask];
+
+	d->pos += n_samples;
+}
+
+void h8819_delay_skip(struct h8819_delay_s *d, int n_samples)
+{
+	const uint32_t mask = H8819_DELAY_RING_SAMPLES - 1;
+	if (n_samples > H8819_DELAY_RING_SAMPLES)
+		n_samples = H8819_DELAY_RING_SAMPLES;
+
+	for (int is = 0; is < n_samples; is++)
+		d->buf[(d->pos + is) & mask] = 0.0f;
+	d->pos += n_samples;
+}
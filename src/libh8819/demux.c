@@ -0,0 +1,69 @@
+#include <stdio.h>
+#include "h8819.h"
+
+static inline unsigned int slot_of(uint64_t key)
+{
+	// Fibonacci hashing; the lower bits of MAC addresses from one vendor are not uniform.
+	return (unsigned int)((key * 0x9E3779B97F4A7C15ULL) >> 60) & (H8819_DEMUX_SLOTS - 1);
+}
+
+int h8819_demux_find(const struct h8819_demux_s *dm, uint64_t key)
+{
+	// Almost all frames come from the same stream as the previous one.
+	if (dm->n_streams > dm->last && dm->keys[dm->last] == key)
+		return dm->last;
+
+	for (unsigned int i = slot_of(key), n = 0; n < H8819_DEMUX_SLOTS; i = (i + 1) & (H8819_DEMUX_SLOTS - 1), n++) {
+		int ix = dm->slots[i] - 1;
+		if (ix < 0)
+			return -1;
+		if (dm->keys[ix] == key)
+			return ix;
+	}
+	return -1;
+}
+
+int h8819_demux_get(struct h8819_demux_s *dm, uint64_t key, bool *created)
+{
+	*created = false;
+
+	int ix = h8819_demux_find(dm, key);
+	if (ix >= 0) {
+		dm->last = ix;
+		return ix;
+	}
+
+	if (dm->n_streams >= H8819_MAX_STREAMS)
+		return -1;
+
+	unsigned int i = slot_of(key);
+	while (dm->slots[i])
+		i = (i + 1) & (H8819_DEMUX_SLOTS - 1);
+
+	ix = dm->n_streams++;
+	dm->keys[ix] = key;
+	dm->slots[i] = (int8_t)(ix + 1);
+	dm->last = ix;
+	*created = true;
+	return ix;
+}
+
+void h8819_stream_key_to_string(char buf[H8819_MAC_STRLEN], uint64_t key)
+{
+	snprintf(buf, H8819_MAC_STRLEN, "%02x:%02x:%02x:%02x:%02x:%02x", (unsigned int)(key >> 40) & 0xFF,
+		 (unsigned int)(key >> 32) & 0xFF, (unsigned int)(key >> 24) & 0xFF, (unsigned int)(key >> 16) & 0xFF,
+		 (unsigned int)(key >> 8) & 0xFF, (unsigned int)key & 0xFF);
+}
+
+uint64_t h8819_stream_key_from_string(const char *str)
+{
+	unsigned int b[6];
+	char c;
+	if (!str || sscanf(str, "%2x:%2x:%2x:%2x:%2x:%2x%c", b, b + 1, b + 2, b + 3, b + 4, b + 5, &c) != 6)
+		return 0;
+
+	uint64_t key = 1ULL << 48;
+	for (int i = 0; i < 6; i++)
+		key |= (uint64_t)b[i] << (40 - 8 * i);
+	return key;
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+/*
+ * libh8819 - REAC packet engine
+ *
+ * This library has no dependency on libobs nor libpcap so that it can be used by the plugin,
+ * the capture helper process, and standalone tools.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Geometry of the common REAC frame. Others are derived from the frame length.
+#define H8819_N_CHANNELS 40
+#define H8819_N_SAMPLES 12
+#define H8819_SAMPLE_RATE 48000
+
+// Upper limit of the channels in a frame. Channels are paired, so the number of channels in a frame is even.
+#define H8819_MAX_CHANNELS 128
+
+#define H8819_ETHER_HEADER_LEN (6 * 2 + 2)
+#define H8819_L2_HEADER_LEN (H8819_ETHER_HEADER_LEN + 2 + 2 + 32)
+#define H8819_TRAILER_LEN 2
+#define H8819_PAYLOAD_LEN (H8819_N_SAMPLES * H8819_N_CHANNELS * 3)
+#define H8819_MAX_PAYLOAD_LEN (H8819_N_SAMPLES * H8819_MAX_CHANNELS * 3)
+#define H8819_MAX_FRAME_LEN (H8819_L2_HEADER_LEN + H8819_MAX_PAYLOAD_LEN + H8819_TRAILER_LEN)
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+static inline int h8819_ctz64(uint64_t x)
+{
+#if defined(_MSC_VER)
+	unsigned long ix;
+	_BitScanForward64(&ix, x);
+	return (int)ix;
+#else
+	return __builtin_ctzll(x);
+#endif
+}
+
+/* Set of channels, bit `ch % 64` of `w[ch / 64]` for the channel `ch` */
+#define H8819_CHMASK_WORDS ((H8819_MAX_CHANNELS + 63) / 64)
+
+struct h8819_chmask_s
+{
+	uint64_t w[H8819_CHMASK_WORDS];
+};
+
+static inline void h8819_chmask_set(struct h8819_chmask_s *m, int ch)
+{
+	m->w[ch / 64] |= 1ULL << (ch % 64);
+}
+
+static inline bool h8819_chmask_test(const struct h8819_chmask_s *m, int ch)
+{
+	return (m->w[ch / 64] >> (ch % 64)) & 1;
+}
+
+static inline void h8819_chmask_or(struct h8819_chmask_s *dst, const struct h8819_chmask_s *src)
+{
+	for (int i = 0; i < H8819_CHMASK_WORDS; i++)
+		dst->w[i] |= src->w[i];
+}
+
+static inline void h8819_chmask_andnot(struct h8819_chmask_s *dst, const struct h8819_chmask_s *src)
+{
+	for (int i = 0; i < H8819_CHMASK_WORDS; i++)
+		dst->w[i] &= ~src->w[i];
+}
+
+static inline bool h8819_chmask_equal(const struct h8819_chmask_s *a, const struct h8819_chmask_s *b)
+{
+	for (int i = 0; i < H8819_CHMASK_WORDS; i++) {
+		if (a->w[i] != b->w[i])
+			return false;
+	}
+	return true;
+}
+
+static inline bool h8819_chmask_is_empty(const struct h8819_chmask_s *m)
+{
+	for (int i = 0; i < H8819_CHMASK_WORDS; i++) {
+		if (m->w[i])
+			return false;
+	}
+	return true;
+}
+
+/* Parse 1-based channels such as `1,2,7-8`. Returns false if the string is invalid or empty. */
+bool h8819_chmask_from_string(struct h8819_chmask_s *mask, const char *str);
+
+struct h8819_packet_header_s
+{
+	uint8_t dhost[6];
+	uint8_t shost[6];
+	uint8_t type[2];
+
+	uint16_t l2_counter; // assume LE
+	uint16_t l2_type;
+	uint8_t l2_unkown[32];
+};
+
+/* Return values and event flags of h8819_stream_feed */
+#define H8819_ERROR_SHORT -1
+#define H8819_ERROR_NOT_REAC -2
+#define H8819_ERROR_TRAILER -3
+#define H8819_ERROR_GEOMETRY -4
+#define H8819_ERROR_NOT_BROADCAST -5
+#define H8819_EVENT_GAP 1
+#define H8819_EVENT_FIRST 2
+
+struct h8819_frame_s
+{
+	const struct h8819_packet_header_s *header;
+	const uint8_t *payload;
+	int64_t timestamp;
+	uint32_t n_samples;
+	uint32_t n_channels;
+	uint32_t n_skipped_packets;
+	uint16_t counter_expected;
+};
+
+struct h8819_stream_s
+{
+	uint16_t counter_last;
+	bool got_packet;
+
+	uint64_t packets_received;
+	uint64_t packets_missed;
+	uint64_t packets_invalid;
+};
+
+/* Validate a frame, track the counter, and fill `frame`.
+ * Returns a negative error code if the frame is not usable, otherwise a combination of event flags. */
+int h8819_stream_feed(struct h8819_stream_s *st, struct h8819_frame_s *frame, const uint8_t *data, size_t caplen,
+		      int64_t timestamp);
+
+/* Demultiplex frames on one wire into logical streams by the source MAC address.
+ * A master and a split or slave stream have their own counter sequence. */
+#define H8819_MAX_STREAMS 8
+#define H8819_DEMUX_SLOTS 16 // power of two larger than H8819_MAX_STREAMS
+#define H8819_MAC_STRLEN 18
+
+struct h8819_demux_s
+{
+	uint64_t keys[H8819_MAX_STREAMS];
+	int n_streams;
+	int8_t slots[H8819_DEMUX_SLOTS]; // stream index + 1, 0 if empty
+	int last;
+};
+
+/* Key of the stream the frame belongs to, 0 if the frame is too short. */
+static inline uint64_t h8819_stream_key(const uint8_t *data, size_t caplen)
+{
+	if (caplen < H8819_ETHER_HEADER_LEN)
+		return 0;
+	const uint8_t *s = data + 6;
+	uint64_t key = (uint64_t)s[0] << 40 | (uint64_t)s[1] << 32 | (uint64_t)s[2] << 24 | (uint64_t)s[3] << 16 |
+		       (uint64_t)s[4] << 8 | (uint64_t)s[5];
+	return key | 1ULL << 48; // never 0 even if the address is 00:00:00:00:00:00
+}
+
+/* Returns the stream index of `key`, or -1 if not found. */
+int h8819_demux_find(const struct h8819_demux_s *dm, uint64_t key);
+
+/* Same as `h8819_demux_find` but adds a new stream if not found.
+ * `*created` is set to true if a new stream is added.
+ * Returns -1 if the table is full. */
+int h8819_demux_get(struct h8819_demux_s *dm, uint64_t key, bool *created);
+
+/* Format the key as `xx:xx:xx:xx:xx:xx`. */
+void h8819_stream_key_to_string(char buf[H8819_MAC_STRLEN], uint64_t key);
+
+/* Parse `xx:xx:xx:xx:xx:xx`. Returns 0 if the string is not a MAC address. */
+uint64_t h8819_stream_key_from_string(const char *str);
+
+static inline int h8819_count_channels(uint64_t n)
+{
+	n = (n >> 1 & 0x5555555555555555ULL) + (n & 0x5555555555555555ULL);
+	n = (n >> 2 & 0x3333333333333333ULL) + (n & 0x3333333333333333ULL);
+	n = (n >> 4 & 0x0F0F0F0F0F0F0F0FULL) + (n & 0x0F0F0F0F0F0F0F0FULL);
+	n = (n >> 8 & 0x00FF00FF00FF00FFULL) + (n & 0x00FF00FF00FF00FFULL);
+	n = (n >> 16 & 0x0000FFFF0000FFFFULL) + (n & 0x0000FFFF0000FFFFULL);
+	n = (n >> 32 & 0x00000000FFFFFFFFULL) + (n & 0x00000000FFFFFFFFULL);
+	return (int)n;
+}
+
+static inline int h8819_chmask_count(const struct h8819_chmask_s *m)
+{
+	int n = 0;
+	for (int i = 0; i < H8819_CHMASK_WORDS; i++)
+		n += h8819_count_channels(m->w[i]);
+	return n;
+}
+
+/* Number of channels in `m` that exist in a frame of `n_channels` channels. */
+static inline int h8819_chmask_count_below(const struct h8819_chmask_s *m, int n_channels)
+{
+	int n = 0;
+	for (int i = 0; i < H8819_CHMASK_WORDS && i * 64 < n_channels; i++) {
+		uint64_t w = m->w[i];
+		if (n_channels - i * 64 < 64)
+			w &= (1ULL << (n_channels - i * 64)) - 1;
+		n += h8819_count_channels(w);
+	}
+	return n;
+}
+
+/* Extract channels in `channel_mask` from the frame as planar 24-bit little-endian PCM.
+ * Channels that do not exist in the frame are skipped. */
+void h8819_convert_to_s24lep(uint8_t *dst, const struct h8819_frame_s *frame,
+			     const struct h8819_chmask_s *channel_mask);
+
+/* Extract channels in `channel_mask` from the frame as planar float.
+ * `dst` needs `frame->n_samples * (n_channels + 1)` floats.
+ * Channels not in the mask or not in the frame point to a silent buffer. */
+void h8819_convert_to_fltp(float *fltp_all[H8819_MAX_CHANNELS], float *dst, const struct h8819_frame_s *frame,
+			   const struct h8819_chmask_s *channel_mask);
+
+void h8819_s24lep_to_fltp(float *dst, const uint8_t *src, size_t n_samples);
+
+/* Build a broadcast frame of `n_channels` channels, which must be even, and `H8819_N_SAMPLES` samples
+ * from planar float. NULL in `fltp` is silent. The header fields after `l2_counter` are zero.
+ * `dst` needs `H8819_MAX_FRAME_LEN` bytes. Returns the length of the frame. */
+size_t h8819_build_frame(uint8_t *dst, const uint8_t shost[6], uint16_t counter, const float *const *fltp,
+			 int n_channels);
+
+/* Level of one channel accumulated over frames. Clear it to start a new period. */
+struct h8819_meter_s
+{
+	float peak;
+	float sum_squares;
+	uint32_t n_samples;
+	uint32_t n_clips;
+};
+
+/* Samples at the full scale of 24-bit PCM are counted as clipped. */
+#define H8819_CLIP_LEVEL (8388607.0f / 8388608.0f)
+
+void h8819_meter_update(struct h8819_meter_s *m, const float *fltp, int n_samples);
+
+/* Sum `n_in` planar channels into `out` with the linear gain `gains[i]` for the channel `in[i]`. */
+void h8819_mix(float *out, const float *const *in, const float *gains, int n_in, int n_samples);
+
+/* Delay line of one channel. `buf` has `H8819_DELAY_RING_SAMPLES` samples, initially zero. */
+#define H8819_DELAY_MAX_SAMPLES 24000 // 500 ms
+#define H8819_DELAY_RING_SAMPLES 32768 // power of two above the maximum delay and a frame
+
+struct h8819_delay_s
+{
+	float *buf;
+	uint32_t pos;
+	uint32_t delay; // samples, up to H8819_DELAY_MAX_SAMPLES
+};
+
+void h8819_delay_process(struct h8819_delay_s *d, float *out, const float *in, int n_samples);
+
+/* Advance the delay line by silence for missing packets so that the delay stays aligned. */
+void h8819_delay_skip(struct h8819_delay_s *d, int n_samples);
+
+/* Polyphase resampler from 48 kHz to another rate, shared by the channels of a stream.
+ * The channels are filtered together. The ratio can be corrected by a few ppm to follow the clock of the host. */
+#define H8819_RESAMPLE_TAPS 32
+#define H8819_RESAMPLE_MAX_UP 4 // up to 192 kHz
+#define H8819_RESAMPLE_MAX_OUTPUT (H8819_N_SAMPLES * H8819_RESAMPLE_MAX_UP + 1)
+
+struct h8819_resampler_s
+{
+	uint32_t rate_out;
+	uint64_t step_nominal; // input samples for an output sample in 32.32 fixed point
+	uint64_t step;
+	uint64_t pos; // of the next output from the start of the history in 32.32 fixed point
+	float *coeffs;
+	struct h8819_chmask_s channel_mask;
+	float history[H8819_MAX_CHANNELS][H8819_RESAMPLE_TAPS - 1];
+};
+
+/* Returns false if the rate is not supported. */
+bool h8819_resampler_init(struct h8819_resampler_s *rs, uint32_t rate_out);
+void h8819_resampler_free(struct h8819_resampler_s *rs);
+
+/* Take `ppm` more input samples for each output sample, for an input clock faster than the nominal rate. */
+void h8819_resampler_set_correction(struct h8819_resampler_s *rs, double ppm);
+
+/* Continue from the state of `src`, which runs at the same `rate_out` as `dst`. */
+void h8819_resampler_copy_state(struct h8819_resampler_s *dst, const struct h8819_resampler_s *src);
+
+/* Resample channels in `channel_mask` of up to `H8819_N_SAMPLES` samples
+ * into `fltp_out`, which have `H8819_RESAMPLE_MAX_OUTPUT` samples for each channel.
+ * `offset_ns` receives the time of the first output from the first input. Returns the number of output samples. */
+int h8819_resampler_process(struct h8819_resampler_s *rs, float *const fltp_out[H8819_MAX_CHANNELS],
+			    const float *const fltp_in[H8819_MAX_CHANNELS], const struct h8819_chmask_s *channel_mask,
+			    int n_in, int64_t *offset_ns);
+
+static inline int64_t h8819_sample_time(int n_samples)
+{
+	return n_samples * 62500LL / 3; // * 1000000000 / 48000
+}
+
+/* Estimate the offset from the packet timestamp to the host clock.
+ * The estimation has converged once a moving average of the squared corrections is small enough,
+ * which takes a few tens of packets from scratch and a few packets from a seed. */
+struct h8819_tsest_s
+{
+	int64_t ts_offset;
+	bool valid;
+
+	int64_t err_var;    // [ns^2], updated until converged
+	uint32_t n_updates; // until converged
+	bool converged;
+	bool seeded;
+};
+
+/* Start from the offset of a previous estimation if it had converged.
+ * The seed is dropped if the first packet does not agree with it. */
+void h8819_tsest_seed(struct h8819_tsest_s *est, const struct h8819_tsest_s *prev);
+
+/* `ts_host` is the host time when the first sample of the packet would have been captured.
+ * Returns the timestamp of the packet on the host clock. */
+int64_t h8819_tsest_update(struct h8819_tsest_s *est, int64_t ts_packet, int64_t ts_host);
+
+#ifdef __cplusplus
+}
+#endif
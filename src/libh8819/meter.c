@@ -0,0 +1,37 @@
+#include <math.h>
+#include "h8819.h"
+
+/* Independent accumulators so that the compiler can keep them in one vector register. */
+#define LANES 4
+
+void h8819_meter_update(struct h8819_meter_s *m, const float *fltp, int n_samples)
+{
+	float peak[LANES] = {0.0f};
+	float sum_squares[LANES] = {0.0f};
+	uint32_t n_clips[LANES] = {0};
+
+	int is = 0;
+	for (; is + LANES <= n_samples; is += LANES) {
+		for (int j = 0; j < LANES; j++) {
+			float v = fltp[is + j];
+			float a = fabsf(v);
+			peak[j] = a > peak[j] ? a : peak[j];
+			sum_squares[j] += v * v;
+			n_clips[j] += a >= H8819_CLIP_LEVEL;
+		}
+	}
+	for (; is < n_samples; is++) {
+		float v = fltp[is];
+		float a = fabsf(v);
+		peak[0] = a > peak[0] ? a : peak[0];
+		sum_squares[0] += v * v;
+		n_clips[0] += a >= H8819_CLIP_LEVEL;
+	}
+
+	for (int j = 0; j < LANES; j++) {
+		m->peak = peak[j] > m->peak ? peak[j] : m->peak;
+		m->sum_squares += sum_squares[j];
+		m->n_clips += n_clips[j];
+	}
+	m->n_samples += (uint32_t)n_samples;
+}
@@ -0,0 +1,40 @@
+#include "h8819.h"
+
+#if defined(_MSC_VER)
+#define FORCE_INLINE static __forceinline
+#else
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
+// Sums into a local buffer so that the compiler does not have to assume `out` aliases the inputs.
+FORCE_INLINE void mix_block(float *out, const float *const *in, const float *gains, int n_in, int offset,
+			    const int n_samples)
+{
+	float acc[H8819_N_SAMPLES] = {0.0f};
+
+	for (int i = 0; i < n_in; i++) {
+		const float g = gains[i];
+		if (g == 0.0f)
+			continue;
+		const float *src = in[i] + offset;
+		for (int is = 0; is < n_samples; is++)
+			acc[is] += g * src[is];
+	}
+
+	for (int is = 0; is < n_samples; is++)
+		out[offset + is] = acc[is];
+}
+
+void h8819_mix(float *out, const float *const *in, const float *gains, int n_in, int n_samples)
+{
+	// The common frame gets a kernel with a constant length, which the compiler vectorizes.
+	if (n_samples == H8819_N_SAMPLES) {
+		mix_block(out, in, gains, n_in, 0, H8819_N_SAMPLES);
+		return;
+	}
+
+	for (int offset = 0; offset < n_samples; offset += H8819_N_SAMPLES) {
+		int n = n_samples - offset < H8819_N_SAMPLES ? n_samples - offset : H8819_N_SAMPLES;
+		mix_block(out, in, gains, n_in, offset, n);
+	}
+}
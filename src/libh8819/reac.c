@@ -0,0 +1,256 @@
+#include <string.h>
+#include "h8819.h"
+#include "probes.h"
+
+int h8819_stream_feed(struct h8819_stream_s *st, struct h8819_frame_s *frame, const uint8_t *data, size_t caplen,
+		      int64_t timestamp)
+{
+	if (caplen < sizeof(struct h8819_packet_header_s) + H8819_TRAILER_LEN) {
+		st->packets_invalid++;
+		return H8819_ERROR_SHORT;
+	}
+	const struct h8819_packet_header_s *header = (const void *)data;
+
+	if (header->type[0] != 0x88 || header->type[1] != 0x19) {
+		st->packets_invalid++;
+		return H8819_ERROR_NOT_REAC;
+	}
+
+	// REAC devices broadcast the frames.
+	// The kernel filter of the helper checks it too, but AF_XDP and files are checked only here.
+	static const uint8_t broadcast[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+	if (memcmp(header->dhost, broadcast, sizeof(broadcast)) != 0) {
+		st->packets_invalid++;
+		return H8819_ERROR_NOT_BROADCAST;
+	}
+
+	if (data[caplen - 2] != 0xC2 || data[caplen - 1] != 0xEA) {
+		H8819_PROBE1(bad_trailer, caplen);
+		st->packets_invalid++;
+		return H8819_ERROR_TRAILER;
+	}
+
+	// A frame has a fixed number of samples and a pair of channels takes 6 bytes per sample.
+	// The number of channels is derived from the payload length.
+	if (caplen < H8819_L2_HEADER_LEN + H8819_TRAILER_LEN) {
+		st->packets_invalid++;
+		return H8819_ERROR_SHORT;
+	}
+	size_t payload_len = caplen - H8819_L2_HEADER_LEN - H8819_TRAILER_LEN;
+	size_t n_channels = payload_len / (H8819_N_SAMPLES * 3);
+	if (n_channels == 0 || n_channels > H8819_MAX_CHANNELS || n_channels % 2 ||
+	    n_channels * H8819_N_SAMPLES * 3 != payload_len) {
+		st->packets_invalid++;
+		return H8819_ERROR_GEOMETRY;
+	}
+
+	int ret = 0;
+	frame->header = header;
+	frame->payload = data + H8819_L2_HEADER_LEN;
+	frame->timestamp = timestamp;
+	frame->n_samples = H8819_N_SAMPLES;
+	frame->n_channels = (uint32_t)n_channels;
+	frame->n_skipped_packets = 0;
+	frame->counter_expected = header->l2_counter;
+
+	H8819_PROBE3(packet_receive, header->l2_counter, caplen, timestamp);
+
+	if (st->got_packet) {
+		uint16_t counter_exp = st->counter_last + 1;
+		frame->counter_expected = counter_exp;
+		if (counter_exp != header->l2_counter) {
+			uint16_t skipped = header->l2_counter - counter_exp;
+			frame->n_skipped_packets = skipped;
+			H8819_PROBE3(packet_gap, header->l2_counter, counter_exp, skipped);
+			ret |= H8819_EVENT_GAP;
+		}
+	}
+	else {
+		ret |= H8819_EVENT_FIRST;
+	}
+
+	st->counter_last = header->l2_counter;
+	st->got_packet = true;
+	st->packets_received++;
+	st->packets_missed += frame->n_skipped_packets;
+
+	return ret;
+}
+
+#if defined(_MSC_VER)
+#define FORCE_INLINE static __forceinline
+#else
+#define FORCE_INLINE static inline __attribute__((always_inline))
+#endif
+
+/* Geometries that get conversion kernels with constant strides.
+ * Other geometries go through the generic kernel. */
+#define H8819_GEOMETRIES(X) \
+	X(40, 12)           \
+	X(16, 12)           \
+	X(32, 12)           \
+	X(64, 12)
+
+/* Iterate channels in the mask below `n_channels` without visiting unused channels. */
+#define FOR_EACH_CHANNEL(ch, mask, n_channels)                                                       \
+	for (int iw_ = 0; iw_ < H8819_CHMASK_WORDS && iw_ * 64 < (n_channels); iw_++)                \
+		for (uint64_t bits_ = (mask)->w[iw_], ch = 0;                                         \
+		     bits_ && (ch = iw_ * 64 + h8819_ctz64(bits_)) < (uint64_t)(n_channels); bits_ &= bits_ - 1)
+
+FORCE_INLINE void convert_to_s24lep_impl(uint8_t *dptr, const uint8_t *sptr, const struct h8819_chmask_s *channel_mask,
+					 const int n_channels, const int n_samples)
+{
+	FOR_EACH_CHANNEL(ch, channel_mask, n_channels)
+	{
+		const uint8_t *sptr1 = sptr + (ch & ~1) * 3;
+		for (int is = 0; is < n_samples; is++) {
+			if ((ch & 1) == 0) {
+				*dptr++ = sptr1[3];
+				*dptr++ = sptr1[0];
+				*dptr++ = sptr1[1];
+			}
+			else {
+				*dptr++ = sptr1[4];
+				*dptr++ = sptr1[5];
+				*dptr++ = sptr1[2];
+			}
+			sptr1 += n_channels * 3;
+		}
+	}
+}
+
+void h8819_convert_to_s24lep(uint8_t *dptr, const struct h8819_frame_s *frame,
+			     const struct h8819_chmask_s *channel_mask)
+{
+#define X(c, s)                                                                       \
+	if (frame->n_channels == (c) && frame->n_samples == (s)) {                    \
+		convert_to_s24lep_impl(dptr, frame->payload, channel_mask, (c), (s)); \
+		return;                                                               \
+	}
+	H8819_GEOMETRIES(X)
+#undef X
+
+	convert_to_s24lep_impl(dptr, frame->payload, channel_mask, (int)frame->n_channels, (int)frame->n_samples);
+}
+
+FORCE_INLINE void convert_to_fltp_impl(float *fltp_all[H8819_MAX_CHANNELS], float *dptr, const uint8_t *sptr,
+				       const struct h8819_chmask_s *channel_mask, const int n_channels,
+				       const int n_samples)
+{
+	float *fltp0 = dptr;
+	for (int is = 0; is < n_samples; is++)
+		*dptr++ = 0.0f;
+
+	for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++)
+		fltp_all[ch] = fltp0;
+
+	FOR_EACH_CHANNEL(ch, channel_mask, n_channels)
+	{
+		const uint8_t *sptr1 = sptr + (ch & ~1) * 3;
+		fltp_all[ch] = dptr;
+		for (int is = 0; is < n_samples; is++) {
+			uint32_t u;
+			if ((ch & 1) == 0)
+				u = sptr1[3] | sptr1[0] << 8 | sptr1[1] << 16;
+			else
+				u = sptr1[4] | sptr1[5] << 8 | sptr1[2] << 16;
+			int s = u & 0x800000 ? (int)u - 0x1000000 : (int)u;
+			*dptr++ = (float)s / 8388608.0f;
+			sptr1 += n_channels * 3;
+		}
+	}
+}
+
+void h8819_convert_to_fltp(float *fltp_all[H8819_MAX_CHANNELS], float *dptr, const struct h8819_frame_s *frame,
+			   const struct h8819_chmask_s *channel_mask)
+{
+#define X(c, s)                                                                             \
+	if (frame->n_channels == (c) && frame->n_samples == (s)) {                          \
+		convert_to_fltp_impl(fltp_all, dptr, frame->payload, channel_mask, (c), (s)); \
+		return;                                                                     \
+	}
+	H8819_GEOMETRIES(X)
+#undef X
+
+	convert_to_fltp_impl(fltp_all, dptr, frame->payload, channel_mask, (int)frame->n_channels,
+			     (int)frame->n_samples);
+}
+
+void h8819_s24lep_to_fltp(float *ptr_dst, const uint8_t *ptr_src, size_t n_samples)
+{
+	for (size_t n = n_samples; n > 0; n--) {
+		uint32_t u = ptr_src[0] | ptr_src[1] << 8 | ptr_src[2] << 16;
+		int s = u & 0x800000 ? (int)u - 0x1000000 : (int)u;
+		*ptr_dst = (float)s / 8388608.0f;
+		ptr_src += 3;
+		ptr_dst += 1;
+	}
+}
+
+static inline uint32_t float_to_s24(float v)
+{
+	float s = v * 8388608.0f;
+	if (s != s)
+		return 0;
+	if (s >= 8388607.0f)
+		return 0x7FFFFF;
+	if (s <= -8388608.0f)
+		return 0x800000;
+	return (uint32_t)(int32_t)(s < 0.0f ? s - 0.5f : s + 0.5f) & 0xFFFFFF;
+}
+
+FORCE_INLINE void build_payload_impl(uint8_t *dptr, const float *const *fltp, const int n_channels,
+				     const int n_samples)
+{
+	for (int ch = 0; ch < n_channels; ch++) {
+		const float *src = fltp[ch];
+		uint8_t *dptr1 = dptr + (ch & ~1) * 3;
+		for (int is = 0; is < n_samples; is++) {
+			uint32_t u = src ? float_to_s24(src[is]) : 0;
+			if ((ch & 1) == 0) {
+				dptr1[3] = u & 0xFF;
+				dptr1[0] = (u >> 8) & 0xFF;
+				dptr1[1] = (u >> 16) & 0xFF;
+			}
+			else {
+				dptr1[4] = u & 0xFF;
+				dptr1[5] = (u >> 8) & 0xFF;
+				dptr1[2] = (u >> 16) & 0xFF;
+			}
+			dptr1 += n_channels * 3;
+		}
+	}
+}
+
+static void build_payload(uint8_t *dptr, const float *const *fltp, int n_channels)
+{
+#define X(c, s)                                                     \
+	if (n_channels == (c) && H8819_N_SAMPLES == (s)) {          \
+		build_payload_impl(dptr, fltp, (c), (s));           \
+		return;                                             \
+	}
+	H8819_GEOMETRIES(X)
+#undef X
+
+	build_payload_impl(dptr, fltp, n_channels, H8819_N_SAMPLES);
+}
+
+size_t h8819_build_frame(uint8_t *dst, const uint8_t shost[6], uint16_t counter, const float *const *fltp,
+			 int n_channels)
+{
+	struct h8819_packet_header_s *header = (void *)dst;
+	memset(header, 0, H8819_L2_HEADER_LEN);
+	memset(header->dhost, 0xFF, sizeof(header->dhost));
+	memcpy(header->shost, shost, sizeof(header->shost));
+	header->type[0] = 0x88;
+	header->type[1] = 0x19;
+	header->l2_counter = counter;
+
+	uint8_t *payload = dst + H8819_L2_HEADER_LEN;
+	size_t payload_len = (size_t)n_channels * H8819_N_SAMPLES * 3;
+	build_payload(payload, fltp, n_channels);
+
+	payload[payload_len] = 0xC2;
+	payload[payload_len + 1] = 0xEA;
+	return H8819_L2_HEADER_LEN + payload_len + H8819_TRAILER_LEN;
+}
@@ -0,0 +1,147 @@
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "h8819.h"
+
+#define HISTORY (H8819_RESAMPLE_TAPS - 1)
+// Position of the output in the taps of the first phase
+#define CENTER (H8819_RESAMPLE_TAPS / 2 - 1)
+#define PHASE_BITS 8
+#define N_PHASES (1 << PHASE_BITS)
+#define FRAC_BITS (32 - PHASE_BITS)
+
+static double sinc(double x)
+{
+	return x == 0.0 ? 1.0 : sin(M_PI * x) / (M_PI * x);
+}
+
+// Windowed sinc for each phase and one more to interpolate the last phase,
+// normalized so that each phase passes DC as it is.
+static void design(float *coeffs, double fc)
+{
+	const double half = H8819_RESAMPLE_TAPS / 2.0;
+
+	for (int p = 0; p <= N_PHASES; p++) {
+		float *h = coeffs + (size_t)p * H8819_RESAMPLE_TAPS;
+		double sum = 0.0;
+		for (int k = 0; k < H8819_RESAMPLE_TAPS; k++) {
+			double d = k - CENTER - (double)p / N_PHASES;
+			// Blackman window
+			double w = 0.0;
+			if (fabs(d) < half)
+				w = 0.42 + 0.5 * cos(M_PI * d / half) + 0.08 * cos(2.0 * M_PI * d / half);
+			double v = fc * sinc(fc * d) * w;
+			h[k] = (float)v;
+			sum += v;
+		}
+		for (int k = 0; k < H8819_RESAMPLE_TAPS; k++)
+			h[k] = (float)(h[k] / sum);
+	}
+}
+
+bool h8819_resampler_init(struct h8819_resampler_s *rs, uint32_t rate_out)
+{
+	*rs = (struct h8819_resampler_s){0};
+	if (!rate_out || rate_out > H8819_SAMPLE_RATE * H8819_RESAMPLE_MAX_UP)
+		return false;
+
+	rs->coeffs = malloc(sizeof(float) * (N_PHASES + 1) * H8819_RESAMPLE_TAPS);
+	if (!rs->coeffs)
+		return false;
+	// Cut off below the lower Nyquist frequency with a margin for the transition band.
+	design(rs->coeffs, (rate_out < H8819_SAMPLE_RATE ? (double)rate_out / H8819_SAMPLE_RATE : 1.0) * 0.92);
+	rs->rate_out = rate_out;
+	rs->step_nominal = ((uint64_t)H8819_SAMPLE_RATE << 32) / rate_out;
+	rs->step = rs->step_nominal;
+	return true;
+}
+
+void h8819_resampler_free(struct h8819_resampler_s *rs)
+{
+	free(rs->coeffs);
+	rs->coeffs = NULL;
+}
+
+void h8819_resampler_set_correction(struct h8819_resampler_s *rs, double ppm)
+{
+	rs->step = (uint64_t)((double)rs->step_nominal * (1.0 + ppm * 1e-6) + 0.5);
+}
+
+void h8819_resampler_copy_state(struct h8819_resampler_s *dst, const struct h8819_resampler_s *src)
+{
+	dst->step = src->step;
+	dst->pos = src->pos;
+	dst->channel_mask = src->channel_mask;
+	memcpy(dst->history, src->history, sizeof(dst->history));
+}
+
+int h8819_resampler_process(struct h8819_resampler_s *rs, float *const fltp_out[H8819_MAX_CHANNELS],
+			    const float *const fltp_in[H8819_MAX_CHANNELS], const struct h8819_chmask_s *channel_mask,
+			    int n_in, int64_t *offset_ns)
+{
+	if (n_in > H8819_N_SAMPLES)
+		n_in = H8819_N_SAMPLES;
+
+	int chs[H8819_MAX_CHANNELS];
+	int n_ch = 0;
+	for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++) {
+		if (!h8819_chmask_test(channel_mask, ch))
+			continue;
+		// A channel that starts now has no history.
+		if (!h8819_chmask_test(&rs->channel_mask, ch))
+			memset(rs->history[ch], 0, sizeof(rs->history[ch]));
+		chs[n_ch++] = ch;
+	}
+	rs->channel_mask = *channel_mask;
+
+	// Interleaved so that the innermost loop runs over the channels, which the compiler vectorizes.
+	float x[(HISTORY + H8819_N_SAMPLES) * H8819_MAX_CHANNELS];
+	for (int i = 0; i < n_ch; i++) {
+		const int ch = chs[i];
+		for (int t = 0; t < HISTORY; t++)
+			x[t * n_ch + i] = rs->history[ch][t];
+		for (int t = 0; t < n_in; t++)
+			x[(HISTORY + t) * n_ch + i] = fltp_in[ch][t];
+	}
+
+	// The first output estimates the input at `pos + CENTER` from the start of the history.
+	int64_t first = (int64_t)rs->pos - ((int64_t)(HISTORY - CENTER) << 32);
+	*offset_ns = (int64_t)((double)first * (1e9 / H8819_SAMPLE_RATE / 4294967296.0));
+
+	int n_out = 0;
+	float h[H8819_RESAMPLE_TAPS];
+	float acc[H8819_MAX_CHANNELS];
+	while ((rs->pos >> 32) < (uint64_t)n_in && n_out < H8819_RESAMPLE_MAX_OUTPUT) {
+		const uint32_t frac = (uint32_t)rs->pos;
+		const float *h0 = rs->coeffs + (size_t)(frac >> FRAC_BITS) * H8819_RESAMPLE_TAPS;
+		const float *h1 = h0 + H8819_RESAMPLE_TAPS;
+		const float f = (float)(frac & ((1U << FRAC_BITS) - 1)) * (1.0f / (1U << FRAC_BITS));
+		for (int k = 0; k < H8819_RESAMPLE_TAPS; k++)
+			h[k] = h0[k] + f * (h1[k] - h0[k]);
+
+		const float *xp = x + (size_t)(rs->pos >> 32) * n_ch;
+		for (int i = 0; i < n_ch; i++)
+			acc[i] = 0.0f;
+		for (int k = 0; k < H8819_RESAMPLE_TAPS; k++) {
+			const float hk = h[k];
+			const float *xk = xp + k * n_ch;
+			for (int i = 0; i < n_ch; i++)
+				acc[i] += hk * xk[i];
+		}
+		for (int i = 0; i < n_ch; i++)
+			fltp_out[chs[i]][n_out] = acc[i];
+
+		n_out++;
+		rs->pos += rs->step;
+	}
+	rs->pos -= (uint64_t)n_in << 32;
+
+	for (int i = 0; i < n_ch; i++) {
+		const int ch = chs[i];
+		for (int t = 0; t < HISTORY; t++)
+			rs->history[ch][t] = x[(n_in + t) * n_ch + i];
+	}
+
+	return n_out;
+}
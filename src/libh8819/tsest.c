@@ -0,0 +1,64 @@
+#include "h8819.h"
+#include "probes.h"
+
+#define K_OFFSET_DECAY (256 * 16)
+#define K_VAR_DECAY 8
+// The offset is reset if the packet arrives later than this.
+#define WINDOW_NS 70000000
+// A seed is dropped if the first packet arrives earlier than it tells by this.
+#define SEED_TOLERANCE_NS 500000
+// Without a seed, the corrections are assumed to be this large at the start
+// so that a few tens of updates without a large correction are needed.
+#define INITIAL_VAR (10000000LL * 10000000LL)
+#define CONVERGED_VAR (100000LL * 100000LL)
+#define MIN_UPDATES 8
+// Same as the fixed warm-up that was used before, in case the host is too noisy to converge.
+#define MAX_UPDATES 1024
+
+void h8819_tsest_seed(struct h8819_tsest_s *est, const struct h8819_tsest_s *prev)
+{
+	*est = (struct h8819_tsest_s){0};
+	if (prev->converged) {
+		est->ts_offset = prev->ts_offset;
+		est->seeded = true;
+	}
+}
+
+int64_t h8819_tsest_update(struct h8819_tsest_s *est, int64_t ts_packet, int64_t ts_host)
+{
+	int64_t e = ts_host - ts_packet - est->ts_offset;
+
+	if (!est->valid) {
+		est->seeded = est->seeded && e > -SEED_TOLERANCE_NS && e <= WINDOW_NS;
+		if (!est->seeded) {
+			est->ts_offset = ts_host - ts_packet;
+			e = 0;
+		}
+		est->err_var = est->seeded ? 0 : INITIAL_VAR;
+		est->valid = true;
+	}
+
+	// The offset follows the earliest arrival at once and a later arrival slowly.
+	int64_t step = e <= 0 || e > WINDOW_NS ? e : e / K_OFFSET_DECAY;
+	est->ts_offset += step;
+
+	if (!est->converged) {
+		if (step < -WINDOW_NS)
+			step = -WINDOW_NS;
+		else if (step > WINDOW_NS)
+			step = WINDOW_NS;
+		est->err_var += (step * step - est->err_var) / K_VAR_DECAY;
+
+		est->n_updates++;
+		if ((est->n_updates >= MIN_UPDATES && est->err_var < CONVERGED_VAR) || est->n_updates >= MAX_UPDATES) {
+			est->converged = true;
+			H8819_PROBE3(timestamp_converged, est->n_updates, est->err_var, est->seeded);
+		}
+	}
+
+	int64_t ts = ts_packet + est->ts_offset;
+
+	H8819_PROBE3(timestamp, ts_packet, ts_host, est->ts_offset);
+
+	return ts;
+}
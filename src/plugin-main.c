@@ -19,20 +19,32 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <obs-module.h>
 
 #include "plugin-macros.generated.h"
+#include "capdev.h"
+#include "devlist.h"
 
 OBS_DECLARE_MODULE()
 OBS_MODULE_USE_DEFAULT_LOCALE(PLUGIN_NAME, "en-US")
 
 extern const struct obs_source_info src_info;
+#ifdef OS_LINUX
+extern const struct obs_source_info transmit_filter_info;
+#endif
 
 bool obs_module_load(void)
 {
 	obs_register_source(&src_info);
+#ifdef OS_LINUX
+	obs_register_source(&transmit_filter_info);
+#endif
+	capdev_init();
+	devlist_init();
 	blog(LOG_INFO, "plugin loaded (version %s)", PLUGIN_VERSION);
 	return true;
 }
 
 void obs_module_unload()
 {
+	devlist_shutdown();
+	capdev_shutdown();
 	blog(LOG_INFO, "plugin unloaded");
 }
@@ -0,0 +1,40 @@
+#pragma once
+
+/*
+ * Static tracepoints (USDT) for the capture path.
+ *
+ * When sys/sdt.h is available, each probe is compiled into a single nop and a note section entry,
+ * so the cost is zero unless a tracer such as bpftrace or perf attaches to it.
+ * Otherwise the probes are compiled out.
+ *
+ * List the probes by `bpftrace -l 'usdt:/path/to/obs-h8819-proc:h8819:*'`.
+ */
+
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+
+#define H8819_PROBE0(name) DTRACE_PROBE(h8819, name)
+#define H8819_PROBE1(name, a1) DTRACE_PROBE1(h8819, name, a1)
+#define H8819_PROBE2(name, a1, a2) DTRACE_PROBE2(h8819, name, a1, a2)
+#define H8819_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(h8819, name, a1, a2, a3)
+#define H8819_PROBE4(name, a1, a2, a3, a4) DTRACE_PROBE4(h8819, name, a1, a2, a3, a4)
+
+#else // HAVE_SYS_SDT_H
+
+#define H8819_PROBE0(name) \
+	do {               \
+	} while (0)
+#define H8819_PROBE1(name, a1) \
+	do {                   \
+	} while (0)
+#define H8819_PROBE2(name, a1, a2) \
+	do {                       \
+	} while (0)
+#define H8819_PROBE3(name, a1, a2, a3) \
+	do {                           \
+	} while (0)
+#define H8819_PROBE4(name, a1, a2, a3, a4) \
+	do {                               \
+	} while (0)
+
+#endif // HAVE_SYS_SDT_H
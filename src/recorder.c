@@ -0,0 +1,655 @@
+#define _GNU_SOURCE // O_DIRECT
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "recorder.h"
+#include "probes.h"
+
+// Samples start at this offset so that the writes are aligned for O_DIRECT.
+#define HEADER_SIZE 4096
+#define BUFFER_SIZE (8 * 1024 * 1024)
+#define MAX_GAPS 64
+
+enum gap_cause_e
+{
+	GAP_MISSING,
+	GAP_DROPPED,
+};
+
+struct gap_s
+{
+	uint64_t sample;
+	uint32_t n_samples;
+	enum gap_cause_e cause;
+};
+
+struct buffer_s
+{
+	uint8_t *data;
+	size_t size;
+	bool busy; // given to the writer thread, protected by `mutex`
+
+	// The buffer starts a new file.
+	bool start_of_file;
+	int n_channels;
+	int64_t file_timestamp;
+
+	// The file is closed after writing the buffer.
+	bool end_of_file;
+
+	struct gap_s gaps[MAX_GAPS];
+	int n_gaps;
+	uint32_t n_gaps_lost;
+};
+
+struct recorder_s
+{
+	char *directory;
+	struct h8819_chmask_s channel_mask;
+	enum recorder_format_e format;
+	uint32_t rollover_seconds;
+	uint64_t rollover_bytes;
+	bool direct_io;
+
+	// capture thread
+	struct buffer_s buffers[2];
+	struct buffer_s *fill;
+	bool in_file;
+	int n_channels;
+	uint32_t n_frame_channels;
+	int64_t file_timestamp;
+	uint64_t file_bytes;
+	uint64_t file_samples;
+	uint32_t n_dropped;
+
+	pthread_t thread;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	struct buffer_s *queued;
+	bool exiting;
+
+	// writer thread
+	uint8_t *header;
+	int fd;
+	FILE *log;
+	char *path;
+	int w_n_channels;
+	uint64_t w_data_bytes;
+};
+
+int recorder_format_from_name(const char *name)
+{
+	if (strcmp(name, "w64") == 0)
+		return RECORDER_FORMAT_W64;
+	if (strcmp(name, "rf64") == 0)
+		return RECORDER_FORMAT_RF64;
+	if (strcmp(name, "caf") == 0)
+		return RECORDER_FORMAT_CAF;
+	return -1;
+}
+
+static const char *format_extension(enum recorder_format_e format)
+{
+	switch (format) {
+	case RECORDER_FORMAT_RF64:
+		return "wav";
+	case RECORDER_FORMAT_CAF:
+		return "caf";
+	default:
+		return "w64";
+	}
+}
+
+static uint8_t *put_bytes(uint8_t *p, const void *data, size_t size)
+{
+	memcpy(p, data, size);
+	return p + size;
+}
+
+static uint8_t *put_le16(uint8_t *p, uint16_t v)
+{
+	p[0] = v & 0xFF;
+	p[1] = v >> 8;
+	return p + 2;
+}
+
+static uint8_t *put_le32(uint8_t *p, uint32_t v)
+{
+	put_le16(p, v & 0xFFFF);
+	return put_le16(p + 2, v >> 16);
+}
+
+static uint8_t *put_le64(uint8_t *p, uint64_t v)
+{
+	put_le32(p, v & 0xFFFFFFFF);
+	return put_le32(p + 4, v >> 32);
+}
+
+static uint8_t *put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = (v >> 16) & 0xFF;
+	p[2] = (v >> 8) & 0xFF;
+	p[3] = v & 0xFF;
+	return p + 4;
+}
+
+static uint8_t *put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = v >> 8;
+	p[1] = v & 0xFF;
+	return p + 2;
+}
+
+static uint8_t *put_be64(uint8_t *p, uint64_t v)
+{
+	put_be32(p, v >> 32);
+	return put_be32(p + 4, v & 0xFFFFFFFF);
+}
+
+static const uint8_t guid_riff[16] = {'r', 'i', 'f', 'f', 0x2E, 0x91, 0xCF, 0x11,
+				      0xA5, 0xD6, 0x28, 0xDB, 0x04, 0xC1, 0x00, 0x00};
+#define W64_GUID(a, b, c, d) {a, b, c, d, 0xF3, 0xAC, 0xD3, 0x11, 0x8C, 0xD1, 0x00, 0xC0, 0x4F, 0x8E, 0xDB, 0x8A}
+static const uint8_t guid_wave[16] = W64_GUID('w', 'a', 'v', 'e');
+static const uint8_t guid_fmt[16] = W64_GUID('f', 'm', 't', ' ');
+static const uint8_t guid_junk[16] = W64_GUID('j', 'u', 'n', 'k');
+static const uint8_t guid_data[16] = W64_GUID('d', 'a', 't', 'a');
+static const uint8_t guid_subformat_pcm[16] = {0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x10, 0x00,
+					       0x80, 0x00, 0x00, 0xAA, 0x00, 0x38, 0x9B, 0x71};
+
+// WAVEFORMATEXTENSIBLE, 40 bytes
+static uint8_t *put_wave_format(uint8_t *p, int n_channels)
+{
+	p = put_le16(p, 0xFFFE);
+	p = put_le16(p, n_channels);
+	p = put_le32(p, H8819_SAMPLE_RATE);
+	p = put_le32(p, H8819_SAMPLE_RATE * 3 * n_channels);
+	p = put_le16(p, 3 * n_channels);
+	p = put_le16(p, 24);
+	p = put_le16(p, 22);
+	p = put_le16(p, 24);
+	p = put_le32(p, 0); // no speaker position
+	return put_bytes(p, guid_subformat_pcm, 16);
+}
+
+static void format_header(uint8_t *h, enum recorder_format_e format, int n_channels, uint64_t data_bytes)
+{
+	memset(h, 0, HEADER_SIZE);
+	uint8_t *p = h;
+
+	switch (format) {
+	case RECORDER_FORMAT_W64:
+		p = put_bytes(p, guid_riff, 16);
+		p = put_le64(p, HEADER_SIZE + data_bytes);
+		p = put_bytes(p, guid_wave, 16);
+		p = put_bytes(p, guid_fmt, 16);
+		p = put_le64(p, 24 + 40);
+		p = put_wave_format(p, n_channels);
+		p = put_bytes(p, guid_junk, 16);
+		p = put_le64(p, h + HEADER_SIZE - 24 - p + 16);
+		p = h + HEADER_SIZE - 24;
+		p = put_bytes(p, guid_data, 16);
+		put_le64(p, 24 + data_bytes);
+		break;
+
+	case RECORDER_FORMAT_RF64:
+		p = put_bytes(p, "RF64", 4);
+		p = put_le32(p, 0xFFFFFFFF);
+		p = put_bytes(p, "WAVE", 4);
+		p = put_bytes(p, "ds64", 4);
+		p = put_le32(p, 28);
+		p = put_le64(p, HEADER_SIZE - 8 + data_bytes);
+		p = put_le64(p, data_bytes);
+		p = put_le64(p, data_bytes / (3 * n_channels));
+		p = put_le32(p, 0);
+		p = put_bytes(p, "fmt ", 4);
+		p = put_le32(p, 40);
+		p = put_wave_format(p, n_channels);
+		p = put_bytes(p, "JUNK", 4);
+		p = put_le32(p, h + HEADER_SIZE - 8 - p - 4);
+		p = h + HEADER_SIZE - 8;
+		p = put_bytes(p, "data", 4);
+		put_le32(p, 0xFFFFFFFF);
+		break;
+
+	case RECORDER_FORMAT_CAF: {
+		double rate = H8819_SAMPLE_RATE;
+		uint64_t rate_bits;
+		memcpy(&rate_bits, &rate, sizeof(rate_bits));
+
+		p = put_bytes(p, "caff", 4);
+		p = put_be16(p, 1);
+		p = put_be16(p, 0);
+		p = put_bytes(p, "desc", 4);
+		p = put_be64(p, 32);
+		p = put_be64(p, rate_bits);
+		p = put_bytes(p, "lpcm", 4);
+		p = put_be32(p, 2); // kCAFLinearPCMFormatFlagIsLittleEndian
+		p = put_be32(p, 3 * n_channels);
+		p = put_be32(p, 1);
+		p = put_be32(p, n_channels);
+		p = put_be32(p, 24);
+		p = put_bytes(p, "free", 4);
+		p = put_be64(p, h + HEADER_SIZE - 16 - p - 8);
+		p = h + HEADER_SIZE - 16;
+		p = put_bytes(p, "data", 4);
+		p = put_be64(p, 4 + data_bytes);
+		put_be32(p, 0); // edit count
+		break;
+	}
+	}
+}
+
+static bool write_full(int fd, const uint8_t *data, size_t size, off_t offset)
+{
+	while (size) {
+		ssize_t ret = pwrite(fd, data, size, offset);
+		if (ret < 0 && errno == EINTR)
+			continue;
+		if (ret <= 0)
+			return false;
+		data += ret;
+		size -= ret;
+		offset += ret;
+	}
+	return true;
+}
+
+static void writer_close(struct recorder_s *rec);
+
+static void writer_fail(struct recorder_s *rec, const char *what)
+{
+	fprintf(stderr, "Error: recorder: %s '%s': %s\n", what, rec->path, strerror(errno));
+	writer_close(rec);
+}
+
+static bool writer_update_header(struct recorder_s *rec)
+{
+	format_header(rec->header, rec->format, rec->w_n_channels, rec->w_data_bytes);
+	return write_full(rec->fd, rec->header, HEADER_SIZE, 0);
+}
+
+static int open_file(const char *path, bool direct_io)
+{
+	int flags = O_WRONLY | O_CREAT | O_EXCL;
+#ifdef O_DIRECT
+	if (direct_io) {
+		int fd = open(path, flags | O_DIRECT, 0644);
+		// Some file systems such as tmpfs do not support O_DIRECT.
+		if (fd >= 0 || errno != EINVAL)
+			return fd;
+	}
+#else
+	(void)direct_io;
+#endif
+	return open(path, flags, 0644);
+}
+
+static void writer_open(struct recorder_s *rec, const struct buffer_s *b)
+{
+	time_t t = (time_t)(b->file_timestamp / 1000000000);
+	struct tm tm;
+	localtime_r(&t, &tm);
+	char base[32];
+	strftime(base, sizeof(base), "REAC-%Y%m%d-%H%M%S", &tm);
+
+	size_t len = strlen(rec->directory) + sizeof(base) + 16;
+	rec->path = malloc(len);
+	for (int i = 0; i < 100; i++) {
+		if (i == 0)
+			snprintf(rec->path, len, "%s/%s.%s", rec->directory, base, format_extension(rec->format));
+		else
+			snprintf(rec->path, len, "%s/%s-%d.%s", rec->directory, base, i, format_extension(rec->format));
+		rec->fd = open_file(rec->path, rec->direct_io);
+		if (rec->fd >= 0 || errno != EEXIST)
+			break;
+	}
+	if (rec->fd < 0) {
+		writer_fail(rec, "cannot create");
+		return;
+	}
+
+	rec->w_n_channels = b->n_channels;
+	rec->w_data_bytes = 0;
+	if (!writer_update_header(rec)) {
+		writer_fail(rec, "cannot write");
+		return;
+	}
+	fprintf(stderr, "Info: recording %d channels to '%s'\n", rec->w_n_channels, rec->path);
+}
+
+static void writer_close(struct recorder_s *rec)
+{
+	if (rec->fd >= 0) {
+		if (!writer_update_header(rec))
+			fprintf(stderr, "Error: recorder: cannot update the header of '%s'\n", rec->path);
+		close(rec->fd);
+		fprintf(stderr, "Info: recorded %" PRIu64 " bytes to '%s'\n", rec->w_data_bytes, rec->path);
+	}
+	rec->fd = -1;
+	if (rec->log)
+		fclose(rec->log);
+	rec->log = NULL;
+	free(rec->path);
+	rec->path = NULL;
+}
+
+static void writer_log_gaps(struct recorder_s *rec, const struct buffer_s *b)
+{
+	if (!b->n_gaps && !b->n_gaps_lost)
+		return;
+
+	if (!rec->log) {
+		// The gap log is created only if there is a gap.
+		size_t len = strlen(rec->path) + 16;
+		char *log_path = malloc(len);
+		snprintf(log_path, len, "%s.gaps.txt", rec->path);
+		rec->log = fopen(log_path, "w");
+		if (!rec->log) {
+			fprintf(stderr, "Error: recorder: cannot create '%s'\n", log_path);
+			free(log_path);
+			return;
+		}
+		free(log_path);
+		fputs("# sample\tlength\tcause\n", rec->log);
+	}
+
+	for (int i = 0; i < b->n_gaps; i++) {
+		const struct gap_s *g = b->gaps + i;
+		fprintf(rec->log, "%" PRIu64 "\t%" PRIu32 "\t%s\n", g->sample, g->n_samples,
+			g->cause == GAP_MISSING ? "missing, filled with silence" : "dropped, not in the file");
+	}
+	if (b->n_gaps_lost)
+		fprintf(rec->log, "# %" PRIu32 " more gaps are not logged\n", b->n_gaps_lost);
+	fflush(rec->log);
+}
+
+static void writer_process(struct recorder_s *rec, const struct buffer_s *b)
+{
+	if (b->start_of_file) {
+		writer_close(rec);
+		writer_open(rec, b);
+	}
+
+	if (rec->fd >= 0 && b->size) {
+#ifdef O_DIRECT
+		if (b->size % HEADER_SIZE) {
+			// Only the last buffer of a file is partial, which cannot be written with O_DIRECT.
+			int flags = fcntl(rec->fd, F_GETFL);
+			if (flags >= 0 && flags & O_DIRECT)
+				fcntl(rec->fd, F_SETFL, flags & ~O_DIRECT);
+		}
+#endif
+		H8819_PROBE1(record_write_start, b->size);
+		if (!write_full(rec->fd, b->data, b->size, HEADER_SIZE + rec->w_data_bytes)) {
+			writer_fail(rec, "cannot write");
+		}
+		else {
+			rec->w_data_bytes += b->size;
+			// Keep the header updated so that the file is readable even if the helper is killed.
+			writer_update_header(rec);
+		}
+		H8819_PROBE1(record_write_done, b->size);
+	}
+
+	if (rec->fd >= 0)
+		writer_log_gaps(rec, b);
+
+	if (b->end_of_file)
+		writer_close(rec);
+}
+
+static void *writer_thread(void *data)
+{
+	struct recorder_s *rec = data;
+
+	pthread_mutex_lock(&rec->mutex);
+	while (true) {
+		while (!rec->queued && !rec->exiting)
+			pthread_cond_wait(&rec->cond, &rec->mutex);
+		struct buffer_s *b = rec->queued;
+		if (!b)
+			break;
+		rec->queued = NULL;
+		pthread_mutex_unlock(&rec->mutex);
+
+		writer_process(rec, b);
+
+		pthread_mutex_lock(&rec->mutex);
+		b->busy = false;
+		pthread_cond_broadcast(&rec->cond);
+	}
+	pthread_mutex_unlock(&rec->mutex);
+
+	writer_close(rec);
+	return NULL;
+}
+
+struct recorder_s *recorder_create(const struct recorder_config_s *cfg)
+{
+	struct recorder_s *rec = calloc(1, sizeof(struct recorder_s));
+	if (!rec)
+		return NULL;
+
+	rec->directory = strdup(cfg->directory);
+	rec->channel_mask = cfg->channel_mask;
+	rec->format = cfg->format;
+	rec->rollover_seconds = cfg->rollover_seconds;
+	rec->rollover_bytes = cfg->rollover_bytes;
+	rec->direct_io = cfg->direct_io;
+	rec->fd = -1;
+
+	// Aligned for O_DIRECT
+	bool ok = posix_memalign((void **)&rec->header, HEADER_SIZE, HEADER_SIZE) == 0;
+	for (int i = 0; i < 2; i++)
+		ok = ok && posix_memalign((void **)&rec->buffers[i].data, HEADER_SIZE, BUFFER_SIZE) == 0;
+	rec->fill = rec->buffers;
+
+	pthread_mutex_init(&rec->mutex, NULL);
+	pthread_cond_init(&rec->cond, NULL);
+	if (!ok || pthread_create(&rec->thread, NULL, writer_thread, rec) != 0) {
+		fputs("Error: recorder: failed to start\n", stderr);
+		pthread_mutex_destroy(&rec->mutex);
+		pthread_cond_destroy(&rec->cond);
+		free(rec->buffers[0].data);
+		free(rec->buffers[1].data);
+		free(rec->header);
+		free(rec->directory);
+		free(rec);
+		return NULL;
+	}
+
+	return rec;
+}
+
+static struct buffer_s *other_buffer(struct recorder_s *rec)
+{
+	return rec->fill == rec->buffers ? rec->buffers + 1 : rec->buffers;
+}
+
+static bool other_buffer_free(struct recorder_s *rec)
+{
+	pthread_mutex_lock(&rec->mutex);
+	bool ret = !other_buffer(rec)->busy;
+	pthread_mutex_unlock(&rec->mutex);
+	return ret;
+}
+
+// Give the buffer to the writer thread. The other buffer has to be free.
+static void submit(struct recorder_s *rec)
+{
+	struct buffer_s *b = rec->fill;
+	pthread_mutex_lock(&rec->mutex);
+	b->busy = true;
+	rec->queued = b;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->mutex);
+
+	rec->fill = other_buffer(rec);
+	struct buffer_s *f = rec->fill;
+	f->size = 0;
+	f->start_of_file = false;
+	f->end_of_file = false;
+	f->n_gaps = 0;
+	f->n_gaps_lost = 0;
+}
+
+static void add_gap(struct recorder_s *rec, enum gap_cause_e cause, uint32_t n_samples)
+{
+	struct buffer_s *b = rec->fill;
+	if (b->n_gaps >= MAX_GAPS) {
+		b->n_gaps_lost++;
+		return;
+	}
+	b->gaps[b->n_gaps++] = (struct gap_s){
+		.sample = rec->file_samples,
+		.n_samples = n_samples,
+		.cause = cause,
+	};
+}
+
+// Append samples of the current geometry. `data` is NULL for silence.
+// Returns false and counts the samples as dropped if the writer thread is behind.
+static bool append_samples(struct recorder_s *rec, const uint8_t *data, uint32_t n_samples)
+{
+	size_t size = (size_t)n_samples * 3 * rec->n_channels;
+	if (rec->fill->size + size >= BUFFER_SIZE && !other_buffer_free(rec)) {
+		H8819_PROBE1(record_drop, n_samples);
+		rec->n_dropped += n_samples;
+		return false;
+	}
+
+	if (rec->n_dropped) {
+		add_gap(rec, GAP_DROPPED, rec->n_dropped);
+		rec->n_dropped = 0;
+	}
+
+	rec->file_samples += n_samples;
+	rec->file_bytes += size;
+	while (size) {
+		size_t n = BUFFER_SIZE - rec->fill->size;
+		if (n > size)
+			n = size;
+		if (data) {
+			memcpy(rec->fill->data + rec->fill->size, data, n);
+			data += n;
+		}
+		else {
+			memset(rec->fill->data + rec->fill->size, 0, n);
+		}
+		rec->fill->size += n;
+		size -= n;
+		if (rec->fill->size == BUFFER_SIZE)
+			submit(rec);
+	}
+	return true;
+}
+
+static bool need_rollover(const struct recorder_s *rec, const struct h8819_frame_s *frame, size_t size)
+{
+	if (frame->n_channels != rec->n_frame_channels)
+		return true;
+	if (rec->rollover_bytes && rec->file_bytes && rec->file_bytes + size > rec->rollover_bytes)
+		return true;
+	if (rec->rollover_seconds && frame->timestamp - rec->file_timestamp >= rec->rollover_seconds * 1000000000LL)
+		return true;
+	return false;
+}
+
+static void start_file(struct recorder_s *rec, const struct h8819_frame_s *frame, int n_channels)
+{
+	rec->in_file = true;
+	rec->n_channels = n_channels;
+	rec->n_frame_channels = frame->n_channels;
+	rec->file_timestamp = frame->timestamp;
+	rec->file_bytes = 0;
+	rec->file_samples = 0;
+
+	rec->fill->start_of_file = true;
+	rec->fill->n_channels = n_channels;
+	rec->fill->file_timestamp = frame->timestamp;
+}
+
+void recorder_write_frame(struct recorder_s *rec, const struct h8819_frame_s *frame)
+{
+	int n_channels = h8819_chmask_count_below(&rec->channel_mask, (int)frame->n_channels);
+	size_t size = (size_t)frame->n_samples * 3 * n_channels;
+
+	if (rec->in_file && need_rollover(rec, frame, size)) {
+		if (other_buffer_free(rec)) {
+			rec->fill->end_of_file = true;
+			submit(rec);
+			rec->in_file = false;
+		}
+		else if (frame->n_channels != rec->n_frame_channels) {
+			// The frame cannot go to the current file.
+			rec->n_dropped += frame->n_samples;
+			return;
+		}
+		// Otherwise, keep writing the current file and try again at the next frame.
+	}
+
+	if (!rec->in_file) {
+		if (!n_channels)
+			return;
+		start_file(rec, frame, n_channels);
+	}
+	else if (frame->n_skipped_packets) {
+		uint32_t n_missing = frame->n_skipped_packets * frame->n_samples;
+		add_gap(rec, GAP_MISSING, n_missing);
+		for (uint32_t i = 0; i < frame->n_skipped_packets; i++)
+			append_samples(rec, NULL, frame->n_samples);
+	}
+
+	uint8_t planar[H8819_MAX_PAYLOAD_LEN];
+	uint8_t interleaved[H8819_MAX_PAYLOAD_LEN];
+	h8819_convert_to_s24lep(planar, frame, &rec->channel_mask);
+	uint8_t *dptr = interleaved;
+	for (uint32_t is = 0; is < frame->n_samples; is++) {
+		for (int k = 0; k < n_channels; k++) {
+			memcpy(dptr, planar + (k * frame->n_samples + is) * 3, 3);
+			dptr += 3;
+		}
+	}
+
+	append_samples(rec, interleaved, frame->n_samples);
+}
+
+void recorder_destroy(struct recorder_s *rec)
+{
+	if (!rec)
+		return;
+
+	// Wait for the writer so that the last samples are not dropped.
+	pthread_mutex_lock(&rec->mutex);
+	while (other_buffer(rec)->busy)
+		pthread_cond_wait(&rec->cond, &rec->mutex);
+	pthread_mutex_unlock(&rec->mutex);
+
+	if (rec->in_file) {
+		if (rec->n_dropped)
+			add_gap(rec, GAP_DROPPED, rec->n_dropped);
+		rec->fill->end_of_file = true;
+		submit(rec);
+	}
+
+	pthread_mutex_lock(&rec->mutex);
+	rec->exiting = true;
+	pthread_cond_broadcast(&rec->cond);
+	pthread_mutex_unlock(&rec->mutex);
+	pthread_join(rec->thread, NULL);
+
+	pthread_mutex_destroy(&rec->mutex);
+	pthread_cond_destroy(&rec->cond);
+	free(rec->buffers[0].data);
+	free(rec->buffers[1].data);
+	free(rec->header);
+	free(rec->directory);
+	free(rec);
+}
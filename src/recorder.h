@@ -0,0 +1,43 @@
+#pragma once
+
+/*
+ * Multitrack recorder used by the capture helper and h8819-cat.
+ *
+ * Frames are converted to interleaved 24-bit PCM into one of two large buffers on the capture thread.
+ * A writer thread writes the other buffer to the disk, so that a slow disk never blocks the capture.
+ * If both buffers are in use, frames are dropped and the drop is written to the gap log.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "h8819.h"
+
+enum recorder_format_e
+{
+	RECORDER_FORMAT_W64 = 0,
+	RECORDER_FORMAT_RF64 = 1,
+	RECORDER_FORMAT_CAF = 2,
+};
+
+struct recorder_config_s
+{
+	const char *directory;
+	struct h8819_chmask_s channel_mask;
+	enum recorder_format_e format;
+	uint32_t rollover_seconds; // 0 not to roll over by time
+	uint64_t rollover_bytes;   // 0 not to roll over by size
+	bool direct_io;            // bypass the page cache if the file system supports it
+};
+
+struct recorder_s;
+
+/* Returns the format by the name `w64`, `rf64`, or `caf`, or -1 if unknown. */
+int recorder_format_from_name(const char *name);
+
+struct recorder_s *recorder_create(const struct recorder_config_s *cfg);
+
+/* Flushes the buffered samples and closes the file. */
+void recorder_destroy(struct recorder_s *rec);
+
+/* Append the frame. Skipped packets before the frame are written as silence and logged. */
+void recorder_write_frame(struct recorder_s *rec, const struct h8819_frame_s *frame);
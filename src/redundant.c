@@ -0,0 +1,309 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "h8819.h"
+#include "redundant.h"
+#include "probes.h"
+
+#define MAX_FRAME_LEN (H8819_L2_HEADER_LEN + H8819_MAX_PAYLOAD_LEN + H8819_TRAILER_LEN)
+// Frames held for reordering and frames remembered after delivery, power of two.
+#define WINDOW 16
+// A missing frame is given up when a frame this far ahead has arrived, 2 ms of the common stream.
+#define MAX_HOLD 8
+// A counter this far behind is a restart of the device, not a late copy.
+#define RESTART_DISTANCE 1024
+// A leg without frames for this period is not waited for.
+#define LEG_TIMEOUT_NS 20000000LL
+#define REPORT_INTERVAL 65536
+
+struct slot_s
+{
+	bool valid;
+	uint16_t counter;
+	uint8_t legs; // bit for each leg that had the frame
+	int first_leg;
+	uint32_t caplen;
+	int64_t timestamp; // arrival on the first leg
+	uint8_t data[MAX_FRAME_LEN];
+};
+
+// Delivered frame, kept to detect late copies and to count the frames each leg missed
+struct history_s
+{
+	bool valid;
+	uint16_t counter;
+	uint8_t legs;
+	int first_leg;
+	int64_t timestamp;
+};
+
+struct leg_s
+{
+	bool seen;
+	bool up;
+	uint16_t last_counter;
+	int64_t last_timestamp;
+	uint64_t received;
+	uint64_t missed;
+};
+
+struct merge_s
+{
+	bool started;
+	uint16_t next;
+	uint16_t head;
+	int n_held;
+	struct leg_s legs[REDUNDANT_MAX_LEGS];
+	struct slot_s slots[WINDOW];
+	struct history_s history[WINDOW];
+
+	uint64_t delivered;
+	uint64_t lost;
+	// arrival time of the second leg minus the first leg
+	double skew_sum;
+	uint64_t n_skew;
+	int64_t skew_max;
+};
+
+struct redundant_s
+{
+	int n_legs;
+	char *names[REDUNDANT_MAX_LEGS];
+	redundant_frame_cb cb;
+	void *param;
+
+	struct h8819_demux_s demux;
+	struct merge_s *streams[H8819_MAX_STREAMS];
+};
+
+struct redundant_s *redundant_create(int n_legs, const char *const *names, redundant_frame_cb cb, void *param)
+{
+	if (n_legs < 1 || n_legs > REDUNDANT_MAX_LEGS)
+		return NULL;
+
+	struct redundant_s *rd = calloc(1, sizeof(struct redundant_s));
+	if (!rd)
+		return NULL;
+	rd->n_legs = n_legs;
+	for (int i = 0; i < n_legs; i++)
+		rd->names[i] = strdup(names[i]);
+	rd->cb = cb;
+	rd->param = param;
+	return rd;
+}
+
+static void report(const struct redundant_s *rd, int ix, const struct merge_s *m)
+{
+	char mac[H8819_MAC_STRLEN];
+	h8819_stream_key_to_string(mac, rd->demux.keys[ix]);
+	fprintf(stderr, "Info: redundant %s: %llu frames, %llu lost on all legs", mac, (unsigned long long)m->delivered,
+		(unsigned long long)m->lost);
+	for (int i = 0; i < rd->n_legs; i++) {
+		fprintf(stderr, ", '%s' %llu received %llu missed", rd->names[i],
+			(unsigned long long)m->legs[i].received, (unsigned long long)m->legs[i].missed);
+	}
+	if (m->n_skew)
+		fprintf(stderr, ", skew %.1f us average %.1f us max", m->skew_sum / (double)m->n_skew * 1e-3,
+			(double)m->skew_max * 1e-3);
+	fputc('\n', stderr);
+}
+
+void redundant_destroy(struct redundant_s *rd)
+{
+	if (!rd)
+		return;
+
+	for (int ix = 0; ix < rd->demux.n_streams; ix++) {
+		if (rd->streams[ix])
+			report(rd, ix, rd->streams[ix]);
+		free(rd->streams[ix]);
+	}
+	for (int i = 0; i < rd->n_legs; i++)
+		free(rd->names[i]);
+	free(rd);
+}
+
+static bool is_reac(const uint8_t *data, uint32_t caplen)
+{
+	// Broken frames are passed through so that they are reported but never win over a good copy.
+	return caplen >= H8819_L2_HEADER_LEN + H8819_TRAILER_LEN && caplen <= MAX_FRAME_LEN && data[12] == 0x88 &&
+	       data[13] == 0x19 && data[caplen - 2] == 0xC2 && data[caplen - 1] == 0xEA;
+}
+
+static void update_legs(struct redundant_s *rd, struct merge_s *m, int leg, uint16_t counter, int64_t timestamp)
+{
+	struct leg_s *l = m->legs + leg;
+	if (!l->seen || (int16_t)(counter - l->last_counter) > 0)
+		l->last_counter = counter;
+	l->seen = true;
+	l->last_timestamp = timestamp;
+	l->received++;
+
+	for (int i = 0; i < rd->n_legs; i++) {
+		l = m->legs + i;
+		bool up = l->seen && timestamp - l->last_timestamp < LEG_TIMEOUT_NS;
+		if (up != l->up && m->started) {
+			if (up)
+				fprintf(stderr, "Info: redundant leg '%s' is up\n", rd->names[i]);
+			else
+				fprintf(stderr, "Warning: redundant leg '%s' is down\n", rd->names[i]);
+		}
+		l->up = up;
+	}
+}
+
+static void add_skew(struct merge_s *m, int first_leg, int64_t first_timestamp, int64_t timestamp)
+{
+	int64_t skew = first_leg == 0 ? timestamp - first_timestamp : first_timestamp - timestamp;
+	m->skew_sum += (double)skew;
+	m->n_skew++;
+	if ((skew < 0 ? -skew : skew) > m->skew_max)
+		m->skew_max = skew < 0 ? -skew : skew;
+}
+
+static void remember(struct redundant_s *rd, struct merge_s *m, uint16_t counter, uint8_t legs, int first_leg,
+		     int64_t timestamp)
+{
+	struct history_s *h = m->history + counter % WINDOW;
+	if (h->valid) {
+		// The frame is no longer waited for. Count it for the legs that were up but did not have it.
+		for (int i = 0; i < rd->n_legs; i++) {
+			if (!(h->legs & 1 << i) && m->legs[i].up) {
+				m->legs[i].missed++;
+				H8819_PROBE2(redundant_miss, i, h->counter);
+			}
+		}
+	}
+	*h = (struct history_s){
+		.valid = true,
+		.counter = counter,
+		.legs = legs,
+		.first_leg = first_leg,
+		.timestamp = timestamp,
+	};
+}
+
+static void deliver(struct redundant_s *rd, int ix, struct merge_s *m, const uint8_t *data, uint32_t caplen,
+		    int64_t timestamp, uint8_t legs, int first_leg)
+{
+	rd->cb(data, caplen, timestamp, rd->param);
+	remember(rd, m, m->next, legs, first_leg, timestamp);
+	m->next++;
+	if (++m->delivered % REPORT_INTERVAL == 0)
+		report(rd, ix, m);
+}
+
+// Whether a leg that is up might still bring the frame `m->next`.
+static bool waiting(const struct redundant_s *rd, const struct merge_s *m)
+{
+	if ((int16_t)(m->head - m->next) >= MAX_HOLD)
+		return false;
+	for (int i = 0; i < rd->n_legs; i++) {
+		if (m->legs[i].up && (int16_t)(m->legs[i].last_counter - m->next) < 0)
+			return true;
+	}
+	return false;
+}
+
+static void release(struct redundant_s *rd, int ix, struct merge_s *m, bool flush)
+{
+	while (m->n_held > 0) {
+		struct slot_s *s = m->slots + m->next % WINDOW;
+		if (s->valid && s->counter == m->next) {
+			s->valid = false;
+			m->n_held--;
+			deliver(rd, ix, m, s->data, s->caplen, s->timestamp, s->legs, s->first_leg);
+			continue;
+		}
+		if (!flush && waiting(rd, m))
+			break;
+
+		// Every leg missed the frame. The merged stream has a gap here.
+		m->lost++;
+		remember(rd, m, m->next, 0, 0, 0);
+		m->next++;
+	}
+}
+
+static void hold(struct merge_s *m, int leg, const uint8_t *data, uint32_t caplen, uint16_t counter,
+		 int64_t timestamp)
+{
+	struct slot_s *s = m->slots + counter % WINDOW;
+	if (s->valid && s->counter == counter) {
+		if (!(s->legs & 1 << leg))
+			add_skew(m, s->first_leg, s->timestamp, timestamp);
+		s->legs |= 1 << leg;
+		return;
+	}
+
+	s->valid = true;
+	s->counter = counter;
+	s->legs = 1 << leg;
+	s->first_leg = leg;
+	s->caplen = caplen;
+	s->timestamp = timestamp;
+	memcpy(s->data, data, caplen);
+	m->n_held++;
+}
+
+static void late_copy(struct merge_s *m, int leg, uint16_t counter, int64_t timestamp)
+{
+	struct history_s *h = m->history + counter % WINDOW;
+	if (!h->valid || h->counter != counter || h->legs & 1 << leg)
+		return;
+	if (h->legs)
+		add_skew(m, h->first_leg, h->timestamp, timestamp);
+	h->legs |= 1 << leg;
+}
+
+void redundant_feed(struct redundant_s *rd, int leg, const uint8_t *data, uint32_t caplen, int64_t timestamp)
+{
+	if (!is_reac(data, caplen)) {
+		rd->cb(data, caplen, timestamp, rd->param);
+		return;
+	}
+
+	bool created;
+	int ix = h8819_demux_get(&rd->demux, h8819_stream_key(data, caplen), &created);
+	if (ix >= 0 && !rd->streams[ix])
+		rd->streams[ix] = calloc(1, sizeof(struct merge_s));
+	if (ix < 0 || !rd->streams[ix]) {
+		rd->cb(data, caplen, timestamp, rd->param);
+		return;
+	}
+	struct merge_s *m = rd->streams[ix];
+
+	const struct h8819_packet_header_s *header = (const void *)data;
+	uint16_t counter = header->l2_counter;
+	update_legs(rd, m, leg, counter, timestamp);
+
+	if (!m->started) {
+		m->started = true;
+		m->next = counter;
+		m->head = counter;
+	}
+
+	int d = (int16_t)(counter - m->next);
+	if (d <= -RESTART_DISTANCE || d >= WINDOW) {
+		// The device restarted or all legs were out for a while.
+		release(rd, ix, m, true);
+		m->next = counter;
+		m->head = counter;
+		d = 0;
+	}
+
+	if (d < 0) {
+		late_copy(m, leg, counter, timestamp);
+	}
+	else {
+		if ((int16_t)(counter - m->head) > 0)
+			m->head = counter;
+		if (d == 0)
+			deliver(rd, ix, m, data, caplen, timestamp, 1 << leg, leg);
+		else
+			hold(m, leg, data, caplen, counter, timestamp);
+	}
+
+	release(rd, ix, m, false);
+}
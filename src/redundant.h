@@ -0,0 +1,25 @@
+#pragma once
+
+/*
+ * Merge of the same REAC streams captured on several interfaces, used by the capture helper.
+ *
+ * Frames are merged by `l2_counter` for each source MAC address. The first copy of each frame wins
+ * and later copies are discarded. A frame that arrived early is held in a short window until the frames
+ * before it arrive, and a missing frame is given up only when all legs that are up have passed it.
+ * So a gap appears in the merged stream only if every leg misses the frame.
+ */
+
+#include <stdint.h>
+
+#define REDUNDANT_MAX_LEGS 2
+
+typedef void (*redundant_frame_cb)(const uint8_t *data, uint32_t caplen, int64_t timestamp, void *param);
+
+struct redundant_s;
+
+/* `names` are used in the log. `cb` is called for each merged frame in the order of the counter. */
+struct redundant_s *redundant_create(int n_legs, const char *const *names, redundant_frame_cb cb, void *param);
+void redundant_destroy(struct redundant_s *rd);
+
+/* Called for each frame captured on the leg. Frames that are not valid REAC frames are passed through. */
+void redundant_feed(struct redundant_s *rd, int leg, const uint8_t *data, uint32_t caplen, int64_t timestamp);
@@ -0,0 +1,299 @@
+#ifdef __linux__
+#define _GNU_SOURCE // sendmmsg
+#endif
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "rtp.h"
+#include "probes.h"
+
+#define RTP_HEADER_LEN 12
+#define BATCH_MAX 64
+// Packets are held up to this duration to be sent together.
+#define BATCH_SAMPLES 48
+// Skipped packets up to this length are sent as silence. A longer gap restarts the packets.
+#define MAX_FILL_SAMPLES 4800
+#define TTL_DEFAULT 16
+// Expedited forwarding as AES67 recommends for the media packets
+#define DSCP_EF 46
+
+struct packet_s
+{
+	uint8_t data[RTP_HEADER_LEN + RTP_MAX_PAYLOAD_LEN];
+};
+
+struct rtp_s
+{
+	char *destination;
+	int fd;
+	struct h8819_chmask_s channel_mask;
+	int n_channels;
+	uint32_t ptime_samples;
+	size_t packet_len;
+	int batch;
+
+	uint16_t seq;
+	uint32_t timestamp; // of the first sample of the packet being filled
+	uint32_t ssrc;
+
+	struct packet_s packets[BATCH_MAX + 1];
+	int n_pending;     // finished packets
+	uint32_t n_filled; // samples in the packet being filled, `packets[n_pending]`
+
+	uint64_t n_sent;
+	uint64_t n_send_errors;
+	uint64_t n_batches;
+	uint64_t n_fill_samples;
+	uint64_t n_restarts;
+};
+
+// The initial values only need to differ between sessions.
+static uint32_t random32(uint64_t *state)
+{
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+static bool parse_destination(struct sockaddr_in *addr, const char *str)
+{
+	char host[INET_ADDRSTRLEN];
+	const char *colon = strchr(str, ':');
+	size_t len = colon ? (size_t)(colon - str) : strlen(str);
+	if (len >= sizeof(host))
+		return false;
+	memcpy(host, str, len);
+	host[len] = '\0';
+
+	long port = RTP_PORT_DEFAULT;
+	if (colon) {
+		char *end;
+		port = strtol(colon + 1, &end, 10);
+		if (*end || port <= 0 || port > 65535)
+			return false;
+	}
+
+	*addr = (struct sockaddr_in){
+		.sin_family = AF_INET,
+		.sin_port = htons((uint16_t)port),
+	};
+	return inet_pton(AF_INET, host, &addr->sin_addr) == 1;
+}
+
+static bool open_socket(struct rtp_s *rtp, const struct rtp_config_s *cfg)
+{
+	struct sockaddr_in addr;
+	if (!parse_destination(&addr, cfg->destination)) {
+		fprintf(stderr, "Error: rtp: invalid destination '%s'\n", cfg->destination);
+		return false;
+	}
+
+	rtp->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (rtp->fd < 0) {
+		fprintf(stderr, "Error: rtp: socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	unsigned char ttl = (unsigned char)(cfg->ttl ? cfg->ttl : TTL_DEFAULT);
+	setsockopt(rtp->fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	int tos = DSCP_EF << 2;
+	setsockopt(rtp->fd, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+
+	if (cfg->interface_address && *cfg->interface_address) {
+		struct in_addr ifaddr;
+		if (inet_pton(AF_INET, cfg->interface_address, &ifaddr) != 1 ||
+		    setsockopt(rtp->fd, IPPROTO_IP, IP_MULTICAST_IF, &ifaddr, sizeof(ifaddr)) < 0) {
+			fprintf(stderr, "Error: rtp: cannot send from '%s'\n", cfg->interface_address);
+			return false;
+		}
+	}
+
+	// Connected so that each packet does not need the address.
+	if (connect(rtp->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		fprintf(stderr, "Error: rtp: cannot send to '%s': %s\n", cfg->destination, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static void rtp_free(struct rtp_s *rtp)
+{
+	if (rtp->fd >= 0)
+		close(rtp->fd);
+	free(rtp->destination);
+	free(rtp);
+}
+
+struct rtp_s *rtp_create(const struct rtp_config_s *cfg)
+{
+	int n_channels = h8819_chmask_count(&cfg->channel_mask);
+	size_t payload_len = (size_t)cfg->ptime_samples * n_channels * 3;
+	if (!n_channels || !cfg->ptime_samples || payload_len > RTP_MAX_PAYLOAD_LEN || cfg->batch < 0 ||
+	    cfg->batch > BATCH_MAX) {
+		fprintf(stderr, "Error: rtp: %d channels of %u samples do not fit in a packet\n", n_channels,
+			cfg->ptime_samples);
+		return NULL;
+	}
+
+	struct rtp_s *rtp = calloc(1, sizeof(struct rtp_s));
+	if (!rtp)
+		return NULL;
+	rtp->destination = strdup(cfg->destination);
+	rtp->fd = -1;
+	rtp->channel_mask = cfg->channel_mask;
+	rtp->n_channels = n_channels;
+	rtp->ptime_samples = cfg->ptime_samples;
+	rtp->packet_len = RTP_HEADER_LEN + payload_len;
+	rtp->batch = cfg->batch ? cfg->batch : (int)((BATCH_SAMPLES + cfg->ptime_samples - 1) / cfg->ptime_samples);
+	if (rtp->batch > BATCH_MAX)
+		rtp->batch = BATCH_MAX;
+
+	if (!open_socket(rtp, cfg)) {
+		rtp_free(rtp);
+		return NULL;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	uint64_t state = (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec + ((uint64_t)getpid() << 32);
+	rtp->seq = (uint16_t)random32(&state);
+	rtp->timestamp = random32(&state);
+	rtp->ssrc = random32(&state);
+
+	fprintf(stderr, "Info: rtp: %d channels to %s, %u samples per packet, %d packets per batch, ssrc %08x\n",
+		rtp->n_channels, rtp->destination, rtp->ptime_samples, rtp->batch, rtp->ssrc);
+	return rtp;
+}
+
+void rtp_destroy(struct rtp_s *rtp)
+{
+	if (!rtp)
+		return;
+
+	rtp_flush(rtp);
+	fprintf(stderr,
+		"Info: rtp %s: %llu packets sent in %llu batches, %llu send errors, %llu samples of silence, "
+		"%llu restarts\n",
+		rtp->destination, (unsigned long long)rtp->n_sent, (unsigned long long)rtp->n_batches,
+		(unsigned long long)rtp->n_send_errors, (unsigned long long)rtp->n_fill_samples,
+		(unsigned long long)rtp->n_restarts);
+	rtp_free(rtp);
+}
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	put_be16(p, (uint16_t)(v >> 16));
+	put_be16(p + 2, (uint16_t)v);
+}
+
+static void finish_packet(struct rtp_s *rtp)
+{
+	uint8_t *h = rtp->packets[rtp->n_pending].data;
+	h[0] = 0x80; // version 2
+	h[1] = RTP_PAYLOAD_TYPE;
+	put_be16(h + 2, rtp->seq++);
+	put_be32(h + 4, rtp->timestamp);
+	put_be32(h + 8, rtp->ssrc);
+
+	rtp->timestamp += rtp->ptime_samples;
+	rtp->n_filled = 0;
+	if (++rtp->n_pending >= rtp->batch)
+		rtp_flush(rtp);
+}
+
+/* Append samples from planar 24-bit little-endian PCM of `n_present` channels as big-endian interleaved PCM.
+ * The other channels and all channels if `planar` is NULL are silent. */
+static void append_samples(struct rtp_s *rtp, const uint8_t *planar, int n_present, uint32_t n_samples)
+{
+	const int n_channels = rtp->n_channels;
+	for (uint32_t is = 0; is < n_samples; is++) {
+		uint8_t *dptr = rtp->packets[rtp->n_pending].data + RTP_HEADER_LEN + rtp->n_filled * n_channels * 3;
+		for (int k = 0; k < n_channels; k++, dptr += 3) {
+			if (planar && k < n_present) {
+				const uint8_t *sptr = planar + ((size_t)k * n_samples + is) * 3;
+				dptr[0] = sptr[2];
+				dptr[1] = sptr[1];
+				dptr[2] = sptr[0];
+			}
+			else {
+				dptr[0] = dptr[1] = dptr[2] = 0;
+			}
+		}
+		if (++rtp->n_filled == rtp->ptime_samples)
+			finish_packet(rtp);
+	}
+}
+
+void rtp_write_frame(struct rtp_s *rtp, const struct h8819_frame_s *frame)
+{
+	if (frame->n_skipped_packets) {
+		uint32_t n_missing = frame->n_skipped_packets * frame->n_samples;
+		if (n_missing <= MAX_FILL_SAMPLES) {
+			append_samples(rtp, NULL, 0, n_missing);
+			rtp->n_fill_samples += n_missing;
+		}
+		else {
+			// The receivers see a jump of the timestamp.
+			rtp->timestamp += rtp->n_filled + n_missing;
+			rtp->n_filled = 0;
+			rtp->n_restarts++;
+		}
+	}
+
+	uint8_t planar[H8819_MAX_PAYLOAD_LEN];
+	h8819_convert_to_s24lep(planar, frame, &rtp->channel_mask);
+	int n_present = h8819_chmask_count_below(&rtp->channel_mask, (int)frame->n_channels);
+	append_samples(rtp, planar, n_present, frame->n_samples);
+}
+
+void rtp_flush(struct rtp_s *rtp)
+{
+	int n = rtp->n_pending;
+	if (!n)
+		return;
+
+	int sent = 0;
+#ifdef __linux__
+	struct iovec iov[BATCH_MAX];
+	struct mmsghdr msgs[BATCH_MAX];
+	for (int i = 0; i < n; i++) {
+		iov[i] = (struct iovec){.iov_base = rtp->packets[i].data, .iov_len = rtp->packet_len};
+		msgs[i] = (struct mmsghdr){.msg_hdr = {.msg_iov = iov + i, .msg_iovlen = 1}};
+	}
+	while (sent < n) {
+		int ret = sendmmsg(rtp->fd, msgs + sent, (unsigned int)(n - sent), MSG_DONTWAIT);
+		if (ret <= 0)
+			break;
+		sent += ret;
+	}
+#else
+	while (sent < n && send(rtp->fd, rtp->packets[sent].data, rtp->packet_len, MSG_DONTWAIT) >= 0)
+		sent++;
+#endif
+	H8819_PROBE2(rtp_send, n, sent);
+
+	rtp->n_sent += sent;
+	rtp->n_send_errors += n - sent;
+	rtp->n_batches++;
+	rtp->n_pending = 0;
+
+	// The packet being filled moves to the first slot.
+	if (rtp->n_filled)
+		memcpy(rtp->packets[0].data + RTP_HEADER_LEN, rtp->packets[n].data + RTP_HEADER_LEN,
+		       (size_t)rtp->n_filled * rtp->n_channels * 3);
+}
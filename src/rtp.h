@@ -0,0 +1,41 @@
+#pragma once
+
+/*
+ * Re-streamer of REAC channels as RTP L24 multicast in the style of AES67, used by the capture helper and h8819-cat.
+ *
+ * Frames are packed into packets of `ptime_samples` samples on the capture thread.
+ * Finished packets are sent in batches by one `sendmmsg` call, a batch covers about 1 ms by default.
+ * The RTP timestamp counts the samples of the REAC stream. It is not aligned to PTP.
+ */
+
+#include <stdint.h>
+#include "h8819.h"
+
+#define RTP_PORT_DEFAULT 5004
+#define RTP_PAYLOAD_TYPE 96
+// Payload limit to fit the standard MTU, as AES67 requires
+#define RTP_MAX_PAYLOAD_LEN 1440
+
+struct rtp_config_s
+{
+	const char *destination;       // IPv4 multicast group with an optional port, such as `239.69.0.1:5004`
+	const char *interface_address; // local address to send from, NULL or empty for the default route
+	struct h8819_chmask_s channel_mask;
+	uint32_t ptime_samples; // samples in a packet, 48 for 1 ms
+	int batch;              // packets sent at once, 0 for the default
+	int ttl;                // 0 for the default
+};
+
+struct rtp_s;
+
+/* Returns NULL if the destination is invalid or the packet does not fit `RTP_MAX_PAYLOAD_LEN`. */
+struct rtp_s *rtp_create(const struct rtp_config_s *cfg);
+
+/* Sends the pending packets and prints the statistics. */
+void rtp_destroy(struct rtp_s *rtp);
+
+/* Append the samples of the frame. Skipped packets before the frame are sent as silence if they are short. */
+void rtp_write_frame(struct rtp_s *rtp, const struct h8819_frame_s *frame);
+
+/* Send the finished packets now, for example when no frame arrives. */
+void rtp_flush(struct rtp_s *rtp);
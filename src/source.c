@@ -1,7 +1,14 @@
 #include <obs-module.h>
+#include <math.h>
+#include <util/dstr.h>
+#include <media-io/audio-math.h>
 #include "plugin-macros.generated.h"
 #include "source.h"
 #include "capdev.h"
+#include "devlist.h"
+#include "h8819.h"
+#include "recorder.h"
+#include "probes.h"
 
 struct source_s
 {
@@ -9,11 +16,29 @@ struct source_s
 
 	// properties
 	char *device_name;
+	char *redundant_device;
+	char *backend;
+	uint64_t stream_key;
 	int channel_l;
 	int channel_r;
+	bool mixing;
+	struct capdev_mix_s mix;
+	uint32_t delays[H8819_MAX_CHANNELS];
+	bool recording;
+	struct capdev_record_s record;
+	bool flightrec_enabled;
+	struct capdev_flightrec_s flightrec;
+	bool rtp_enabled;
+	struct capdev_rtp_s rtp;
+	bool metering;
+	bool resample;
+	bool drift_correct;
+	uint32_t sample_rate; // of OBS, taken at `update` rather than for each frame
 
 	// internal data
 	capdev_t *capdev;
+	bool active;
+	bool showing;
 };
 
 static const char *get_name(void *type_data)
@@ -22,24 +47,172 @@ static const char *get_name(void *type_data)
 	return obs_module_text("h8819 Audio");
 }
 
-static void device_name_enum_cb(const char *name, const char *description, void *param)
+static void backend_count_cb(const char *id, void *param)
+{
+	UNUSED_PARAMETER(id);
+	int *n = param;
+	(*n)++;
+}
+
+static void backend_enum_cb(const char *id, void *param)
 {
 	obs_property_t *prop = param;
+	struct dstr name = {0};
+	dstr_printf(&name, "Backend.%s", id);
+	obs_property_list_add_string(prop, obs_module_text(name.array), id);
+	dstr_free(&name);
+}
+
+struct stream_enum_s
+{
+	obs_property_t *prop;
+	uint64_t current;
+	bool found_current;
+};
+
+static void stream_enum_cb(uint64_t stream_key, void *param)
+{
+	struct stream_enum_s *ctx = param;
+	char mac[H8819_MAC_STRLEN];
+	h8819_stream_key_to_string(mac, stream_key);
+	obs_property_list_add_string(ctx->prop, mac, mac);
+	if (stream_key == ctx->current)
+		ctx->found_current = true;
+}
 
-	obs_property_list_add_string(prop, description, name);
+static bool flightrec_dump_cb(obs_properties_t *props, obs_property_t *property, void *data)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(property);
+	struct source_s *s = data;
+	if (s->capdev)
+		capdev_request_dump(s->capdev);
+	return false;
 }
 
 static obs_properties_t *get_properties(void *data)
 {
-	UNUSED_PARAMETER(data);
+	struct source_s *s = data;
 	obs_properties_t *props = obs_properties_create();
 	obs_property_t *prop;
 
 	prop = obs_properties_add_list(props, "device_name", obs_module_text("Ethernet device"), OBS_COMBO_TYPE_LIST,
 				       OBS_COMBO_FORMAT_STRING);
-	capdev_enum_devices(device_name_enum_cb, prop);
-	obs_properties_add_int(props, "channel_l", obs_module_text("Channel Left"), 1, 40, 1);
-	obs_properties_add_int(props, "channel_r", obs_module_text("Channel Right"), 1, 40, 1);
+	devlist_fill_property(prop, s ? s->device_name : NULL);
+	devlist_request_refresh();
+
+#ifndef OS_WINDOWS
+	prop = obs_properties_add_list(props, "redundant_device", obs_module_text("RedundantDevice"),
+				       OBS_COMBO_TYPE_LIST, OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(prop, obs_module_text("RedundantDevice.None"), "");
+	devlist_fill_property(prop, s ? s->redundant_device : NULL);
+	obs_property_set_long_description(prop, obs_module_text("RedundantDevice.Description"));
+#endif
+
+	int n_backends = 0;
+	capdev_enum_backends(backend_count_cb, &n_backends);
+	if (n_backends > 1) {
+		prop = obs_properties_add_list(props, "backend", obs_module_text("Backend"), OBS_COMBO_TYPE_LIST,
+					       OBS_COMBO_FORMAT_STRING);
+		capdev_enum_backends(backend_enum_cb, prop);
+		obs_property_set_long_description(prop, obs_module_text("Backend.Description"));
+	}
+
+	prop = obs_properties_add_list(props, "stream", obs_module_text("Stream"), OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_STRING);
+	obs_property_list_add_string(prop, obs_module_text("Stream.Auto"), "");
+	struct stream_enum_s stream_ctx = {
+		.prop = prop,
+		.current = s ? s->stream_key : 0,
+	};
+	if (s && s->capdev)
+		capdev_enum_streams(s->capdev, stream_enum_cb, &stream_ctx);
+	if (stream_ctx.current && !stream_ctx.found_current)
+		stream_enum_cb(stream_ctx.current, &stream_ctx);
+	obs_property_set_long_description(prop, obs_module_text("Stream.Description"));
+
+	obs_properties_add_int(props, "channel_l", obs_module_text("Channel Left"), 1, H8819_MAX_CHANNELS, 1);
+	obs_properties_add_int(props, "channel_r", obs_module_text("Channel Right"), 1, H8819_MAX_CHANNELS, 1);
+
+	obs_properties_t *mix = obs_properties_create();
+	prop = obs_properties_add_text(mix, "mix_channels", obs_module_text("Mix.Channels"), OBS_TEXT_MULTILINE);
+	obs_property_set_long_description(prop, obs_module_text("Mix.Channels.Description"));
+	prop = obs_properties_add_group(props, "mix", obs_module_text("Mix"), OBS_GROUP_CHECKABLE, mix);
+	obs_property_set_long_description(prop, obs_module_text("Mix.Description"));
+
+	obs_properties_t *delay = obs_properties_create();
+	prop = obs_properties_add_text(delay, "delay_channels", obs_module_text("Delay.Channels"), OBS_TEXT_MULTILINE);
+	obs_property_set_long_description(prop, obs_module_text("Delay.Channels.Description"));
+	prop = obs_properties_add_group(props, "delay", obs_module_text("Delay"), OBS_GROUP_CHECKABLE, delay);
+	obs_property_set_long_description(prop, obs_module_text("Delay.Description"));
+
+	prop = obs_properties_add_bool(props, "meter", obs_module_text("Meter"));
+	obs_property_set_long_description(prop, obs_module_text("Meter.Description"));
+
+	prop = obs_properties_add_bool(props, "resample", obs_module_text("Resample"));
+	obs_property_set_long_description(prop, obs_module_text("Resample.Description"));
+
+	prop = obs_properties_add_bool(props, "drift_correct", obs_module_text("DriftCorrect"));
+	obs_property_set_long_description(prop, obs_module_text("DriftCorrect.Description"));
+
+	obs_properties_t *record = obs_properties_create();
+	obs_properties_add_path(record, "record_directory", obs_module_text("Record.Directory"),
+				OBS_PATH_DIRECTORY, NULL, NULL);
+	prop = obs_properties_add_text(record, "record_channels", obs_module_text("Record.Channels"),
+				       OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(prop, obs_module_text("Record.Channels.Description"));
+	prop = obs_properties_add_list(record, "record_format", obs_module_text("Record.Format"), OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, "W64", RECORDER_FORMAT_W64);
+	obs_property_list_add_int(prop, "RF64", RECORDER_FORMAT_RF64);
+	obs_property_list_add_int(prop, "CAF", RECORDER_FORMAT_CAF);
+	prop = obs_properties_add_int(record, "record_rollover_minutes", obs_module_text("Record.RolloverMinutes"), 0,
+				      24 * 60, 1);
+	obs_property_int_set_suffix(prop, " min");
+	prop = obs_properties_add_int(record, "record_rollover_mb", obs_module_text("Record.RolloverSize"), 0,
+				      1024 * 1024, 1);
+	obs_property_int_set_suffix(prop, " MB");
+	obs_properties_add_bool(record, "record_direct_io", obs_module_text("Record.DirectIO"));
+	prop = obs_properties_add_group(props, "record", obs_module_text("Record"), OBS_GROUP_CHECKABLE, record);
+	obs_property_set_long_description(prop, obs_module_text("Record.Description"));
+
+	obs_properties_t *flightrec = obs_properties_create();
+	obs_properties_add_path(flightrec, "flightrec_directory", obs_module_text("FlightRecorder.Directory"),
+				OBS_PATH_DIRECTORY, NULL, NULL);
+	prop = obs_properties_add_int(flightrec, "flightrec_before", obs_module_text("FlightRecorder.Before"), 1, 60,
+				      1);
+	obs_property_int_set_suffix(prop, " s");
+	prop = obs_properties_add_int(flightrec, "flightrec_after", obs_module_text("FlightRecorder.After"), 0, 60, 1);
+	obs_property_int_set_suffix(prop, " s");
+	obs_properties_add_button(flightrec, "flightrec_dump", obs_module_text("FlightRecorder.Dump"),
+				  flightrec_dump_cb);
+	prop = obs_properties_add_group(props, "flightrec", obs_module_text("FlightRecorder"), OBS_GROUP_CHECKABLE,
+					flightrec);
+	obs_property_set_long_description(prop, obs_module_text("FlightRecorder.Description"));
+
+	obs_properties_t *rtp = obs_properties_create();
+	prop = obs_properties_add_text(rtp, "rtp_destination", obs_module_text("RTP.Destination"), OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(prop, obs_module_text("RTP.Destination.Description"));
+	prop = obs_properties_add_text(rtp, "rtp_interface", obs_module_text("RTP.Interface"), OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(prop, obs_module_text("RTP.Interface.Description"));
+	prop = obs_properties_add_text(rtp, "rtp_channels", obs_module_text("RTP.Channels"), OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(prop, obs_module_text("RTP.Channels.Description"));
+	prop = obs_properties_add_list(rtp, "rtp_ptime", obs_module_text("RTP.PacketTime"), OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_INT);
+	obs_property_list_add_int(prop, "125 us", 6);
+	obs_property_list_add_int(prop, "250 us", 12);
+	obs_property_list_add_int(prop, "333 us", 16);
+	obs_property_list_add_int(prop, "1 ms", 48);
+	obs_property_list_add_int(prop, "4 ms", 192);
+	prop = obs_properties_add_group(props, "rtp", obs_module_text("RTP"), OBS_GROUP_CHECKABLE, rtp);
+	obs_property_set_long_description(prop, obs_module_text("RTP.Description"));
+
+	prop = obs_properties_add_text(props, "timebase_group", obs_module_text("TimebaseGroup"), OBS_TEXT_DEFAULT);
+	obs_property_set_long_description(prop, obs_module_text("TimebaseGroup.Description"));
+
+	prop = obs_properties_add_int(props, "keepalive", obs_module_text("Keep device open"), 0, 600, 1);
+	obs_property_int_set_suffix(prop, " s");
+	obs_property_set_long_description(prop, obs_module_text("Keep device open.Description"));
 #ifdef ENABLE_ASYNC_COMPENSATION
 	obs_properties_add_bool(props, "async_compensation", obs_module_text("AsyncCompensation"));
 #endif
@@ -47,20 +220,45 @@ static obs_properties_t *get_properties(void *data)
 	return props;
 }
 
-static void update_device(struct source_s *s, const char *device_name, int channel_l, int channel_r)
+static void update_device(struct source_s *s, const char *device_name, const char *redundant_device,
+			  const char *backend, int channel_l, int channel_r)
 {
 	capdev_t *old_dev = s->capdev;
 
-	s->capdev = capdev_find_or_create(device_name);
+	// The helper process merges the interfaces given as `a+b`.
+	struct dstr name = {0};
+	dstr_copy(&name, device_name);
+	if (*redundant_device && strcmp(redundant_device, device_name) != 0) {
+		if (strcmp(backend, "proc") == 0)
+			dstr_catf(&name, "+%s", redundant_device);
+		else
+			blog(LOG_WARNING, "h8819: redundant device requires the helper process backend");
+	}
+	s->capdev = capdev_find_or_create(name.array, backend);
+	dstr_free(&name);
 
 	bfree(s->device_name);
 	s->device_name = bstrdup(device_name);
+	bfree(s->redundant_device);
+	s->redundant_device = bstrdup(redundant_device);
+	bfree(s->backend);
+	s->backend = bstrdup(backend);
 
 	if (old_dev)
 		capdev_unlink_source(old_dev, s);
 
 	int cc[3] = {channel_l, channel_r, -1};
 	capdev_link_source(s->capdev, s, cc);
+	capdev_set_source_stream(s->capdev, s, s->stream_key);
+	capdev_set_source_mix(s->capdev, s, s->mixing ? &s->mix : NULL);
+	capdev_set_source_delays(s->capdev, s, s->delays);
+	capdev_set_source_record(s->capdev, s, s->recording ? &s->record : NULL);
+	capdev_set_source_flightrec(s->capdev, s, s->flightrec_enabled ? &s->flightrec : NULL);
+	capdev_set_source_rtp(s->capdev, s, s->rtp_enabled ? &s->rtp : NULL);
+	capdev_set_source_meter(s->capdev, s, s->metering);
+	capdev_set_source_resample(s->capdev, s, s->resample, s->sample_rate);
+	capdev_set_source_drift_correct(s->capdev, s, s->drift_correct);
+	capdev_set_source_active(s->capdev, s, s->active || s->showing);
 
 	s->channel_l = channel_l;
 	s->channel_r = channel_r;
@@ -79,39 +277,336 @@ static void update_channels(struct source_s *s, int channel_l, int channel_r)
 	s->channel_r = channel_r;
 }
 
+/* Parse lines of `channels [gain dB] [pan] [mute]` such as `1-8 -6 -50`.
+ * Pan is from -100 (left) to 100 (right) with the constant power law.
+ * Text from `#` is ignored. A later line overrides the channels listed before. */
+static bool parse_mix(struct capdev_mix_s *mix, const char *str)
+{
+	*mix = (struct capdev_mix_s){0};
+	int index[H8819_MAX_CHANNELS]; // index in `mix` of each channel, -1 if not yet listed
+	for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++)
+		index[ch] = -1;
+	char **lines = strlist_split(str, '\n', false);
+	bool ok = true;
+
+	for (size_t i = 0; lines && lines[i] && ok; i++) {
+		char *line = lines[i];
+		char *comment = strchr(line, '#');
+		if (comment)
+			*comment = '\0';
+
+		char **words = strlist_split(line, ' ', false);
+		struct h8819_chmask_s channels = {0};
+		double values[2] = {0.0, 0.0}; // gain and pan
+		int n_values = 0;
+		bool mute = false;
+		size_t n_words = 0;
+		for (; words && words[n_words] && ok; n_words++) {
+			const char *w = words[n_words];
+			char *end;
+			if (n_words == 0) {
+				ok = h8819_chmask_from_string(&channels, w);
+			}
+			else if (strcmp(w, "mute") == 0) {
+				mute = true;
+			}
+			else if (n_values < 2) {
+				values[n_values++] = strtod(w, &end);
+				ok = *end == '\0';
+			}
+			else {
+				ok = false;
+			}
+		}
+		strlist_free(words);
+		double gain_db = values[0];
+		double pan = values[1];
+		if (pan < -100.0 || pan > 100.0)
+			ok = false;
+		if (!ok || n_words == 0)
+			continue;
+
+		const double half_pi = 1.5707963267948966;
+		double theta = (pan + 100.0) / 200.0 * half_pi;
+		double gain = mute ? 0.0 : pow(10.0, gain_db / 20.0);
+		for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++) {
+			if (!h8819_chmask_test(&channels, ch))
+				continue;
+			if (index[ch] < 0)
+				index[ch] = mix->n_inputs++;
+			int ix = index[ch];
+			mix->channels[ix] = ch;
+			mix->gains[0][ix] = (float)(gain * cos(theta));
+			mix->gains[1][ix] = (float)(gain * sin(theta));
+		}
+	}
+
+	strlist_free(lines);
+	return ok && mix->n_inputs > 0;
+}
+
+/* Parse lines of `channels milliseconds` such as `9-10 12.5`. Text from `#` is ignored. */
+static bool parse_delays(uint32_t delays[H8819_MAX_CHANNELS], const char *str)
+{
+	memset(delays, 0, sizeof(uint32_t) * H8819_MAX_CHANNELS);
+	char **lines = strlist_split(str, '\n', false);
+	bool ok = true;
+
+	for (size_t i = 0; lines && lines[i] && ok; i++) {
+		char *comment = strchr(lines[i], '#');
+		if (comment)
+			*comment = '\0';
+
+		char **words = strlist_split(lines[i], ' ', false);
+		if (words && words[0]) {
+			struct h8819_chmask_s channels;
+			char *end = NULL;
+			double ms = words[1] ? strtod(words[1], &end) : -1.0;
+			ok = h8819_chmask_from_string(&channels, words[0]) && end && *end == '\0' && !words[2] &&
+			     ms >= 0.0 && ms * H8819_SAMPLE_RATE / 1000.0 <= H8819_DELAY_MAX_SAMPLES;
+			for (int ch = 0; ok && ch < H8819_MAX_CHANNELS; ch++) {
+				if (h8819_chmask_test(&channels, ch))
+					delays[ch] = (uint32_t)(ms * H8819_SAMPLE_RATE / 1000.0 + 0.5);
+			}
+		}
+		strlist_free(words);
+	}
+
+	strlist_free(lines);
+	if (!ok)
+		memset(delays, 0, sizeof(uint32_t) * H8819_MAX_CHANNELS);
+	return ok;
+}
+
+static bool record_equal(const struct capdev_record_s *a, const struct capdev_record_s *b)
+{
+	return strcmp(a->directory, b->directory) == 0 && h8819_chmask_equal(&a->channel_mask, &b->channel_mask) &&
+	       a->format == b->format && a->rollover_seconds == b->rollover_seconds &&
+	       a->rollover_bytes == b->rollover_bytes && a->direct_io == b->direct_io;
+}
+
+// Returns true if the recording settings have changed.
+static bool update_record_settings(struct source_s *s, obs_data_t *settings)
+{
+	struct capdev_record_s rec = {
+		.directory = obs_data_get_string(settings, "record_directory"),
+		.format = (int)obs_data_get_int(settings, "record_format"),
+		.rollover_seconds = (uint32_t)obs_data_get_int(settings, "record_rollover_minutes") * 60,
+		.rollover_bytes = (uint64_t)obs_data_get_int(settings, "record_rollover_mb") * 1000000,
+		.direct_io = obs_data_get_bool(settings, "record_direct_io"),
+	};
+	bool recording = obs_data_get_bool(settings, "record") && *rec.directory &&
+			 h8819_chmask_from_string(&rec.channel_mask, obs_data_get_string(settings, "record_channels"));
+	if (!recording)
+		rec = (struct capdev_record_s){0};
+
+	if (recording == s->recording && (!recording || record_equal(&rec, &s->record)))
+		return false;
+
+	bfree((char *)s->record.directory);
+	s->recording = recording;
+	s->record = rec;
+	s->record.directory = recording ? bstrdup(rec.directory) : NULL;
+	return true;
+}
+
+// Returns true if the flight recorder settings have changed.
+static bool update_flightrec_settings(struct source_s *s, obs_data_t *settings)
+{
+	struct capdev_flightrec_s fr = {
+		.directory = obs_data_get_string(settings, "flightrec_directory"),
+		.seconds_before = (uint32_t)obs_data_get_int(settings, "flightrec_before"),
+		.seconds_after = (uint32_t)obs_data_get_int(settings, "flightrec_after"),
+	};
+	bool enabled = obs_data_get_bool(settings, "flightrec") && *fr.directory;
+	if (!enabled)
+		fr = (struct capdev_flightrec_s){0};
+
+	if (enabled == s->flightrec_enabled &&
+	    (!enabled || (strcmp(fr.directory, s->flightrec.directory) == 0 &&
+			  fr.seconds_before == s->flightrec.seconds_before &&
+			  fr.seconds_after == s->flightrec.seconds_after)))
+		return false;
+
+	bfree((char *)s->flightrec.directory);
+	s->flightrec_enabled = enabled;
+	s->flightrec = fr;
+	s->flightrec.directory = enabled ? bstrdup(fr.directory) : NULL;
+	return true;
+}
+
+// Returns true if the RTP settings have changed.
+static bool update_rtp_settings(struct source_s *s, obs_data_t *settings)
+{
+	struct capdev_rtp_s rtp = {
+		.destination = obs_data_get_string(settings, "rtp_destination"),
+		.interface_address = obs_data_get_string(settings, "rtp_interface"),
+		.ptime_samples = (uint32_t)obs_data_get_int(settings, "rtp_ptime"),
+	};
+	bool enabled = obs_data_get_bool(settings, "rtp") && *rtp.destination && rtp.ptime_samples &&
+		       h8819_chmask_from_string(&rtp.channel_mask, obs_data_get_string(settings, "rtp_channels"));
+	if (!enabled)
+		rtp = (struct capdev_rtp_s){0};
+
+	if (enabled == s->rtp_enabled &&
+	    (!enabled || (strcmp(rtp.destination, s->rtp.destination) == 0 &&
+			  strcmp(rtp.interface_address, s->rtp.interface_address) == 0 &&
+			  h8819_chmask_equal(&rtp.channel_mask, &s->rtp.channel_mask) &&
+			  rtp.ptime_samples == s->rtp.ptime_samples)))
+		return false;
+
+	bfree((char *)s->rtp.destination);
+	bfree((char *)s->rtp.interface_address);
+	s->rtp_enabled = enabled;
+	s->rtp = rtp;
+	s->rtp.destination = enabled ? bstrdup(rtp.destination) : NULL;
+	s->rtp.interface_address = enabled ? bstrdup(rtp.interface_address) : NULL;
+	return true;
+}
+
 static void update(void *data, obs_data_t *settings)
 {
 	struct source_s *s = data;
 
 	const char *device_name = obs_data_get_string(settings, "device_name");
+	const char *redundant_device = obs_data_get_string(settings, "redundant_device");
+	const char *backend = obs_data_get_string(settings, "backend");
+	uint64_t stream_key = h8819_stream_key_from_string(obs_data_get_string(settings, "stream"));
 	int channel_l = obs_data_get_int(settings, "channel_l") - 1;
 	int channel_r = obs_data_get_int(settings, "channel_r") - 1;
 
 	if (channel_l < 0)
 		channel_l = 0;
-	if (channel_l >= 40)
-		channel_l = 40 - 1;
+	if (channel_l >= H8819_MAX_CHANNELS)
+		channel_l = H8819_MAX_CHANNELS - 1;
 	if (channel_r < 0)
 		channel_r = 0;
-	if (channel_r >= 40)
-		channel_r = 40 - 1;
+	if (channel_r >= H8819_MAX_CHANNELS)
+		channel_r = H8819_MAX_CHANNELS - 1;
+
+	if (stream_key != s->stream_key) {
+		s->stream_key = stream_key;
+		if (s->capdev)
+			capdev_set_source_stream(s->capdev, s, stream_key);
+	}
 
-	if (device_name && (!s->device_name || strcmp(device_name, s->device_name)))
-		update_device(s, device_name, channel_l, channel_r);
+	if (device_name &&
+	    (!s->device_name || strcmp(device_name, s->device_name) || !s->redundant_device ||
+	     strcmp(redundant_device, s->redundant_device) || !s->backend || strcmp(backend, s->backend)))
+		update_device(s, device_name, redundant_device, backend, channel_l, channel_r);
 
 	if (channel_l != s->channel_l || channel_r != s->channel_r)
 		update_channels(s, channel_l, channel_r);
 
+	struct capdev_mix_s mix;
+	bool mixing = obs_data_get_bool(settings, "mix") &&
+		      parse_mix(&mix, obs_data_get_string(settings, "mix_channels"));
+	if (!mixing)
+		mix = (struct capdev_mix_s){0};
+	uint32_t delays[H8819_MAX_CHANNELS] = {0};
+	if (obs_data_get_bool(settings, "delay"))
+		parse_delays(delays, obs_data_get_string(settings, "delay_channels"));
+	if (memcmp(delays, s->delays, sizeof(delays)) != 0) {
+		memcpy(s->delays, delays, sizeof(delays));
+		if (s->capdev)
+			capdev_set_source_delays(s->capdev, s, delays);
+	}
+
+	if (mixing != s->mixing || memcmp(&mix, &s->mix, sizeof(mix)) != 0) {
+		s->mixing = mixing;
+		s->mix = mix;
+		if (s->capdev)
+			capdev_set_source_mix(s->capdev, s, mixing ? &mix : NULL);
+	}
+
+	if (update_record_settings(s, settings) && s->capdev)
+		capdev_set_source_record(s->capdev, s, s->recording ? &s->record : NULL);
+
+	if (update_flightrec_settings(s, settings) && s->capdev)
+		capdev_set_source_flightrec(s->capdev, s, s->flightrec_enabled ? &s->flightrec : NULL);
+
+	if (update_rtp_settings(s, settings) && s->capdev)
+		capdev_set_source_rtp(s->capdev, s, s->rtp_enabled ? &s->rtp : NULL);
+
+	bool metering = obs_data_get_bool(settings, "meter");
+	if (metering != s->metering) {
+		s->metering = metering;
+		if (s->capdev)
+			capdev_set_source_meter(s->capdev, s, metering);
+	}
+
+	bool resample = obs_data_get_bool(settings, "resample");
+	uint32_t sample_rate = audio_output_get_sample_rate(obs_get_audio());
+	if (resample != s->resample || sample_rate != s->sample_rate) {
+		s->resample = resample;
+		s->sample_rate = sample_rate;
+		if (s->capdev)
+			capdev_set_source_resample(s->capdev, s, resample, sample_rate);
+	}
+
+	bool drift_correct = obs_data_get_bool(settings, "drift_correct");
+	if (drift_correct != s->drift_correct) {
+		s->drift_correct = drift_correct;
+		if (s->capdev)
+			capdev_set_source_drift_correct(s->capdev, s, drift_correct);
+	}
+
+	if (s->capdev) {
+		capdev_set_source_keepalive(s->capdev, s, (int)obs_data_get_int(settings, "keepalive") * 1000);
+		capdev_set_source_timebase_group(s->capdev, s, obs_data_get_string(settings, "timebase_group"));
+	}
+
 #ifdef ENABLE_ASYNC_COMPENSATION
 	obs_source_set_async_compensation(s->context, obs_data_get_bool(settings, "async_compensation"));
 #endif
 }
 
+static void get_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_string(settings, "backend", capdev_default_backend());
+	obs_data_set_default_int(settings, "keepalive", CAPDEV_KEEPALIVE_S_DEFAULT);
+	obs_data_set_default_string(settings, "record_channels", "1-40");
+	obs_data_set_default_int(settings, "record_format", RECORDER_FORMAT_W64);
+	obs_data_set_default_int(settings, "record_rollover_minutes", 60);
+	obs_data_set_default_int(settings, "flightrec_before", 5);
+	obs_data_set_default_int(settings, "flightrec_after", 2);
+	obs_data_set_default_string(settings, "rtp_destination", "239.69.0.1:5004");
+	obs_data_set_default_string(settings, "rtp_channels", "1-2");
+	obs_data_set_default_int(settings, "rtp_ptime", 48);
+}
+
+// Levels of one channel of the stream, for docks and scripts that show all channels.
+// Each call locks the device against the capture thread, so it should not be polled faster than every 50 ms.
+static void get_meter_proc(void *data, calldata_t *cd)
+{
+	struct source_s *s = data;
+	struct capdev_levels_s levels;
+	int ch = (int)calldata_int(cd, "channel") - 1;
+
+	if (!s->capdev || !capdev_get_levels(s->capdev, s->stream_key, &levels)) {
+		calldata_set_int(cd, "n_channels", 0);
+		return;
+	}
+
+	calldata_set_int(cd, "n_channels", levels.n_channels);
+	if (ch < 0 || ch >= levels.n_channels)
+		return;
+	calldata_set_float(cd, "peak", mul_to_db(levels.peak[ch]));
+	calldata_set_float(cd, "rms", mul_to_db(levels.rms[ch]));
+	calldata_set_int(cd, "clips", levels.clips[ch]);
+}
+
 static void *create(obs_data_t *settings, obs_source_t *source)
 {
 	struct source_s *s = bzalloc(sizeof(struct source_s));
 	s->context = source;
 
+	proc_handler_t *ph = obs_source_get_proc_handler(source);
+	proc_handler_add(ph,
+			 "void get_meter(in int channel, out int n_channels, out float peak, out float rms, "
+			 "out int clips)",
+			 get_meter_proc, s);
+
 	update(s, settings);
 
 	return s;
@@ -127,14 +622,54 @@ static void destroy(void *data)
 	}
 
 	bfree(s->device_name);
+	bfree(s->redundant_device);
+	bfree(s->backend);
+	bfree((char *)s->record.directory);
+	bfree((char *)s->flightrec.directory);
+	bfree((char *)s->rtp.destination);
+	bfree((char *)s->rtp.interface_address);
 	bfree(s);
 }
 
-void source_add_audio(source_t *s, float **data, int n_samples, uint64_t timestamp)
+static void update_active(struct source_s *s)
+{
+	if (s->capdev)
+		capdev_set_source_active(s->capdev, s, s->active || s->showing);
+}
+
+static void activate(void *data)
+{
+	struct source_s *s = data;
+	s->active = true;
+	update_active(s);
+}
+
+static void deactivate(void *data)
+{
+	struct source_s *s = data;
+	s->active = false;
+	update_active(s);
+}
+
+static void show(void *data)
+{
+	struct source_s *s = data;
+	s->showing = true;
+	update_active(s);
+}
+
+static void hide(void *data)
+{
+	struct source_s *s = data;
+	s->showing = false;
+	update_active(s);
+}
+
+void source_add_audio(source_t *s, float **data, int n_samples, uint32_t sample_rate, uint64_t timestamp)
 {
 	struct obs_source_audio out = {
 		.speakers = 2,
-		.samples_per_sec = 48000, // TODO: retrieve from the packet
+		.samples_per_sec = sample_rate,
 		.format = AUDIO_FORMAT_FLOAT_PLANAR,
 		.frames = n_samples,
 		.timestamp = timestamp,
@@ -142,6 +677,7 @@ void source_add_audio(source_t *s, float **data, int n_samples, uint64_t timesta
 	for (int i = 0; i < 2; i++)
 		out.data[i] = (void *)data[i];
 
+	H8819_PROBE3(source_deliver, s, n_samples, timestamp);
 	obs_source_output_audio(s->context, &out);
 }
 
@@ -150,9 +686,14 @@ const struct obs_source_info src_info = {
 	.type = OBS_SOURCE_TYPE_INPUT,
 	.output_flags = OBS_SOURCE_AUDIO | OBS_SOURCE_DO_NOT_DUPLICATE,
 	.get_name = get_name,
+	.get_defaults = get_defaults,
 	.create = create,
 	.destroy = destroy,
 	.update = update,
+	.activate = activate,
+	.deactivate = deactivate,
+	.show = show,
+	.hide = hide,
 	.get_properties = get_properties,
 	.icon_type = OBS_ICON_TYPE_AUDIO_INPUT,
 };
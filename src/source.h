@@ -3,4 +3,4 @@
 #include <stdint.h>
 #include "common.h"
 
-void source_add_audio(source_t *s, float **data, int n_samples, uint64_t timestamp);
+void source_add_audio(source_t *s, float **data, int n_samples, uint32_t sample_rate, uint64_t timestamp);
@@ -0,0 +1,150 @@
+#include <obs-module.h>
+#include <util/threading.h>
+#include "plugin-macros.generated.h"
+#include "capdev.h"
+#include "devlist.h"
+#include "h8819.h"
+
+#define FRAME_CHANNELS_DEFAULT 40
+
+struct transmit_filter_s
+{
+	obs_source_t *context;
+
+	// properties
+	char *device_name;
+	int frame_channels; // protected by `mutex`
+	int first_channel;  // 0-based, protected by `mutex`
+
+	// internal data
+	pthread_mutex_t mutex;
+	capdev_t *capdev; // protected by `mutex`
+	bool warned_rate;
+};
+
+static const char *get_name(void *type_data)
+{
+	UNUSED_PARAMETER(type_data);
+	return obs_module_text("TransmitFilter");
+}
+
+static obs_properties_t *get_properties(void *data)
+{
+	struct transmit_filter_s *s = data;
+	obs_properties_t *props = obs_properties_create();
+	obs_property_t *prop;
+
+	prop = obs_properties_add_list(props, "device_name", obs_module_text("Ethernet device"), OBS_COMBO_TYPE_LIST,
+				       OBS_COMBO_FORMAT_STRING);
+	devlist_fill_property(prop, s ? s->device_name : NULL);
+	devlist_request_refresh();
+
+	prop = obs_properties_add_int(props, "frame_channels", obs_module_text("Transmit.FrameChannels"), 2,
+				      H8819_MAX_CHANNELS, 2);
+	obs_property_set_long_description(prop, obs_module_text("Transmit.FrameChannels.Description"));
+
+	obs_properties_add_int(props, "first_channel", obs_module_text("Transmit.FirstChannel"), 1, H8819_MAX_CHANNELS,
+			       1);
+
+	return props;
+}
+
+static void get_defaults(obs_data_t *settings)
+{
+	obs_data_set_default_int(settings, "frame_channels", FRAME_CHANNELS_DEFAULT);
+	obs_data_set_default_int(settings, "first_channel", 1);
+}
+
+static void update(void *data, obs_data_t *settings)
+{
+	struct transmit_filter_s *s = data;
+
+	const char *device_name = obs_data_get_string(settings, "device_name");
+	pthread_mutex_lock(&s->mutex);
+	s->frame_channels = (int)obs_data_get_int(settings, "frame_channels") & ~1;
+	s->first_channel = (int)obs_data_get_int(settings, "first_channel") - 1;
+	pthread_mutex_unlock(&s->mutex);
+
+	if (s->device_name && strcmp(device_name, s->device_name) == 0)
+		return;
+
+	capdev_t *dev = *device_name ? capdev_find_or_create(device_name, "proc") : NULL;
+
+	pthread_mutex_lock(&s->mutex);
+	capdev_t *old_dev = s->capdev;
+	s->capdev = dev;
+	pthread_mutex_unlock(&s->mutex);
+
+	if (old_dev) {
+		capdev_transmit_stop(old_dev);
+		capdev_release(old_dev);
+	}
+
+	bfree(s->device_name);
+	s->device_name = bstrdup(device_name);
+}
+
+static void *create(obs_data_t *settings, obs_source_t *source)
+{
+	struct transmit_filter_s *s = bzalloc(sizeof(struct transmit_filter_s));
+	s->context = source;
+	pthread_mutex_init(&s->mutex, NULL);
+
+	update(s, settings);
+
+	return s;
+}
+
+static void destroy(void *data)
+{
+	struct transmit_filter_s *s = data;
+
+	if (s->capdev) {
+		capdev_transmit_stop(s->capdev);
+		capdev_release(s->capdev);
+	}
+
+	pthread_mutex_destroy(&s->mutex);
+	bfree(s->device_name);
+	bfree(s);
+}
+
+static struct obs_audio_data *filter_audio(void *data, struct obs_audio_data *audio)
+{
+	struct transmit_filter_s *s = data;
+
+	uint32_t sample_rate = audio_output_get_sample_rate(obs_get_audio());
+	if (sample_rate != 48000) {
+		if (!s->warned_rate)
+			blog(LOG_WARNING, "h8819 transmit: sample rate %u Hz is not supported, 48000 Hz is required",
+			     sample_rate);
+		s->warned_rate = true;
+		return audio;
+	}
+
+	pthread_mutex_lock(&s->mutex);
+	int first_channel = s->first_channel;
+	int frame_channels = s->frame_channels;
+	int n_channels = (int)audio_output_get_channels(obs_get_audio());
+	if (n_channels > frame_channels - first_channel)
+		n_channels = frame_channels - first_channel;
+	if (s->capdev && first_channel >= 0 && first_channel < frame_channels)
+		capdev_transmit(s->capdev, frame_channels, first_channel, (const float *const *)audio->data, n_channels,
+				audio->frames);
+	pthread_mutex_unlock(&s->mutex);
+
+	return audio;
+}
+
+const struct obs_source_info transmit_filter_info = {
+	.id = ID_PREFIX "transmit-filter",
+	.type = OBS_SOURCE_TYPE_FILTER,
+	.output_flags = OBS_SOURCE_AUDIO,
+	.get_name = get_name,
+	.get_defaults = get_defaults,
+	.create = create,
+	.destroy = destroy,
+	.update = update,
+	.get_properties = get_properties,
+	.filter_audio = filter_audio,
+};
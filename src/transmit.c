@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+#include "h8819.h"
+#include "transmit.h"
+#include "probes.h"
+
+#define FRAME_NS h8819_sample_time(H8819_N_SAMPLES)
+#define BATCH_DEFAULT 4
+#define BATCH_MAX 16
+// Each slot of the ring holds the TPACKET2 header and the longest frame.
+#define RING_FRAME_SIZE 8192
+#define RING_BLOCK_SIZE (RING_FRAME_SIZE * 4)
+#define RING_FRAMES 64
+// When the thread wakes up later than this, the schedule restarts instead of sending the missed frames at once.
+#define LATE_RESYNC_NS 20000000LL
+// Per-channel queue for `transmit_push`, power of two.
+#define QUEUE_SAMPLES 8192
+// OBS delivers 1024 samples at a time. Keep a half of it more to absorb the jitter.
+#define PREFILL_SAMPLES 1536
+
+struct queue_s
+{
+	float *buf;
+	uint32_t rpos;
+	uint32_t wpos;
+	bool running;
+};
+
+struct transmit_s
+{
+	char *if_name;
+	int n_channels;
+	int batch;
+	transmit_fill_cb fill;
+	void *param;
+	uint8_t mac[6];
+
+	int fd;
+	uint8_t *ring;
+	size_t ring_size;
+	int ring_pos;
+
+	pthread_t thread;
+	atomic_bool exiting;
+
+	pthread_mutex_t mutex;
+	struct queue_s queues[H8819_MAX_CHANNELS];
+	uint64_t n_underruns;
+	uint64_t n_overruns;
+
+	// Written only by the transmit thread
+	uint16_t counter;
+	uint64_t n_sent;
+	uint64_t n_ring_full;
+	uint64_t n_send_errors;
+	uint64_t n_wakeups;
+	uint64_t n_resync;
+	int64_t wakeup_late_sum;
+	int64_t wakeup_late_max;
+};
+
+static int64_t gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until(int64_t ns)
+{
+	struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+static void pop_queues(struct transmit_s *tx, float *const *fltp)
+{
+	pthread_mutex_lock(&tx->mutex);
+	for (int ch = 0; ch < tx->n_channels; ch++) {
+		struct queue_s *q = tx->queues + ch;
+		uint32_t n = q->wpos - q->rpos;
+		if (!q->running && n >= PREFILL_SAMPLES)
+			q->running = true;
+		if (!q->running)
+			continue;
+		if (n < H8819_N_SAMPLES) {
+			// Wait for the prefill again rather than sending fragments.
+			q->running = false;
+			tx->n_underruns++;
+			continue;
+		}
+		for (int i = 0; i < H8819_N_SAMPLES; i++)
+			fltp[ch][i] = q->buf[(q->rpos + i) % QUEUE_SAMPLES];
+		q->rpos += H8819_N_SAMPLES;
+	}
+	pthread_mutex_unlock(&tx->mutex);
+}
+
+static bool queue_frame(struct transmit_s *tx, const float *const *fltp)
+{
+	struct tpacket2_hdr *hdr = (void *)(tx->ring + (size_t)tx->ring_pos * RING_FRAME_SIZE);
+	uint16_t counter = tx->counter++;
+
+	uint32_t status = __atomic_load_n(&hdr->tp_status, __ATOMIC_ACQUIRE);
+	if (status == TP_STATUS_WRONG_FORMAT) {
+		tx->n_send_errors++;
+		status = TP_STATUS_AVAILABLE;
+	}
+	if (status != TP_STATUS_AVAILABLE) {
+		// The counter still advances so that receivers see the dropped frame as a gap.
+		tx->n_ring_full++;
+		return false;
+	}
+
+	uint8_t *data = (uint8_t *)hdr + TPACKET2_HDRLEN - sizeof(struct sockaddr_ll);
+	hdr->tp_len = (uint32_t)h8819_build_frame(data, tx->mac, counter, fltp, tx->n_channels);
+	__atomic_store_n(&hdr->tp_status, TP_STATUS_SEND_REQUEST, __ATOMIC_RELEASE);
+	tx->ring_pos = (tx->ring_pos + 1) % RING_FRAMES;
+	return true;
+}
+
+static void *transmit_thread(void *data)
+{
+	struct transmit_s *tx = data;
+	float buf[H8819_MAX_CHANNELS * H8819_N_SAMPLES];
+	float *fltp[H8819_MAX_CHANNELS];
+	for (int ch = 0; ch < tx->n_channels; ch++)
+		fltp[ch] = buf + ch * H8819_N_SAMPLES;
+
+	int64_t next = gettime_ns();
+	while (!atomic_load(&tx->exiting)) {
+		sleep_until(next);
+
+		int64_t late = gettime_ns() - next;
+		if (late > LATE_RESYNC_NS) {
+			tx->n_resync++;
+			next += late;
+			late = 0;
+		}
+		tx->n_wakeups++;
+		tx->wakeup_late_sum += late;
+		if (late > tx->wakeup_late_max)
+			tx->wakeup_late_max = late;
+
+		int n_queued = 0;
+		for (int i = 0; i < tx->batch; i++) {
+			memset(buf, 0, sizeof(float) * H8819_N_SAMPLES * tx->n_channels);
+			if (tx->fill)
+				tx->fill(tx->counter, fltp, tx->n_channels, H8819_N_SAMPLES, tx->param);
+			else
+				pop_queues(tx, fltp);
+			if (queue_frame(tx, (const float *const *)fltp))
+				n_queued++;
+		}
+
+		ssize_t ret = n_queued ? send(tx->fd, NULL, 0, MSG_DONTWAIT) : 0;
+		H8819_PROBE2(transmit_send, n_queued, ret);
+		if (ret < 0 && errno != EAGAIN && errno != ENOBUFS)
+			tx->n_send_errors++;
+		tx->n_sent += n_queued;
+
+		next += FRAME_NS * tx->batch;
+	}
+
+	return NULL;
+}
+
+static bool open_socket(struct transmit_s *tx)
+{
+	tx->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (tx->fd < 0) {
+		fprintf(stderr, "Error: transmit: socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	int version = TPACKET_V2;
+	if (setsockopt(tx->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fprintf(stderr, "Error: transmit: PACKET_VERSION: %s\n", strerror(errno));
+		return false;
+	}
+
+	// Skipping the qdisc saves latency. It is fine to fail on old kernels.
+	int one = 1;
+	setsockopt(tx->fd, SOL_PACKET, PACKET_QDISC_BYPASS, &one, sizeof(one));
+
+	struct tpacket_req req = {
+		.tp_block_size = RING_BLOCK_SIZE,
+		.tp_block_nr = RING_FRAMES * RING_FRAME_SIZE / RING_BLOCK_SIZE,
+		.tp_frame_size = RING_FRAME_SIZE,
+		.tp_frame_nr = RING_FRAMES,
+	};
+	if (setsockopt(tx->fd, SOL_PACKET, PACKET_TX_RING, &req, sizeof(req)) < 0) {
+		fprintf(stderr, "Error: transmit: PACKET_TX_RING: %s\n", strerror(errno));
+		return false;
+	}
+	tx->ring_size = (size_t)RING_FRAMES * RING_FRAME_SIZE;
+	tx->ring = mmap(NULL, tx->ring_size, PROT_READ | PROT_WRITE, MAP_SHARED, tx->fd, 0);
+	if (tx->ring == MAP_FAILED) {
+		fprintf(stderr, "Error: transmit: mmap: %s\n", strerror(errno));
+		tx->ring = NULL;
+		return false;
+	}
+
+	struct ifreq ifr = {0};
+	snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", tx->if_name);
+	if (ioctl(tx->fd, SIOCGIFHWADDR, &ifr) < 0) {
+		fprintf(stderr, "Error: transmit: cannot get the address of '%s': %s\n", tx->if_name, strerror(errno));
+		return false;
+	}
+	memcpy(tx->mac, ifr.ifr_hwaddr.sa_data, sizeof(tx->mac));
+
+	// Protocol 0 so that the socket does not receive.
+	struct sockaddr_ll sll = {
+		.sll_family = AF_PACKET,
+		.sll_ifindex = (int)if_nametoindex(tx->if_name),
+	};
+	if (!sll.sll_ifindex || bind(tx->fd, (struct sockaddr *)&sll, sizeof(sll)) < 0) {
+		fprintf(stderr, "Error: transmit: cannot bind to '%s': %s\n", tx->if_name, strerror(errno));
+		return false;
+	}
+
+	return true;
+}
+
+static void transmit_free(struct transmit_s *tx)
+{
+	if (tx->ring)
+		munmap(tx->ring, tx->ring_size);
+	if (tx->fd >= 0)
+		close(tx->fd);
+	for (int ch = 0; ch < H8819_MAX_CHANNELS; ch++)
+		free(tx->queues[ch].buf);
+	pthread_mutex_destroy(&tx->mutex);
+	free(tx->if_name);
+	free(tx);
+}
+
+struct transmit_s *transmit_create(const struct transmit_config_s *cfg)
+{
+	if (cfg->n_channels <= 0 || cfg->n_channels > H8819_MAX_CHANNELS || cfg->n_channels % 2 ||
+	    cfg->batch < 0 || cfg->batch > BATCH_MAX) {
+		fprintf(stderr, "Error: transmit: invalid configuration\n");
+		return NULL;
+	}
+
+	struct transmit_s *tx = calloc(1, sizeof(struct transmit_s));
+	if (!tx)
+		return NULL;
+	tx->if_name = strdup(cfg->if_name);
+	tx->n_channels = cfg->n_channels;
+	tx->batch = cfg->batch ? cfg->batch : BATCH_DEFAULT;
+	tx->fill = cfg->fill;
+	tx->param = cfg->param;
+	tx->fd = -1;
+	pthread_mutex_init(&tx->mutex, NULL);
+
+	bool ok = true;
+	for (int ch = 0; ch < tx->n_channels && !cfg->fill && ok; ch++) {
+		tx->queues[ch].buf = calloc(QUEUE_SAMPLES, sizeof(float));
+		ok = tx->queues[ch].buf != NULL;
+	}
+
+	if (!ok || !open_socket(tx) || pthread_create(&tx->thread, NULL, transmit_thread, tx) != 0) {
+		fputs("Error: transmit: failed to start\n", stderr);
+		transmit_free(tx);
+		return NULL;
+	}
+
+	char mac[H8819_MAC_STRLEN];
+	h8819_stream_key_to_string(mac, transmit_stream_key(tx));
+	fprintf(stderr, "Info: transmit: %d channels from %s on '%s', %d frames per batch\n", tx->n_channels, mac,
+		tx->if_name, tx->batch);
+	return tx;
+}
+
+void transmit_destroy(struct transmit_s *tx)
+{
+	if (!tx)
+		return;
+
+	atomic_store(&tx->exiting, true);
+	pthread_join(tx->thread, NULL);
+
+	fprintf(stderr,
+		"Info: transmit '%s': %llu frames sent, %llu dropped on a full ring, %llu send errors, "
+		"wake-up %.1f us late average %.1f us max, %llu restarts, %llu underruns, %llu overruns\n",
+		tx->if_name, (unsigned long long)tx->n_sent, (unsigned long long)tx->n_ring_full,
+		(unsigned long long)tx->n_send_errors,
+		tx->n_wakeups ? (double)tx->wakeup_late_sum / (double)tx->n_wakeups * 1e-3 : 0.0,
+		(double)tx->wakeup_late_max * 1e-3, (unsigned long long)tx->n_resync,
+		(unsigned long long)tx->n_underruns, (unsigned long long)tx->n_overruns);
+
+	transmit_free(tx);
+}
+
+uint64_t transmit_stream_key(const struct transmit_s *tx)
+{
+	uint8_t header[H8819_ETHER_HEADER_LEN] = {0};
+	memcpy(header + 6, tx->mac, sizeof(tx->mac));
+	return h8819_stream_key(header, sizeof(header));
+}
+
+void transmit_push(struct transmit_s *tx, int first_channel, int n_channels, const float *data, int n_samples)
+{
+	if (tx->fill)
+		return;
+
+	// Only the latest samples fit in the queue.
+	int stride = n_samples;
+	int skip = 0;
+	if (n_samples > QUEUE_SAMPLES) {
+		skip = n_samples - QUEUE_SAMPLES;
+		n_samples = QUEUE_SAMPLES;
+	}
+
+	pthread_mutex_lock(&tx->mutex);
+	bool overrun = false;
+	for (int i = 0; i < n_channels; i++) {
+		int ch = first_channel + i;
+		if (ch < 0 || ch >= tx->n_channels)
+			continue;
+		struct queue_s *q = tx->queues + ch;
+		const float *src = data + (size_t)i * stride + skip;
+		if (q->wpos - q->rpos + n_samples > QUEUE_SAMPLES) {
+			q->rpos = q->wpos + n_samples - QUEUE_SAMPLES;
+			overrun = true;
+		}
+		for (int is = 0; is < n_samples; is++)
+			q->buf[(q->wpos + is) % QUEUE_SAMPLES] = src[is];
+		q->wpos += n_samples;
+	}
+	if (overrun)
+		tx->n_overruns++;
+	pthread_mutex_unlock(&tx->mutex);
+}
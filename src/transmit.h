@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Transmitter of REAC frames used by the capture helper and h8819-cat, Linux only.
+ *
+ * A dedicated thread wakes up every batch of frames on the monotonic clock,
+ * builds the frames into the PACKET_MMAP TX ring of an AF_PACKET socket,
+ * and kicks the kernel once for the batch.
+ * The samples come from the queue of each channel filled by `transmit_push`, or from a callback.
+ */
+
+#include <stdint.h>
+
+/* Called on the transmit thread for each frame. `fltp` has `n_channels` zero-filled buffers of `n_samples`. */
+typedef void (*transmit_fill_cb)(uint16_t counter, float *const *fltp, int n_channels, int n_samples, void *param);
+
+struct transmit_config_s
+{
+	const char *if_name;
+	int n_channels; // channels in a frame, even
+	int batch;      // frames kicked at once, 0 for the default
+	transmit_fill_cb fill; // NULL to take the samples queued by `transmit_push`
+	void *param;
+};
+
+struct transmit_s;
+
+struct transmit_s *transmit_create(const struct transmit_config_s *cfg);
+
+/* Stops the thread and prints the statistics. */
+void transmit_destroy(struct transmit_s *tx);
+
+/* Key of the frames given by `h8819_stream_key`, to tell them from the received frames. */
+uint64_t transmit_stream_key(const struct transmit_s *tx);
+
+/* Queue planar samples, `n_samples` for each channel from `first_channel`.
+ * Sending a channel starts when enough samples are queued to absorb the jitter of the feed. */
+void transmit_push(struct transmit_s *tx, int first_channel, int n_channels, const float *data, int n_samples);
@@ -0,0 +1,17 @@
+# Run with -DTEST=<h8819-replay-test> -DCORPUS=<checked-in pcap>
+execute_process(
+	COMMAND ${TEST} generate corpus-generated.pcap
+	RESULT_VARIABLE ret
+)
+if(NOT ret EQUAL 0)
+	message(FATAL_ERROR "failed to generate the corpus")
+endif()
+
+execute_process(
+	COMMAND ${CMAKE_COMMAND} -E compare_files corpus-generated.pcap ${CORPUS}
+	RESULT_VARIABLE ret
+)
+file(REMOVE corpus-generated.pcap)
+if(NOT ret EQUAL 0)
+	message(FATAL_ERROR "${CORPUS} differs from the generated corpus, regenerate it by `h8819-replay-test generate`")
+endif()
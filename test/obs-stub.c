@@ -0,0 +1,576 @@
+/*
+ * Functions of libobs used by `source.c` and the capture path, implemented only as far as the tests need.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/threading.h>
+#include <util/dstr.h>
+#include <util/darray.h>
+#include <util/profiler.h>
+#include <callback/calldata.h>
+#include <callback/proc.h>
+#include <media-io/audio-io.h>
+#include "plugin-macros.generated.h"
+#include "obs-stub.h"
+
+// The plugin prefixes its log lines by a macro, which would rename the definition below.
+#undef blog
+
+#define STUB_SAMPLE_RATE 48000
+
+void blog(int log_level, const char *format, ...)
+{
+	if (log_level > LOG_INFO)
+		return;
+
+	va_list args;
+	va_start(args, format);
+	vfprintf(stderr, format, args);
+	va_end(args);
+	fputc('\n', stderr);
+}
+
+void *bmalloc(size_t size)
+{
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr) {
+		fputs("Error: out of memory\n", stderr);
+		abort();
+	}
+	return ptr;
+}
+
+void *brealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size ? size : 1);
+	if (!ptr) {
+		fputs("Error: out of memory\n", stderr);
+		abort();
+	}
+	return ptr;
+}
+
+void bfree(void *ptr)
+{
+	free(ptr);
+}
+
+void *bmemdup(const void *ptr, size_t size)
+{
+	void *out = bmalloc(size);
+	if (size)
+		memcpy(out, ptr, size);
+	return out;
+}
+
+void dstr_copy(struct dstr *dst, const char *array)
+{
+	dstr_free(dst);
+	if (!array || !*array)
+		return;
+
+	dst->len = strlen(array);
+	dst->capacity = dst->len + 1;
+	dst->array = bmemdup(array, dst->capacity);
+}
+
+void dstr_vcatf(struct dstr *dst, const char *format, va_list args)
+{
+	va_list args2;
+	va_copy(args2, args);
+	int len = vsnprintf(NULL, 0, format, args2);
+	va_end(args2);
+	if (len <= 0)
+		return;
+
+	if (dst->len + len + 1 > dst->capacity) {
+		dst->capacity = dst->len + len + 1;
+		dst->array = brealloc(dst->array, dst->capacity);
+	}
+	vsnprintf(dst->array + dst->len, len + 1, format, args);
+	dst->len += len;
+}
+
+void dstr_vprintf(struct dstr *dst, const char *format, va_list args)
+{
+	if (dst->array)
+		dst->array[0] = '\0';
+	dst->len = 0;
+	dstr_vcatf(dst, format, args);
+}
+
+void dstr_catf(struct dstr *dst, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	dstr_vcatf(dst, format, args);
+	va_end(args);
+}
+
+void dstr_printf(struct dstr *dst, const char *format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	dstr_vprintf(dst, format, args);
+	va_end(args);
+}
+
+char **strlist_split(const char *str, char split_ch, bool include_empty)
+{
+	DARRAY(char *) list;
+	da_init(list);
+
+	for (const char *s = str; s;) {
+		const char *e = strchr(s, split_ch);
+		size_t len = e ? (size_t)(e - s) : strlen(s);
+		if (len || include_empty) {
+			char *item = bmalloc(len + 1);
+			memcpy(item, s, len);
+			item[len] = '\0';
+			da_push_back(list, &item);
+		}
+		s = e ? e + 1 : NULL;
+	}
+
+	char *end = NULL;
+	da_push_back(list, &end);
+	return list.array;
+}
+
+void strlist_free(char **strlist)
+{
+	for (char **s = strlist; s && *s; s++)
+		bfree(*s);
+	bfree(strlist);
+}
+
+uint64_t os_gettime_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+void os_sleep_ms(uint32_t duration)
+{
+	usleep(duration * 1000);
+}
+
+void os_set_thread_name(const char *name)
+{
+	UNUSED_PARAMETER(name);
+}
+
+struct os_event_data
+{
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool signalled;
+	bool manual;
+};
+
+int os_event_init(os_event_t **event, enum os_event_type type)
+{
+	os_event_t *e = bzalloc(sizeof(os_event_t));
+	pthread_mutex_init(&e->mutex, NULL);
+	pthread_cond_init(&e->cond, NULL);
+	e->manual = type == OS_EVENT_TYPE_MANUAL;
+	*event = e;
+	return 0;
+}
+
+void os_event_destroy(os_event_t *event)
+{
+	if (!event)
+		return;
+	pthread_mutex_destroy(&event->mutex);
+	pthread_cond_destroy(&event->cond);
+	bfree(event);
+}
+
+int os_event_wait(os_event_t *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	while (!event->signalled)
+		pthread_cond_wait(&event->cond, &event->mutex);
+	if (!event->manual)
+		event->signalled = false;
+	pthread_mutex_unlock(&event->mutex);
+	return 0;
+}
+
+int os_event_timedwait(os_event_t *event, unsigned long milliseconds)
+{
+	struct timespec abstime;
+	clock_gettime(CLOCK_REALTIME, &abstime);
+	abstime.tv_sec += milliseconds / 1000;
+	abstime.tv_nsec += (milliseconds % 1000) * 1000000;
+	if (abstime.tv_nsec >= 1000000000) {
+		abstime.tv_sec++;
+		abstime.tv_nsec -= 1000000000;
+	}
+
+	int ret = 0;
+	pthread_mutex_lock(&event->mutex);
+	while (!event->signalled && ret == 0)
+		ret = pthread_cond_timedwait(&event->cond, &event->mutex, &abstime);
+	if (event->signalled) {
+		if (!event->manual)
+			event->signalled = false;
+		ret = 0;
+	}
+	pthread_mutex_unlock(&event->mutex);
+	return ret;
+}
+
+int os_event_signal(os_event_t *event)
+{
+	pthread_mutex_lock(&event->mutex);
+	event->signalled = true;
+	pthread_cond_broadcast(&event->cond);
+	pthread_mutex_unlock(&event->mutex);
+	return 0;
+}
+
+void profile_start(const char *name)
+{
+	UNUSED_PARAMETER(name);
+}
+
+void profile_end(const char *name)
+{
+	UNUSED_PARAMETER(name);
+}
+
+profiler_name_store_t *obs_get_profiler_name_store(void)
+{
+	return NULL;
+}
+
+// Nothing is profiled, so the name is not formatted.
+const char *profile_store_name(profiler_name_store_t *store, const char *format, ...)
+{
+	UNUSED_PARAMETER(store);
+	return format;
+}
+
+bool calldata_get_data(const calldata_t *data, const char *name, void *out, size_t size)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(out);
+	UNUSED_PARAMETER(size);
+	return false;
+}
+
+void calldata_set_data(calldata_t *data, const char *name, const void *in, size_t new_size)
+{
+	UNUSED_PARAMETER(data);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(in);
+	UNUSED_PARAMETER(new_size);
+}
+
+void proc_handler_add(proc_handler_t *handler, const char *decl_string, proc_handler_proc_t proc, void *data)
+{
+	UNUSED_PARAMETER(handler);
+	UNUSED_PARAMETER(decl_string);
+	UNUSED_PARAMETER(proc);
+	UNUSED_PARAMETER(data);
+}
+
+audio_t *obs_get_audio(void)
+{
+	return NULL;
+}
+
+uint32_t audio_output_get_sample_rate(const audio_t *audio)
+{
+	UNUSED_PARAMETER(audio);
+	return STUB_SAMPLE_RATE;
+}
+
+const char *obs_module_text(const char *lookup_string)
+{
+	return lookup_string;
+}
+
+obs_module_t *obs_current_module(void)
+{
+	return NULL;
+}
+
+// The helper is found in the build directory, given by the build system.
+char *obs_find_module_file(obs_module_t *module, const char *file)
+{
+	UNUSED_PARAMETER(module);
+	struct dstr path = {0};
+	dstr_printf(&path, "%s/%s", OBS_STUB_MODULE_DIR, file);
+	return path.array;
+}
+
+struct obs_source
+{
+	obs_stub_audio_cb cb;
+	void *param;
+};
+
+obs_source_t *obs_stub_source_create(obs_stub_audio_cb cb, void *param)
+{
+	obs_source_t *source = bzalloc(sizeof(obs_source_t));
+	source->cb = cb;
+	source->param = param;
+	return source;
+}
+
+void obs_stub_source_destroy(obs_source_t *source)
+{
+	bfree(source);
+}
+
+void obs_source_output_audio(obs_source_t *source, const struct obs_source_audio *audio)
+{
+	source->cb(source->param, audio);
+}
+
+proc_handler_t *obs_source_get_proc_handler(const obs_source_t *source)
+{
+	UNUSED_PARAMETER(source);
+	return NULL;
+}
+
+#ifdef ENABLE_ASYNC_COMPENSATION
+void obs_source_set_async_compensation(obs_source_t *source, bool compensate)
+{
+	UNUSED_PARAMETER(source);
+	UNUSED_PARAMETER(compensate);
+}
+#endif
+
+/* Settings are kept as strings and numbers by name. The defaults are used for the names without a value. */
+struct data_item_s
+{
+	char *name;
+	bool has_value;
+	char *str;
+	long long num;
+	bool has_default;
+	char *def_str;
+	long long def_num;
+};
+
+struct obs_data
+{
+	DARRAY(struct data_item_s) items;
+};
+
+obs_data_t *obs_data_create(void)
+{
+	return bzalloc(sizeof(obs_data_t));
+}
+
+void obs_data_release(obs_data_t *data)
+{
+	if (!data)
+		return;
+	for (size_t i = 0; i < data->items.num; i++) {
+		struct data_item_s *item = data->items.array + i;
+		bfree(item->name);
+		bfree(item->str);
+		bfree(item->def_str);
+	}
+	da_free(data->items);
+	bfree(data);
+}
+
+static struct data_item_s *data_item(obs_data_t *data, const char *name, bool create)
+{
+	for (size_t i = 0; i < data->items.num; i++) {
+		if (strcmp(data->items.array[i].name, name) == 0)
+			return data->items.array + i;
+	}
+	if (!create)
+		return NULL;
+
+	struct data_item_s *item = da_push_back_new(data->items);
+	item->name = bstrdup(name);
+	return item;
+}
+
+void obs_data_set_string(obs_data_t *data, const char *name, const char *val)
+{
+	struct data_item_s *item = data_item(data, name, true);
+	bfree(item->str);
+	item->str = bstrdup(val ? val : "");
+	item->has_value = true;
+}
+
+void obs_data_set_int(obs_data_t *data, const char *name, long long val)
+{
+	struct data_item_s *item = data_item(data, name, true);
+	item->num = val;
+	item->has_value = true;
+}
+
+void obs_data_set_bool(obs_data_t *data, const char *name, bool val)
+{
+	obs_data_set_int(data, name, val);
+}
+
+void obs_data_set_default_string(obs_data_t *data, const char *name, const char *val)
+{
+	struct data_item_s *item = data_item(data, name, true);
+	bfree(item->def_str);
+	item->def_str = bstrdup(val ? val : "");
+	item->has_default = true;
+}
+
+void obs_data_set_default_int(obs_data_t *data, const char *name, long long val)
+{
+	struct data_item_s *item = data_item(data, name, true);
+	item->def_num = val;
+	item->has_default = true;
+}
+
+const char *obs_data_get_string(obs_data_t *data, const char *name)
+{
+	const struct data_item_s *item = data_item(data, name, false);
+	if (item && item->has_value && item->str)
+		return item->str;
+	if (item && item->has_default && item->def_str)
+		return item->def_str;
+	return "";
+}
+
+long long obs_data_get_int(obs_data_t *data, const char *name)
+{
+	const struct data_item_s *item = data_item(data, name, false);
+	if (item && item->has_value)
+		return item->num;
+	if (item && item->has_default)
+		return item->def_num;
+	return 0;
+}
+
+bool obs_data_get_bool(obs_data_t *data, const char *name)
+{
+	return obs_data_get_int(data, name) != 0;
+}
+
+/* Properties are not shown, so nothing is built. */
+
+obs_properties_t *obs_properties_create(void)
+{
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_bool(obs_properties_t *props, const char *name, const char *description)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_int(obs_properties_t *props, const char *name, const char *description, int min,
+				       int max, int step)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	UNUSED_PARAMETER(min);
+	UNUSED_PARAMETER(max);
+	UNUSED_PARAMETER(step);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_text(obs_properties_t *props, const char *name, const char *description,
+					enum obs_text_type type)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	UNUSED_PARAMETER(type);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_path(obs_properties_t *props, const char *name, const char *description,
+					enum obs_path_type type, const char *filter, const char *default_path)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	UNUSED_PARAMETER(type);
+	UNUSED_PARAMETER(filter);
+	UNUSED_PARAMETER(default_path);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_list(obs_properties_t *props, const char *name, const char *description,
+					enum obs_combo_type type, enum obs_combo_format format)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	UNUSED_PARAMETER(type);
+	UNUSED_PARAMETER(format);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_button(obs_properties_t *props, const char *name, const char *text,
+					  obs_property_clicked_t callback)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(text);
+	UNUSED_PARAMETER(callback);
+	return NULL;
+}
+
+obs_property_t *obs_properties_add_group(obs_properties_t *props, const char *name, const char *description,
+					 enum obs_group_type type, obs_properties_t *group)
+{
+	UNUSED_PARAMETER(props);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(description);
+	UNUSED_PARAMETER(type);
+	UNUSED_PARAMETER(group);
+	return NULL;
+}
+
+void obs_property_int_set_suffix(obs_property_t *p, const char *suffix)
+{
+	UNUSED_PARAMETER(p);
+	UNUSED_PARAMETER(suffix);
+}
+
+void obs_property_set_long_description(obs_property_t *p, const char *long_description)
+{
+	UNUSED_PARAMETER(p);
+	UNUSED_PARAMETER(long_description);
+}
+
+size_t obs_property_list_add_int(obs_property_t *p, const char *name, long long val)
+{
+	UNUSED_PARAMETER(p);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(val);
+	return 0;
+}
+
+size_t obs_property_list_add_string(obs_property_t *p, const char *name, const char *val)
+{
+	UNUSED_PARAMETER(p);
+	UNUSED_PARAMETER(name);
+	UNUSED_PARAMETER(val);
+	return 0;
+}
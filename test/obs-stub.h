@@ -0,0 +1,14 @@
+#pragma once
+
+/*
+ * Minimal libobs for the tests, enough to run the sources and the capture path of the plugin without OBS.
+ * The audio output of each source goes to a callback instead of the mixer, and no property is built.
+ */
+
+#include <obs.h>
+
+typedef void (*obs_stub_audio_cb)(void *param, const struct obs_source_audio *audio);
+
+// `cb` is called from the capture thread for each `obs_source_output_audio` of the source.
+obs_source_t *obs_stub_source_create(obs_stub_audio_cb cb, void *param);
+void obs_stub_source_destroy(obs_source_t *source);
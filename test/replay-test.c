@@ -0,0 +1,770 @@
+/*
+ * End-to-end test of the capture path without OBS.
+ * The sources and the capture thread of the plugin run against the stub of libobs,
+ * and the helper replays a capture file as if the packets arrived on an interface.
+ *
+ * Usage:
+ *   h8819-replay-test generate file.pcap
+ *     Write the corpus, one stream of 2 channels with a wrap of the counter and missing packets.
+ *   h8819-replay-test check scenario file.pcap expected
+ *     Replay the corpus to a source and compare the digests of its audio with the expected file.
+ *     The scenarios are `gaps`, `switch`, and `reactivate`.
+ *   h8819-replay-test bench sources...
+ *     Replay a capture of 40 channels without pacing to the number of sources
+ *     and print the packets per second and the CPU time per packet of the plugin and the helper
+ *     between the first and the last output,
+ *     and the time from creating a source to its first output with a pooled helper and without.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#ifdef __APPLE__
+#include <libproc.h>
+#include <mach/mach_time.h>
+#endif
+#include <obs-module.h>
+#include <util/platform.h>
+#include <util/darray.h>
+#include <util/dstr.h>
+#include "capdev.h"
+#include "capdev-proc.h"
+#include "h8819.h"
+#include "obs-stub.h"
+#include "plugin-macros.generated.h"
+#include "capdev-internal.h"
+
+extern const struct obs_source_info src_info;
+
+#define PACKET_NS 250000 // `H8819_N_SAMPLES` at 48 kHz
+#define P(n) ((int64_t)(n) * H8819_N_SAMPLES)
+
+// Packets of the corpus are numbered from 0 including the missing ones.
+#define CORPUS_CHANNELS 2
+#define CORPUS_PACKETS 2700
+#define CORPUS_FIRST_COUNTER (65536 - 1500)
+
+// Ranges [first, end) of the missing packets. The first one spans the wrap of the counter.
+static const int corpus_missing[][2] = {{1499, 1502}, {1700, 1701}, {1900, 1905}};
+#define N_CORPUS_MISSING (int)(sizeof(corpus_missing) / sizeof(*corpus_missing))
+
+#define BENCH_CHANNELS 40
+#define BENCH_PACKETS 20000
+#define BENCH_CAPTURE "bench-40ch.pcap"
+
+#define CAPTURE_START_NS 1700000000000000000LL
+#define CHECK_TIMEOUT_NS 10000000000ULL
+#define BENCH_TIMEOUT_NS 60000000000ULL
+#define BENCH_IDLE_NS 500000000ULL
+// The CPU time is sampled at the first output and then at this interval, not to add a system call to each packet.
+#define BENCH_CPU_SAMPLE_PACKETS 256
+#define STARTUP_RUNS 5
+// OBS loads the plugin well before a source is added, so the pooled helper has started by then.
+#define STARTUP_SETTLE_MS 500
+
+// The timestamps can move by the jitter of the arrival after the estimation has converged.
+#define TS_TOLERANCE_NS 2000000
+
+// Each sample tells its position in the stream and its channel. Odd positions are negative to cover the sign.
+#define VALUE_PERIOD 65535
+#define VALUE_CHANNEL_BITS 6
+
+static int32_t sample_value(int64_t pos, int ch)
+{
+	int32_t v = (int32_t)((pos % VALUE_PERIOD + 1) << VALUE_CHANNEL_BITS | ch);
+	return pos & 1 ? -v : v;
+}
+
+// Returns false if the value is not a sample of the corpus.
+static bool sample_decode(float f, int64_t *pos, int *ch)
+{
+	int32_t v = (int32_t)lrintf(f * 8388608.0f);
+	int32_t u = v < 0 ? -v : v;
+	if (u >> VALUE_CHANNEL_BITS == 0)
+		return false;
+	*pos = (u >> VALUE_CHANNEL_BITS) - 1;
+	*ch = u & ((1 << VALUE_CHANNEL_BITS) - 1);
+	return ((*pos & 1) != 0) == (v < 0);
+}
+
+static bool corpus_is_missing(int64_t pos)
+{
+	int64_t packet = pos / H8819_N_SAMPLES;
+	for (int i = 0; i < N_CORPUS_MISSING; i++) {
+		if (packet >= corpus_missing[i][0] && packet < corpus_missing[i][1])
+			return true;
+	}
+	return false;
+}
+
+static bool write_capture(const char *path, int n_channels, int n_packets, uint16_t first_counter,
+			  const int (*missing)[2], int n_missing)
+{
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+
+	// pcap with nanosecond timestamps, Ethernet
+	const uint32_t magic = 0xA1B23C4D;
+	const uint16_t version[2] = {2, 4};
+	const uint32_t rest[4] = {0, 0, H8819_MAX_FRAME_LEN, 1};
+	fwrite(&magic, sizeof(magic), 1, fp);
+	fwrite(version, sizeof(version), 1, fp);
+	fwrite(rest, sizeof(rest), 1, fp);
+
+	static const uint8_t shost[6] = {0x02, 0x00, 0x00, 0x00, 0x88, 0x19};
+	static float samples[H8819_MAX_CHANNELS][H8819_N_SAMPLES];
+	const float *fltp[H8819_MAX_CHANNELS];
+	for (int ch = 0; ch < n_channels; ch++)
+		fltp[ch] = samples[ch];
+
+	uint8_t frame[H8819_MAX_FRAME_LEN];
+	int m = 0;
+	for (int i = 0; i < n_packets; i++) {
+		while (m < n_missing && i >= missing[m][1])
+			m++;
+		if (m < n_missing && i >= missing[m][0])
+			continue;
+
+		for (int ch = 0; ch < n_channels; ch++) {
+			for (int k = 0; k < H8819_N_SAMPLES; k++)
+				samples[ch][k] = (float)sample_value(P(i) + k, ch) / 8388608.0f;
+		}
+		uint16_t counter = (uint16_t)(first_counter + i);
+		uint32_t len = (uint32_t)h8819_build_frame(frame, shost, counter, fltp, n_channels);
+
+		int64_t ts = CAPTURE_START_NS + (int64_t)i * PACKET_NS;
+		uint32_t hdr[4] = {(uint32_t)(ts / 1000000000), (uint32_t)(ts % 1000000000), len, len};
+		fwrite(hdr, sizeof(hdr), 1, fp);
+		fwrite(frame, len, 1, fp);
+	}
+
+	bool ok = !ferror(fp);
+	if (fclose(fp) != 0 || !ok) {
+		perror(path);
+		return false;
+	}
+	return true;
+}
+
+struct call_s
+{
+	uint64_t timestamp;
+	size_t offset; // of the first sample in the recording
+};
+
+// Audio of a source, written by the capture thread
+struct recording_s
+{
+	pthread_mutex_t mutex;
+	bool keep; // keep the samples and the calls, or only count them
+	DARRAY(float) samples[2];
+	DARRAY(struct call_s) calls;
+	uint64_t n_samples;
+	uint64_t first_ns; // host time of the first and the last output
+	uint64_t last_ns;
+	bool bad_format;
+
+	// Set for the first source of the bench to sample the CPU time of the plugin and the helper of `dev`
+	capdev_t *dev;
+	uint64_t cpu_first_ns;
+	uint64_t cpu_last_ns;
+	uint64_t cpu_first_samples; // `n_samples` when the CPU time was sampled
+	uint64_t cpu_last_samples;
+
+	// Position in the corpus of the first sample, known at the first sample of the corpus
+	bool pos_known;
+	int64_t pos0;
+
+	// Samples before the source was activated again, 0 if it stayed active
+	size_t resume_offset;
+};
+
+// CPU time of a process since it started, 0 if it cannot be read
+static uint64_t process_cpu_ns(pid_t pid)
+{
+#ifdef __APPLE__
+	struct rusage_info_v2 ri;
+	if (proc_pid_rusage(pid, RUSAGE_INFO_V2, (rusage_info_t *)&ri) != 0)
+		return 0;
+	mach_timebase_info_data_t tb;
+	mach_timebase_info(&tb);
+	return (ri.ri_user_time + ri.ri_system_time) * tb.numer / tb.denom;
+#else
+	clockid_t clock;
+	struct timespec ts;
+	if (clock_getcpuclockid(pid, &clock) != 0 || clock_gettime(clock, &ts) != 0)
+		return 0;
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+static void record_audio(void *param, const struct obs_source_audio *audio)
+{
+	struct recording_s *rec = param;
+	uint64_t now = os_gettime_ns();
+
+	pthread_mutex_lock(&rec->mutex);
+	if (audio->speakers != SPEAKERS_STEREO || audio->format != AUDIO_FORMAT_FLOAT_PLANAR ||
+	    audio->samples_per_sec != H8819_SAMPLE_RATE)
+		rec->bad_format = true;
+
+	if (rec->keep) {
+		const float *left = (const float *)audio->data[0];
+		for (uint32_t i = 0; i < audio->frames && !rec->pos_known; i++) {
+			int ch;
+			if (sample_decode(left[i], &rec->pos0, &ch)) {
+				rec->pos0 -= (int64_t)(rec->samples[0].num + i);
+				rec->pos_known = true;
+			}
+		}
+
+		struct call_s call = {.timestamp = audio->timestamp, .offset = rec->samples[0].num};
+		da_push_back(rec->calls, &call);
+		for (int i = 0; i < 2; i++)
+			da_push_back_array(rec->samples[i], (const float *)audio->data[i], audio->frames);
+	}
+
+	if (!rec->n_samples)
+		rec->first_ns = now;
+	rec->last_ns = now;
+	uint64_t n_samples = rec->n_samples;
+	rec->n_samples += audio->frames;
+
+	// The helper is running, so its CPU time is read from its clock
+	// as the usage of the children only counts the children waited for.
+	const uint64_t interval = BENCH_CPU_SAMPLE_PACKETS * H8819_N_SAMPLES;
+	if (rec->dev && (!n_samples || n_samples / interval != rec->n_samples / interval)) {
+		uint64_t cpu = process_cpu_ns(getpid()) + process_cpu_ns(rec->dev->pid);
+		if (!n_samples) {
+			rec->cpu_first_ns = cpu;
+			rec->cpu_first_samples = rec->n_samples;
+		}
+		rec->cpu_last_ns = cpu;
+		rec->cpu_last_samples = rec->n_samples;
+	}
+	pthread_mutex_unlock(&rec->mutex);
+}
+
+// Position in the corpus after the last sample, -1 until a sample of the corpus arrives.
+static int64_t recording_position(struct recording_s *rec)
+{
+	pthread_mutex_lock(&rec->mutex);
+	int64_t pos = rec->pos_known ? rec->pos0 + (int64_t)rec->samples[0].num : -1;
+	pthread_mutex_unlock(&rec->mutex);
+	return pos;
+}
+
+struct test_source_s
+{
+	obs_data_t *settings;
+	obs_source_t *source;
+	void *data;
+	struct recording_s rec;
+};
+
+static void test_source_create(struct test_source_s *ts, const char *device_name, int channel_l, int channel_r,
+			       bool keep)
+{
+	pthread_mutex_init(&ts->rec.mutex, NULL);
+	ts->rec.keep = keep;
+
+	ts->settings = obs_data_create();
+	src_info.get_defaults(ts->settings);
+	obs_data_set_string(ts->settings, "device_name", device_name);
+	obs_data_set_int(ts->settings, "channel_l", channel_l);
+	obs_data_set_int(ts->settings, "channel_r", channel_r);
+	// The device is closed with the last source so that the helper has exited at `capdev_shutdown`.
+	obs_data_set_int(ts->settings, "keepalive", 0);
+
+	ts->source = obs_stub_source_create(record_audio, &ts->rec);
+	ts->data = src_info.create(ts->settings, ts->source);
+	src_info.activate(ts->data);
+}
+
+// The recording is kept until `test_source_free`.
+static void test_source_stop(struct test_source_s *ts)
+{
+	if (!ts->data)
+		return;
+	src_info.deactivate(ts->data);
+	src_info.destroy(ts->data);
+	ts->data = NULL;
+	obs_stub_source_destroy(ts->source);
+	ts->source = NULL;
+}
+
+static void test_source_free(struct test_source_s *ts)
+{
+	test_source_stop(ts);
+	obs_data_release(ts->settings);
+	for (int i = 0; i < 2; i++)
+		da_free(ts->rec.samples[i]);
+	da_free(ts->rec.calls);
+	pthread_mutex_destroy(&ts->rec.mutex);
+}
+
+struct scenario_s
+{
+	const char *name;
+	int channels[2]; // 1-based, left and right
+	int switched[2]; // channels after the output reaches `switch_pos`, 0 not to switch
+	int64_t switch_pos;
+	int n_windows;
+	int64_t windows[2][2]; // positions [start, end) compared with the expected digests
+	int64_t deactivate_pos; // deactivate the source when the output reaches it, 0 not to
+	int inactive_ms;        // until the source is activated again
+};
+
+static const struct scenario_s scenarios[] = {
+	{"gaps", {1, 2}, {0, 0}, 0, 1, {{P(1200), P(2600)}}, 0, 0},
+	// The new channels start where the update reaches the plugin, which depends on the timing.
+	// The audio between the windows is checked only to continue without silence.
+	{"switch", {1, 1}, {2, 2}, P(2000), 2, {{P(1200), P(2000)}, {P(2400), P(2600)}}, 0, 0},
+	// The source is inactive over the missing packets at the wrap of the counter
+	// and resumes without playing them as a gap.
+	{"reactivate", {1, 2}, {0, 0}, 0, 2, {{P(1200), P(1480)}, {P(1800), P(2600)}}, P(1480), 10},
+};
+
+// Run of the recording that continues the corpus without a break
+struct segment_s
+{
+	size_t start; // offsets in the recording
+	size_t end;
+	int64_t pos0; // position in the corpus at `start`
+};
+
+// The recording breaks where the source was activated again. Returns the number of segments, 0 on error.
+static int recording_segments(const struct recording_s *rec, struct segment_s segments[2])
+{
+	const size_t n = rec->samples[0].num;
+	const size_t resume = rec->resume_offset ? rec->resume_offset : n;
+	segments[0] = (struct segment_s){0, resume, rec->pos0};
+	if (resume == n)
+		return 1;
+
+	for (size_t i = resume; i < n; i++) {
+		int64_t pos;
+		int ch;
+		if (sample_decode(rec->samples[0].array[i], &pos, &ch)) {
+			segments[1] = (struct segment_s){resume, n, pos - (int64_t)(i - resume)};
+			return 2;
+		}
+	}
+	fputs("Error: no audio after the source was activated again\n", stderr);
+	return 0;
+}
+
+#define FNV_OFFSET 0xCBF29CE484222325ULL
+#define FNV_PRIME 0x100000001B3ULL
+
+static uint64_t digest_update(uint64_t h, const void *data, size_t size)
+{
+	const uint8_t *p = data;
+	for (size_t i = 0; i < size; i++)
+		h = (h ^ p[i]) * FNV_PRIME;
+	return h;
+}
+
+/* Check that each sample is the sample of the corpus at its position on the expected channel,
+ * or silence in place of the missing packets. */
+static bool check_samples(const struct scenario_s *sc, const struct recording_s *rec, const struct segment_s *seg,
+			  int64_t *switched_pos)
+{
+	bool switched = false;
+	*switched_pos = -1;
+	for (size_t i = seg->start; i < seg->end; i++) {
+		const int64_t pos = seg->pos0 + (int64_t)(i - seg->start);
+		int ch[2];
+		for (int c = 0; c < 2; c++) {
+			const float f = rec->samples[c].array[i];
+			int64_t pos_sample;
+			if (corpus_is_missing(pos)) {
+				if (f != 0.0f) {
+					fprintf(stderr, "Error: position %" PRId64 " should be silent\n", pos);
+					return false;
+				}
+				ch[c] = -1;
+			}
+			else if (!sample_decode(f, &pos_sample, &ch[c]) || pos_sample != pos) {
+				fprintf(stderr, "Error: position %" PRId64 " %s has %.8f\n", pos, c ? "right" : "left",
+					(double)f);
+				return false;
+			}
+		}
+		if (ch[0] < 0)
+			continue;
+
+		if (!switched && sc->switched[0] && ch[0] == sc->switched[0] - 1 && ch[1] == sc->switched[1] - 1) {
+			switched = true;
+			*switched_pos = pos;
+		}
+		const int *expected = switched ? sc->switched : sc->channels;
+		if (ch[0] != expected[0] - 1 || ch[1] != expected[1] - 1) {
+			fprintf(stderr, "Error: position %" PRId64 " has channels %d and %d\n", pos, ch[0] + 1,
+				ch[1] + 1);
+			return false;
+		}
+	}
+	return true;
+}
+
+// Returns the largest error of the timestamps from the first output of the segment, or -1 if out of the tolerance.
+static int64_t check_timestamps(const struct recording_s *rec, const struct segment_s *seg)
+{
+	const struct call_s *first = NULL;
+	int64_t err_max = 0;
+	for (size_t k = 0; k < rec->calls.num; k++) {
+		const struct call_s *call = rec->calls.array + k;
+		if (call->offset < seg->start || call->offset >= seg->end)
+			continue;
+		if (!first)
+			first = call;
+		int64_t expected = (int64_t)first->timestamp + h8819_sample_time((int)(call->offset - first->offset));
+		int64_t err = llabs((int64_t)call->timestamp - expected);
+		if (err > err_max)
+			err_max = err;
+		if (err > TS_TOLERANCE_NS) {
+			fprintf(stderr, "Error: timestamp at position %" PRId64 " is off by %.3f ms\n",
+				seg->pos0 + (int64_t)(call->offset - seg->start), err * 1e-6);
+			return -1;
+		}
+	}
+	return err_max;
+}
+
+static int64_t segment_pos_end(const struct segment_s *seg)
+{
+	return seg->pos0 + (int64_t)(seg->end - seg->start);
+}
+
+static bool analyze(const struct scenario_s *sc, const struct recording_s *rec, struct dstr *result)
+{
+	if (rec->bad_format) {
+		fputs("Error: unexpected format of the audio\n", stderr);
+		return false;
+	}
+	if (!rec->pos_known) {
+		fputs("Error: no audio from the source\n", stderr);
+		return false;
+	}
+
+	struct segment_s segments[2];
+	const int n_segments = recording_segments(rec, segments);
+	if (!n_segments)
+		return false;
+	if (n_segments > 1 && segments[1].pos0 < segment_pos_end(segments)) {
+		fprintf(stderr, "Error: the audio resumed at position %" PRId64 " before %" PRId64 "\n",
+			segments[1].pos0, segment_pos_end(segments));
+		return false;
+	}
+
+	int64_t switched_pos = -1;
+	int64_t ts_err = 0;
+	for (int k = 0; k < n_segments; k++) {
+		int64_t pos;
+		if (!check_samples(sc, rec, segments + k, &pos))
+			return false;
+		if (switched_pos < 0)
+			switched_pos = pos;
+		int64_t err = check_timestamps(rec, segments + k);
+		if (err < 0)
+			return false;
+		if (err > ts_err)
+			ts_err = err;
+	}
+	if (sc->switched[0] && switched_pos < sc->switch_pos) {
+		fprintf(stderr, "Error: channels switched at position %" PRId64 ", expected from %" PRId64 "\n",
+			switched_pos, sc->switch_pos);
+		return false;
+	}
+
+	fputs("Info: positions", stderr);
+	for (int k = 0; k < n_segments; k++)
+		fprintf(stderr, "%s %" PRId64 " to %" PRId64, k ? " and" : "", segments[k].pos0,
+			segment_pos_end(segments + k));
+	fprintf(stderr, " in %zu outputs, timestamps within %.3f ms", rec->calls.num, ts_err * 1e-6);
+	if (sc->switched[0])
+		fprintf(stderr, ", switched at %" PRId64, switched_pos);
+	fputc('\n', stderr);
+
+	for (int w = 0; w < sc->n_windows; w++) {
+		const int64_t start = sc->windows[w][0];
+		const int64_t end = sc->windows[w][1];
+		const struct segment_s *seg = NULL;
+		for (int k = 0; k < n_segments; k++) {
+			if (start >= segments[k].pos0 && end <= segment_pos_end(segments + k))
+				seg = segments + k;
+		}
+		if (!seg) {
+			fprintf(stderr, "Error: window %" PRId64 " to %" PRId64 " is not covered\n", start, end);
+			return false;
+		}
+
+		uint64_t h = FNV_OFFSET;
+		for (int64_t pos = start; pos < end; pos++) {
+			const size_t i = seg->start + (size_t)(pos - seg->pos0);
+			for (int c = 0; c < 2; c++)
+				h = digest_update(h, rec->samples[c].array + i, sizeof(float));
+		}
+		dstr_catf(result, "window %" PRId64 " %" PRId64 " %016" PRIx64 "\n", start, end, h);
+	}
+	return true;
+}
+
+// Lines of the expected file except the comments
+static bool read_expected(const char *path, struct dstr *expected)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp) {
+		perror(path);
+		return false;
+	}
+
+	char line[256];
+	while (fgets(line, sizeof(line), fp)) {
+		if (line[0] != '#' && line[0] != '\n')
+			dstr_catf(expected, "%s", line);
+	}
+	fclose(fp);
+	return true;
+}
+
+static int run_check(const char *name, const char *capture, const char *expected_path)
+{
+	const struct scenario_s *sc = NULL;
+	for (size_t i = 0; i < sizeof(scenarios) / sizeof(*scenarios); i++) {
+		if (strcmp(scenarios[i].name, name) == 0)
+			sc = scenarios + i;
+	}
+	if (!sc) {
+		fprintf(stderr, "Error: unknown scenario '%s'\n", name);
+		return 1;
+	}
+
+	struct dstr expected = {0};
+	if (!read_expected(expected_path, &expected))
+		return 1;
+
+	struct dstr device = {0};
+	dstr_printf(&device, "%s%s", CAPDEV_PROC_REPLAY_PREFIX, capture);
+
+	capdev_init();
+	struct test_source_s ts = {0};
+	test_source_create(&ts, device.array, sc->channels[0], sc->channels[1], true);
+
+	const int64_t pos_last = sc->windows[sc->n_windows - 1][1];
+	const uint64_t deadline = os_gettime_ns() + CHECK_TIMEOUT_NS;
+	bool switched = false;
+	bool deactivated = false;
+	int64_t pos;
+	while ((pos = recording_position(&ts.rec)) < pos_last && os_gettime_ns() < deadline) {
+		if (sc->switched[0] && !switched && pos >= sc->switch_pos) {
+			obs_data_set_int(ts.settings, "channel_l", sc->switched[0]);
+			obs_data_set_int(ts.settings, "channel_r", sc->switched[1]);
+			src_info.update(ts.data, ts.settings);
+			switched = true;
+		}
+		// Nothing is delivered to an inactive source, so the recording breaks at `resume_offset`.
+		if (sc->deactivate_pos && !deactivated && pos >= sc->deactivate_pos) {
+			src_info.deactivate(ts.data);
+			os_sleep_ms(sc->inactive_ms);
+			pthread_mutex_lock(&ts.rec.mutex);
+			ts.rec.resume_offset = ts.rec.samples[0].num;
+			pthread_mutex_unlock(&ts.rec.mutex);
+			src_info.activate(ts.data);
+			deactivated = true;
+		}
+		os_sleep_ms(1);
+	}
+
+	test_source_stop(&ts);
+	capdev_shutdown();
+
+	struct dstr result = {0};
+	bool ok = analyze(sc, &ts.rec, &result);
+	if (ok)
+		fputs(result.array, stdout);
+	if (ok && (!expected.array || strcmp(result.array, expected.array) != 0)) {
+		fprintf(stderr, "Error: digests differ from '%s'\n", expected_path);
+		ok = false;
+	}
+
+	test_source_free(&ts);
+	dstr_free(&result);
+	dstr_free(&expected);
+	dstr_free(&device);
+	return ok ? 0 : 1;
+}
+
+// Replay to `n_sources` sources, each taking its own pair of channels as far as the channels go.
+static bool bench(const char *device, int n_sources)
+{
+	capdev_init();
+
+	// The device is opened before the sources so that the first output finds it set.
+	struct test_source_s *sources = bzalloc(sizeof(struct test_source_s) * n_sources);
+	sources[0].rec.dev = capdev_find_or_create(device, NULL);
+	for (int k = 0; k < n_sources; k++) {
+		int ch = (2 * k) % BENCH_CHANNELS;
+		test_source_create(sources + k, device, ch + 1, ch + 2, false);
+	}
+
+	// The helper keeps running at the end of the file, so the audio stopping tells the end.
+	struct recording_s *rec = &sources[0].rec;
+	const uint64_t deadline = os_gettime_ns() + BENCH_TIMEOUT_NS;
+	uint64_t n_samples = 0;
+	uint64_t changed_ns = os_gettime_ns();
+	for (uint64_t now = changed_ns; now < deadline; now = os_gettime_ns()) {
+		pthread_mutex_lock(&rec->mutex);
+		uint64_t n = rec->n_samples;
+		pthread_mutex_unlock(&rec->mutex);
+		if (n != n_samples) {
+			n_samples = n;
+			changed_ns = now;
+		}
+		else if (n && now - changed_ns > BENCH_IDLE_NS) {
+			break;
+		}
+		os_sleep_ms(10);
+	}
+
+	for (int k = 0; k < n_sources; k++)
+		test_source_stop(sources + k);
+	capdev_release(rec->dev);
+	rec->dev = NULL;
+	capdev_shutdown();
+
+	// Creating the device, spawning the helper, and the shutdown are left out.
+	const uint64_t n_packets = rec->n_samples / H8819_N_SAMPLES;
+	const uint64_t duration = rec->last_ns - rec->first_ns;
+	const uint64_t cpu_packets = (rec->cpu_last_samples - rec->cpu_first_samples) / H8819_N_SAMPLES;
+	bool ok = n_packets > 1 && duration > 0 && cpu_packets > 0;
+	if (ok) {
+		printf("%d source%s: %" PRIu64 " packets at %.0f packets/s, %.0f ns of CPU per packet\n", n_sources,
+		       n_sources > 1 ? "s" : "", n_packets, (double)(n_packets - 1) * 1e9 / (double)duration,
+		       (double)(rec->cpu_last_ns - rec->cpu_first_ns) / (double)cpu_packets);
+	}
+	else {
+		fprintf(stderr, "Error: no audio to %d sources\n", n_sources);
+	}
+
+	for (int k = 0; k < n_sources; k++)
+		test_source_free(sources + k);
+	bfree(sources);
+	return ok;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+	return x < y ? -1 : x > y;
+}
+
+// Time from creating a source to its first output with `pool_size` helpers started in advance
+static bool bench_startup(const char *device, int pool_size)
+{
+	// Read by `capdev_init`
+	const char *env = getenv("OBS_H8819_POOL_SIZE");
+	char *saved = env ? bstrdup(env) : NULL;
+	char size[16];
+	snprintf(size, sizeof(size), "%d", pool_size);
+	setenv("OBS_H8819_POOL_SIZE", size, 1);
+
+	uint64_t ns[STARTUP_RUNS];
+	bool ok = true;
+	for (int i = 0; i < STARTUP_RUNS && ok; i++) {
+		capdev_init();
+		os_sleep_ms(STARTUP_SETTLE_MS);
+
+		struct test_source_s ts = {0};
+		const uint64_t create_ns = os_gettime_ns();
+		test_source_create(&ts, device, 1, 2, false);
+
+		const uint64_t deadline = create_ns + CHECK_TIMEOUT_NS;
+		uint64_t first_ns = 0;
+		while (!first_ns && os_gettime_ns() < deadline) {
+			os_sleep_ms(1);
+			pthread_mutex_lock(&ts.rec.mutex);
+			if (ts.rec.n_samples)
+				first_ns = ts.rec.first_ns;
+			pthread_mutex_unlock(&ts.rec.mutex);
+		}
+
+		test_source_stop(&ts);
+		capdev_shutdown();
+		test_source_free(&ts);
+
+		ok = first_ns > 0;
+		ns[i] = first_ns - create_ns;
+	}
+
+	if (saved)
+		setenv("OBS_H8819_POOL_SIZE", saved, 1);
+	else
+		unsetenv("OBS_H8819_POOL_SIZE");
+	bfree(saved);
+
+	if (!ok) {
+		fprintf(stderr, "Error: no audio with %d pooled helpers\n", pool_size);
+		return false;
+	}
+	qsort(ns, STARTUP_RUNS, sizeof(*ns), compare_u64);
+	printf("%d pooled helper%s: first output %.1f ms after creating the source, median of %d\n", pool_size,
+	       pool_size == 1 ? "" : "s", (double)ns[STARTUP_RUNS / 2] * 1e-6, STARTUP_RUNS);
+	return true;
+}
+
+static int run_bench(int argc, char **argv)
+{
+	if (!write_capture(BENCH_CAPTURE, BENCH_CHANNELS, BENCH_PACKETS, 0, NULL, 0))
+		return 1;
+
+	// The helper reads the environment when it opens the file.
+	setenv("OBS_H8819_REPLAY_PACE", "0", 1);
+	struct dstr device = {0};
+	dstr_printf(&device, "%s%s", CAPDEV_PROC_REPLAY_PREFIX, BENCH_CAPTURE);
+
+	bool ok = bench_startup(device.array, 1) && bench_startup(device.array, 0);
+	for (int i = 0; i < argc && ok; i++) {
+		int n_sources = atoi(argv[i]);
+		if (n_sources <= 0) {
+			fprintf(stderr, "Error: invalid number of sources '%s'\n", argv[i]);
+			ok = false;
+			break;
+		}
+		ok = bench(device.array, n_sources);
+	}
+
+	dstr_free(&device);
+	unlink(BENCH_CAPTURE);
+	return ok ? 0 : 1;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc == 3 && strcmp(argv[1], "generate") == 0) {
+		return write_capture(argv[2], CORPUS_CHANNELS, CORPUS_PACKETS, CORPUS_FIRST_COUNTER, corpus_missing,
+				     N_CORPUS_MISSING)
+			       ? 0
+			       : 1;
+	}
+	if (argc == 5 && strcmp(argv[1], "check") == 0)
+		return run_check(argv[2], argv[3], argv[4]);
+	if (argc >= 3 && strcmp(argv[1], "bench") == 0)
+		return run_bench(argc - 2, argv + 2);
+
+	fprintf(stderr, "Usage: %s generate file.pcap\n"
+			"       %s check scenario file.pcap expected\n"
+			"       %s bench sources...\n",
+		argv[0], argv[0], argv[0]);
+	return 1;
+}